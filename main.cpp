@@ -36,8 +36,50 @@
 #include "wx/listctrl.h"    // for wxListCtrl
 #include "wx/dnd.h"         // drag and drop for the playlist
 #include "wx/filename.h"    // For wxFileName::GetName()
-#include "wx/config.h"      // for native wxConfig
 #include "wx/vector.h"
+#include "wx/file.h"        // for reading media headers in the prober
+#include "wx/thread.h"      // for the background prober's worker threads
+#include "wx/filefn.h"      // for wxStat() when validating cached info
+#include "wx/stdpaths.h"    // for where to keep the media info cache
+#include "wx/dir.h"         // for walking imported directories
+#include "wx/msgout.h"      // for logging playback errors without a dialog
+#include "wx/socket.h"      // for handing files to a running instance
+#include "wx/image.h"       // for scaling posters down to thumbnails
+#include "wx/imaglist.h"    // for showing thumbnails in the playlist
+#include "wx/mstream.h"     // for decoding cover art read into memory
+#include "wx/srchctrl.h"    // for the search box under the playlist
+
+#ifdef __UNIX__
+    #include <sys/mman.h>   // for mmap()ing the media info cache
+    #include <sys/stat.h>   // for lstat() while walking directories
+    #include <dirent.h>     // for readdir(), which skips wxDir's stat()s
+#endif
+
+#ifdef __LINUX__
+    #include <sys/inotify.h>    // for following changes to imported folders
+    #include <poll.h>
+    #include <unistd.h>
+    #include <fcntl.h>
+#endif
+
+// Handing files to a running instance and --control need Unix domain
+// sockets, so there is neither without them
+#if wxUSE_SOCKETS && defined(__UNIX__)
+    #define wxMEDIA_USE_REMOTE
+#endif
+
+// SIMD versions of the pixel kernels: SSE2 wherever the compiler targets
+// it, and AVX2 where GCC and clang can build single functions for it and
+// pick them at run time
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define wxMEDIA_USE_SSE2
+    #include <emmintrin.h>
+    #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        #define wxMEDIA_USE_AVX2
+        #include <immintrin.h>
+    #endif
+#endif
 
 // Under MSW we have several different backends but when linking statically
 // they may be discarded by the linker (this definitely happens with MSVC) so
@@ -78,6 +120,7 @@ enum
     // Menu event IDs
     wxID_OPENFILESAMEPAGE,
     wxID_CLOSECURRENTPAGE,
+    wxID_EXPORTPLAYLIST,
     wxID_PLAY,
     wxID_PAUSE,
     wxID_NEXT,
@@ -85,9 +128,78 @@ enum
     // Control event IDs
     wxID_NOTEBOOK,
     wxID_MEDIACTRL,
+    wxID_STANDBYCTRL,
     wxID_LISTCTRL,
+    wxID_SEARCHCTRL,
+    wxID_LOOPTIMER,
+    wxID_HEALTHTIMER,
+    wxID_RETRYTIMER,
+    wxID_STANDBYTIMER,
+    wxID_LOADTIMER,
+    wxID_SEEKSLIDER,
+    wxID_SEEKTIMER,
+    wxID_SLIDERTIMER,
+    wxID_BENCHTIMER,
+    wxID_STATSTIMER,
+    wxID_PROBER,
+    wxID_SCANNER,
+    wxID_THUMBNAILER,
+    wxID_WATCHER,
+    wxID_ERRORS,
+    wxID_REMOTE,
+    wxID_REMOTECLIENT,
+    wxID_BENCHCLIENT,
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStartupTrace
+//
+// Where cold start time goes, for --startup-trace.  The one instance is a
+// static object, so its clock starts before main(); each mark is taken the
+// first time it's reached.
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerStartupMark
+{
+    wxSTARTUP_APP,              // wxMediaPlayerApp constructed
+    wxSTARTUP_INIT,             // OnInit() entered
+    wxSTARTUP_FRAME,            // Frame and its pages constructed
+    wxSTARTUP_SHOWN,            // Frame shown
+    wxSTARTUP_FIRST_PAINT,      // Notebook painted
+    wxSTARTUP_BACKEND_START,    // First media control being created
+    wxSTARTUP_BACKEND_DONE,     // and done, the backend with it
+    wxSTARTUP_FIRST_LOAD,       // First Load() returned
+    wxSTARTUP_FIRST_LOADED,     // First wxEVT_MEDIA_LOADED
+    wxSTARTUP_FIRST_FRAME,      // First wxEVT_MEDIA_PLAY
+    wxSTARTUP_MARKS
+};
+
+class wxMediaPlayerStartupTrace
+{
+public:
+    wxMediaPlayerStartupTrace();
+
+    // Returns true the first time
+    bool Mark(int mark)
+    {
+        if (m_nMarks[mark] >= 0)
+            return false;
+        m_nMarks[mark] = m_clock.TimeInMicro().GetValue();
+        return true;
+    }
+
+    // Where WriteReport() writes the marks as JSON, if anywhere
+    void SetReport(const wxString& report) { m_szReport = report; }
+    bool WriteReport() const;
+
+private:
+    wxStopWatch m_clock;
+    wxInt64     m_nMarks[wxSTARTUP_MARKS];  // Microseconds, or -1
+    wxString    m_szReport;
 };
 
+static wxMediaPlayerStartupTrace gs_startupTrace;
+
 // ----------------------------------------------------------------------------
 // wxMediaPlayerApp
 // ----------------------------------------------------------------------------
@@ -95,6 +207,12 @@ enum
 class wxMediaPlayerApp : public wxApp
 {
 public:
+    wxMediaPlayerApp()
+        : m_frame(NULL), m_stats(NULL), m_bExit(false), m_nExitCode(0)
+    {
+        gs_startupTrace.Mark(wxSTARTUP_APP);
+    }
+
 #ifdef __WXMAC__
     virtual void MacOpenFiles(const wxArrayString & fileNames );
 #endif
@@ -105,12 +223,43 @@ public:
 
     // Files specified on the command line, if any.
     wxVector<wxString> m_params;
+    bool m_bShuffle;            // --shuffle
+    bool m_bRepeat;             // not --no-repeat
+    wxString m_szExtensions;    // --ext, what to import from directories
+    bool m_bKeepDuplicates;     // --duplicates keep
+    bool m_bWatch;              // --watch
+    wxString m_szBenchReport;   // --bench, where to write the report
+    long m_nBenchSwitches;      // --bench-switches
+    long m_nBenchPages;         // --bench-pages
+    wxString m_szKernelReport;  // --bench-kernels
+    wxString m_szStatsFile;     // --stats, where to export them
+    long m_nStatsInterval;      // --stats-interval
+    long m_nHealthInterval;     // --health-interval
+    long m_nStallTimeout;       // --stall-timeout
+    int  m_nStallAction;        // --on-stall
+    long m_nPageBudget;         // --page-budget
+    wxString m_szStartupTrace;  // --startup-trace
+#ifdef wxMEDIA_USE_REMOTE
+    bool m_bSingleInstance;     // --single-instance
+    int  m_nOpenMode;           // --open-mode
+    wxString m_szControl;       // --control, where to take commands
+#endif // wxMEDIA_USE_REMOTE
 #endif // wxUSE_CMDLINE_PARSER
 
     virtual bool OnInit();
+    virtual int OnRun();
+    virtual int OnExit();
+
+    // Tell the stats when the event loop waits and when it works
+    virtual bool ProcessIdle();
+    virtual int FilterEvent(wxEvent& event);
 
 protected:
     class wxMediaPlayerFrame* m_frame;
+    class wxMediaPlayerStats* m_stats;  // Handler timings, with --stats
+    bool m_bExit;               // Files went to another instance, or there
+                                // was only --bench-kernels to run
+    int  m_nExitCode;           // Then
 };
 
 // ----------------------------------------------------------------------------
@@ -121,7 +270,8 @@ class wxMediaPlayerFrame : public wxFrame
 {
 public:
     // Ctor/Dtor
-    wxMediaPlayerFrame(const wxString& title);
+    wxMediaPlayerFrame(const wxString& title,
+                       class wxMediaPlayerStats* stats = NULL);
     ~wxMediaPlayerFrame();
 
     // Menu event handlers
@@ -129,832 +279,14953 @@ public:
 
     void OnOpenFileSamePage(wxCommandEvent& event);
     void OnCloseCurrentPage(wxCommandEvent& event);
+    void OnExportPlaylist(wxCommandEvent& event);
 
     void OnPlay(wxCommandEvent& event);
     void OnPause(wxCommandEvent& event);
     void OnNext(wxCommandEvent& event);
     void OnPrev(wxCommandEvent& event);
 
+    // What those do, for any page
+    void PlayPage(class wxMediaPlayerNotebookPage* page);
+    void PausePage(class wxMediaPlayerNotebookPage* page);
+    void PlayPrev(class wxMediaPlayerNotebookPage* page);
+
     // Key event handlers
     void OnKeyDown(wxKeyEvent& event);
 
-    // Quickie for playing from command line
-    void AddToPlayList(const wxString& szString);
+    // Adds files, and the media files in directories, to the page, the
+    // current one by default.  With bPlay the first of them is played as
+    // soon as it's there.
+    void ImportPaths(const wxVector<wxString>& paths, bool bPlay);
+    void ImportPaths(class wxMediaPlayerNotebookPage* page,
+                     const wxVector<wxString>& paths, bool bPlay);
 
-    // Media event handlers
-    void OnMediaLoaded(wxMediaEvent& event);
+    // Play order of all pages, including ones opened later
+    void SetPlayOrder(bool bShuffle, bool bRepeat);
+
+    // How often pages sample the health of their playback (0 for never),
+    // and what they do about media that doesn't move for nStallTimeout,
+    // in milliseconds and wxMediaPlayerStallAction
+    void SetHealthPolicy(long nInterval, long nStallTimeout, int action);
+
+    // How many pages may keep media loaded (0 for all of them).  Hidden
+    // pages are paused, and the ones hidden the longest unload it past that.
+    void SetPageBudget(long nPages);
+
+    // Whether directories imported from now on are watched for changes
+    void SetWatchFolders(bool bWatch) { m_bWatchFolders = bWatch; }
+
+#ifdef wxMEDIA_USE_REMOTE
+    // Opens files another instance was started with, mode being one of
+    // wxMediaPlayerOpenMode
+    void OpenForwarded(const wxVector<wxString>& paths, int mode);
+#endif // wxMEDIA_USE_REMOTE
 
     // Close event handlers
     void OnClose(wxCloseEvent& event);
 
+    // Background prober results
+    void OnProbeResults(wxThreadEvent& event);
+    // Files found by the directory scanner
+    void OnScanResults(wxThreadEvent& event);
+    // Thumbnails made for the playlist
+    void OnThumbnails(wxThreadEvent& event);
+    // Changes to the folders pages watch
+    void OnWatchChanges(wxThreadEvent& event);
+
+    // Queues an error to be logged once the handler that ran into it has
+    // returned, and entry n of the page (if not -1) to be moved on from
+    void QueueError(int nPageId, long n, const wxString& message);
+    void OnErrors(wxThreadEvent& event);
+    // Plays the next entry of the page that isn't failing
+    void SkipToPlayable(class wxMediaPlayerNotebookPage* page);
+    void PlayNext(class wxMediaPlayerNotebookPage* page);
+    // Forgets a page, its playlist and anything still queued for it
+    void ClosePage(class wxMediaPlayerNotebookPage* page);
+
 private:
     // Common open file code
     void OpenFile(bool bNewPage);
     void DoOpenFile(const wxString& path, bool bNewPage);
-    void DoPlayFile(const wxString& path);
+    void DoPlayFile(class wxMediaPlayerNotebookPage* page, long n);
+    void PlayLoadedFile(class wxMediaPlayerNotebookPage* page);
+
+    class wxMediaPlayerNotebookPage* FindPage(int nPageId);
+
+    // Suspends the page that was shown and restores the one that is now
+    void OnPageChanged(wxBookCtrlEvent& event);
+    // Marks wxSTARTUP_FIRST_PAINT
+    void OnNotebookPaint(wxPaintEvent& event);
+    // Evicts suspended pages, least recently shown first, until no more
+    // than m_nPageBudget have media loaded
+    void EnforcePageBudget();
+
+    struct Error
+    {
+        int      m_nPage;       // wxMediaPlayerNotebookPage::m_nPageId
+        long     m_nEntry;      // Entry that failed, or -1
+        wxString m_szMessage;
+    };
 
     wxNotebook* m_notebook;     // Notebook containing our pages
+    class wxMediaPlayerProber* m_prober;  // Probes playlist files for info
+    class wxMediaPlayerScanner* m_scanner;  // Walks imported directories
+    class wxMediaPlayerWatcher* m_watcher;  // Follows them, with --watch
+    class wxMediaPlayerThumbnailer* m_thumbnailer;  // Makes playlist posters
+    class wxMediaPlayerThumbnailCache* m_thumbnails;    // Shown ones of those
+    class wxMediaPlayerBench* m_bench;      // Times playback for --bench
+#ifdef wxMEDIA_USE_REMOTE
+    class wxMediaPlayerRemote* m_remote;    // Takes files from later instances
+    class wxMediaPlayerRemote* m_control;   // Takes commands for --control
+#endif // wxMEDIA_USE_REMOTE
+    class wxMediaPlayerStats* m_stats;      // Times handlers for --stats
+    class wxMediaPlayerInfoCache* m_infoCache;  // Info from earlier runs
+    class wxMediaPlayerPlaylistStore* m_playlists;  // Saved page playlists
+    bool m_bShuffle;            // Play order for new pages
+    bool m_bRepeat;
+    long m_nHealthInterval;     // See SetHealthPolicy()
+    long m_nStallTimeout;
+    int  m_nStallAction;
+    long m_nPageBudget;         // See SetPageBudget()
+    bool m_bWatchFolders;       // See SetWatchFolders()
+    int  m_nShownPage;          // Id of the page last shown, or -1
+    wxUint32 m_nPageClock;      // Ticks each time a page is shown
+    wxVector<Error> m_errors;   // Queued by QueueError()
+    wxStopWatch m_retryClock;   // What retry times are measured on, it
+                                // doesn't jump with the wall clock
 
     // Maybe I should use more accessors, but for simplicity
     // I'll allow the other classes access to our members
     friend class wxMediaPlayerApp;
     friend class wxMediaPlayerNotebookPage;
+    friend class wxMediaPlayerBench;
+    friend class wxMediaPlayerRemote;
 };
 
 
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerNotebookPage
+// wxMediaPlayerMediaInfo
+//
+// What the background prober learns about a file without loading it into a
+// wxMediaCtrl.  Kept small since there is one per unique playlist path.
 // ----------------------------------------------------------------------------
 
-class wxMediaPlayerNotebookPage : public wxPanel
+enum
 {
-    wxMediaPlayerNotebookPage(wxMediaPlayerFrame* parentFrame,
-        wxNotebook* book, const wxString& be = wxEmptyString);
+    wxMEDIAINFO_PROBED = 1,     // A probe has completed (successfully or not)
+    wxMEDIAINFO_VALID  = 2      // The fields below are meaningful
+};
 
-    // Media event handlers
-    void OnMediaPlay(wxMediaEvent& event);
-    void OnMediaPause(wxMediaEvent& event);
-    void OnMediaFinished(wxMediaEvent& event);
+struct wxMediaPlayerMediaInfo
+{
+    wxUint32 m_nDuration;       // Length in milliseconds
+    wxUint32 m_nBitrate;        // Average bits per second over the file
+    wxUint32 m_nVideoCodec;     // FourCC of the first video track, or 0
+    wxUint32 m_nAudioCodec;     // FourCC of the first audio track, or 0
+    wxUint16 m_nWidth;          // Size of the first video track
+    wxUint16 m_nHeight;
+    wxUint8  m_nFlags;          // wxMEDIAINFO_XXX
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerHealth
+//
+// Playback problems the health sampler of a page saw, for one file or all
+// files of the page
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerHealthEvent
+{
+    wxHEALTH_OK,
+    wxHEALTH_DROPPED,           // The position jumped ahead of the clock
+    wxHEALTH_UNDERRUN,          // It stopped while the stream downloads
+    wxHEALTH_STALLED,           // It stopped for the stall timeout
+    wxHEALTH_RECOVERED,         // The page reloaded or skipped the file
+    wxHEALTH_FAILED,            // It couldn't be loaded or played
+    wxHEALTH_QUARANTINED,       // It failed too often to be tried again
+    wxHEALTH_EVENTS
+};
+
+struct wxMediaPlayerHealth
+{
+    wxUint32 m_nDrops;
+    wxUint32 m_nDroppedTime;    // Milliseconds jumped over
+    wxUint32 m_nUnderruns;
+    wxUint32 m_nStalls;
+    wxUint32 m_nRecoveries;
+    wxUint32 m_nErrors;         // Failures to load or play
+    wxUint32 m_nFailures;       // Of a file: failures since it last played
+    wxInt64  m_nRetryAt;        // Of a file: when it may be tried again,
+                                // in ms of wxMediaPlayerFrame::m_retryClock
+
+    // Counts one of wxMediaPlayerHealthEvent, nJump being how far a drop
+    // jumped
+    void Add(int event, long nJump);
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore
+//
+// Flat storage behind a page's playlist.  Paths are interned into a single
+// UTF-8 pool (the same path added twice is only stored once), the display
+// name is precomputed as a slice of the path, and each entry is just an
+// index into the path table plus a state byte.  Nothing here allocates per
+// row, so adding n entries is O(n) memory copies.  Paths can also be given
+// a content fingerprint, so that copies of them can be found as well.
+// ----------------------------------------------------------------------------
+
+// Path of removed entries in wxMediaPlayerEntryStore::EditEntries()
+static const wxUint32 wxMediaNoPath = 0xffffffff;
+
+// State of an entry, shown in the first column of the playlist
+enum wxMediaPlayerEntryState
+{
+    wxMEDIAENTRY_IDLE,          // "*"
+    wxMEDIAENTRY_OPENED,        // "O"
+    wxMEDIAENTRY_PLAYING,       // ">"
+    wxMEDIAENTRY_PAUSED,        // "||"
+    wxMEDIAENTRY_FINISHED,      // "[]"
+    wxMEDIAENTRY_ERROR,         // "E"
+    wxMEDIAENTRY_QUARANTINED    // "Q"
+};
 
+class wxMediaPlayerEntryStore
+{
 public:
-    bool IsBeingDragged();      // accessor for m_bIsBeingDragged
+    wxMediaPlayerEntryStore();
+
+    // Appends an entry and returns its index
+    size_t Add(const wxString& path);
+    size_t AddUTF8(const char* path, size_t len);
+    // Edits all entries in one pass: the ones of path p are removed if
+    // paths[p] is wxMediaNoPath and use path paths[p] otherwise, paths
+    // beyond the end of paths stay.  map gets the new index of every
+    // entry, or -1.
+    void EditEntries(const wxVector<wxUint32>& paths, wxVector<long>& map);
+    void Reserve(size_t count);
+    void Clear();
+
+    size_t GetCount() const { return m_entries.size(); }
+
+    wxString GetPath(size_t n) const;
+    wxString GetName(size_t n) const;
+    const char* GetNameUTF8(wxUint32 path, size_t* len) const;
+
+    wxUint8 GetState(size_t n) const { return m_entries[n].m_nState; }
+    void SetState(size_t n, wxUint8 state) { m_entries[n].m_nState = state; }
+
+    // Unique paths, numbered in the order they were first added
+    size_t GetPathCount() const { return m_paths.size(); }
+    wxUint32 GetPathId(size_t n) const { return m_entries[n].m_nPath; }
+    const char* GetPathUTF8(wxUint32 path, size_t* len) const;
+    // Interns a path without adding an entry for it
+    wxUint32 AddPath(const char* data, size_t len)
+        { return InternPath(data, len); }
+    // How many entries use a path
+    wxUint32 GetPathEntries(wxUint32 path) const
+        { return m_paths[path].m_nEntries; }
+    // The entries of a path, from the last one back: GetLastPathEntry(),
+    // then GetPrevPathEntry() of each until it returns -1
+    long GetLastPathEntry(wxUint32 path) const
+        { return (long) m_paths[path].m_nLastEntry - 1; }
+    long GetPrevPathEntry(size_t n) const
+        { return (long) m_entries[n].m_nPrevEntry - 1; }
+    // Looks up a path that entries use, without adding it
+    bool FindPath(const char* data, size_t len, wxUint32* path) const;
+    // First entry of a path, GetCount() if none
+    size_t FindEntry(wxUint32 path) const;
+
+    // See wxFingerprintMediaFile().  A fingerprint finds the first path
+    // given it that entries still use.
+    void SetPathFingerprint(wxUint32 path, wxUint64 fingerprint);
+    bool FindFingerprint(wxUint64 fingerprint, wxUint32* path) const;
+
+    // Media info is shared by all entries with the same path
+    const wxMediaPlayerMediaInfo& GetInfo(size_t n) const
+        { return m_info[m_entries[n].m_nPath]; }
+    const wxMediaPlayerMediaInfo& GetPathInfo(wxUint32 path) const
+        { return m_info[path]; }
+    void SetPathInfo(wxUint32 path, const wxMediaPlayerMediaInfo& info)
+        { m_info[path] = info; }
+
+    // Playback problems, only kept for paths that had any: NULL if entry
+    // n had none, and the record of a path, added if necessary
+    const wxMediaPlayerHealth* FindHealth(size_t n) const;
+    wxMediaPlayerHealth& GetPathHealth(wxUint32 path);
+
+    // How often and when, in seconds since the epoch, a path was played
+    // this session
+    void RecordPlay(wxUint32 path, wxUint32 when);
+    wxUint32 GetPathPlays(wxUint32 path) const
+        { return m_paths[path].m_nPlays; }
+    wxUint32 GetPathLastPlayed(wxUint32 path) const
+        { return m_paths[path].m_nLastPlayed; }
 
-    // make wxMediaPlayerFrame able to access the private members
-    friend class wxMediaPlayerFrame;
+private:
+    // An interned path: a slice of m_pool plus the display name within it
+    struct PathRecord
+    {
+        wxUint32 m_nOffset;     // Byte offset of the path in m_pool
+        wxUint32 m_nLength;     // Length of the path in bytes
+        wxUint32 m_nNameStart;  // Display name, relative to m_nOffset
+        wxUint32 m_nNameLength;
+        wxUint32 m_nHash;       // Cached hash for rehashing the intern table
+        wxUint32 m_nEntries;    // Entries using the path
+        wxUint32 m_nLastEntry;  // The last of them plus 1, 0 if none
+        wxUint32 m_nPlays;      // Times it was played
+        wxUint32 m_nLastPlayed; // Time it was last played, 0 if never
+    };
+
+    struct Entry
+    {
+        wxUint32 m_nPath;       // Index into m_paths
+        wxUint32 m_nPrevEntry;  // Entry before it with the same path plus 1,
+                                // 0 if none
+        wxUint8  m_nState;      // One of wxMediaPlayerEntryState
+    };
 
-    int      m_nLastFileId;     // List ID of played file in listctrl
-    wxString m_szFile;          // Name of currently playing file/location
+    struct HealthRecord
+    {
+        wxUint32            m_nPath;
+        wxMediaPlayerHealth m_health;
+    };
 
-    wxMediaCtrl* m_mediactrl;   // Our media control
-    class wxMediaPlayerListCtrl* m_playlist;  // Our playlist
-    int m_nLoops;               // Number of times media has looped
-    bool m_bLoop;               // Whether we are looping or not
-    bool m_bIsBeingDragged;     // Whether the user is dragging the scroll bar
-    wxMediaPlayerFrame* m_parentFrame;  // Main wxFrame of our sample
-    wxButton* m_prevButton;     // Go to previous file button
-    wxButton* m_playButton;     // Play/pause file button
-    wxButton* m_nextButton;     // Next file button
+    struct FingerprintSlot
+    {
+        wxUint64 m_nFingerprint;    // 0 for a free slot
+        wxUint32 m_nPath;
+    };
+
+    wxUint32 InternPath(const char* data, size_t len);
+    void GrowInternTable();
+    void GrowFingerprintTable();
+    // Index of the first record in m_health not before path
+    size_t FindHealthRecord(wxUint32 path) const;
+
+    wxVector<char>       m_pool;    // UTF-8 bytes of all unique paths
+    wxVector<PathRecord> m_paths;   // Unique paths
+    wxVector<wxMediaPlayerMediaInfo> m_info;    // Parallel to m_paths
+    wxVector<Entry>      m_entries; // Playlist rows, in order
+    wxVector<wxUint32>   m_intern;  // Open-addressed set of m_paths index+1
+    wxVector<HealthRecord> m_health;    // Sorted by path
+    wxVector<FingerprintSlot> m_fingerprints;   // Open-addressed
+    size_t               m_nFingerprints;   // Slots of it in use
 };
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerListCtrl
+// wxMediaPlayerSearchIndex
+//
+// Trigram index over the paths of an entry store, for the search box of a
+// page; the display name is the end of the path, so it is covered too.
+// Every trigram of a lowercased path lists the paths it is in, ascending
+// and delta coded as varints, in chains of small blocks in one pool, so
+// indexing new paths only ever appends.  Nothing is taken out: paths that
+// no entry uses any more are skipped when searching, as FindFingerprint()
+// does.  Only ASCII letters are matched regardless of case.
 // ----------------------------------------------------------------------------
-class wxMediaPlayerListCtrl : public wxListCtrl
+
+class wxMediaPlayerSearchIndex
 {
 public:
-    void AddToPlayList(const wxString& szString)
+    wxMediaPlayerSearchIndex();
+
+    // Indexes the paths added to entries since the last call
+    void Update(const wxMediaPlayerEntryStore& entries);
+    void Clear();
+    bool IsBuilt() const { return m_nPaths != 0; }
+
+    // The paths entries use that contain query, which is Fold()ed, in
+    // ascending order.  With candidates only those are looked at, which
+    // is how a search is narrowed as more is typed.
+    void Find(const wxMediaPlayerEntryStore& entries,
+              const wxVector<char>& query,
+              const wxVector<wxUint32>* candidates,
+              wxVector<wxUint32>& paths) const;
+
+    // Lowercases the ASCII letters of the UTF-8 text
+    static void Fold(const wxString& text, wxVector<char>& folded);
+    // Whether text contains the folded query, ignoring the case of text
+    static bool Contains(const char* text, size_t len,
+                         const char* query, size_t queryLen);
+
+private:
+    // A trigram and its list of paths
+    struct Slot
     {
-        wxListItem kNewItem;
-        kNewItem.SetAlign(wxLIST_FORMAT_LEFT);
+        wxUint32 m_nKey;        // The trigram's bytes plus 1, 0 if free
+        wxUint32 m_nHead;       // First block of the list
+        wxUint32 m_nTail;       // Where the next byte goes, 0 at first
+        wxUint32 m_nCount;      // Paths in the list
+        wxUint32 m_nLast;       // The last of them, deltas are from there
+    };
+
+    // Reads a list
+    struct Cursor
+    {
+        const wxUint8* m_blocks;
+        wxUint32 m_nBlock;
+        wxUint32 m_nAt;
+        wxUint32 m_nLeft;
+        wxUint32 m_nPath;       // Where Next() got to
+
+        Cursor(const wxVector<wxUint8>& blocks, const Slot& slot);
+        bool Next();
+    };
+
+    size_t FindSlot(wxUint32 key) const;
+    void AddPosting(wxUint32 key, wxUint32 path);
+    void PutByte(Slot& slot, wxUint8 byte);
+    void GrowTable();
+
+    wxVector<Slot>    m_slots;      // Open-addressed by key
+    size_t            m_nSlots;     // Of them in use
+    wxVector<wxUint8> m_blocks;     // All lists; offset 0 is no block
+    wxUint32          m_nPaths;     // Paths indexed so far
+    wxVector<char>    m_folded;     // For Update()
+};
 
-        int nID = this->GetItemCount();
-        kNewItem.SetId(nID);
-        kNewItem.SetMask(wxLIST_MASK_DATA);
-        kNewItem.SetData(new wxString(szString));
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter
+//
+// Orders the entries of an entry store for the sorted views of a playlist.
+// Each entry gets its key worked out once, a number or the first eight
+// lowercased bytes of the text, so most comparisons are one of integers.
+// Text that starts the same is compared with memcmp() on a lowercased copy
+// that the sorter keeps of the names or paths, and extends as paths come.
+// Big sorts are split over threads that merge sort a slice each, and the
+// slices are then merged pairwise.  Ties go by entry, so the order is the
+// same every time.
+// ----------------------------------------------------------------------------
 
-        this->InsertItem(kNewItem);
-        this->SetItem(nID, 0, wxT("*"));
-        this->SetItem(nID, 1, wxFileName(szString).GetName());
+enum wxMediaPlayerSortKey
+{
+    wxSORT_NONE,                // The order of the entries
+    wxSORT_NAME,                // Display name, ignoring ASCII case
+    wxSORT_PATH,                // Whole path, likewise
+    wxSORT_LENGTH,              // Shortest first, unknown ones before all
+    wxSORT_PLAYS,               // Least played first
+    wxSORT_LAST_PLAYED          // Longest ago first, never played before all
+};
 
-        if (nID % 2)
-        {
-            kNewItem.SetBackgroundColour(wxColour(192,192,192));
-            this->SetItem(kNewItem);
-        }
-    }
+class wxMediaPlayerSorter
+{
+public:
+    struct Item
+    {
+        wxUint64 m_nKey;
+        wxUint32 m_nEntry;
+        wxUint32 m_nText;       // For text keys, where it is in m_text
+        wxUint32 m_nLength;     // and how long
+    };
+
+    wxMediaPlayerSorter(const wxMediaPlayerEntryStore& entries);
+
+    // Items sort by a wxMediaPlayerSortKey; changing it invalidates them
+    void SetKey(int key);
+    int GetKey() const { return m_nKey; }
+
+    // Appends the items of entries [nFrom, nTo), or of those listed
+    void AddEntries(size_t nFrom, size_t nTo, wxVector<Item>& items);
+    void AddEntries(const wxVector<wxUint32>& entries,
+                    wxVector<Item>& items);
+    // Sorts items, in parallel if there are enough of them
+    void Sort(wxVector<Item>& items) const;
+    // Sorts added and merges it into items, which are sorted.  Returns
+    // how many of items stayed where they were, at the front.
+    size_t Merge(wxVector<Item>& items, wxVector<Item>& added) const;
+
+    bool Less(const Item& a, const Item& b) const;
+
+private:
+    friend class wxMediaPlayerSorterThread;
 
-    void GetSelectedItem(wxListItem& listitem)
+    // A slice to sort, or two to merge into out when b isn't NULL
+    struct Job
     {
-        listitem.SetMask(wxLIST_MASK_TEXT |  wxLIST_MASK_DATA);
-        int nLast = -1, nLastSelected = -1;
-        while ((nLast = this->GetNextItem(nLast,
-                                         wxLIST_NEXT_ALL,
-                                         wxLIST_STATE_SELECTED)) != -1)
-        {
-            listitem.SetId(nLast);
-            this->GetItem(listitem);
-            if ((listitem.GetState() & wxLIST_STATE_FOCUSED) )
-                break;
-            nLastSelected = nLast;
-        }
-        if (nLast == -1 && nLastSelected == -1)
-            return;
-        listitem.SetId(nLastSelected == -1 ? nLast : nLastSelected);
-        this->GetItem(listitem);
-    }
+        Item*  m_a;
+        size_t m_nA;
+        Item*  m_b;
+        size_t m_nB;
+        Item*  m_out;
+    };
+
+    // Sorts count items in place, using scratch for as many
+    void SortRange(Item* items, Item* scratch, size_t count) const;
+    void MergeRuns(const Item* a, size_t nA, const Item* b, size_t nB,
+                   Item* out) const;
+    void RunJob(const Job& job) const;
+    // Runs all of jobs, on threads but for the last one
+    void RunJobs(const wxVector<Job>& jobs) const;
+    bool IsText() const
+        { return m_nKey == wxSORT_NAME || m_nKey == wxSORT_PATH; }
+    // Adds the paths new to the store to m_text
+    void FoldNewPaths();
+    // The item of entry n, once its path is in m_text
+    Item MakeItem(size_t n) const;
+
+    const wxMediaPlayerEntryStore& m_entries;
+    int m_nKey;                 // wxMediaPlayerSortKey
+    wxVector<char> m_text;      // Lowercased names or paths, by path
+    wxVector<wxUint32> m_textAt;    // Offset of each in m_text, and the end
 };
 
-
-// ============================================================================
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache
 //
-// Implementation
+// Media info remembered across runs, keyed by path and only trusted while
+// the file's size and modification time still match.  The cache file is a
+// fixed layout, versioned snapshot that is mmap'd read-only: a header, an
+// open-addressed hash table of record numbers, fixed size records and a
+// pool of UTF-8 paths.  Looking something up is a hash and a probe, there
+// is nothing to parse.  New results are appended to a journal which a
+// background thread folds into a fresh snapshot once it grows big enough.
+// Keyframe indexes are too big for the fixed records, and only wanted for
+// files that are played, so each of those gets a small file of its own next
+// to the cache instead.
 //
-// ============================================================================
+// All public methods are thread-safe.
+// ----------------------------------------------------------------------------
 
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+class wxMediaPlayerInfoCache
+{
+public:
+    wxMediaPlayerInfoCache();
+    ~wxMediaPlayerInfoCache();
+
+    // Maps the snapshot in dir and replays the journal next to it
+    bool Open(const wxString& dir);
+    void Close();
+
+    // Returns the cached info of a path along with the size and mtime the
+    // file had when it was probed
+    bool Lookup(const char* path, size_t len, wxMediaPlayerMediaInfo& info,
+                wxUint64* size, wxInt64* mtime);
+    void Store(const char* path, size_t len, wxUint64 size, wxInt64 mtime,
+               const wxMediaPlayerMediaInfo& info);
+
+    // The keyframe index of a path, if it was built while the file had
+    // this size and mtime
+    bool LookupKeyframes(const char* path, size_t len, wxUint64 size,
+                         wxInt64 mtime, wxVector<wxUint32>& keyframes);
+    void StoreKeyframes(const char* path, size_t len, wxUint64 size,
+                        wxInt64 mtime, const wxVector<wxUint32>& keyframes);
+
+private:
+    friend class wxMediaPlayerInfoCacheCompactor;
+
+    // Start of a keyframe index file, followed by the path and the times
+    struct KeyframeHeader
+    {
+        char     m_szMagic[8];  // "wxMPKeys"
+        wxUint32 m_nVersion;    // wxMEDIAINFOCACHE_VERSION
+        wxUint32 m_nByteOrder;  // 0x01020304 as written by the host
+        wxUint64 m_nSize;       // Size and mtime of the indexed file
+        wxInt64  m_nMTime;
+        wxUint32 m_nPathLength;
+        wxUint32 m_nCount;      // Keyframes
+    };
+
+    wxString GetKeyframeFile(const char* path, size_t len) const;
+
+    struct Header
+    {
+        char     m_szMagic[8];  // "wxMPInfo"
+        wxUint32 m_nVersion;    // wxMEDIAINFOCACHE_VERSION
+        wxUint32 m_nByteOrder;  // 0x01020304 as written by the host
+        wxUint32 m_nBuckets;    // Size of the hash table, a power of two
+        wxUint32 m_nRecords;
+        wxUint32 m_nPoolSize;   // Bytes of path data after the records
+        wxUint32 m_nReserved[9];
+    };
+
+    struct Record
+    {
+        wxUint64 m_nSize;       // Size of the file when it was probed
+        wxInt64  m_nMTime;      // Its modification time
+        wxInt64  m_nProbed;     // When it was probed
+        wxUint32 m_nHash;       // wxMediaPlayerHashPath() of the path
+        wxUint32 m_nPath;       // Offset of the path in the pool
+        wxUint32 m_nPathLength;
+        wxUint32 m_nDuration;   // Copy of wxMediaPlayerMediaInfo
+        wxUint32 m_nBitrate;
+        wxUint32 m_nVideoCodec;
+        wxUint32 m_nAudioCodec;
+        wxUint16 m_nWidth;
+        wxUint16 m_nHeight;
+        wxUint32 m_nFlags;
+        wxUint32 m_nReserved;
+    };
+
+    // Snapshot
+    bool MapSnapshot();
+    void UnmapSnapshot();
+    const Record* FindInSnapshot(const char* path, size_t len,
+                                 wxUint32 hash) const;
+
+    // Journal
+    bool LoadJournal(const wxString& file, bool bKeep);
+    void AddToJournal(const Record& rec, const char* path);
+    const Record* FindInJournal(const char* path, size_t len,
+                                wxUint32 hash) const;
+    void RebuildJournalIndex();
+
+    // Compaction, see wxMediaPlayerInfoCacheCompactor
+    void StartCompaction();
+    void DoCompaction();
+    static void InsertRecord(wxVector<wxUint32>& buckets,
+                             wxVector<Record>& records,
+                             wxVector<char>& pool,
+                             const Record& rec, const char* path);
+
+    wxString m_szSnapshot;          // Paths of our files
+    wxString m_szJournal;
+    wxString m_szOldJournal;        // Journal being compacted
+    wxString m_szKeyframeDir;       // Keyframe index files
+
+    wxMutex m_mutex;                // Protects everything below
+
+    // The mapped snapshot, m_records and m_pool point into m_pMap
+    const char*   m_pMap;
+    size_t        m_nMapSize;
+    wxUint32      m_nBuckets;
+    const wxUint32* m_buckets;
+    const Record* m_records;
+    wxUint32      m_nRecords;
+    const char*   m_pool;
+    wxUint32      m_nPoolSize;
+#ifndef __UNIX__
+    wxVector<char> m_mapBuffer;     // Read into memory where there's no mmap
+#endif
+
+    // Results stored since the last compaction
+    wxFile             m_journalFile;
+    wxVector<Record>   m_journal;
+    wxVector<char>     m_journalPool;
+    wxVector<wxUint32> m_journalIndex;  // Open-addressed m_journal index+1
+
+    wxThread* m_compactor;          // Running compaction, if any
+    size_t    m_nCompacting;        // Journal records it is folding in
+    bool      m_bCompactionDone;    // m_compactor can be joined
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistStore
 //
-// [Functions]
+// The playlists of all notebook pages, kept across runs.  Every edit is
+// appended to a journal with a single write() as it happens, so there is
+// nothing left to save at shutdown and a killed process only loses what
+// hadn't reached the OS yet.  The snapshot is made of the same records as
+// the journal, so startup is one sequential read and replay of each file.
+// Once the journal outgrows the snapshot a background thread replays both
+// into a new snapshot.
 //
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// Only the UI thread may call the public methods.
+// ----------------------------------------------------------------------------
+
+class wxMediaPlayerPlaylistStore
+{
+public:
+    // A playlist as it was restored
+    struct Playlist
+    {
+        wxUint32           m_nId;
+        wxVector<char>     m_pool;      // UTF-8 paths back to back, after
+                                        // an unused byte 0
+        wxVector<wxUint32> m_offsets;   // Start of each path, plus the end
+
+        size_t GetCount() const { return m_offsets.size() - 1; }
+    };
+
+    wxMediaPlayerPlaylistStore();
+    ~wxMediaPlayerPlaylistStore();
+
+    // Loads the playlists saved in dir, in the order of their pages
+    bool Open(const wxString& dir, wxVector<Playlist>& playlists);
+    void Close();
+
+    // Edits, each one journalled before returning
+    wxUint32 CreatePlaylist();
+    void RemovePlaylist(wxUint32 id);
+    void AppendEntries(wxUint32 id, const wxMediaPlayerEntryStore& entries,
+                       size_t from);
+    // Entries indexes[k], in ascending order, were removed if paths[k] is
+    // wxMediaNoPath and were given path paths[k] of entries otherwise
+    void ChangeEntries(wxUint32 id, const wxMediaPlayerEntryStore& entries,
+                       const wxVector<wxUint32>& indexes,
+                       const wxVector<wxUint32>& paths);
+
+private:
+    friend class wxMediaPlayerPlaylistCompactor;
+
+    struct Header
+    {
+        char     m_szMagic[8];  // "wxMPList" or "wxMPLJnl"
+        wxUint32 m_nVersion;    // wxMEDIAPLAYLIST_VERSION
+        wxUint32 m_nByteOrder;  // 0x01020304 as written by the host
+        wxUint32 m_nGeneration; // Journal number; for the snapshot the last
+                                // journal folded into it
+        wxUint32 m_nReserved[3];
+    };
+
+    struct Op
+    {
+        wxUint32 m_nTag;        // wxMediaPlaylistOpTag
+        wxUint32 m_nOp;         // wxPLAYLISTOP_XXX
+        wxUint32 m_nPlaylist;
+        wxUint32 m_nCount;      // Paths in the payload
+        wxUint32 m_nSize;       // Bytes of payload after the Op
+        wxUint32 m_nHash;       // wxMediaPlayerHashPath() of the payload
+    };
+
+    // File format, shared with the compactor
+    static bool ReadFile(const wxString& file, const char* magic,
+                         wxVector<char>& data, wxUint32* generation);
+    static size_t Replay(const wxVector<char>& data,
+                         wxVector<Playlist>& playlists, wxUint32* nextId);
+    static bool ApplyOp(const Op& op, const char* payload,
+                        wxVector<Playlist>& playlists, wxUint32* nextId);
+    static void WriteHeader(wxVector<char>& buf, const char* magic,
+                            wxUint32 generation);
+    static void AddPath(wxVector<char>& buf, const char* path, wxUint32 len);
+    static void FinishOp(wxVector<char>& buf, size_t at, wxUint32 op,
+                         wxUint32 id, wxUint32 count);
+    static bool WriteSnapshot(const wxString& file, wxUint32 generation,
+                              const wxVector<Playlist>& playlists,
+                              wxFileOffset* size);
+
+    void Append(const wxVector<char>& buf);
+    void StartCompaction(bool bRotate);
+    void DoCompaction();
+    void JoinCompactor();
+
+    wxString m_szSnapshot;          // Paths of our files
+    wxString m_szJournal;
+    wxString m_szOldJournal;        // Journal being compacted
+
+    wxFile       m_journalFile;
+    wxUint32     m_nGeneration;     // Of m_journalFile
+    wxFileOffset m_nJournalSize;
+    wxUint32     m_nNextId;         // For CreatePlaylist()
+    wxThread*    m_compactor;       // Running compaction, if any
+
+    wxMutex      m_mutex;           // Protects everything below
+    wxFileOffset m_nSnapshotSize;
+    bool         m_bCompactionDone; // m_compactor can be joined
+    bool         m_bStopping;       // Close() wants the compactor to give up
+};
 
 // ----------------------------------------------------------------------------
-// wxGetMediaStateText
+// wxMediaPlayerProber
 //
-// Converts a wxMediaCtrl state into something useful that we can display
-// to the user
+// Pool of worker threads, one per core, that fill in wxMediaPlayerMediaInfo
+// for playlist paths off the UI thread.  Every page has its own queue of
+// unique paths; paths the list control is about to show jump the queue.
+// Results are collected here and announced to the frame with a single
+// wxThreadEvent, so however fast the workers are the UI thread only sees
+// one event per batch.  The workers also build keyframe indexes of files
+// being played, ahead of anything else.
 // ----------------------------------------------------------------------------
-const wxChar* wxGetMediaStateText(int nState)
+
+class wxMediaPlayerProber
 {
-    switch(nState)
+public:
+    struct Result
     {
-        case wxMEDIASTATE_PLAYING:
-            return wxT("Playing");
-        ///case wxMEDIASTATE_PAUSED:
-        default:
-            return wxT("Paused");
-    }
-}
+        int      m_nPage;       // wxMediaPlayerNotebookPage::m_nPageId
+        wxUint32 m_nPath;       // Path id in that page's entry store
+        wxMediaPlayerMediaInfo m_info;
+    };
 
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-//
-// wxMediaPlayerApp
-//
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+    struct Index
+    {
+        int      m_nPage;       // wxMediaPlayerNotebookPage::m_nPageId
+        wxString m_szFile;
+        wxVector<wxUint32> m_keyframes; // Milliseconds, empty if none
+    };
+
+    wxMediaPlayerProber();
+    ~wxMediaPlayerProber();
+
+    // Starts the workers, which post wxID_PROBER events to handler and
+    // check the cache before probing anything.  With stats they time
+    // every probe.
+    void Start(wxEvtHandler* handler, wxMediaPlayerInfoCache* cache,
+               class wxMediaPlayerStats* stats = NULL);
+    void Stop();
+
+    // Queues the paths of a page with ids from "from" onwards
+    void Enqueue(int page, const wxMediaPlayerEntryStore& store,
+                 wxUint32 from);
+    // Makes the workers pick these paths of the page before anything else
+    void Prioritize(int page, const wxVector<wxUint32>& paths);
+    // Forgets everything still queued for a page
+    void RemovePage(int page);
+    // Queues building the keyframe index of a file the page plays
+    void RequestIndex(int page, const wxString& file);
+
+    // Hands over all results and indexes collected since the last call
+    void TakeResults(wxVector<Result>& results);
+    void TakeIndexes(wxVector<Index>& indexes);
+
+private:
+    friend class wxMediaPlayerProberThread;
+
+    struct Queue
+    {
+        int                m_nPage;
+        wxUint32           m_nBase;     // Path id of m_offsets[0]
+        wxVector<char>     m_pool;      // UTF-8 copies of the queued paths
+        wxVector<wxUint32> m_offsets;   // Start of each path in m_pool
+        wxVector<wxUint8>  m_claimed;   // Whether a worker took the path
+        wxVector<wxUint32> m_hint;      // Path ids to probe first
+        size_t             m_nNext;     // Next index for sequential order
+    };
+
+    Queue* FindQueue(int page);
+    bool ClaimJob(Queue* queue, wxUint32 path,
+                  int& page, wxUint32& jobPath, wxString& file);
+
+    // Called by the worker threads.  GetJob() sets bIndex for an index to
+    // build rather than a path to probe.
+    bool GetJob(int& page, wxUint32& path, wxString& file, bool& bIndex);
+    void Probe(const wxString& file, wxMediaPlayerMediaInfo& info);
+    void BuildIndex(const wxString& file, wxVector<wxUint32>& keyframes);
+    void AddResult(const Result& result);
+    void AddIndex(const Index& index);
+
+    wxMutex             m_mutex;    // Protects everything below
+    wxCondition         m_cond;     // Signalled when jobs are queued
+    wxVector<Queue*>    m_queues;
+    wxVector<Index>     m_indexJobs;    // Files to index, m_keyframes empty
+    wxVector<Result>    m_results;
+    wxVector<Index>     m_indexes;
+    wxVector<wxThread*> m_threads;
+    wxEvtHandler*       m_handler;
+    wxMediaPlayerInfoCache* m_cache;
+    class wxMediaPlayerStats* m_stats;
+    bool                m_bStopping;
+};
 
 // ----------------------------------------------------------------------------
-// This sets up this wxApp as the global wxApp that gui calls in wxWidgets
-// use.  For example, if you were to be in windows and use a file dialog,
-// wxWidgets would use wxTheApp->GetHInstance() which would get the instance
-// handle of the application.  These routines in wx _DO NOT_ check to see if
-// the wxApp exists, and thus will crash the application if you try it.
+// wxMediaPlayerScanner
 //
-// IMPLEMENT_APP does this, and also implements the platform-specific entry
-// routine, such as main or WinMain().  Use IMPLEMENT_APP_NO_MAIN if you do
-// not desire this behaviour.
+// Pool of worker threads that walk directory trees for media files.  The
+// directories still to read are shared between the workers, so a tree is
+// read with as many directory listings in flight as there are workers,
+// which is what matters on network file systems.  Files are filtered by
+// extension and collected as UTF-8 per page; like the prober's results
+// they are announced with one wxThreadEvent per batch, so the page can show
+// and play the first of them while the rest of the tree is still read.
+// Unless told otherwise the workers also fingerprint every file they hand
+// over, see wxFingerprintMediaFile(), so that the page can drop copies of
+// what it already has.
 // ----------------------------------------------------------------------------
-IMPLEMENT_APP(wxMediaPlayerApp)
+
+class wxMediaPlayerScanner
+{
+public:
+    // Files found for a page since the last TakeBatches()
+    struct Batch
+    {
+        int                m_nPage;     // wxMediaPlayerNotebookPage::m_nPageId
+        wxVector<char>     m_pool;      // UTF-8 paths, back to back
+        wxVector<wxUint32> m_offsets;   // Start of each path, plus the end
+        wxVector<wxUint64> m_fingerprints;  // Of each path, 0 if unreadable;
+                                            // empty if not fingerprinting
+    };
+
+    wxMediaPlayerScanner();
+    ~wxMediaPlayerScanner();
+
+    // Workers post wxID_SCANNER events to handler.  They are only started
+    // by the first Scan().
+    void Start(wxEvtHandler* handler);
+    void Stop();
+
+    // Comma separated extensions of the files to pick, without dots
+    void SetExtensions(const wxString& extensions);
+    // Whether to fingerprint the files found, on by default
+    void SetFingerprinting(bool bFingerprint);
+    bool IsFingerprinting() const { return m_bFingerprint; }
+    // Whether a UTF-8 file name has one of the extensions
+    bool IsMediaFile(const char* name, size_t len) const;
+
+    // Looks for media files in the tree under dir, for a page
+    void Scan(int page, const wxString& dir);
+    // Reads the entries of a playlist file, for a page
+    void ScanPlaylist(int page, const wxString& file);
+    // Fingerprints files given one by one, for a page
+    void ScanFiles(int page, const wxVector<wxString>& files);
+    // Forgets everything still to be read for a page, including what the
+    // workers are in the middle of
+    void RemovePage(int page);
+
+    // Hands over all files found since the last call
+    void TakeBatches(wxVector<Batch>& batches);
+
+private:
+    friend class wxMediaPlayerScannerThread;
+
+    struct Job
+    {
+        int      m_nPage;
+        wxString m_szPath;
+        bool     m_bPlaylist;   // m_szPath is a playlist, not a directory
+        wxVector<wxString> m_files; // Or, if not empty, the files to hand
+                                    // over as they are
+    };
+
+    void AddJob(const Job& job);
+
+    // Called by the worker threads
+    bool GetJob(Job& job);
+    void Walk(const Job& dir);
+    void ReadPlaylist(const Job& playlist);
+    void ReadFiles(const Job& files);
+    bool Fingerprint(int page, const wxVector<char>& pool,
+                     const wxVector<wxUint32>& offsets,
+                     wxVector<wxUint64>& fingerprints);
+    // Whether a job of page should carry on, called with m_mutex held
+    bool IsWanted(int page) const;
+    bool AddResults(int page, const wxVector<char>& pool,
+                    const wxVector<wxUint32>& offsets,
+                    const wxVector<wxString>& subdirs);
+
+    wxVector<char>      m_extensions;   // ",ext,ext,", lower case, read only
+                                        // while the workers run
+    bool                m_bFingerprint; // Likewise
+    wxMutex             m_mutex;    // Protects everything below
+    wxCondition         m_cond;     // Signalled when directories are queued
+    wxVector<Job>       m_jobs;     // Directories and playlists to read
+    wxVector<Batch>     m_batches;  // Files found, one batch per page
+    wxVector<int>       m_removedPages; // RemovePage()d, whose jobs end
+    wxVector<wxThread*> m_threads;
+    wxEvtHandler*       m_handler;
+    bool                m_bStopping;
+};
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerApp command line parsing
+// wxMediaPlayerWatcher
+//
+// Follows changes to the directory trees imported into pages, for --watch.
+// One thread reads inotify events, which name the file and the directory
+// it is in, so nothing is listed again but directories that appear.  Files
+// are picked up once closed after writing or moved in, so half copied ones
+// aren't, and a move within the watched trees becomes a rename.  Changes
+// are held back until none came for wxMediaWatchQuiet milliseconds, or
+// wxMediaWatchLatency at most, then handed over in order as one batch
+// announced like the scanner's.
+//
+// Only changes made on this machine are seen, network file systems don't
+// tell about other clients' ones.  Does nothing but on Linux.
+//
+// All public methods are thread-safe.
 // ----------------------------------------------------------------------------
 
-#if wxUSE_CMDLINE_PARSER
+enum wxMediaPlayerWatchEvent
+{
+    wxWATCH_ADDED,              // A media file was written or moved in
+    wxWATCH_REMOVED,            // A file was deleted or moved out
+    wxWATCH_RENAMED,            // A file was moved within the trees
+    wxWATCH_DIR_ADDED,          // A directory was made or moved in
+    wxWATCH_DIR_REMOVED,        // A directory was deleted or moved out
+    wxWATCH_DIR_RENAMED         // A directory was moved within the trees
+};
 
-void wxMediaPlayerApp::OnInitCmdLine(wxCmdLineParser& parser)
+class wxMediaPlayerWatcher
 {
-    wxApp::OnInitCmdLine(parser);
+public:
+    struct Change
+    {
+        int      m_nPage;       // wxMediaPlayerNotebookPage::m_nPageId
+        int      m_nEvent;      // wxMediaPlayerWatchEvent
+        wxString m_szPath;      // Directories end with a separator
+        wxString m_szNewPath;   // Of renames
+    };
 
-    parser.AddParam("input files",
-                    wxCMD_LINE_VAL_STRING,
-                    wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE);
-}
+    wxMediaPlayerWatcher();
+    ~wxMediaPlayerWatcher();
 
-bool wxMediaPlayerApp::OnCmdLineParsed(wxCmdLineParser& parser)
-{
-    if ( !wxApp::OnCmdLineParsed(parser) )
-        return false;
+    // The thread posts wxID_WATCHER events to handler and goes by the
+    // extensions of scanner.  It is only started by the first Watch().
+    void Start(wxEvtHandler* handler, const wxMediaPlayerScanner* scanner);
+    void Stop();
 
-    for (size_t paramNr=0; paramNr < parser.GetParamCount(); ++paramNr)
-        m_params.push_back(parser.GetParam(paramNr));
+    // Follows the tree under dir, for a page
+    void Watch(int page, const wxString& dir);
+    // Stops following the trees of a page
+    void RemovePage(int page);
 
-    return true;
-}
+    // Hands over all changes since the last call
+    void TakeChanges(wxVector<Change>& changes);
 
-#endif // wxUSE_CMDLINE_PARSER
+private:
+    friend class wxMediaPlayerWatcherThread;
+
+    // A watched directory of a page.  inotify gives the same directory the
+    // same watch descriptor, however many pages watch it.
+    struct Dir
+    {
+        int      m_nWatch;
+        int      m_nPage;
+        wxString m_szPath;      // With a separator at the end
+        bool     m_bRoot;       // Given to Watch()
+    };
+
+    // Called by the thread
+    void Run();
+    bool TakeRequests();
+    void AddTree(int page, const wxString& dir, bool bRoot);
+    void RemoveTree(int page, const wxString& dir);
+    void RenameTree(int page, const wxString& dir, const wxString& newDir);
+    void RemoveWatch(size_t nDir);
+    size_t FindWatch(int watch) const;
+    bool ReadEvents();
+    void HandleEvent(const struct inotify_event& event);
+    bool PairMove(const Dir& dir, const char* name, wxUint32 cookie,
+                  bool bDir);
+    void AddChange(const Dir& dir, int event, const char* name,
+                   wxUint32 cookie);
+    void Flush();
+
+    // Interrupts the thread's poll(), called with m_mutex held
+    void Wake();
+
+    // Only used by the thread
+    int                 m_nInotify;     // inotify descriptor
+    int                 m_wake[2];      // Pipe that interrupts its poll()
+    wxVector<Dir>       m_dirs;         // Sorted by watch descriptor
+    wxVector<Change>    m_pending;      // Held back
+    wxVector<wxUint32>  m_cookies;      // Of the moves out in m_pending
+    wxVector<char>      m_buffer;       // For read()ing events
+    const wxMediaPlayerScanner* m_scanner;
+    bool                m_bWatchesFull; // Said that we ran out of watches
+
+    wxMutex             m_mutex;        // Protects everything below
+    wxVector<Dir>       m_requests;     // Watch()es the thread hasn't seen
+    wxVector<int>       m_removedPages; // RemovePage()s likewise
+    wxVector<Change>    m_changes;      // Handed over by the thread
+    wxThread*           m_thread;
+    wxEvtHandler*       m_handler;
+    bool                m_bStopping;
+};
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerApp::OnInit
+// wxMediaPlayerThumbnailer
 //
-// Where execution starts - akin to a main or WinMain.
-// 1) Create the frame and show it to the user
-// 2) Process filenames from the commandline
-// 3) return true specifying that we want execution to continue past OnInit
+// Small pool of worker threads making the poster thumbnails of the
+// playlist, see wxExtractMediaPoster().  Only the rows the list is about to
+// paint are asked for and each request replaces whatever is still queued,
+// so scrolling past 100k rows leaves no backlog behind.  Thumbnails are kept
+// across runs in a pack file of fixed size records that is only appended
+// to; like the media info cache it is keyed by path and a record is only
+// trusted while the file's size and mtime still match.  Results are
+// announced with one wxThreadEvent per batch, as the prober does.
+//
+// All public methods are thread-safe.
 // ----------------------------------------------------------------------------
-bool wxMediaPlayerApp::OnInit()
+
+// Size of a thumbnail, which is 16:9 as most of our content is
+static const int wxMediaThumbnailWidth = 64;
+static const int wxMediaThumbnailHeight = 36;
+
+class wxMediaPlayerThumbnailer
 {
-    if ( !wxApp::OnInit() )
-        return false;
+public:
+    struct Result
+    {
+        wxString m_szFile;
+        wxVector<unsigned char> m_rgb;  // Of the thumbnail, empty if the
+                                        // file has no poster
+    };
 
-    // SetAppName() lets wxConfig and others know where to write
-    SetAppName(wxT("wxMediaPlayer"));
+    wxMediaPlayerThumbnailer();
+    ~wxMediaPlayerThumbnailer();
 
-    wxMediaPlayerFrame *frame =
-        new wxMediaPlayerFrame(wxT("media"));
-    frame->Show(true);
+    // Starts the workers, which post wxID_THUMBNAILER events to handler and
+    // keep the pack file in dir
+    void Start(wxEvtHandler* handler, const wxString& dir);
+    void Stop();
 
-#if wxUSE_CMDLINE_PARSER
-    if ( !m_params.empty() )
-    {
-        for ( size_t n = 0; n < m_params.size(); n++ )
-            frame->AddToPlayList(m_params[n]);
+    // Replaces the files still queued, the first of them is made first
+    void Request(const wxVector<wxString>& files);
 
-        wxCommandEvent theEvent(wxEVT_MENU, wxID_NEXT);
-        frame->AddPendingEvent(theEvent);
-    }
-#endif // wxUSE_CMDLINE_PARSER
+    // Hands over all thumbnails made since the last call
+    void TakeResults(wxVector<Result>& results);
 
-    return true;
-}
+private:
+    friend class wxMediaPlayerThumbnailerThread;
 
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-//
-// wxMediaPlayerFrame
-//
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+    struct PackHeader
+    {
+        char     m_szMagic[8];  // "wxMPThmb"
+        wxUint32 m_nVersion;    // wxMEDIATHUMBNAIL_VERSION
+        wxUint32 m_nByteOrder;  // 0x01020304 as written by the host
+        wxUint32 m_nWidth;      // Of every thumbnail in the file
+        wxUint32 m_nHeight;
+        wxUint32 m_nReserved[2];
+    };
+
+    // Followed by the path and the pixels
+    struct PackRecord
+    {
+        wxUint32 m_nTag;        // wxMediaThumbnailTag, to spot a torn write
+        wxUint32 m_nHash;       // wxMediaPlayerHashPath() of the path
+        wxUint64 m_nSize;       // Size of the file the poster is of
+        wxInt64  m_nMTime;      // Its modification time
+        wxUint32 m_nPathLength;
+        wxUint32 m_nPixels;     // Bytes of RGB, 0 if the file had no poster
+    };
+
+    // Called by the worker threads
+    bool GetJob(wxString& file);
+    void Make(const wxString& file, wxVector<unsigned char>& rgb);
+    void AddResult(const Result& result);
+
+    // Pack file, called with m_packMutex held
+    bool OpenPack();
+    bool LookupPack(const char* path, size_t len, wxUint64 size,
+                    wxInt64 mtime, wxVector<unsigned char>& rgb);
+    void StorePack(const char* path, size_t len, wxUint64 size,
+                   wxInt64 mtime, const wxVector<unsigned char>& rgb);
+    void IndexPackRecord(wxUint32 hash, wxUint32 offset);
+
+    wxMutex             m_mutex;    // Protects everything below
+    wxCondition         m_cond;     // Signalled when files are requested
+    wxVector<wxString>  m_jobs;     // Latest request
+    size_t              m_nNextJob; // Next file of it to make
+    wxVector<wxString>  m_busy;     // Files the workers are making
+    wxVector<Result>    m_results;
+    wxVector<wxThread*> m_threads;
+    wxEvtHandler*       m_handler;
+    bool                m_bStopping;
+
+    wxMutex             m_packMutex;    // Protects everything below
+    wxString            m_szPack;
+    bool                m_bPackOpened;  // Whether OpenPack() ran
+    wxFile              m_pack;
+    wxFileOffset        m_nPackEnd;     // Where the next record goes
+    wxVector<wxUint32>  m_packHashes;   // Open-addressed, by path hash
+    wxVector<wxUint32>  m_packOffsets;  // Of the record, 0 if the slot is
+                                        // free, parallel to m_packHashes
+    size_t              m_nPackRecords;
+};
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame Constructor
+// wxMediaPlayerThumbnailCache
 //
-// 1) Create our menus
-// 2) Create our notebook control and add it to the frame
-// 3) Create our status bar
-// 4) Connect our events
+// The thumbnails on hand for the playlists, in one wxImageList all pages
+// share.  A fixed number of images is recycled least recently shown first,
+// so memory stays the same however many rows there are.  Looking a row up
+// is a hash of its UTF-8 path and a short chain walk, cheap enough for
+// every row that is painted.  Files without a poster take up an entry as
+// well, so they aren't asked for over and over.
+//
+// Only the UI thread may use this.
+// ----------------------------------------------------------------------------
+
+// Images in the list
+static const int wxMediaThumbnailSlots = 1024;
+
+class wxMediaPlayerThumbnailCache
+{
+public:
+    wxMediaPlayerThumbnailCache();
+
+    wxImageList* GetImageList() { return &m_images; }
+
+    // Image of a path in GetImageList(), wxTHUMBNAIL_NONE if the file has
+    // no poster and wxTHUMBNAIL_UNKNOWN if it has to be asked for
+    int Find(const char* path, size_t len);
+    void Add(const wxString& file, const wxVector<unsigned char>& rgb);
+
+private:
+    struct Entry
+    {
+        wxVector<char> m_path;  // UTF-8
+        wxUint32 m_nHash;       // wxMediaPlayerHashPath() of m_path
+        int      m_nChain;      // Next entry in the bucket, or -1
+        int      m_nPrev;       // More recently shown entry, or -1
+        int      m_nNext;       // Less recently shown entry, or -1
+        bool     m_bPoster;     // Whether its image holds a poster
+    };
+
+    int FindEntry(const char* path, size_t len, wxUint32 hash) const;
+    void Unlink(int n);
+    void LinkFirst(int n);
+
+    wxImageList      m_images;
+    wxVector<Entry>  m_entries;     // Entry n owns image n
+    wxVector<int>    m_buckets;     // First entry of each chain, or -1
+    int              m_nFirst;      // Most recently shown entry, or -1
+    int              m_nLast;       // Least recently shown entry, or -1
+};
+
+enum
+{
+    wxTHUMBNAIL_NONE = -1,
+    wxTHUMBNAIL_UNKNOWN = -2
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader and wxMediaPlayerPlaylistWriter
+//
+// M3U/M3U8, PLS and XSPF playlist files, a buffer at a time.  The reader is
+// fed the file in chunks of any size and appends each entry it completes as
+// a UTF-8 path to a pool plus offsets, the layout the scanner hands to the
+// UI thread, so a million line M3U is a few large reads and memcpy()s
+// rather than an allocation per line.  Relative entries are resolved
+// against the playlist's directory and file:// URLs become paths again.
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerPlaylistFormat
+{
+    wxPLAYLISTFORMAT_NONE,
+    wxPLAYLISTFORMAT_M3U,       // .m3u and .m3u8
+    wxPLAYLISTFORMAT_PLS,       // .pls
+    wxPLAYLISTFORMAT_XSPF       // .xspf
+};
+
+class wxMediaPlayerPlaylistReader
+{
+public:
+    wxMediaPlayerPlaylistReader(int format, const wxString& dir);
+
+    // Format of a playlist file going by its extension
+    static int GetFormat(const wxString& path);
+
+    // Parses the next chunk of the file.  The entries completed by it are
+    // appended to pool, with offsets holding where each starts plus the end.
+    void Feed(const char* data, size_t len,
+              wxVector<char>& pool, wxVector<wxUint32>& offsets);
+    // Parses whatever the last chunk left over
+    void Finish(wxVector<char>& pool, wxVector<wxUint32>& offsets);
+
+private:
+    void SkipBOM();
+    size_t ParseLines(bool bLast,
+                      wxVector<char>& pool, wxVector<wxUint32>& offsets);
+    size_t ParseXSPF(wxVector<char>& pool, wxVector<wxUint32>& offsets);
+    void AddPath(const char* p, const char* end, bool bURI,
+                 wxVector<char>& pool, wxVector<wxUint32>& offsets);
+
+    int            m_nFormat;
+    wxVector<char> m_base;      // Playlist directory and separator, UTF-8
+    wxVector<char> m_buffer;    // What the chunks so far left unparsed
+    wxVector<char> m_scratch;   // An XSPF location with entities decoded
+    bool           m_bStart;    // At the start of the file, maybe a BOM
+};
+
+class wxMediaPlayerPlaylistWriter
+{
+public:
+    wxMediaPlayerPlaylistWriter();
+
+    // Starts writing a playlist, which replaces path once committed
+    bool Create(const wxString& path, int format);
+    // Adds an entry, duration in milliseconds or 0 if unknown
+    void Add(const char* path, size_t len, wxUint32 duration);
+    // Writes the rest of the file and moves it into place
+    bool Commit();
+
+private:
+    void Write(const char* data, size_t len);
+    void Write(const char* sz) { Write(sz, strlen(sz)); }
+    void WriteNumber(wxUint32 n);
+    void WriteLocation(const char* path, size_t len);
+    void Flush();
+
+    int            m_nFormat;
+    wxTempFile     m_file;
+    wxVector<char> m_buffer;    // Written to m_file when full
+    wxUint32       m_nEntries;
+    bool           m_bOK;
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench
+//
+// Drives --bench: plays each entry of the current page for a moment, moves
+// on with Next until enough switches were timed, then opens a few more
+// pages in the background and starts them all at once, then has a few
+// more instances of the app hand it a file, times commands over the same
+// socket, writes a JSON report and closes the frame.  The frame and pages
+// tell it when an entry is opened, loaded and playing; everything is timed
+// against one stopwatch started with the app, so the first play also gives
+// the startup time.
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerBenchPhase
+{
+    wxBENCH_STARTUP,            // OnInit() to the first wxEVT_MEDIA_PLAY
+    wxBENCH_OPEN_TO_LOADED,     // DoPlayFile() to wxEVT_MEDIA_LOADED
+    wxBENCH_LOADED_TO_PLAYING,  // wxEVT_MEDIA_LOADED to wxEVT_MEDIA_PLAY
+    wxBENCH_SWITCH,             // Next to wxEVT_MEDIA_PLAY of the new entry
+    wxBENCH_CONCURRENT,         // The same with --bench-pages pages at once
+    wxBENCH_HANDOFF,            // Starting an instance to its files arriving
+    wxBENCH_CONTROL_ROUND_TRIP, // A command and its answer, one at a time
+    wxBENCH_CONTROL_PIPELINED,  // Per command, sent without waiting
+    wxBENCH_CONTROL_BATCH,      // Per command, sent as one batch
+    wxBENCH_PHASES
+};
+
+class wxMediaPlayerBench : public wxEvtHandler
+{
+public:
+    wxMediaPlayerBench(const wxString& report, long nSwitches, long nPages);
+    ~wxMediaPlayerBench();
+
+    // Writes short WAV clips to a temporary directory, for when no files
+    // were given to go through
+    bool GenerateClips(wxVector<wxString>& files);
+
+    // Where the page is at with the entry being switched to
+    void OnOpen(class wxMediaPlayerNotebookPage* page);
+    void OnPreloaded(class wxMediaPlayerNotebookPage* page);
+    void OnFailed(class wxMediaPlayerNotebookPage* page);
+    void OnLoaded(class wxMediaPlayerNotebookPage* page);
+    void OnPlaying(class wxMediaPlayerNotebookPage* page);
+#ifdef wxMEDIA_USE_REMOTE
+    // Files another instance was started with arrived
+    void OnHandoff();
+#endif // wxMEDIA_USE_REMOTE
+
+    // Opens a page of its own for the run, which is forgotten at the end
+    void Start(class wxMediaPlayerFrame* frame);
+
+    // Runs --bench-kernels, returning the exit code
+    static int BenchKernels(const wxString& report);
+
+private:
+    // One of the pages started at once
+    struct Page
+    {
+        int     m_nPage;        // wxMediaPlayerNotebookPage::m_nPageId
+        long    m_nEntry;       // What it was told to play
+        wxInt64 m_nOpened;      // When it was, or -1
+        bool    m_bWaiting;     // Opened and not playing yet
+    };
+
+    void OnTimer(wxTimerEvent& event);
+    void Next();
+    void OpenPages();
+    void ClosePages();
+    Page* FindPage(int nPageId);
+    void OnPagePlaying(Page& bench, class wxMediaPlayerNotebookPage* page);
+#ifdef wxMEDIA_USE_REMOTE
+    void StartHandoff(class wxMediaPlayerNotebookPage* page);
+    void OnClientDone(wxThreadEvent& event);
+#endif // wxMEDIA_USE_REMOTE
+    bool WriteReport() const;
+
+    wxString           m_szReport;      // Where the JSON goes
+    long               m_nSwitches;     // How many switches to time
+    wxStopWatch        m_clock;         // Started with the app
+    wxTimer            m_timer;         // Dwell time and load timeouts
+    class wxMediaPlayerFrame* m_frame;
+    int                m_nPage;         // Id of the page the run is on
+    wxVector<wxUint32> m_samples[wxBENCH_PHASES];   // Microseconds
+    wxInt64            m_nOpened;       // When the entry was opened, or -1
+    wxInt64            m_nLoaded;       // When it loaded, or -1
+    bool               m_bWaiting;      // Opened and not playing yet
+    long               m_nDone;         // Switches so far
+    long               m_nPreloaded;    // Switches the standby control did
+    long               m_nFailed;
+    long               m_nTimeouts;
+    long               m_nPages;        // How many pages to start at once
+    wxVector<Page>     m_pages;         // Them, once they are
+    long               m_nPagesWaiting;
+    bool               m_bPagesOpened;
+    long               m_nMisrouted;    // Pages playing the wrong entry
+    long               m_nHandoffs;     // Instances started so far
+    wxInt64            m_nHandoffStart; // When the last one was, or -1
+    class wxMediaPlayerBenchClient* m_client;   // Timing commands, or NULL
+    bool               m_bCommandsTimed;
+    wxVector<wxString> m_clips;         // Generated, removed at the end
+    wxString           m_szClipDir;
+};
+
+#ifdef wxMEDIA_USE_REMOTE
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBenchClient
+//
+// Sends commands to a wxMediaPlayerRemote for the benchmark, from a thread
+// of its own so the UI thread is free to answer them.  Posts wxEVT_THREAD
+// with wxID_BENCHCLIENT to the handler when done.
+// ----------------------------------------------------------------------------
+
+class wxMediaPlayerBenchClient : public wxThread
+{
+public:
+    wxMediaPlayerBenchClient(wxEvtHandler* handler, const wxString& path);
+
+    // Microseconds per command
+    wxVector<wxUint32> m_roundTrip;
+    wxVector<wxUint32> m_pipelined;
+    wxVector<wxUint32> m_batch;
+
+protected:
+    virtual ExitCode Entry();
+
+private:
+    // Sends request and waits for nLines lines of answers
+    bool Exchange(wxSocketClient& client, const wxString& request,
+                  int nLines);
+
+    wxEvtHandler* m_handler;
+    wxString      m_szPath;
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerJSONValue
+//
+// Just enough JSON for the requests wxMediaPlayerRemote reads.  Numbers are
+// doubles, and objects keep their members in order.
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerJSONType
+{
+    wxJSON_NULL,
+    wxJSON_BOOL,
+    wxJSON_NUMBER,
+    wxJSON_STRING,
+    wxJSON_ARRAY,
+    wxJSON_OBJECT
+};
+
+struct wxMediaPlayerJSONValue
+{
+    wxMediaPlayerJSONValue() : m_nType(wxJSON_NULL), m_dNumber(0) { }
+
+    // Replaces the value with the UTF-8 text in p, false unless that is
+    // exactly one JSON value
+    bool Parse(const char* p, size_t len);
+
+    // The member called name of an object, or NULL
+    const wxMediaPlayerJSONValue* Get(const char* name) const;
+
+    // Members, or def if they are missing or of another type
+    wxString GetString(const char* name,
+                       const wxString& def = wxEmptyString) const;
+    double GetNumber(const char* name, double def) const;
+    bool GetBool(const char* name, bool def) const;
+
+    int      m_nType;           // wxMediaPlayerJSONType
+    double   m_dNumber;         // Also 0 or 1 for wxJSON_BOOL
+    wxString m_szValue;         // For wxJSON_STRING
+    wxVector<wxString> m_names; // Of the members of an object
+    wxVector<wxMediaPlayerJSONValue> m_items;   // Items or member values
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote
+//
+// Lets other processes drive the player over a Unix domain socket.  With
+// --single-instance the first instance listens on one in the user's data
+// directory, and later ones hand it their files and exit before creating a
+// window, let alone a media control.  --control listens on a path of your
+// choosing for automation.  Both run off socket events on the UI thread, so
+// a command is carried out in the handler that reads it, with no further
+// events or threads in between.
+//
+// Requests are line-delimited JSON: an object with a "cmd" and its
+// arguments, or an array of them carried out as a batch, and answered with
+// an array.  Every line gets an answer line, in order, so clients may send
+// more before reading any.  "id" is echoed in the answer, and "page" picks
+// the page by index instead of the current one.  Answers are queued and
+// written as the socket takes them, so a client that doesn't read can't
+// stall the UI thread, and is dropped once too much piles up for it.
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerOpenMode
+{
+    wxOPEN_APPEND,              // Added to the current page
+    wxOPEN_REPLACE,             // In a new page instead of the current one
+    wxOPEN_PLAY,                // Added to the current page and played
+    wxOPEN_MODES
+};
+
+class wxMediaPlayerRemote : public wxEvtHandler
+{
+public:
+    wxMediaPlayerRemote();
+    ~wxMediaPlayerRemote();
+
+    // wxMediaPlayerOpenMode for a name, or -1
+    static int GetOpenMode(const wxString& name);
+
+    // Where --single-instance instances meet
+    static wxString GetInstancePath();
+
+    // Hands the paths to a running instance, false if there is none or it
+    // didn't take them
+    static bool Forward(const wxVector<wxString>& paths, int mode);
+
+    // Takes over the socket at path unless something still listens on it
+    bool Listen(class wxMediaPlayerFrame* frame, const wxString& path);
+
+    const wxString& GetPath() const { return m_szPath; }
+
+private:
+    struct Client
+    {
+        wxSocketBase*  m_socket;
+        wxVector<char> m_buffer;    // Read and not handled yet
+        wxVector<char> m_output;    // Answered and not written yet
+    };
+
+    void OnServerEvent(wxSocketEvent& event);
+    void OnClientEvent(wxSocketEvent& event);
+    // Writes what the socket takes of the queued answers, false if the
+    // client is to be dropped
+    bool FlushClient(Client* client);
+    // Appends the answer to a request line to reply
+    void HandleRequest(const char* p, size_t len, wxString& reply);
+    void HandleCommand(const wxMediaPlayerJSONValue& command,
+                       wxString& reply);
+    // Appends the members of the answer to result, or returns an error
+    wxString RunCommand(const wxMediaPlayerJSONValue& command,
+                        wxString& result);
+    void DropClient(Client* client);
+
+    wxSocketServer*    m_server;
+    wxString           m_szPath;        // Of the socket, once it's ours
+    wxVector<Client*>  m_clients;
+    class wxMediaPlayerFrame* m_frame;
+};
+
+#endif // wxMEDIA_USE_REMOTE
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStats
+//
+// Always-on timing of the handlers that matter when playback stutters, for
+// --stats.  Each thread that records has a shard of its own, so recording
+// is two clock reads and a few increments without locks or atomics, into
+// log-linear (HDR style) histograms: exact below 16us, then 16 buckets per
+// power of two, which keeps every percentile within about 6%.  The UI
+// thread sums the shards now and then and writes them out in the Prometheus
+// text format for the local agent to scrape.
+// ----------------------------------------------------------------------------
+
+enum wxMediaPlayerStatsMetric
+{
+    wxSTATS_PLAY_FILE,          // wxMediaPlayerFrame::DoPlayFile()
+    wxSTATS_MEDIA_LOADED,       // The wxEVT_MEDIA_* handlers of the pages
+    wxSTATS_MEDIA_PLAY,
+    wxSTATS_MEDIA_PAUSE,
+    wxSTATS_MEDIA_FINISHED,
+    wxSTATS_SEEK,               // wxMediaCtrl::Seek() for the slider and keys
+    wxSTATS_LIST_UPDATE,        // New rows and repaints of probed rows
+    wxSTATS_SEARCH,             // A keystroke in the search box of a page
+    wxSTATS_SORT,               // Sorting a page by a column
+    wxSTATS_PROBE,              // One file, in a prober thread
+    wxSTATS_REMOTE,             // A command from a wxMediaPlayerRemote client
+    wxSTATS_IDLE,               // The event loop waiting for an event
+    wxSTATS_METRICS
+};
+
+#define wxMEDIASTATS_SUBBUCKETS 16
+#define wxMEDIASTATS_BUCKETS    (29 * wxMEDIASTATS_SUBBUCKETS)
+
+struct wxMediaPlayerHistogram
+{
+    wxUint32 m_counts[wxMEDIASTATS_BUCKETS];
+    wxUint64 m_nCount;
+    wxUint64 m_nSum;            // Microseconds
+    wxUint32 m_nMax;
+
+    void Record(wxInt64 nTime)
+    {
+        // Anything over an hour and a bit is just very long
+        const wxUint32 nMicro = nTime < 0xffffffff ? (wxUint32) nTime
+                                                   : 0xffffffff;
+        ++m_counts[GetBucket(nMicro)];
+        ++m_nCount;
+        m_nSum += nMicro;
+        if (nMicro > m_nMax)
+            m_nMax = nMicro;
+    }
+
+    void Add(const wxMediaPlayerHistogram& other);
+
+    // How many samples were at most nMicro, rounded down to a bucket
+    wxUint64 CountUpTo(wxUint32 nMicro) const;
+    // Upper end of the bucket with the nPercent'th percentile
+    wxUint32 GetPercentile(int nPercent) const;
+
+    static size_t GetBucket(wxUint32 nMicro);
+    static wxUint32 GetBucketMax(size_t bucket);
+};
+
+class wxMediaPlayerStats : public wxEvtHandler
+{
+public:
+    struct Shard
+    {
+        wxMediaPlayerHistogram m_hist[wxSTATS_METRICS];
+        wxUint64 m_events[wxHEALTH_EVENTS];     // Playback problems
+    };
+
+    // Writes to file every nInterval seconds
+    wxMediaPlayerStats(const wxString& file, long nInterval);
+    ~wxMediaPlayerStats();
+
+    // Microseconds since the stats were created, from any thread
+    wxInt64 Now() const { return m_clock.TimeInMicro().GetValue(); }
+
+    // The UI thread's shard, and a new one for a worker thread to use for
+    // as long as the stats live
+    Shard* GetMainShard() { return &m_main; }
+    Shard* AddShard();
+
+    // Counts one of wxMediaPlayerHealthEvent (UI thread only)
+    void CountEvent(int event) { ++m_main.m_events[event]; }
+
+    // The event loop went idle, or got an event again (UI thread only)
+    void OnIdle()
+    {
+        if (m_nIdleSince < 0)
+            m_nIdleSince = Now();
+    }
+    void OnEvent()
+    {
+        if (m_nIdleSince >= 0)
+        {
+            m_main.m_hist[wxSTATS_IDLE].Record(Now() - m_nIdleSince);
+            m_nIdleSince = -1;
+        }
+    }
+
+    bool Export();
+
+private:
+    void Calibrate();
+    void OnTimer(wxTimerEvent& event);
+
+    wxString         m_szFile;
+    wxStopWatch      m_clock;
+    wxTimer          m_timer;
+    Shard            m_main;
+    wxMutex          m_mutex;       // Protects m_shards, not their contents
+    wxVector<Shard*> m_shards;
+    wxInt64          m_nIdleSince;  // When the event loop went idle, or -1
+    double           m_nSampleCost; // Microseconds to take one sample
+    wxInt64          m_nExportTime; // Microseconds spent in Export()
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStatsScope
+//
+// Records the time until it goes out of scope, if there are stats at all
+// ----------------------------------------------------------------------------
+
+class wxMediaPlayerStatsScope
+{
+public:
+    wxMediaPlayerStatsScope(wxMediaPlayerStats* stats, int metric,
+                            wxMediaPlayerStats::Shard* shard = NULL)
+        : m_stats(stats), m_shard(shard), m_nMetric(metric)
+    {
+        if (m_stats)
+        {
+            if (!m_shard)
+                m_shard = m_stats->GetMainShard();
+            m_nStart = m_stats->Now();
+        }
+    }
+
+    ~wxMediaPlayerStatsScope()
+    {
+        if (m_stats)
+            m_shard->m_hist[m_nMetric].Record(m_stats->Now() - m_nStart);
+    }
+
+private:
+    wxMediaPlayerStats*        m_stats;
+    wxMediaPlayerStats::Shard* m_shard;
+    int                        m_nMetric;
+    wxInt64                    m_nStart;
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder
+//
+// Decides what a page plays next without looking at the list control.  In
+// sequential order that is just the next index.  Shuffling keeps a
+// permutation of all entries, its inverse and a cursor into it, so every
+// entry plays once per cycle and stepping either way is O(1).  Entries
+// picked by hand are swapped in at the cursor, which leaves the rest of the
+// cycle as it was, and a history of shuffled plays lets Prev retrace them.
+// ----------------------------------------------------------------------------
+
+class wxMediaPlayerPlayOrder
+{
+public:
+    wxMediaPlayerPlayOrder();
+
+    // Entries were appended to the page, or all of them removed
+    void SetCount(size_t count);
+    // Some entries were removed, map holding the new index of every old
+    // one or -1.  If the current one went there is none now, and the entry
+    // Next would have gone on with is returned.
+    long RemoveEntries(const wxVector<long>& map, size_t count);
+
+    void SetShuffle(bool bShuffle);
+    bool IsShuffle() const { return m_bShuffle; }
+    // Whether to go round again after the last entry or stop
+    void SetRepeat(bool bRepeat) { m_bRepeat = bRepeat; }
+    bool IsRepeat() const { return m_bRepeat; }
+
+    // Shuffles the entries still to come in this cycle
+    void Reshuffle();
+
+    // The entry being played, or -1
+    long GetCurrent() const { return m_nCurrent; }
+
+    // Where Next and Prev go from here, or -1.  GetNext() starts a new
+    // shuffled cycle when this one is used up, PeekNext() returns -1 then.
+    long GetNext();
+    long PeekNext() const;
+    long GetPrev() const;
+
+    // Makes n the current entry.  If it's what GetNext() or GetPrev()
+    // returned the cursor and history follow along.  Without bRecord the
+    // entry left isn't added to the history, Prev won't go back to it.
+    void MoveTo(long n, bool bRecord = true);
+
+private:
+    void StartCycle();
+    void SwapPositions(size_t a, size_t b);
+    wxUint32 Random(wxUint32 n);
+
+    size_t             m_nCount;
+    long               m_nCurrent;
+    bool               m_bShuffle;
+    bool               m_bRepeat;
+    wxVector<wxUint32> m_order;     // Entries in shuffled order
+    wxVector<wxUint32> m_position;  // Index of each entry in m_order
+    long               m_nPos;      // Cursor in m_order, -1 before the start
+    wxVector<wxUint32> m_history;   // Shuffled entries played before this
+    wxUint64           m_nSeed;     // xorshift state for Random()
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerLoopStats
+//
+// How well a page has been looping its media.  The gap is media time cut
+// off the end by wrapping around early, the drift is how much longer a
+// loop took on the wall clock than the media time it played.
+// ----------------------------------------------------------------------------
+
+struct wxMediaPlayerLoopStats
+{
+    long m_nLoops;              // Number of times media has looped
+    long m_nLateLoops;          // Of those, restarts after it had finished
+    long m_nLastGap;            // In milliseconds
+    long m_nMaxGap;
+    long m_nLastDrift;          // In milliseconds, of timed loops only
+    long m_nMaxDrift;
+    wxInt64 m_nTotalDrift;
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerHealthSampler
+//
+// A frozen pipeline often still says wxMEDIASTATE_PLAYING, so a page polls
+// the position of its media and compares it with the clock.  This keeps
+// track of the samples and says when one shows a problem: the position
+// jumping ahead (the backend dropping frames to catch up), or standing
+// still, which is an underrun while a stream still downloads and a stall
+// once it lasts long enough.  Every problem is reported once, until the
+// position moves normally again.
+// ----------------------------------------------------------------------------
+
+// What a page does about a stall, for --on-stall
+enum wxMediaPlayerStallAction
+{
+    wxSTALL_NONE,
+    wxSTALL_RELOAD,             // Load the file again, where it stalled
+    wxSTALL_SKIP                // Go on with the next entry
+};
+
+class wxMediaPlayerHealthSampler
+{
+public:
+    wxMediaPlayerHealthSampler() { Reset(); }
+
+    // Forgets all samples, for new media and after seeking
+    void Reset();
+
+    // Takes position nPos at time nTime, both in milliseconds, and
+    // returns one of wxMediaPlayerHealthEvent
+    int Sample(long nPos, long nTime, bool bDownloading, long nStallTimeout);
+
+    long GetPosition() const { return m_nLastPos; }
+    // How far the position jumped at the last wxHEALTH_DROPPED
+    long GetJump() const { return m_nJump; }
+    // How far playback fell behind the clock since Reset(), in
+    // milliseconds, and its speed in per mille of real time
+    long GetDrift() const;
+    long GetRate() const;
+
+private:
+    long m_nBasePos;            // First sample after Reset()
+    long m_nBaseTime;
+    long m_nLastPos;            // Last sample, or -1
+    long m_nLastTime;
+    long m_nStopTime;           // When the position stopped moving, or -1
+    bool m_bUnderrun;           // Whether the stop was reported as either
+    bool m_bStalled;
+    long m_nJump;
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage
+// ----------------------------------------------------------------------------
+
+// What a page holds on to while it isn't shown
+enum wxMediaPlayerPageResidency
+{
+    wxPAGE_ACTIVE,              // Its media, playing or not
+    wxPAGE_SUSPENDED,           // Its media, paused
+    wxPAGE_EVICTED              // Only where it was, the controls are empty
+};
+
+class wxMediaPlayerNotebookPage : public wxPanel
+{
+    wxMediaPlayerNotebookPage(wxMediaPlayerFrame* parentFrame,
+        wxNotebook* book, const wxString& be = wxEmptyString);
+
+    // Media event handlers, for both media controls
+    void OnMediaLoaded(wxMediaEvent& event);
+    void OnMediaPlay(wxMediaEvent& event);
+    void OnMediaPause(wxMediaEvent& event);
+    void OnMediaFinished(wxMediaEvent& event);
+    void OnMediaStop(wxMediaEvent& event);
+
+    // List control events
+    void OnListCacheHint(wxListEvent& event);
+    void OnListItemActivated(wxListEvent& event);
+    void OnListColClick(wxListEvent& event);
+
+    // Search box
+    void OnSearch(wxCommandEvent& event);
+    void OnSearchCancel(wxCommandEvent& event);
+    void FilterEntries(const wxString& query);
+    void SyncRows();
+
+    // Sorts m_sorted by m_sorter's key again
+    void ResortEntries();
+    // Makes m_sorted follow EditEntries() of the entry store
+    void RemapSorted(const wxVector<wxUint32>& paths,
+                     const wxVector<long>& map);
+    // Gives m_playlist the rows of the sort and the search
+    void BuildRows();
+
+    // Seamless looping
+    void OnLoopTimer(wxTimerEvent& event);
+    void ArmLoopTimer();
+    void WrapLoop(long nRemaining);
+
+    // Playback health
+    void OnHealthTimer(wxTimerEvent& event);
+    void RecoverPlayback();
+    void OnRetryTimer(wxTimerEvent& event);
+    void OnLoadTimer(wxTimerEvent& event);
+
+    // Seek slider
+    void OnSeekTrack(wxScrollEvent& event);
+    void OnSeekRelease(wxScrollEvent& event);
+    void OnSeekChanged(wxScrollEvent& event);
+    void OnSeekTimer(wxTimerEvent& event);
+    void OnSliderTimer(wxTimerEvent& event);
+    void DoSeek(long nPos);
+
+public:
+    // Appends files and hands directories and playlists to the scanner
+    void Import(const wxVector<wxString>& paths);
+    // Appends a file found by the scanner or watcher, see OnScanResults()
+    bool AddImported(const char* path, size_t len, bool bDedup,
+                     wxUint64 fingerprint);
+    // Applies changes to the watched folders to m_entries
+    void ApplyWatchChanges(
+        const wxVector<wxMediaPlayerWatcher::Change>& changes);
+    // Carries out removals and renames collected by ApplyWatchChanges()
+    void EditEntries(wxVector<wxUint32>& paths);
+    // Stops the media of an entry that was removed
+    void DropCurrentFile();
+    // Shows m_playlist sorted by a wxMediaPlayerSortKey
+    void SortEntries(int key, bool bDescending);
+    // Writes the entries to a playlist file, the format going by extension
+    bool ExportPlaylist(const wxString& path) const;
+    // Updates the list control, play order, playlist store and prober
+    // after entries were appended to m_entries
+    void SyncNewEntries();
+    // Hands paths added since the last call to the background prober
+    void QueueNewPaths();
+    // Journals entries added since the last call
+    void SaveNewEntries();
+
+    // The entry we expect to play after the current one, or -1
+    long PredictNextEntry() const;
+    // Loads the predicted entry into the standby control
+    void PrepareStandby();
+    // Makes the standby control the visible one if it has path ready
+    bool SwapInStandby(const wxString& path);
+    // Gives up on the standby load in flight
+    void CancelStandby();
+    void OnStandbyTimer(wxTimerEvent& event);
+
+    // Starts watching for the end of newly started media to loop it
+    void ScheduleLoop();
+    // Starts sampling the health of media that just started playing
+    void StartHealthSampler();
+
+    // Pauses the media of a page that is being hidden, remembering where
+    // it was and whether it played
+    void Suspend();
+    // Unloads the media of a suspended page
+    void Evict();
+    // Undoes Suspend() or Evict() for a page that is shown again
+    void Restore();
+    // Marks the page as using its media again and returns whether it was
+    // evicted
+    bool Activate();
+    // Creates m_mediactrl if there isn't one yet
+    void EnsureMediaCtrl();
+    wxMediaCtrl* CreateMediaCtrl(wxWindowID id);
+
+    // Seeks to nPos milliseconds.  While a seek settles newer ones only
+    // replace the target, so at most one is in flight.
+    void RequestSeek(long nPos);
+    // Where the last seek asked for goes, or the media is
+    long GetSeekPosition() const;
+    // The keyframe nearest to nPos, or the one before or after it with
+    // nDirection -1 or 1.  Without an index, nPos or a step from it.
+    long FindKeyframe(long nPos, int nDirection) const;
+    // Asks the prober for the keyframes of m_szFile
+    void RequestKeyframes();
+    // Shows the length and position of the media on the slider
+    void UpdateSlider();
+
+    // Marks entry n as failed, backs off from or quarantines its file and
+    // queues the error with the frame
+    void ReportError(long n, const wxString& what);
+    // Whether entry n may be played without anybody asking for it
+    bool IsPlayable(long n) const;
+
+    bool IsBeingDragged();      // accessor for m_bIsBeingDragged
+
+    // make wxMediaPlayerFrame able to access the private members
+    friend class wxMediaPlayerFrame;
+    friend class wxMediaPlayerBench;
+
+    int      m_nPageId;         // Unique id, stays valid after deletion
+    wxUint32 m_nPlaylistId;     // Id in the frame's playlist store
+    wxString m_szFile;          // Name of currently playing file/location
+
+    wxMediaCtrl* m_mediactrl;   // Our media control, once something loads
+    class wxMediaPlayerListCtrl* m_playlist;  // Our playlist
+    wxSearchCtrl* m_search;     // Filters it
+    wxMediaPlayerSearchIndex m_index;   // Built with the first search
+    wxVector<char> m_query;     // Folded search box text m_playlist shows
+    wxVector<wxUint32> m_queryPaths;    // Paths matching it, ascending
+    wxVector<wxUint32> m_foundPaths;    // The ones before, reused for the
+                                        // next search
+    wxVector<wxUint8> m_pathMatches;    // For BuildRows(), all 0 between
+    wxVector<wxUint32> m_spareRows;     // Rows m_playlist gave back, reused
+    size_t   m_nRowEntries;     // Entries m_playlist's rows cover
+    wxMediaPlayerEntryStore m_entries;  // Entries shown in m_playlist
+    wxMediaPlayerSorter m_sorter;   // Has the key m_playlist is sorted by
+    bool m_bSortDescending;     // Whether it shows it backwards
+    wxVector<wxMediaPlayerSorter::Item> m_sorted;   // All entries, ascending
+    wxVector<wxUint32> m_sortedAt;      // Where each entry is in m_sorted,
+                                        // empty until a search needs it
+    wxMediaPlayerPlayOrder m_order;     // Which entry plays, and next
+    wxUint32 m_nQueuedPaths;    // Paths of m_entries given to the prober
+    size_t   m_nSavedEntries;   // Entries of m_entries that are journalled
+    long     m_nAutoPlay;       // Imported entry to play once it's there
+    wxUint32 m_nDuplicates;     // Imported files dropped as already there
+    wxMediaCtrl* m_standby;     // Hidden control pre-rolling the next entry
+    wxString m_szStandbyFile;   // What m_standby has loaded, if anything
+    wxString m_szStandbyLoading;    // What it is still loading, if anything
+    wxTimer m_standbyTimer;     // Gives up on that
+    bool m_bNoStandby;          // The backend wouldn't give us a second one
+    int  m_nDirection;          // 1 after Next, -1 after Prev
+    wxStopWatch m_switchWatch;  // Started when switching entries
+    long m_nSwitchMicros;       // How long the last switch took
+    bool m_bLoop;               // Whether we are looping or not
+    wxTimer m_loopTimer;        // Fires just before the end when looping
+    wxStopWatch m_loopWatch;    // Started at the last wrap around
+    bool m_bLoopTimed;          // Whether m_loopWatch times a whole loop
+    wxMediaPlayerLoopStats m_loopStats;
+    wxTimer m_healthTimer;      // Samples the position while playing
+    wxStopWatch m_healthWatch;  // The clock the samples are compared with
+    wxMediaPlayerHealthSampler m_sampler;
+    wxMediaPlayerHealth m_health;   // Problems of all files of the page
+    long m_nResumeAt;           // Where a reload after a stall goes on, or -1
+    wxTimer m_retryTimer;       // Looks again when nothing was playable
+    wxTimer m_loadTimer;        // Gives up on a load that never finishes
+    wxString m_szBackend;       // For media controls created later
+    int  m_nResidency;          // wxMediaPlayerPageResidency
+    wxUint32 m_nLastShown;      // wxMediaPlayerFrame::m_nPageClock then
+    bool m_bResumePlaying;      // Whether it played when suspended
+    long m_nSuspendedAt;        // Where it was then
+    bool m_bResumePaused;       // Whether a restoring load stays paused
+    bool m_bPlayPending;        // Opened by DoPlayFile(), counts as played
+                                // once it does
+    bool m_bIsBeingDragged;     // Whether the user is dragging the scroll bar
+    wxSlider* m_slider;         // Position in the media, for seeking
+    wxTimer m_sliderTimer;      // Moves m_slider along while playing
+    wxTimer m_seekTimer;        // Runs while the last seek settles
+    long m_nLastSeek;           // Where that went
+    long m_nSeekTarget;         // Where to go once it has, or -1
+    wxVector<wxUint32> m_keyframes; // Of m_szFile in ms, empty until indexed
+    wxMediaPlayerFrame* m_parentFrame;  // Main wxFrame of our sample
+    wxButton* m_prevButton;     // Go to previous file button
+    wxButton* m_playButton;     // Play/pause file button
+    wxButton* m_nextButton;     // Next file button
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl
+// ----------------------------------------------------------------------------
+class wxMediaPlayerListCtrl : public wxListCtrl
+{
+public:
+    wxMediaPlayerListCtrl(wxMediaPlayerEntryStore* entries,
+                          wxMediaPlayerThumbnailCache* thumbnails)
+        : m_entries(entries), m_thumbnails(thumbnails), m_bRows(false)
+    {
+        m_attrOdd.SetBackgroundColour(wxColour(192,192,192));
+    }
+
+    // The page shows it with SyncNewEntries()
+    void AddToPlayList(const wxString& szString)
+    {
+        m_entries->Add(szString);
+    }
+
+    // Changes the state of an entry and repaints its row
+    void SetEntryState(long n, wxUint8 state)
+    {
+        m_entries->SetState(n, state);
+        RefreshEntry(n);
+    }
+
+    // Shows only the entries in rows, in that order, taking them over.
+    // They must be ascending unless bSorted.  ClearRows() shows all
+    // entries in their own order again.
+    void SetRows(wxVector<wxUint32>& rows, bool bSorted = false);
+    void ClearRows()
+    {
+        m_rows.clear();
+        m_rowOf.clear();
+        m_bRows = false;
+        SyncItemCount();
+    }
+    bool HasRows() const { return m_bRows; }
+    // Shows entry n too, which must be after those shown and not sorted
+    void AppendRow(wxUint32 n) { m_rows.push_back(n); }
+    // Replaces the sorted rows from nRow on with rows, which must show
+    // all the entries and each only once
+    void ReplaceRows(size_t nRow, const wxVector<wxUint32>& rows);
+    // After entries were appended, or rows
+    void SyncItemCount()
+    {
+        this->SetItemCount(m_bRows ? (long) m_rows.size()
+                                   : (long) m_entries->GetCount());
+    }
+
+    // The entry shown in a row
+    long GetEntry(long row) const
+    {
+        return m_bRows ? (long) m_rows[row] : row;
+    }
+    // The row showing entry n, -1 if it isn't shown
+    long FindRow(long n) const;
+
+    void RefreshEntry(long n)
+    {
+        long row = FindRow(n);
+        if (row != -1)
+            this->RefreshItem(row);
+    }
+    void EnsureEntryVisible(long n)
+    {
+        long row = FindRow(n);
+        if (row != -1)
+            this->EnsureVisible(row);
+    }
+
+    wxString GetEntryPath(long n) const
+    {
+        return m_entries->GetPath(n);
+    }
+
+    // Repaints the rows currently on screen after their entries changed
+    void RefreshVisibleItems()
+    {
+        long nCount = this->GetItemCount();
+        if (nCount == 0)
+            return;
+
+        long nTop = this->GetTopItem();
+        this->RefreshItems(nTop,
+                           wxMin(nTop + this->GetCountPerPage(), nCount - 1));
+    }
+
+    // Rows are served straight out of the entry store, and thumbnails
+    // out of the cache
+    virtual wxString OnGetItemText(long item, long column) const;
+    virtual int OnGetItemColumnImage(long item, long column) const;
+    virtual wxListItemAttr* OnGetItemAttr(long item) const;
+
+private:
+    wxMediaPlayerEntryStore* m_entries; // Owned by the notebook page
+    wxMediaPlayerThumbnailCache* m_thumbnails;  // Owned by the frame
+    wxListItemAttr m_attrOdd;           // Zebra background for odd rows
+    wxVector<wxUint32> m_rows;          // Entries shown, when filtered
+                                        // or sorted
+    wxVector<wxUint32> m_rowOf;         // Row+1 of each entry if sorted
+    bool m_bRows;                       // Whether only m_rows are shown
+};
+
+#if wxUSE_DRAG_AND_DROP
+// ----------------------------------------------------------------------------
+// wxPlayListDropTarget
+//
+// Files and directories dropped on a playlist are imported into its page
+// ----------------------------------------------------------------------------
+class wxPlayListDropTarget : public wxFileDropTarget
+{
+public:
+    wxPlayListDropTarget(wxMediaPlayerNotebookPage* page) : m_page(page) {}
+
+    virtual bool OnDropFiles(wxCoord WXUNUSED(x), wxCoord WXUNUSED(y),
+                             const wxArrayString& files)
+    {
+        wxVector<wxString> paths;
+        paths.reserve(files.GetCount());
+        for (size_t n = 0; n < files.GetCount(); ++n)
+            paths.push_back(files[n]);
+
+        m_page->Import(paths);
+        return true;
+    }
+
+private:
+    wxMediaPlayerNotebookPage* m_page;
+};
+#endif // wxUSE_DRAG_AND_DROP
+
+
+// ============================================================================
+//
+// Implementation
+//
+// ============================================================================
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// [Functions]
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// ----------------------------------------------------------------------------
+// wxGetMediaStateText
+//
+// Converts a wxMediaCtrl state into something useful that we can display
+// to the user
+// ----------------------------------------------------------------------------
+const wxChar* wxGetMediaStateText(int nState)
+{
+    switch(nState)
+    {
+        case wxMEDIASTATE_PLAYING:
+            return wxT("Playing");
+        ///case wxMEDIASTATE_PAUSED:
+        default:
+            return wxT("Paused");
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxGetMediaEntryStateText
+//
+// Converts a playlist entry state into the marker shown in the first column
+// ----------------------------------------------------------------------------
+const wxChar* wxGetMediaEntryStateText(int nState)
+{
+    switch(nState)
+    {
+        case wxMEDIAENTRY_OPENED:
+            return wxT("O");
+        case wxMEDIAENTRY_PLAYING:
+            return wxT(">");
+        case wxMEDIAENTRY_PAUSED:
+            return wxT("||");
+        case wxMEDIAENTRY_FINISHED:
+            return wxT("[]");
+        case wxMEDIAENTRY_ERROR:
+            return wxT("E");
+        case wxMEDIAENTRY_QUARANTINED:
+            return wxT("Q");
+        ///case wxMEDIAENTRY_IDLE:
+        default:
+            return wxT("*");
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerHashPath
+//
+// FNV-1a hash of a UTF-8 path.  The media info cache stores these on disk,
+// so this must not change without bumping wxMEDIAINFOCACHE_VERSION.
+// ----------------------------------------------------------------------------
+wxUint32 wxMediaPlayerHashPath(const char* data, size_t len)
+{
+    wxUint32 hash = 2166136261u;
+    for ( size_t i = 0; i < len; ++i )
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    return hash;
+}
+
+// ----------------------------------------------------------------------------
+// wxGetMediaDurationText
+//
+// Formats a length in milliseconds as m:ss, or h:mm:ss for long media
+// ----------------------------------------------------------------------------
+wxString wxGetMediaDurationText(wxUint32 nMilliseconds)
+{
+    unsigned nSeconds = nMilliseconds / 1000;
+    if (nSeconds >= 3600)
+        return wxString::Format(wxT("%u:%02u:%02u"), nSeconds / 3600,
+                                (nSeconds / 60) % 60, nSeconds % 60);
+
+    return wxString::Format(wxT("%u:%02u"), nSeconds / 60, nSeconds % 60);
+}
+
+// ----------------------------------------------------------------------------
+// wxGetMediaInfoText
+//
+// Summarises the stream info of a file, e.g. "1920x1080 avc1/mp4a 8.1 Mb/s"
+// ----------------------------------------------------------------------------
+static wxString wxGetFourCCText(wxUint32 nFourCC)
+{
+    wxString s;
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        char c = (char)((nFourCC >> shift) & 0xff);
+        s += (c > ' ' && c < 0x7f) ? c : '.';
+    }
+    return s;
+}
+
+wxString wxGetMediaInfoText(const wxMediaPlayerMediaInfo& info)
+{
+    wxString s;
+    if (info.m_nWidth && info.m_nHeight)
+        s << info.m_nWidth << wxT("x") << info.m_nHeight << wxT(" ");
+
+    if (info.m_nVideoCodec)
+        s << wxGetFourCCText(info.m_nVideoCodec);
+    if (info.m_nVideoCodec && info.m_nAudioCodec)
+        s << wxT("/");
+    if (info.m_nAudioCodec)
+        s << wxGetFourCCText(info.m_nAudioCodec);
+
+    if (info.m_nBitrate)
+        s << wxString::Format(wxT(" %.1f Mb/s"), info.m_nBitrate / 1e6);
+
+    return s.Trim(false);
+}
+
+// ----------------------------------------------------------------------------
+// wxGetMediaHealthEventText
+// ----------------------------------------------------------------------------
+const wxChar* wxGetMediaHealthEventText(int event)
+{
+    switch(event)
+    {
+        case wxHEALTH_DROPPED:
+            return wxT("dropped");
+        case wxHEALTH_UNDERRUN:
+            return wxT("underrun");
+        case wxHEALTH_STALLED:
+            return wxT("stalled");
+        case wxHEALTH_RECOVERED:
+            return wxT("recovered");
+        case wxHEALTH_FAILED:
+            return wxT("failed");
+        case wxHEALTH_QUARANTINED:
+            return wxT("quarantined");
+        ///case wxHEALTH_OK:
+        default:
+            return wxT("ok");
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxGetMediaHealthText
+//
+// Summarises the playback problems of a file, e.g. "2 stalled, 1 recovered,
+// dropped 0.8s in 3"
+// ----------------------------------------------------------------------------
+wxString wxGetMediaHealthText(const wxMediaPlayerHealth& health)
+{
+    wxString s;
+    if (health.m_nErrors)
+        s << health.m_nErrors << wxT(" failed, ");
+    if (health.m_nStalls)
+        s << health.m_nStalls << wxT(" stalled, ");
+    if (health.m_nUnderruns)
+        s << health.m_nUnderruns << wxT(" underruns, ");
+    if (health.m_nRecoveries)
+        s << health.m_nRecoveries << wxT(" recovered, ");
+    if (health.m_nDrops)
+        s << wxString::Format(wxT("dropped %.1fs in %u, "),
+                              health.m_nDroppedTime / 1000.0,
+                              (unsigned) health.m_nDrops);
+
+    if (!s.empty())
+        s.RemoveLast(2);
+    return s;
+}
+
+// ----------------------------------------------------------------------------
+// wxProbeMediaFile
+//
+// Fills in info from the container headers of an ISO base media file (.mov,
+// .mp4, .m4v, .3gp), which is what our content is.  Only the box headers up
+// to and including the 'moov' box are read - no media data is touched, so
+// this costs a couple of seeks per file.  Returns false for anything else;
+// those files still get their length from wxMediaCtrl once they are loaded.
+//
+// Runs on the prober's worker threads, so it mustn't touch any GUI objects.
+// ----------------------------------------------------------------------------
+#define wxMEDIA_FOURCC(a, b, c, d) \
+    (((wxUint32)(a) << 24) | ((wxUint32)(b) << 16) | \
+     ((wxUint32)(c) << 8) | (wxUint32)(d))
+
+static inline wxUint32 wxMediaReadBE32(const unsigned char* p)
+{
+    return ((wxUint32)p[0] << 24) | ((wxUint32)p[1] << 16) |
+           ((wxUint32)p[2] << 8) | (wxUint32)p[3];
+}
+
+static inline wxUint64 wxMediaReadBE64(const unsigned char* p)
+{
+    return ((wxUint64)wxMediaReadBE32(p) << 32) | wxMediaReadBE32(p + 4);
+}
+
+// Returns the body of the first box of the given type in [p, end) and its
+// end in *bodyEnd, or NULL if there is none
+static const unsigned char* wxMediaFindBox(const unsigned char* p,
+                                           const unsigned char* end,
+                                           wxUint32 type,
+                                           const unsigned char** bodyEnd)
+{
+    while (end - p >= 8)
+    {
+        wxUint64 size = wxMediaReadBE32(p);
+        size_t header = 8;
+        if (size == 1)
+        {
+            if (end - p < 16)
+                return NULL;
+            size = wxMediaReadBE64(p + 8);
+            header = 16;
+        }
+        else if (size == 0)
+        {
+            size = end - p;     // box extends to the end of its parent
+        }
+
+        if (size < header || size > (wxUint64)(end - p))
+            return NULL;
+
+        if (wxMediaReadBE32(p + 4) == type)
+        {
+            *bodyEnd = p + size;
+            return p + header;
+        }
+        p += size;
+    }
+    return NULL;
+}
+
+// Same as wxMediaFindBox() but descends through a path of nested boxes
+static const unsigned char* wxMediaFindBoxPath(const unsigned char* p,
+                                               const unsigned char* end,
+                                               const wxUint32* path,
+                                               size_t depth,
+                                               const unsigned char** bodyEnd)
+{
+    for (size_t n = 0; p && n < depth; ++n)
+    {
+        p = wxMediaFindBox(p, end, path[n], bodyEnd);
+        end = *bodyEnd;
+    }
+    return p;
+}
+
+// Reads the body of the movie box of the file into moov
+static bool wxMediaReadMovieBox(wxFile& file, wxFileOffset length,
+                                wxVector<unsigned char>& moov)
+{
+    //
+    //  Walk the top level boxes until we find the movie box
+    //
+    wxFileOffset pos = 0;
+    while (moov.empty())
+    {
+        unsigned char header[16];
+        if (pos + 8 > length || file.Seek(pos) != pos ||
+            file.Read(header, 8) != 8)
+            return false;
+
+        wxUint64 size = wxMediaReadBE32(header);
+        wxUint32 type = wxMediaReadBE32(header + 4);
+        size_t headerSize = 8;
+        if (size == 1)
+        {
+            if (file.Read(header + 8, 8) != 8)
+                return false;
+            size = wxMediaReadBE64(header + 8);
+            headerSize = 16;
+        }
+        else if (size == 0)
+        {
+            size = length - pos;
+        }
+
+        // Bail out early on files that aren't ISO media at all
+        if (pos == 0 &&
+            type != wxMEDIA_FOURCC('f','t','y','p') &&
+            type != wxMEDIA_FOURCC('m','o','o','v') &&
+            type != wxMEDIA_FOURCC('m','d','a','t') &&
+            type != wxMEDIA_FOURCC('f','r','e','e') &&
+            type != wxMEDIA_FOURCC('s','k','i','p') &&
+            type != wxMEDIA_FOURCC('w','i','d','e') &&
+            type != wxMEDIA_FOURCC('p','n','o','t'))
+            return false;
+
+        if (size < headerSize || size > (wxUint64)(length - pos))
+            return false;
+
+        if (type == wxMEDIA_FOURCC('m','o','o','v'))
+        {
+            // Even hour long movies have a moov box of a few MB
+            if (size > 64 * 1024 * 1024 || size == headerSize)
+                return false;
+
+            moov.resize(size - headerSize);
+            if (file.Read(&moov[0], moov.size()) != (ssize_t)moov.size())
+                return false;
+        }
+
+        pos += size;
+    }
+    return true;
+}
+
+bool wxProbeMediaFile(const wxString& path, wxMediaPlayerMediaInfo& info)
+{
+    memset(&info, 0, sizeof(info));
+    info.m_nFlags = wxMEDIAINFO_PROBED;
+
+    wxLogNull noLog;    // a missing file is reported when it is played
+    wxFile file;
+    if (!file.Open(path))
+        return false;
+
+    const wxFileOffset length = file.Length();
+
+    wxVector<unsigned char> moov;
+    if (!wxMediaReadMovieBox(file, length, moov))
+        return false;
+
+    const unsigned char* body = &moov[0];
+    const unsigned char* end = body + moov.size();
+    const unsigned char* boxEnd;
+
+    //
+    //  Movie header: overall duration
+    //
+    const unsigned char* mvhd =
+        wxMediaFindBox(body, end, wxMEDIA_FOURCC('m','v','h','d'), &boxEnd);
+    if (!mvhd || boxEnd - mvhd < 32)
+        return false;
+
+    wxUint32 timescale;
+    wxUint64 duration;
+    if (mvhd[0] == 1)
+    {
+        timescale = wxMediaReadBE32(mvhd + 20);
+        duration = wxMediaReadBE64(mvhd + 24);
+    }
+    else
+    {
+        timescale = wxMediaReadBE32(mvhd + 12);
+        duration = wxMediaReadBE32(mvhd + 16);
+    }
+    if (timescale == 0)
+        return false;
+
+    duration = duration * 1000 / timescale;
+    info.m_nDuration = (wxUint32)wxMin(duration, (wxUint64)0xffffffff);
+    if (duration)
+        info.m_nBitrate = (wxUint32)wxMin((wxUint64)length * 8000 / duration,
+                                          (wxUint64)0xffffffff);
+
+    //
+    //  Tracks: codec of the first video and audio track, and the video size
+    //
+    static const wxUint32 hdlrPath[] =
+        { wxMEDIA_FOURCC('m','d','i','a'), wxMEDIA_FOURCC('h','d','l','r') };
+    static const wxUint32 stsdPath[] =
+        { wxMEDIA_FOURCC('m','d','i','a'), wxMEDIA_FOURCC('m','i','n','f'),
+          wxMEDIA_FOURCC('s','t','b','l'), wxMEDIA_FOURCC('s','t','s','d') };
+
+    const unsigned char* trakEnd;
+    const unsigned char* trak;
+    while ((trak = wxMediaFindBox(body, end,
+                                  wxMEDIA_FOURCC('t','r','a','k'),
+                                  &trakEnd)) != NULL)
+    {
+        body = trakEnd;
+
+        const unsigned char* hdlr =
+            wxMediaFindBoxPath(trak, trakEnd, hdlrPath, 2, &boxEnd);
+        if (!hdlr || boxEnd - hdlr < 12)
+            continue;
+        wxUint32 handler = wxMediaReadBE32(hdlr + 8);
+
+        // The format of the first sample description is the codec
+        const unsigned char* stsd =
+            wxMediaFindBoxPath(trak, trakEnd, stsdPath, 4, &boxEnd);
+        wxUint32 codec = stsd && boxEnd - stsd >= 16 ?
+                            wxMediaReadBE32(stsd + 12) : 0;
+
+        if (handler == wxMEDIA_FOURCC('v','i','d','e') && !info.m_nVideoCodec)
+        {
+            info.m_nVideoCodec = codec;
+
+            // Width and height are 16.16 fixed point at the end of tkhd
+            const unsigned char* tkhd =
+                wxMediaFindBox(trak, trakEnd,
+                               wxMEDIA_FOURCC('t','k','h','d'), &boxEnd);
+            if (tkhd)
+            {
+                size_t offset = tkhd[0] == 1 ? 88 : 76;
+                if ((size_t)(boxEnd - tkhd) >= offset + 8)
+                {
+                    info.m_nWidth = wxMediaReadBE32(tkhd + offset) >> 16;
+                    info.m_nHeight = wxMediaReadBE32(tkhd + offset + 4) >> 16;
+                }
+            }
+        }
+        else if (handler == wxMEDIA_FOURCC('s','o','u','n') &&
+                 !info.m_nAudioCodec)
+        {
+            info.m_nAudioCodec = codec;
+        }
+    }
+
+    info.m_nFlags |= wxMEDIAINFO_VALID;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxBuildMediaKeyframeIndex
+//
+// Collects when the sync samples of the first video track of an ISO base
+// media file are shown, in milliseconds: their decoding times from 'stts',
+// plus their composition offsets from 'ctts', less where the edit list
+// starts the track.  Those are the points a backend can seek to without
+// decoding any frames it doesn't show.  A track without 'stss' has only
+// sync samples and needs no index, so keyframes stays empty.
+//
+// Like wxProbeMediaFile() this only reads the movie box, and runs on the
+// prober's worker threads.
+// ----------------------------------------------------------------------------
+
+// Cursor over a table of (sample count, value) runs, as in 'stts' and 'ctts'
+class wxMediaSampleRuns
+{
+public:
+    wxMediaSampleRuns(const unsigned char* box, const unsigned char* end)
+        : m_p(NULL), m_nRuns(0), m_nRun(0), m_nUsed(0)
+    {
+        if (box && end - box >= 8)
+        {
+            m_p = box + 8;
+            m_nRuns = wxMin((size_t)wxMediaReadBE32(box + 4),
+                            (size_t)(end - m_p) / 8);
+        }
+    }
+
+    // Moves on by n samples, adding their values to *sum if given.  False
+    // if the table ends first.
+    bool Skip(wxUint32 n, wxUint64* sum)
+    {
+        while (n && m_nRun < m_nRuns)
+        {
+            wxUint32 nCount = wxMediaReadBE32(m_p + m_nRun * 8);
+            wxUint32 nStep = wxMin(n, nCount - m_nUsed);
+            if (sum)
+                *sum += (wxUint64)nStep * GetValue();
+            n -= nStep;
+            m_nUsed += nStep;
+            if (m_nUsed == nCount)
+            {
+                ++m_nRun;
+                m_nUsed = 0;
+            }
+        }
+        return n == 0;
+    }
+
+    // Of the current sample, 0 past the end of the table
+    wxUint32 GetValue() const
+    {
+        return m_nRun < m_nRuns ? wxMediaReadBE32(m_p + m_nRun * 8 + 4) : 0;
+    }
+
+private:
+    const unsigned char* m_p;   // First run
+    size_t   m_nRuns;
+    size_t   m_nRun;            // The current sample's
+    wxUint32 m_nUsed;           // Samples of it before the current one
+};
+
+bool wxBuildMediaKeyframeIndex(const wxString& path,
+                               wxVector<wxUint32>& keyframes)
+{
+    keyframes.clear();
+
+    wxLogNull noLog;
+    wxFile file;
+    if (!file.Open(path))
+        return false;
+
+    wxVector<unsigned char> moov;
+    if (!wxMediaReadMovieBox(file, file.Length(), moov))
+        return false;
+
+    static const wxUint32 hdlrPath[] =
+        { wxMEDIA_FOURCC('m','d','i','a'), wxMEDIA_FOURCC('h','d','l','r') };
+    static const wxUint32 mdhdPath[] =
+        { wxMEDIA_FOURCC('m','d','i','a'), wxMEDIA_FOURCC('m','d','h','d') };
+    static const wxUint32 stblPath[] =
+        { wxMEDIA_FOURCC('m','d','i','a'), wxMEDIA_FOURCC('m','i','n','f'),
+          wxMEDIA_FOURCC('s','t','b','l') };
+    static const wxUint32 elstPath[] =
+        { wxMEDIA_FOURCC('e','d','t','s'), wxMEDIA_FOURCC('e','l','s','t') };
+
+    const unsigned char* body = &moov[0];
+    const unsigned char* end = body + moov.size();
+    const unsigned char* boxEnd;
+    const unsigned char* trakEnd;
+    const unsigned char* trak;
+    while ((trak = wxMediaFindBox(body, end,
+                                  wxMEDIA_FOURCC('t','r','a','k'),
+                                  &trakEnd)) != NULL)
+    {
+        body = trakEnd;
+
+        const unsigned char* hdlr =
+            wxMediaFindBoxPath(trak, trakEnd, hdlrPath, 2, &boxEnd);
+        if (!hdlr || boxEnd - hdlr < 12 ||
+            wxMediaReadBE32(hdlr + 8) != wxMEDIA_FOURCC('v','i','d','e'))
+            continue;
+
+        //  Media time scale, which the sample tables count in
+        const unsigned char* mdhd =
+            wxMediaFindBoxPath(trak, trakEnd, mdhdPath, 2, &boxEnd);
+        if (!mdhd || boxEnd - mdhd < 24)
+            return false;
+        wxUint32 timescale = wxMediaReadBE32(mdhd + (mdhd[0] == 1 ? 20 : 12));
+        if (!timescale)
+            return false;
+
+        //  Where the first edit that shows anything starts in the media
+        wxInt64 nStart = 0;
+        const unsigned char* elst =
+            wxMediaFindBoxPath(trak, trakEnd, elstPath, 2, &boxEnd);
+        size_t nEntrySize = elst && elst[0] == 1 ? 20 : 12;
+        for (size_t n = 0; elst && boxEnd - elst >= 8 &&
+                           n < wxMediaReadBE32(elst + 4) &&
+                           (size_t)(boxEnd - elst) >= 8 + (n + 1) * nEntrySize;
+             ++n)
+        {
+            const unsigned char* entry = elst + 8 + n * nEntrySize;
+            wxInt64 nMediaTime = elst[0] == 1
+                ? (wxInt64)wxMediaReadBE64(entry + 8)
+                : (wxInt64)(wxInt32)wxMediaReadBE32(entry + 4);
+            if (nMediaTime != -1)
+            {
+                nStart = nMediaTime;
+                break;
+            }
+        }
+
+        const unsigned char* stblEnd;
+        const unsigned char* stbl =
+            wxMediaFindBoxPath(trak, trakEnd, stblPath, 3, &stblEnd);
+        if (!stbl)
+            return false;
+
+        const unsigned char* stssEnd;
+        const unsigned char* stss =
+            wxMediaFindBox(stbl, stblEnd, wxMEDIA_FOURCC('s','t','s','s'),
+                           &stssEnd);
+        if (!stss)
+            return true;
+        if (stssEnd - stss < 8)
+            return false;
+
+        const unsigned char* sttsEnd;
+        const unsigned char* stts =
+            wxMediaFindBox(stbl, stblEnd, wxMEDIA_FOURCC('s','t','t','s'),
+                           &sttsEnd);
+        const unsigned char* cttsEnd;
+        const unsigned char* ctts =
+            wxMediaFindBox(stbl, stblEnd, wxMEDIA_FOURCC('c','t','t','s'),
+                           &cttsEnd);
+        if (!stts)
+            return false;
+
+        wxMediaSampleRuns durations(stts, sttsEnd);
+        wxMediaSampleRuns offsets(ctts, cttsEnd);
+
+        //  Sync samples are numbered from 1, in increasing order
+        size_t nSync = wxMin((size_t)wxMediaReadBE32(stss + 4),
+                             (size_t)(stssEnd - stss - 8) / 4);
+        wxUint64 nDecodeTime = 0;
+        wxUint32 nSample = 1;
+        for (size_t n = 0; n < nSync; ++n)
+        {
+            wxUint32 nKey = wxMediaReadBE32(stss + 8 + n * 4);
+            if (nKey < nSample)
+                continue;
+
+            if (!durations.Skip(nKey - nSample, &nDecodeTime))
+                break;
+            offsets.Skip(nKey - nSample, NULL);
+            nSample = nKey;
+
+            //  Version 1 offsets are signed, and version 0 ones in practice
+            wxInt64 nTime = (wxInt64)nDecodeTime - nStart +
+                            (wxInt32)offsets.GetValue();
+            if (nTime < 0)
+                nTime = 0;
+            keyframes.push_back((wxUint32)wxMin((wxUint64)nTime * 1000 /
+                                                    timescale,
+                                                (wxUint64)0xffffffff));
+        }
+
+        //  B-frames can show sync samples out of decoding order
+        wxVectorSort(keyframes);
+        return true;
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// wxFingerprintMediaFile
+//
+// A 64 bit hash of the parts of a media file most likely to differ between
+// two files: the size, the first and last wxMediaFingerprintChunk bytes and
+// as many again at wxMediaFingerprintStrides points in between, or all of
+// it when that's no smaller.  Two copies of a file match, and two encodes
+// of the same thing don't share their header, index and sizes.  It is a
+// handful of reads whatever the size of the file, so on network shares
+// and spinning disks it costs about as much as the seeks.  Returns 0 for a
+// file that can't be read, which never matches anything.
+//
+// Called by the scanner's worker threads.
+// ----------------------------------------------------------------------------
+static const size_t wxMediaFingerprintChunk = 16 * 1024;
+static const size_t wxMediaFingerprintStrides = 4;
+
+static inline wxUint64 wxMediaRotate64(wxUint64 x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+// Mixes bytes into a hash 8 at a time, as xxHash64 does its rounds.  Words
+// are read in native byte order, fingerprints are never stored.
+static wxUint64 wxMediaHashBytes(wxUint64 hash, const unsigned char* p,
+                                 size_t len)
+{
+    const wxUint64 prime1 = wxULL(0x9e3779b185ebca87);
+    const wxUint64 prime2 = wxULL(0xc2b2ae3d27d4eb4f);
+
+    for ( ; len >= 8; p += 8, len -= 8)
+    {
+        wxUint64 word;
+        memcpy(&word, p, 8);
+        hash ^= wxMediaRotate64(word * prime2, 31) * prime1;
+        hash = wxMediaRotate64(hash, 27) * prime1 + wxULL(0x85ebca77c2b2ae63);
+    }
+    for ( ; len > 0; ++p, --len)
+    {
+        hash ^= *p * wxULL(0x27d4eb2f165667c5);
+        hash = wxMediaRotate64(hash, 11) * prime1;
+    }
+    return hash;
+}
+
+wxUint64 wxFingerprintMediaFile(const wxString& path)
+{
+    wxLogNull noLog;
+    wxFile file;
+    if (!file.Open(path))
+        return 0;
+
+    const wxFileOffset length = file.Length();
+    if (length == wxInvalidOffset)
+        return 0;
+
+    const wxUint64 size = (wxUint64) length;
+    const size_t nSamples = wxMediaFingerprintStrides + 2;
+    wxUint64 hash = wxMediaRotate64(size * wxULL(0x9e3779b185ebca87), 31);
+
+    wxVector<unsigned char> buffer;
+    if (size <= nSamples * wxMediaFingerprintChunk)
+    {
+        buffer.resize((size_t) size + 1);
+        if (file.Read(&buffer[0], (size_t) size) != (ssize_t) size)
+            return 0;
+        hash = wxMediaHashBytes(hash, &buffer[0], (size_t) size);
+    }
+    else
+    {
+        //  The head, evenly spaced strides and the tail
+        buffer.resize(wxMediaFingerprintChunk);
+        const wxUint64 last = size - wxMediaFingerprintChunk;
+        for (size_t n = 0; n < nSamples; ++n)
+        {
+            const wxUint64 offset = last * n / (nSamples - 1);
+            if (file.Seek((wxFileOffset) offset) == wxInvalidOffset ||
+                file.Read(&buffer[0], buffer.size()) !=
+                    (ssize_t) buffer.size())
+                return 0;
+            hash = wxMediaHashBytes(hash, &buffer[0], buffer.size());
+        }
+    }
+
+    //  Avalanche, and keep 0 for "unreadable"
+    hash ^= hash >> 33;
+    hash *= wxULL(0xc2b2ae3d27d4eb4f);
+    hash ^= hash >> 29;
+    hash *= wxULL(0x165667b19e3779f9);
+    hash ^= hash >> 32;
+    return hash ? hash : 1;
+}
+
+// ----------------------------------------------------------------------------
+// Pixel kernels
+//
+// Converting decoded frames to the RGB24 layout of wxImage::GetData() and
+// shrinking images are the only per pixel work in the player, and kiosks
+// without a GPU do them on the CPU.  Each kernel has a scalar version, the
+// reference, and SSE2 and AVX2 versions that give exactly the same bytes;
+// --bench-kernels checks that and times them.  The level is picked once
+// from what the CPU supports.
+//
+// YUV is BT.601 limited range in 6 bit fixed point, which keeps every sum
+// within 16 bits: with L = (Y-16)*74 + ((Y-16) >> 1), that is 1.164 * 64,
+// R = (L + (V-128)*102 + 32) >> 6 and so on.  The only sum that can
+// overflow is one that is clamped to 255 anyway.
+//
+// None of these touch any GUI objects, so any thread may use them.
+// ----------------------------------------------------------------------------
+
+enum wxMediaKernelLevel
+{
+    wxKERNELS_SCALAR,
+    wxKERNELS_SSE2,
+    wxKERNELS_AVX2,
+    wxKERNELS_LEVELS
+};
+
+enum wxMediaPixelFormat
+{
+    wxPIXELFORMAT_I420,         // Y plane, then U and V planes
+    wxPIXELFORMAT_NV12          // Y plane, then one plane of U,V pairs
+};
+
+// A decoded frame, chroma being subsampled 2x2
+struct wxMediaYUVFrame
+{
+    int m_nFormat;              // wxMediaPixelFormat
+    int m_nWidth;
+    int m_nHeight;
+    const unsigned char* m_planes[3];   // Y, U, V, or Y, UV for NV12
+    int m_strides[3];                   // Bytes per row of each plane
+};
+
+static const char* const wxMediaKernelLevelNames[wxKERNELS_LEVELS] =
+{
+    "scalar",
+    "sse2",
+    "avx2"
+};
+
+// ----------------------------------------------------------------------------
+// wxGetMediaKernelLevel
+//
+// The best level of this build and CPU
+// ----------------------------------------------------------------------------
+static int wxDetectMediaKernelLevel()
+{
+#ifdef wxMEDIA_USE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return wxKERNELS_AVX2;
+#endif
+#ifdef wxMEDIA_USE_SSE2
+    return wxKERNELS_SSE2;
+#else
+    return wxKERNELS_SCALAR;
+#endif
+}
+
+int wxGetMediaKernelLevel()
+{
+    static const int level = wxDetectMediaKernelLevel();
+    return level;
+}
+
+static inline unsigned char wxMediaClampPixel(int value)
+{
+    return (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+}
+
+// Converts a row of pixels starting at x, the chroma of pixel n being
+// u[n / 2 * step] and v[n / 2 * step]
+static void wxMediaYUVRowScalar(const unsigned char* y,
+                                const unsigned char* u,
+                                const unsigned char* v, int step,
+                                unsigned char* rgb, int x, int width)
+{
+    for ( ; x < width; ++x)
+    {
+        const int luma = (y[x] - 16) * 74 + ((y[x] - 16) >> 1);
+        const int cu = u[x / 2 * step] - 128;
+        const int cv = v[x / 2 * step] - 128;
+
+        rgb[x * 3] = wxMediaClampPixel((luma + 102 * cv + 32) >> 6);
+        rgb[x * 3 + 1] =
+            wxMediaClampPixel((luma - 25 * cu - 52 * cv + 32) >> 6);
+        rgb[x * 3 + 2] = wxMediaClampPixel((luma + 129 * cu + 32) >> 6);
+    }
+}
+
+// Interleaves planar R, G and B into RGB24
+static inline void wxMediaInterleaveRGB(const unsigned char* r,
+                                        const unsigned char* g,
+                                        const unsigned char* b,
+                                        unsigned char* rgb, int count)
+{
+    for (int n = 0; n < count; ++n)
+    {
+        rgb[n * 3] = r[n];
+        rgb[n * 3 + 1] = g[n];
+        rgb[n * 3 + 2] = b[n];
+    }
+}
+
+// Adds a row of bytes to 16 bit sums
+static void wxMediaAddRowScalar(const unsigned char* src, wxUint16* sums,
+                                size_t n, size_t count)
+{
+    for ( ; n < count; ++n)
+        sums[n] += src[n];
+}
+
+#ifdef wxMEDIA_USE_SSE2
+
+// 16 pixels at a time.  Chroma comes in as 8 16 bit values, one per pixel
+// pair.
+static inline void wxMediaYUVPixelsSSE2(__m128i luma, __m128i cu, __m128i cv,
+                                        __m128i& r, __m128i& g, __m128i& b)
+{
+    const __m128i round = _mm_set1_epi16(32);
+
+    luma = _mm_sub_epi16(luma, _mm_set1_epi16(16));
+    luma = _mm_add_epi16(_mm_mullo_epi16(luma, _mm_set1_epi16(74)),
+                         _mm_srai_epi16(luma, 1));
+    cu = _mm_sub_epi16(cu, _mm_set1_epi16(128));
+    cv = _mm_sub_epi16(cv, _mm_set1_epi16(128));
+
+    r = _mm_add_epi16(luma, _mm_mullo_epi16(cv, _mm_set1_epi16(102)));
+    g = _mm_sub_epi16(luma, _mm_add_epi16(
+            _mm_mullo_epi16(cu, _mm_set1_epi16(25)),
+            _mm_mullo_epi16(cv, _mm_set1_epi16(52))));
+    b = _mm_adds_epi16(luma, _mm_mullo_epi16(cu, _mm_set1_epi16(129)));
+
+    r = _mm_srai_epi16(_mm_adds_epi16(r, round), 6);
+    g = _mm_srai_epi16(_mm_adds_epi16(g, round), 6);
+    b = _mm_srai_epi16(_mm_adds_epi16(b, round), 6);
+}
+
+static void wxMediaYUVRowSSE2(const unsigned char* y,
+                              const unsigned char* u,
+                              const unsigned char* v, int step,
+                              unsigned char* rgb, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi16(0xff);
+    unsigned char r[16], g[16], b[16];
+
+    int x = 0;
+    for ( ; x + 16 <= width; x += 16)
+    {
+        __m128i cu, cv;
+        if (step == 1)
+        {
+            cu = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64((const __m128i*)(u + x / 2)), zero);
+            cv = _mm_unpacklo_epi8(
+                    _mm_loadl_epi64((const __m128i*)(v + x / 2)), zero);
+        }
+        else
+        {
+            const __m128i uv = _mm_loadu_si128((const __m128i*)(u + x));
+            cu = _mm_and_si128(uv, low);
+            cv = _mm_srli_epi16(uv, 8);
+        }
+
+        const __m128i luma = _mm_loadu_si128((const __m128i*)(y + x));
+        __m128i r0, g0, b0, r1, g1, b1;
+        wxMediaYUVPixelsSSE2(_mm_unpacklo_epi8(luma, zero),
+                             _mm_unpacklo_epi16(cu, cu),
+                             _mm_unpacklo_epi16(cv, cv), r0, g0, b0);
+        wxMediaYUVPixelsSSE2(_mm_unpackhi_epi8(luma, zero),
+                             _mm_unpackhi_epi16(cu, cu),
+                             _mm_unpackhi_epi16(cv, cv), r1, g1, b1);
+
+        _mm_storeu_si128((__m128i*)r, _mm_packus_epi16(r0, r1));
+        _mm_storeu_si128((__m128i*)g, _mm_packus_epi16(g0, g1));
+        _mm_storeu_si128((__m128i*)b, _mm_packus_epi16(b0, b1));
+        wxMediaInterleaveRGB(r, g, b, rgb + x * 3, 16);
+    }
+
+    wxMediaYUVRowScalar(y, u, v, step, rgb, x, width);
+}
+
+static void wxMediaAddRowSSE2(const unsigned char* src, wxUint16* sums,
+                              size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    size_t n = 0;
+    for ( ; n + 16 <= count; n += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128((const __m128i*)(src + n));
+        __m128i* p = (__m128i*)(sums + n);
+        _mm_storeu_si128(p, _mm_add_epi16(_mm_loadu_si128(p),
+                                          _mm_unpacklo_epi8(bytes, zero)));
+        _mm_storeu_si128(p + 1, _mm_add_epi16(_mm_loadu_si128(p + 1),
+                                              _mm_unpackhi_epi8(bytes, zero)));
+    }
+
+    wxMediaAddRowScalar(src, sums, n, count);
+}
+
+#endif // wxMEDIA_USE_SSE2
+
+#ifdef wxMEDIA_USE_AVX2
+
+// 16 pixels at a time, like wxMediaYUVPixelsSSE2()
+__attribute__((target("avx2")))
+static inline void wxMediaYUVPixelsAVX2(__m256i luma, __m256i cu, __m256i cv,
+                                        __m256i& r, __m256i& g, __m256i& b)
+{
+    const __m256i round = _mm256_set1_epi16(32);
+
+    luma = _mm256_sub_epi16(luma, _mm256_set1_epi16(16));
+    luma = _mm256_add_epi16(_mm256_mullo_epi16(luma, _mm256_set1_epi16(74)),
+                            _mm256_srai_epi16(luma, 1));
+    cu = _mm256_sub_epi16(cu, _mm256_set1_epi16(128));
+    cv = _mm256_sub_epi16(cv, _mm256_set1_epi16(128));
+
+    r = _mm256_add_epi16(luma, _mm256_mullo_epi16(cv, _mm256_set1_epi16(102)));
+    g = _mm256_sub_epi16(luma, _mm256_add_epi16(
+            _mm256_mullo_epi16(cu, _mm256_set1_epi16(25)),
+            _mm256_mullo_epi16(cv, _mm256_set1_epi16(52))));
+    b = _mm256_adds_epi16(luma,
+                          _mm256_mullo_epi16(cu, _mm256_set1_epi16(129)));
+
+    r = _mm256_srai_epi16(_mm256_adds_epi16(r, round), 6);
+    g = _mm256_srai_epi16(_mm256_adds_epi16(g, round), 6);
+    b = _mm256_srai_epi16(_mm256_adds_epi16(b, round), 6);
+}
+
+// The chroma of 16 pixels, each of 8 values twice, in order
+__attribute__((target("avx2")))
+static inline __m256i wxMediaChromaAVX2(__m128i chroma)
+{
+    return _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_unpacklo_epi16(chroma, chroma)),
+                _mm_unpackhi_epi16(chroma, chroma), 1);
+}
+
+__attribute__((target("avx2")))
+static void wxMediaYUVRowAVX2(const unsigned char* y,
+                              const unsigned char* u,
+                              const unsigned char* v, int step,
+                              unsigned char* rgb, int width)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi16(0xff);
+    unsigned char r[32], g[32], b[32];
+
+    int x = 0;
+    for ( ; x + 32 <= width; x += 32)
+    {
+        __m256i cu[2], cv[2], luma[2], rs[2], gs[2], bs[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            const int xh = x + half * 16;
+            __m128i hu, hv;
+            if (step == 1)
+            {
+                hu = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64((const __m128i*)(u + xh / 2)), zero);
+                hv = _mm_unpacklo_epi8(
+                        _mm_loadl_epi64((const __m128i*)(v + xh / 2)), zero);
+            }
+            else
+            {
+                const __m128i uv = _mm_loadu_si128((const __m128i*)(u + xh));
+                hu = _mm_and_si128(uv, low);
+                hv = _mm_srli_epi16(uv, 8);
+            }
+            cu[half] = wxMediaChromaAVX2(hu);
+            cv[half] = wxMediaChromaAVX2(hv);
+            luma[half] = _mm256_cvtepu8_epi16(
+                            _mm_loadu_si128((const __m128i*)(y + xh)));
+
+            wxMediaYUVPixelsAVX2(luma[half], cu[half], cv[half],
+                                 rs[half], gs[half], bs[half]);
+        }
+
+        //  Packing works within 128 bit lanes, so put them back in order
+        _mm256_storeu_si256((__m256i*)r, _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(rs[0], rs[1]), 0xd8));
+        _mm256_storeu_si256((__m256i*)g, _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(gs[0], gs[1]), 0xd8));
+        _mm256_storeu_si256((__m256i*)b, _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(bs[0], bs[1]), 0xd8));
+        wxMediaInterleaveRGB(r, g, b, rgb + x * 3, 32);
+    }
+
+    wxMediaYUVRowScalar(y, u, v, step, rgb, x, width);
+}
+
+__attribute__((target("avx2")))
+static void wxMediaAddRowAVX2(const unsigned char* src, wxUint16* sums,
+                              size_t count)
+{
+    size_t n = 0;
+    for ( ; n + 16 <= count; n += 16)
+    {
+        __m256i* p = (__m256i*)(sums + n);
+        _mm256_storeu_si256(p, _mm256_add_epi16(_mm256_loadu_si256(p),
+            _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + n)))));
+    }
+
+    wxMediaAddRowScalar(src, sums, n, count);
+}
+
+#endif // wxMEDIA_USE_AVX2
+
+// ----------------------------------------------------------------------------
+// wxConvertMediaFrame
+//
+// Converts a frame to RGB24 rows of m_nWidth * 3 bytes, as in a wxImage of
+// the same size.  level is a wxMediaKernelLevel the CPU supports, or -1 for
+// the best one.
+// ----------------------------------------------------------------------------
+void wxConvertMediaFrame(const wxMediaYUVFrame& frame, unsigned char* rgb,
+                         int level = -1)
+{
+    if (level < 0)
+        level = wxGetMediaKernelLevel();
+
+    const bool bNV12 = frame.m_nFormat == wxPIXELFORMAT_NV12;
+    const int step = bNV12 ? 2 : 1;
+
+    for (int row = 0; row < frame.m_nHeight; ++row)
+    {
+        const unsigned char* y = frame.m_planes[0] +
+                                 row * frame.m_strides[0];
+        const unsigned char* u = frame.m_planes[1] +
+                                 row / 2 * frame.m_strides[1];
+        const unsigned char* v = bNV12 ? u + 1 :
+                                 frame.m_planes[2] +
+                                 row / 2 * frame.m_strides[2];
+        unsigned char* out = rgb + (size_t)row * frame.m_nWidth * 3;
+
+        switch (level)
+        {
+#ifdef wxMEDIA_USE_AVX2
+            case wxKERNELS_AVX2:
+                wxMediaYUVRowAVX2(y, u, v, step, out, frame.m_nWidth);
+                break;
+#endif
+#ifdef wxMEDIA_USE_SSE2
+            case wxKERNELS_SSE2:
+                wxMediaYUVRowSSE2(y, u, v, step, out, frame.m_nWidth);
+                break;
+#endif
+            default:
+                wxMediaYUVRowScalar(y, u, v, step, out, 0, frame.m_nWidth);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxShrinkMediaImage
+//
+// Averages each block of factor x factor pixels of an RGB24 image into one
+// pixel of dst, which is width / factor by height / factor.  Partial blocks
+// at the right and bottom edges are dropped.  Rows of blocks are summed
+// with the SIMD kernels, which is all but 1 / factor of the work.  factor
+// is at most wxMediaMaxShrink, so the 16 bit sums can't overflow.
+// ----------------------------------------------------------------------------
+static const int wxMediaMaxShrink = 256;
+
+void wxShrinkMediaImage(const unsigned char* src, int width, int height,
+                        int factor, unsigned char* dst, int level = -1)
+{
+    if (level < 0)
+        level = wxGetMediaKernelLevel();
+
+    factor = wxMax(1, wxMin(factor, wxMediaMaxShrink));
+    const int nWidth = width / factor;
+    const int nHeight = height / factor;
+    const size_t nBytes = (size_t)nWidth * factor * 3;
+    const wxUint32 nArea = factor * factor;
+
+    wxVector<wxUint16> sums(nBytes + 1);
+    for (int row = 0; row < nHeight; ++row)
+    {
+        memset(&sums[0], 0, nBytes * sizeof(wxUint16));
+        for (int n = 0; n < factor; ++n)
+        {
+            const unsigned char* line =
+                src + ((size_t)row * factor + n) * width * 3;
+            switch (level)
+            {
+#ifdef wxMEDIA_USE_AVX2
+                case wxKERNELS_AVX2:
+                    wxMediaAddRowAVX2(line, &sums[0], nBytes);
+                    break;
+#endif
+#ifdef wxMEDIA_USE_SSE2
+                case wxKERNELS_SSE2:
+                    wxMediaAddRowSSE2(line, &sums[0], nBytes);
+                    break;
+#endif
+                default:
+                    wxMediaAddRowScalar(line, &sums[0], 0, nBytes);
+            }
+        }
+
+        unsigned char* out = dst + (size_t)row * nWidth * 3;
+        for (int x = 0; x < nWidth; ++x)
+        {
+            const wxUint16* block = &sums[(size_t)x * factor * 3];
+            for (int c = 0; c < 3; ++c)
+            {
+                wxUint32 nSum = 0;
+                for (int n = 0; n < factor; ++n)
+                    nSum += block[n * 3 + c];
+                out[x * 3 + c] = (unsigned char)((nSum + nArea / 2) / nArea);
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxExtractMediaPoster
+//
+// Makes the playlist thumbnail of a file.  We don't decode video ourselves,
+// and wxMediaCtrl can't render off screen, so a poster is whichever of
+// these turns up first: the file itself if it is an image, the cover art
+// in the 'covr' item of an ISO media file's metadata, an image named like
+// the file next to it, or one for the whole directory.  It is scaled down
+// keeping its aspect ratio and centred on black.
+//
+// Runs on the thumbnailer's worker threads, so it mustn't touch any GUI
+// objects.
+// ----------------------------------------------------------------------------
+
+// Images named after the directory rather than a file in it
+static const wxChar* const wxMediaPosterFiles[] =
+    { wxT("folder.jpg"), wxT("poster.jpg"), wxT("cover.jpg") };
+static const wxChar* const wxMediaPosterExtensions[] =
+    { wxT("jpg"), wxT("jpeg"), wxT("png") };
+
+static bool wxLoadMediaCoverArt(const wxString& path, wxImage& image)
+{
+    wxFile file;
+    if (!file.Open(path))
+        return false;
+
+    wxVector<unsigned char> moov;
+    if (!wxMediaReadMovieBox(file, file.Length(), moov))
+        return false;
+
+    static const wxUint32 metaPath[] =
+        { wxMEDIA_FOURCC('u','d','t','a'), wxMEDIA_FOURCC('m','e','t','a') };
+    static const wxUint32 dataPath[] =
+        { wxMEDIA_FOURCC('i','l','s','t'), wxMEDIA_FOURCC('c','o','v','r'),
+          wxMEDIA_FOURCC('d','a','t','a') };
+
+    const unsigned char* metaEnd;
+    const unsigned char* meta =
+        wxMediaFindBoxPath(&moov[0], &moov[0] + moov.size(), metaPath, 2,
+                           &metaEnd);
+    if (!meta)
+        return false;
+
+    //  'meta' is a full box in MP4 files but not in QuickTime ones
+    if (metaEnd - meta >= 8 &&
+        wxMediaReadBE32(meta + 4) != wxMEDIA_FOURCC('h','d','l','r'))
+        meta += 4;
+
+    //  The image follows a type and a locale
+    const unsigned char* dataEnd;
+    const unsigned char* data =
+        wxMediaFindBoxPath(meta, metaEnd, dataPath, 3, &dataEnd);
+    if (!data || dataEnd - data <= 8)
+        return false;
+
+    wxMemoryInputStream stream(data + 8, dataEnd - data - 8);
+    return image.LoadFile(stream, wxBITMAP_TYPE_ANY);
+}
+
+bool wxExtractMediaPoster(const wxString& path, wxImage& poster)
+{
+    wxLogNull noLog;    // a broken image is just a missing thumbnail
+
+    wxFileName name(path);
+    const wxString ext = name.GetExt().Lower();
+
+    wxImage image;
+    for (size_t n = 0; n < WXSIZEOF(wxMediaPosterExtensions); ++n)
+    {
+        if (ext == wxMediaPosterExtensions[n])
+        {
+            image.LoadFile(path, wxBITMAP_TYPE_ANY);
+            break;
+        }
+    }
+
+    if (!image.IsOk())
+        wxLoadMediaCoverArt(path, image);
+
+    for (size_t n = 0;
+         !image.IsOk() && n < WXSIZEOF(wxMediaPosterExtensions); ++n)
+    {
+        wxFileName sidecar(name);
+        sidecar.SetExt(wxMediaPosterExtensions[n]);
+        if (ext != wxMediaPosterExtensions[n] && sidecar.FileExists())
+            image.LoadFile(sidecar.GetFullPath(), wxBITMAP_TYPE_ANY);
+    }
+
+    for (size_t n = 0; !image.IsOk() && n < WXSIZEOF(wxMediaPosterFiles); ++n)
+    {
+        wxFileName folder(name.GetPath(), wxMediaPosterFiles[n]);
+        if (folder.FileExists())
+            image.LoadFile(folder.GetFullPath(), wxBITMAP_TYPE_ANY);
+    }
+
+    if (!image.IsOk() || image.GetWidth() <= 0 || image.GetHeight() <= 0)
+        return false;
+
+    //  Big images are first shrunk by whole blocks to no less than twice
+    //  the size, which costs a fraction of wxImage's box average over them
+    int factor = wxMin(image.GetWidth() / (2 * wxMediaThumbnailWidth),
+                       image.GetHeight() / (2 * wxMediaThumbnailHeight));
+    factor = wxMin(factor, wxMediaMaxShrink);
+    if (factor >= 2)
+    {
+        wxImage shrunk(image.GetWidth() / factor, image.GetHeight() / factor,
+                       false);
+        wxShrinkMediaImage(image.GetData(), image.GetWidth(),
+                           image.GetHeight(), factor, shrunk.GetData());
+        image = shrunk;
+    }
+
+    //  Fit it in, then pad the other way
+    int nWidth = wxMediaThumbnailWidth;
+    int nHeight = wxMediaThumbnailHeight;
+    if ((wxInt64)image.GetWidth() * wxMediaThumbnailHeight >
+        (wxInt64)image.GetHeight() * wxMediaThumbnailWidth)
+        nHeight = wxMax(1, (int)((wxInt64)image.GetHeight() * nWidth /
+                                 image.GetWidth()));
+    else
+        nWidth = wxMax(1, (int)((wxInt64)image.GetWidth() * nHeight /
+                                image.GetHeight()));
+
+    image.Rescale(nWidth, nHeight, wxIMAGE_QUALITY_BOX_AVERAGE);
+    poster = image.Size(wxSize(wxMediaThumbnailWidth, wxMediaThumbnailHeight),
+                        wxPoint((wxMediaThumbnailWidth - nWidth) / 2,
+                                (wxMediaThumbnailHeight - nHeight) / 2),
+                        0, 0, 0);
+    return poster.IsOk();
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerApp
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// ----------------------------------------------------------------------------
+// This sets up this wxApp as the global wxApp that gui calls in wxWidgets
+// use.  For example, if you were to be in windows and use a file dialog,
+// wxWidgets would use wxTheApp->GetHInstance() which would get the instance
+// handle of the application.  These routines in wx _DO NOT_ check to see if
+// the wxApp exists, and thus will crash the application if you try it.
+//
+// IMPLEMENT_APP does this, and also implements the platform-specific entry
+// routine, such as main or WinMain().  Use IMPLEMENT_APP_NO_MAIN if you do
+// not desire this behaviour.
+// ----------------------------------------------------------------------------
+IMPLEMENT_APP(wxMediaPlayerApp)
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerApp command line parsing
+// ----------------------------------------------------------------------------
+
+#if wxUSE_CMDLINE_PARSER
+
+void wxMediaPlayerApp::OnInitCmdLine(wxCmdLineParser& parser)
+{
+    wxApp::OnInitCmdLine(parser);
+
+    parser.AddParam("input files",
+                    wxCMD_LINE_VAL_STRING,
+                    wxCMD_LINE_PARAM_OPTIONAL | wxCMD_LINE_PARAM_MULTIPLE);
+    parser.AddSwitch("", "shuffle", "play the entries in random order");
+    parser.AddSwitch("", "no-repeat", "stop after the last entry");
+    parser.AddOption("", "ext",
+                     "comma separated extensions of the files to import "
+                     "from directories");
+    parser.AddSwitch("", "watch",
+                     "follow changes to imported directories while running "
+                     "(Linux only)");
+    parser.AddOption("", "duplicates",
+                     "what to do with imported files whose contents are "
+                     "already in the playlist: skip (default) or keep");
+    parser.AddOption("", "bench",
+                     "time opening, loading and switching between the files "
+                     "(or generated clips), write a JSON report here and exit",
+                     wxCMD_LINE_VAL_STRING);
+    parser.AddOption("", "bench-switches",
+                     "how many switches --bench times (default 30)",
+                     wxCMD_LINE_VAL_NUMBER);
+    parser.AddOption("", "bench-pages",
+                     "how many pages --bench then opens and plays at once "
+                     "(default 4)",
+                     wxCMD_LINE_VAL_NUMBER);
+    parser.AddOption("", "bench-kernels",
+                     "check the SIMD pixel kernels against the scalar ones, "
+                     "time them, write a JSON report here and exit",
+                     wxCMD_LINE_VAL_STRING);
+    parser.AddOption("", "stats",
+                     "time the event handlers and export the histograms "
+                     "to this file in the Prometheus text format",
+                     wxCMD_LINE_VAL_STRING);
+    parser.AddOption("", "stats-interval",
+                     "seconds between --stats exports (default 10)",
+                     wxCMD_LINE_VAL_NUMBER);
+    parser.AddOption("", "health-interval",
+                     "milliseconds between checks that playing media moves "
+                     "(default 500, 0 to never check)",
+                     wxCMD_LINE_VAL_NUMBER);
+    parser.AddOption("", "stall-timeout",
+                     "milliseconds media may stand still before it counts "
+                     "as stalled (default 3000)",
+                     wxCMD_LINE_VAL_NUMBER);
+    parser.AddOption("", "on-stall",
+                     "what to do about stalled media: reload (default), "
+                     "skip or none");
+    parser.AddOption("", "page-budget",
+                     "how many pages keep their media loaded, hidden ones "
+                     "unload it past that (default 4, 0 for no limit)",
+                     wxCMD_LINE_VAL_NUMBER);
+#ifdef wxMEDIA_USE_REMOTE
+    parser.AddSwitch("", "single-instance",
+                     "hand the files to the instance already running, if "
+                     "any, instead of starting another one");
+    parser.AddOption("", "open-mode",
+                     "what the running instance does with them: append "
+                     "(default), replace or play");
+    parser.AddOption("", "control",
+                     "take line-delimited JSON commands on a Unix domain "
+                     "socket at this path",
+                     wxCMD_LINE_VAL_STRING);
+#endif // wxMEDIA_USE_REMOTE
+    parser.AddOption("", "startup-trace",
+                     "write how long startup took up to the first paint and "
+                     "the first media playing to this file as JSON",
+                     wxCMD_LINE_VAL_STRING);
+}
+
+bool wxMediaPlayerApp::OnCmdLineParsed(wxCmdLineParser& parser)
+{
+    if ( !wxApp::OnCmdLineParsed(parser) )
+        return false;
+
+    for (size_t paramNr=0; paramNr < parser.GetParamCount(); ++paramNr)
+        m_params.push_back(parser.GetParam(paramNr));
+
+    m_bShuffle = parser.Found("shuffle");
+    m_bRepeat = !parser.Found("no-repeat");
+    parser.Found("ext", &m_szExtensions);
+
+    wxString duplicates = wxT("skip");
+    parser.Found("duplicates", &duplicates);
+    if ( duplicates != wxT("skip") && duplicates != wxT("keep") )
+    {
+        wxLogError(wxT("--duplicates must be skip or keep"));
+        return false;
+    }
+    m_bKeepDuplicates = duplicates == wxT("keep");
+    m_bWatch = parser.Found("watch");
+
+    parser.Found("bench", &m_szBenchReport);
+    if ( !parser.Found("bench-switches", &m_nBenchSwitches) )
+        m_nBenchSwitches = 30;
+    if ( !parser.Found("bench-pages", &m_nBenchPages) )
+        m_nBenchPages = 4;
+    parser.Found("bench-kernels", &m_szKernelReport);
+
+    parser.Found("stats", &m_szStatsFile);
+    if ( !parser.Found("stats-interval", &m_nStatsInterval) )
+        m_nStatsInterval = 10;
+
+    if ( !parser.Found("health-interval", &m_nHealthInterval) )
+        m_nHealthInterval = 500;
+    if ( !parser.Found("stall-timeout", &m_nStallTimeout) )
+        m_nStallTimeout = 3000;
+    if ( !parser.Found("page-budget", &m_nPageBudget) )
+        m_nPageBudget = 4;
+    if ( parser.Found("startup-trace", &m_szStartupTrace) )
+        gs_startupTrace.SetReport(m_szStartupTrace);
+
+#ifdef wxMEDIA_USE_REMOTE
+    m_bSingleInstance = parser.Found("single-instance");
+    wxString mode = wxT("append");
+    parser.Found("open-mode", &mode);
+    parser.Found("control", &m_szControl);
+    m_nOpenMode = wxMediaPlayerRemote::GetOpenMode(mode);
+    if ( m_nOpenMode == -1 )
+    {
+        wxLogError(wxT("--open-mode must be append, replace or play"));
+        return false;
+    }
+#endif // wxMEDIA_USE_REMOTE
+
+    wxString action = wxT("reload");
+    parser.Found("on-stall", &action);
+    if ( action == wxT("reload") )
+        m_nStallAction = wxSTALL_RELOAD;
+    else if ( action == wxT("skip") )
+        m_nStallAction = wxSTALL_SKIP;
+    else if ( action == wxT("none") )
+        m_nStallAction = wxSTALL_NONE;
+    else
+    {
+        wxLogError(wxT("--on-stall must be reload, skip or none"));
+        return false;
+    }
+
+    return true;
+}
+
+#endif // wxUSE_CMDLINE_PARSER
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerApp::OnInit
+//
+// Where execution starts - akin to a main or WinMain.
+// 1) Create the frame and show it to the user
+// 2) Process filenames from the commandline, maybe to benchmark with them
+// 3) return true specifying that we want execution to continue past OnInit
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerApp::OnInit()
+{
+    gs_startupTrace.Mark(wxSTARTUP_INIT);
+
+    if ( !wxApp::OnInit() )
+        return false;
+
+    // SetAppName() lets wxStandardPaths and others know where to write
+    SetAppName(wxT("wxMediaPlayer"));
+
+#if wxUSE_CMDLINE_PARSER
+    // Needs no window, nor anything else that is set up below
+    if ( !m_szKernelReport.empty() )
+    {
+        m_nExitCode = wxMediaPlayerBench::BenchKernels(m_szKernelReport);
+        if ( m_nExitCode == 2 )
+            wxLogError(wxT("Couldn't write the kernel report to %s"),
+                       m_szKernelReport.c_str());
+        m_bExit = true;
+        return true;
+    }
+
+#ifdef wxMEDIA_USE_REMOTE
+    // Before anything gets initialized that the running instance has
+    // already, the media backend in particular
+    if ( m_bSingleInstance && m_szBenchReport.empty() &&
+         wxMediaPlayerRemote::Forward(m_params, m_nOpenMode) )
+    {
+        m_bExit = true;
+        return true;
+    }
+#endif // wxMEDIA_USE_REMOTE
+
+    // Created before the frame, as its prober threads take shards of them
+    if ( !m_szStatsFile.empty() )
+        m_stats = new wxMediaPlayerStats(m_szStatsFile, m_nStatsInterval);
+
+    // Started before the frame, as startup is one of the things it times
+    wxMediaPlayerBench* bench = NULL;
+    if ( !m_szBenchReport.empty() )
+        bench = new wxMediaPlayerBench(m_szBenchReport, m_nBenchSwitches,
+                                       m_nBenchPages);
+#endif // wxUSE_CMDLINE_PARSER
+
+    wxMediaPlayerFrame *frame =
+        new wxMediaPlayerFrame(wxT("media"), m_stats);
+    gs_startupTrace.Mark(wxSTARTUP_FRAME);
+    frame->Show(true);
+    gs_startupTrace.Mark(wxSTARTUP_SHOWN);
+
+#if wxUSE_CMDLINE_PARSER
+    if ( bench )
+    {
+        // Go through the files in order, round and round
+        m_bShuffle = false;
+        m_bRepeat = true;
+
+        if ( m_params.empty() && !bench->GenerateClips(m_params) )
+            wxLogError(wxT("Couldn't write the benchmark clips"));
+
+        frame->m_bench = bench;
+        bench->Start(frame);
+    }
+
+    frame->SetPlayOrder(m_bShuffle, m_bRepeat);
+    frame->SetHealthPolicy(m_nHealthInterval, m_nStallTimeout, m_nStallAction);
+    frame->SetPageBudget(m_nPageBudget);
+
+#ifdef wxMEDIA_USE_REMOTE
+    // The benchmark times handing files over to itself
+    if ( m_bSingleInstance || bench )
+    {
+        wxMediaPlayerRemote* remote = new wxMediaPlayerRemote();
+        if ( remote->Listen(frame, wxMediaPlayerRemote::GetInstancePath()) )
+            frame->m_remote = remote;
+        else
+            delete remote;
+    }
+
+    if ( !m_szControl.empty() )
+    {
+        wxMediaPlayerRemote* control = new wxMediaPlayerRemote();
+        if ( control->Listen(frame, m_szControl) )
+            frame->m_control = control;
+        else
+        {
+            wxLogError(wxT("Couldn't listen for commands on %s"),
+                       m_szControl.c_str());
+            delete control;
+        }
+    }
+#endif // wxMEDIA_USE_REMOTE
+
+    if ( !m_szExtensions.empty() )
+        frame->m_scanner->SetExtensions(m_szExtensions);
+    frame->m_scanner->SetFingerprinting(!m_bKeepDuplicates);
+    frame->SetWatchFolders(m_bWatch);
+
+    if ( !m_params.empty() )
+        frame->ImportPaths(m_params, true);
+#endif // wxUSE_CMDLINE_PARSER
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerApp::OnRun
+//
+// Without a window the main loop would never end
+// ----------------------------------------------------------------------------
+int wxMediaPlayerApp::OnRun()
+{
+    if ( m_bExit )
+        return m_nExitCode;
+
+    return wxApp::OnRun();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerApp::OnExit
+//
+// The frame and its threads are gone by now, so the stats can write their
+// last export and go
+// ----------------------------------------------------------------------------
+int wxMediaPlayerApp::OnExit()
+{
+    //  Again, for runs in which nothing ever played
+    if ( !gs_startupTrace.WriteReport() )
+        wxLogError(wxT("Couldn't write the startup trace"));
+
+    if ( m_stats )
+    {
+        m_stats->Export();
+        delete m_stats;
+        m_stats = NULL;
+    }
+
+    return wxApp::OnExit();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerApp::ProcessIdle
+//
+// Called when the event loop has run out of events; with FilterEvent, which
+// sees the next one, this gives the time the loop spent waiting
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerApp::ProcessIdle()
+{
+    bool bMore = wxApp::ProcessIdle();
+    if ( m_stats )
+        m_stats->OnIdle();
+    return bMore;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerApp::FilterEvent
+// ----------------------------------------------------------------------------
+int wxMediaPlayerApp::FilterEvent(wxEvent& event)
+{
+    if ( m_stats && event.GetEventType() != wxEVT_IDLE )
+        m_stats->OnEvent();
+    return wxApp::FilterEvent(event);
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerFrame
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame Constructor
+//
+// 1) Create our menus
+// 2) Create our notebook control and add it to the frame
+// 3) Create our status bar
+// 4) Connect our events
 // 5) Start our timer
 // ----------------------------------------------------------------------------
 
-wxMediaPlayerFrame::wxMediaPlayerFrame(const wxString& title)
-       : wxFrame(NULL, wxID_ANY, title, wxDefaultPosition, wxSize(600,600))
+wxMediaPlayerFrame::wxMediaPlayerFrame(const wxString& title,
+                                       wxMediaPlayerStats* stats)
+       : wxFrame(NULL, wxID_ANY, title, wxDefaultPosition, wxSize(600,600)),
+         m_stats(stats)
+{
+    SetIcon(wxICON(sample));
+
+    //
+    // Create our notebook - using wxNotebook is luckily pretty
+    // simple and self-explanatory in most cases
+    //
+    m_notebook = new wxNotebook(this, wxID_NOTEBOOK);
+
+    m_bShuffle = false;
+    m_bRepeat = true;
+    m_nHealthInterval = 500;
+    m_nStallTimeout = 3000;
+    m_nStallAction = wxSTALL_RELOAD;
+    m_nPageBudget = 4;
+    m_bWatchFolders = false;
+    m_nShownPage = -1;
+    m_nPageClock = 0;
+    m_bench = NULL;
+#ifdef wxMEDIA_USE_REMOTE
+    m_remote = NULL;
+    m_control = NULL;
+#endif // wxMEDIA_USE_REMOTE
+
+    //
+    //  Start the background prober before there are any pages
+    //  that could queue files for it
+    //
+    m_infoCache = new wxMediaPlayerInfoCache();
+    m_infoCache->Open(wxStandardPaths::Get().GetUserLocalDataDir());
+
+    m_prober = new wxMediaPlayerProber();
+    m_prober->Start(this, m_infoCache, m_stats);
+
+    m_scanner = new wxMediaPlayerScanner();
+    m_scanner->Start(this);
+    m_watcher = new wxMediaPlayerWatcher();
+    m_watcher->Start(this, m_scanner);
+
+    //  Only the formats posters come in, instead of wxInitAllImageHandlers()
+#if wxUSE_LIBJPEG
+    wxImage::AddHandler(new wxJPEGHandler);
+#endif
+#if wxUSE_LIBPNG
+    wxImage::AddHandler(new wxPNGHandler);
+#endif
+    m_thumbnails = new wxMediaPlayerThumbnailCache();
+    m_thumbnailer = new wxMediaPlayerThumbnailer();
+    m_thumbnailer->Start(this, wxStandardPaths::Get().GetUserLocalDataDir());
+
+    this->Connect(wxID_PLAY, wxEVT_MENU,
+                  wxCommandEventHandler(wxMediaPlayerFrame::OnPlay));
+    this->Connect(wxID_PAUSE, wxEVT_MENU,
+                  wxCommandEventHandler(wxMediaPlayerFrame::OnPause));
+    this->Connect(wxID_NEXT, wxEVT_MENU,
+                  wxCommandEventHandler(wxMediaPlayerFrame::OnNext));
+    this->Connect(wxID_PREV, wxEVT_MENU,
+                  wxCommandEventHandler(wxMediaPlayerFrame::OnPrev));
+    this->Connect(wxID_CLOSECURRENTPAGE, wxEVT_MENU,
+                  wxCommandEventHandler(wxMediaPlayerFrame::OnCloseCurrentPage));
+    this->Connect(wxID_EXPORTPLAYLIST, wxEVT_MENU,
+                  wxCommandEventHandler(wxMediaPlayerFrame::OnExportPlaylist));
+
+    this->Connect(wxID_PROBER, wxEVT_THREAD,
+                  wxThreadEventHandler(wxMediaPlayerFrame::OnProbeResults));
+    this->Connect(wxID_SCANNER, wxEVT_THREAD,
+                  wxThreadEventHandler(wxMediaPlayerFrame::OnScanResults));
+    this->Connect(wxID_THUMBNAILER, wxEVT_THREAD,
+                  wxThreadEventHandler(wxMediaPlayerFrame::OnThumbnails));
+    this->Connect(wxID_WATCHER, wxEVT_THREAD,
+                  wxThreadEventHandler(wxMediaPlayerFrame::OnWatchChanges));
+    this->Connect(wxID_ERRORS, wxEVT_THREAD,
+                  wxThreadEventHandler(wxMediaPlayerFrame::OnErrors));
+
+    this->Connect(wxID_NOTEBOOK, wxEVT_NOTEBOOK_PAGE_CHANGED,
+                  wxBookCtrlEventHandler(wxMediaPlayerFrame::OnPageChanged));
+    m_notebook->Connect(wxEVT_PAINT,
+                        wxPaintEventHandler(wxMediaPlayerFrame::OnNotebookPaint),
+                        NULL, this);
+
+    //
+    // Close events
+    //
+    this->Connect(wxID_ANY, wxEVT_CLOSE_WINDOW,
+                wxCloseEventHandler(wxMediaPlayerFrame::OnClose));
+
+    //
+    // End of Events
+    //
+
+    //
+    //  Bring back the pages of last time, in one read of the
+    //  playlist store
+    //
+    m_playlists = new wxMediaPlayerPlaylistStore();
+
+    wxVector<wxMediaPlayerPlaylistStore::Playlist> playlists;
+    m_playlists->Open(wxStandardPaths::Get().GetUserLocalDataDir(),
+                      playlists);
+
+    for (size_t n = 0; n < playlists.size(); ++n)
+    {
+        const wxMediaPlayerPlaylistStore::Playlist& playlist = playlists[n];
+
+        wxMediaPlayerNotebookPage* page =
+            new wxMediaPlayerNotebookPage(this, m_notebook);
+        page->m_nPlaylistId = playlist.m_nId;
+
+        page->m_entries.Reserve(playlist.GetCount());
+        for (size_t i = 0; i < playlist.GetCount(); ++i)
+        {
+            const wxUint32 start = playlist.m_offsets[i];
+            page->m_entries.AddUTF8(&playlist.m_pool[0] + start,
+                                    playlist.m_offsets[i + 1] - start);
+        }
+        page->m_nSavedEntries = page->m_entries.GetCount();
+        page->SyncNewEntries();
+
+        m_notebook->AddPage(page, wxT(""), n == 0);
+    }
+
+    //
+    //  Create an initial notebook page so the user has something
+    //  to work with without having to go file->open every time :).
+    //
+    if (playlists.empty())
+    {
+        wxMediaPlayerNotebookPage* page =
+            new wxMediaPlayerNotebookPage(this, m_notebook);
+        page->m_nPlaylistId = m_playlists->CreatePlaylist();
+        m_notebook->AddPage(page,
+                            wxT(""),
+                            true);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame Destructor
+//
+// 1) Deletes child objects implicitly
+// 2) Stop the scanner, prober and thumbnailer threads explicitly
+// 3) Close the stores
+// ----------------------------------------------------------------------------
+wxMediaPlayerFrame::~wxMediaPlayerFrame()
+{
+#ifdef wxMEDIA_USE_REMOTE
+    delete m_remote;
+    delete m_control;
+#endif // wxMEDIA_USE_REMOTE
+    delete m_bench;
+
+    //  Goes by the scanner's settings
+    m_watcher->Stop();
+    delete m_watcher;
+
+    m_scanner->Stop();
+    delete m_scanner;
+
+    m_prober->Stop();
+    delete m_prober;
+
+    //  The pages sharing the image list are gone by now
+    m_thumbnailer->Stop();
+    delete m_thumbnailer;
+    delete m_thumbnails;
+
+    m_infoCache->Close();
+    delete m_infoCache;
+
+    //
+    //  Every playlist edit was journalled as it happened, so there
+    //  is nothing left to save here
+    //
+    m_playlists->Close();
+    delete m_playlists;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnClose
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnClose(wxCloseEvent& event)
+{
+    event.Skip(); // really close the frame
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::ImportPaths
+//
+// Playing waits for OnScanResults(), which also runs once when the event
+// loop starts, so files given on the command line play before any scan is
+// done
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::ImportPaths(const wxVector<wxString>& paths,
+                                     bool bPlay)
+{
+    ImportPaths((wxMediaPlayerNotebookPage*)m_notebook->GetCurrentPage(),
+                paths, bPlay);
+}
+
+void wxMediaPlayerFrame::ImportPaths(wxMediaPlayerNotebookPage* page,
+                                     const wxVector<wxString>& paths,
+                                     bool bPlay)
+{
+    if (bPlay)
+        page->m_nAutoPlay = page->m_entries.GetCount();
+
+    page->Import(paths);
+
+    if (bPlay)
+        wxQueueEvent(this, new wxThreadEvent(wxEVT_THREAD, wxID_SCANNER));
+}
+
+#ifdef wxMEDIA_USE_REMOTE
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OpenForwarded
+//
+// Replacing opens a new page and closes the current one rather than
+// emptying it, which its playlist store has no way to do
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OpenForwarded(const wxVector<wxString>& paths,
+                                       int mode)
+{
+    if (mode == wxOPEN_REPLACE)
+    {
+        wxMediaPlayerNotebookPage* old =
+            (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+
+        wxMediaPlayerNotebookPage* page =
+            new wxMediaPlayerNotebookPage(this, m_notebook);
+        page->m_nPlaylistId = m_playlists->CreatePlaylist();
+        m_notebook->AddPage(page, wxT(""), true);
+
+        if (old)
+            ClosePage(old);
+    }
+
+    if (!paths.empty())
+        ImportPaths(paths, mode != wxOPEN_APPEND);
+}
+
+#endif // wxMEDIA_USE_REMOTE
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::SetPlayOrder
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::SetPlayOrder(bool bShuffle, bool bRepeat)
+{
+    m_bShuffle = bShuffle;
+    m_bRepeat = bRepeat;
+
+    for (size_t n = 0; n < m_notebook->GetPageCount(); ++n)
+    {
+        wxMediaPlayerNotebookPage* page =
+            (wxMediaPlayerNotebookPage*) m_notebook->GetPage(n);
+        page->m_order.SetShuffle(bShuffle);
+        page->m_order.SetRepeat(bRepeat);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::SetHealthPolicy
+//
+// Pages look these up every time, so they apply to what plays from now on
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::SetHealthPolicy(long nInterval, long nStallTimeout,
+                                         int action)
+{
+    m_nHealthInterval = nInterval;
+    m_nStallTimeout = nStallTimeout;
+    m_nStallAction = action;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::SetPageBudget
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::SetPageBudget(long nPages)
+{
+    m_nPageBudget = nPages;
+    EnforcePageBudget();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnPageChanged
+//
+// Pages are told apart by id rather than by the old selection, which is
+// stale once the shown page was deleted
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnPageChanged(wxBookCtrlEvent& event)
+{
+    event.Skip();
+
+    wxMediaPlayerNotebookPage* page =
+        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    if (!page || page->m_nPageId == m_nShownPage)
+        return;
+
+    wxMediaPlayerNotebookPage* hidden = FindPage(m_nShownPage);
+    if (hidden)
+        hidden->Suspend();
+
+    m_nShownPage = page->m_nPageId;
+    page->m_nLastShown = ++m_nPageClock;
+    page->Restore();
+
+    EnforcePageBudget();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnNotebookPaint
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnNotebookPaint(wxPaintEvent& event)
+{
+    gs_startupTrace.Mark(wxSTARTUP_FIRST_PAINT);
+    event.Skip();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::EnforcePageBudget
+//
+// Only suspended pages are evicted: the shown one and any still playing in
+// the background (like those the benchmark starts) keep their media.
+// Pages that never loaded anything don't count.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::EnforcePageBudget()
+{
+    if (m_nPageBudget <= 0)
+        return;
+
+    for (;;)
+    {
+        long nLoaded = 0;
+        wxMediaPlayerNotebookPage* lru = NULL;
+        for (size_t n = 0; n < m_notebook->GetPageCount(); ++n)
+        {
+            wxMediaPlayerNotebookPage* page =
+                (wxMediaPlayerNotebookPage*) m_notebook->GetPage(n);
+            if (page->m_nResidency == wxPAGE_EVICTED || page->m_szFile.empty())
+                continue;
+
+            ++nLoaded;
+            if (page->m_nResidency == wxPAGE_SUSPENDED &&
+                (!lru || page->m_nLastShown < lru->m_nLastShown))
+                lru = page;
+        }
+
+        if (nLoaded <= m_nPageBudget || !lru)
+            return;
+        lru->Evict();
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::FindPage
+//
+// Finds a notebook page by its id, or NULL if it has been closed since
+// ----------------------------------------------------------------------------
+wxMediaPlayerNotebookPage* wxMediaPlayerFrame::FindPage(int nPageId)
+{
+    for (size_t n = 0; n < m_notebook->GetPageCount(); ++n)
+    {
+        wxMediaPlayerNotebookPage* page =
+            (wxMediaPlayerNotebookPage*) m_notebook->GetPage(n);
+        if (page->m_nPageId == nPageId)
+            return page;
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnProbeResults
+//
+// Called when the prober has a batch of results.  Stores them in the pages
+// they belong to, then repaints just the rows on screen of those pages.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnProbeResults(wxThreadEvent& WXUNUSED(event))
+{
+    //  Indexes only matter if the page still plays that file
+    wxVector<wxMediaPlayerProber::Index> indexes;
+    m_prober->TakeIndexes(indexes);
+    for (size_t n = 0; n < indexes.size(); ++n)
+    {
+        wxMediaPlayerNotebookPage* page = FindPage(indexes[n].m_nPage);
+        if (page && page->m_szFile == indexes[n].m_szFile)
+            page->m_keyframes = indexes[n].m_keyframes;
+    }
+
+    wxVector<wxMediaPlayerProber::Result> results;
+    m_prober->TakeResults(results);
+
+    wxVector<wxMediaPlayerNotebookPage*> touched;
+    wxMediaPlayerNotebookPage* page = NULL;
+    for (size_t n = 0; n < results.size(); ++n)
+    {
+        const wxMediaPlayerProber::Result& result = results[n];
+        if (!page || page->m_nPageId != result.m_nPage)
+        {
+            page = FindPage(result.m_nPage);
+            if (!page)
+                continue;   // page was closed while its files were probed
+
+            bool bSeen = false;
+            for (size_t i = 0; i < touched.size(); ++i)
+                bSeen |= touched[i] == page;
+            if (!bSeen)
+                touched.push_back(page);
+        }
+
+        // Don't let a failed probe wipe out what wxMediaCtrl told us
+        if ((result.m_info.m_nFlags & wxMEDIAINFO_VALID) ||
+            !(page->m_entries.GetPathInfo(result.m_nPath).m_nFlags &
+              wxMEDIAINFO_VALID))
+            page->m_entries.SetPathInfo(result.m_nPath, result.m_info);
+    }
+
+    wxMediaPlayerStatsScope scope(m_stats, wxSTATS_LIST_UPDATE);
+    for (size_t i = 0; i < touched.size(); ++i)
+        touched[i]->m_playlist->RefreshVisibleItems();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnScanResults
+//
+// Appends everything the scanner found since last time, a batch per page,
+// and starts playing an import that asked for it once its first entry is in
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnScanResults(wxThreadEvent& WXUNUSED(event))
+{
+    wxVector<wxMediaPlayerScanner::Batch> batches;
+    m_scanner->TakeBatches(batches);
+
+    for (size_t n = 0; n < batches.size(); ++n)
+    {
+        const wxMediaPlayerScanner::Batch& batch = batches[n];
+        wxMediaPlayerNotebookPage* page = FindPage(batch.m_nPage);
+        if (!page)
+            continue;   // page was closed while its directories were read
+
+        const bool bDedup = !batch.m_fingerprints.empty();
+        for (size_t i = 0; i + 1 < batch.m_offsets.size(); ++i)
+        {
+            const wxUint32 start = batch.m_offsets[i];
+            page->AddImported(&batch.m_pool[0] + start,
+                              batch.m_offsets[i + 1] - start, bDedup,
+                              bDedup ? batch.m_fingerprints[i] : 0);
+        }
+        page->SyncNewEntries();
+    }
+
+    //  Imports into pages other than the current one play there as well
+    for (size_t i = 0; i < m_notebook->GetPageCount(); ++i)
+    {
+        wxMediaPlayerNotebookPage* page =
+            (wxMediaPlayerNotebookPage*) m_notebook->GetPage(i);
+        long n = page->m_nAutoPlay;
+        if (n != -1 && n < (long) page->m_entries.GetCount())
+        {
+            page->m_nAutoPlay = -1;
+            DoPlayFile(page, n);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnWatchChanges
+//
+// Hands each page the changes to its folders, in the order they happened
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnWatchChanges(wxThreadEvent& WXUNUSED(event))
+{
+    wxVector<wxMediaPlayerWatcher::Change> changes;
+    m_watcher->TakeChanges(changes);
+
+    wxVector<wxMediaPlayerWatcher::Change> own;
+    while (!changes.empty())
+    {
+        const int nPage = changes[0].m_nPage;
+
+        own.clear();
+        size_t nKept = 0;
+        for (size_t n = 0; n < changes.size(); ++n)
+        {
+            if (changes[n].m_nPage == nPage)
+                own.push_back(changes[n]);
+            else
+                changes[nKept++] = changes[n];
+        }
+        changes.resize(nKept);
+
+        wxMediaPlayerNotebookPage* page = FindPage(nPage);
+        if (page)
+            page->ApplyWatchChanges(own);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnThumbnails
+//
+// Puts the thumbnails made since last time into the cache.  Only the shown
+// page can have rows on screen that are waiting for them.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnThumbnails(wxThreadEvent& WXUNUSED(event))
+{
+    wxVector<wxMediaPlayerThumbnailer::Result> results;
+    m_thumbnailer->TakeResults(results);
+
+    for (size_t n = 0; n < results.size(); ++n)
+        m_thumbnails->Add(results[n].m_szFile, results[n].m_rgb);
+
+    wxMediaPlayerNotebookPage* page =
+        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    if (page && !results.empty())
+        page->m_playlist->RefreshVisibleItems();
+}
+
+// Failed files are skipped for wxMediaRetryDelay milliseconds, twice as
+// long after each further failure in a row, and are only played when asked
+// for after wxMediaQuarantineFailures of them.  With nothing left to play a
+// page looks again every wxMediaRetryPoll milliseconds.
+static const long wxMediaRetryDelay = 5000;
+static const wxUint32 wxMediaQuarantineFailures = 5;
+static const long wxMediaRetryPoll = 1000;
+
+// How long the entry to play may take to load before it counts as failed,
+// some backends never report a load that failed (milliseconds)
+static const long wxMediaLoadTimeout = 15000;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::QueueError
+//
+// Nobody may be around to click a message box away, and the nested modal
+// loop of one would hold up playback until then
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::QueueError(int nPageId, long n,
+                                    const wxString& message)
+{
+    Error error;
+    error.m_nPage = nPageId;
+    error.m_nEntry = n;
+    error.m_szMessage = message;
+    m_errors.push_back(error);
+
+    if (m_errors.size() == 1)
+        wxQueueEvent(this, new wxThreadEvent(wxEVT_THREAD, wxID_ERRORS));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnErrors
+//
+// Logs the queued errors and moves the pages whose current entry failed on.
+// Errors of entries played from here are queued again, so a run of broken
+// files is gone through one event at a time instead of recursively.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnErrors(wxThreadEvent& WXUNUSED(event))
+{
+    wxVector<Error> errors(m_errors);
+    m_errors.clear();
+
+    wxMessageOutputStderr out;
+    for (size_t n = 0; n < errors.size(); ++n)
+        out.Printf(wxT("wxMediaPlayer: %s\n"), errors[n].m_szMessage.c_str());
+
+    //  The benchmark moves on by itself and counts the failures
+    if (m_bench)
+        return;
+
+    for (size_t n = 0; n < errors.size(); ++n)
+    {
+        wxMediaPlayerNotebookPage* page = FindPage(errors[n].m_nPage);
+        if (page && errors[n].m_nEntry != -1 &&
+            errors[n].m_nEntry == page->m_order.GetCurrent())
+            SkipToPlayable(page);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::SkipToPlayable
+//
+// Entries backing off or in quarantine are stepped over in the play order.
+// When there is nothing else, the page looks again a bit later.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::SkipToPlayable(wxMediaPlayerNotebookPage* page)
+{
+    for (size_t nTries = page->m_entries.GetCount(); nTries > 0; --nTries)
+    {
+        long n = page->m_order.GetNext();
+        if (n == -1)
+            return;     // the end of a playlist that doesn't repeat
+
+        if (page->IsPlayable(n))
+        {
+            page->m_nDirection = 1;
+            DoPlayFile(page, n);
+            return;
+        }
+        page->m_order.MoveTo(n, false);
+    }
+
+    page->m_retryTimer.StartOnce(wxMediaRetryPoll);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnQuit
+//
+// Called from file->quit.
+// Closes this application.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnQuit(wxCommandEvent& WXUNUSED(event))
+{
+    // true is to force the frame to close
+    Close(true);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnOpenFileSamePage
+//
+// Called from file->openfile.
+// Opens and plays a media file in the current notebook page
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnOpenFileSamePage(wxCommandEvent& WXUNUSED(event))
+{
+    OpenFile(false);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OpenFile
+//
+// Opens a file dialog asking the user for a filename, then
+// calls DoOpenFile which will add the file to the playlist and play it
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OpenFile(bool bNewPage)
+{
+    wxFileDialog fd(this);
+
+    if(fd.ShowModal() == wxID_OK)
+    {
+        DoOpenFile(fd.GetPath(), bNewPage);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::DoOpenFile
+//
+// Adds the file to our playlist and then calls DoPlayFile to play it.
+// Playlists are imported instead, playing their first entry.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::DoOpenFile(const wxString& path, bool bNewPage)
+{
+    if(bNewPage)
+    {
+        wxMediaPlayerNotebookPage* page =
+            new wxMediaPlayerNotebookPage(this, m_notebook);
+        page->m_nPlaylistId = m_playlists->CreatePlaylist();
+        m_notebook->AddPage(page, path, true);
+    }
+
+    if (wxMediaPlayerPlaylistReader::GetFormat(path) != wxPLAYLISTFORMAT_NONE)
+    {
+        ImportPaths(wxVector<wxString>(1, path), true);
+        return;
+    }
+
+    wxMediaPlayerNotebookPage* currentpage =
+        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+
+    currentpage->m_playlist->AddToPlayList(path);
+    currentpage->SyncNewEntries();
+
+    DoPlayFile(currentpage, currentpage->m_entries.GetCount() - 1);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::DoPlayFile
+//
+// Pauses entry n of the page if its the currently playing one,
+// otherwise it makes it current in the play order and plays it.
+// The page needn't be the current one: pages load, pre-roll and play side
+// by side, each with its own media controls.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::DoPlayFile(wxMediaPlayerNotebookPage* page, long n)
+{
+    wxMediaPlayerStatsScope scope(m_stats, wxSTATS_PLAY_FILE);
+
+    //  A current entry that failed is loaded again rather than resumed,
+    //  as is one the page unloaded when it was evicted
+    long nCurrent = page->m_order.GetCurrent();
+    wxUint8 nState = nCurrent != -1 ? page->m_entries.GetState(nCurrent)
+                                    : (wxUint8) wxMEDIAENTRY_IDLE;
+    bool bFailed = nState == wxMEDIAENTRY_ERROR ||
+                   nState == wxMEDIAENTRY_QUARANTINED;
+    bool bEvicted = page->Activate();
+    page->EnsureMediaCtrl();
+
+    if( n == nCurrent && !bFailed && !bEvicted )
+    {
+        if(page->m_mediactrl->GetState() == wxMEDIASTATE_PLAYING)
+        {
+            if( !page->m_mediactrl->Pause() )
+                QueueError(page->m_nPageId, -1,
+                           wxT("Couldn't pause ") + page->m_szFile);
+        }
+        else
+        {
+            if( !page->m_mediactrl->Play() )
+                page->ReportError(n, wxT("Couldn't play"));
+        }
+    }
+    else
+    {
+        wxString path = page->m_entries.GetPath(n);
+        m_notebook->SetPageText(m_notebook->FindPage(page),
+                                page->m_entries.GetName(n));
+
+        //  Failed entries keep showing it
+        if(nCurrent != -1 && !bFailed)
+           page->m_playlist->SetEntryState(nCurrent, wxMEDIAENTRY_IDLE);
+
+        page->m_loadTimer.Stop();
+        page->m_order.MoveTo(n, !bFailed);
+        page->m_bPlayPending = true;
+        page->m_szFile = path;
+        page->RequestKeyframes();
+        page->m_nResumeAt = -1;
+        page->m_bResumePaused = false;
+        page->m_switchWatch.Start();
+        page->m_playlist->EnsureEntryVisible(n);
+        if (m_bench)
+            m_bench->OnOpen(page);
+
+        wxURI uripath(path);
+        if( page->SwapInStandby(path) )
+        {
+            // Loaded already, so there won't be a wxEVT_MEDIA_LOADED
+            if (m_bench)
+                m_bench->OnPreloaded(page);
+            PlayLoadedFile(page);
+        }
+        else
+        {
+            //  Streams from imported playlists load by URI, and fail or
+            //  time out like files do
+            bool bLoaded = uripath.IsReference()
+                               ? page->m_mediactrl->Load(path)
+                               : page->m_mediactrl->Load(uripath);
+            if( !bLoaded )
+            {
+                if (m_bench)
+                    m_bench->OnFailed(page);
+                page->ReportError(n, wxT("Couldn't load"));
+            }
+            else
+            {
+                gs_startupTrace.Mark(wxSTARTUP_FIRST_LOAD);
+                page->m_playlist->SetEntryState(n, wxMEDIAENTRY_OPENED);
+                page->m_loadTimer.StartOnce(wxMediaLoadTimeout);
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::PlayLoadedFile
+//
+// Called when the media is ready to be played - and does
+// so, also gets the length of media and shows that in the list control.
+// That is either when the page's media control sent wxEVT_MEDIA_LOADED or
+// right after the standby control was swapped in.  Then reports how long
+// the switch took and gets the next entry ready.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::PlayLoadedFile(wxMediaPlayerNotebookPage* currentpage)
+{
+    if( !currentpage->m_mediactrl->Play() )
+    {
+        currentpage->ReportError(currentpage->m_order.GetCurrent(),
+                                 wxT("Couldn't play"));
+    }
+    else
+    {
+		currentpage->m_mediactrl->SetVolume(0.0);
+        currentpage->m_playlist->SetEntryState(currentpage->m_order.GetCurrent(),
+                                               wxMEDIAENTRY_PLAYING);
+    }
+
+    //
+    //  Files the prober couldn't handle still get a length now
+    //
+    wxUint32 nPath =
+        currentpage->m_entries.GetPathId(currentpage->m_order.GetCurrent());
+    wxMediaPlayerMediaInfo info = currentpage->m_entries.GetPathInfo(nPath);
+    if ( !(info.m_nFlags & wxMEDIAINFO_VALID) )
+    {
+        info.m_nDuration = (wxUint32) currentpage->m_mediactrl->Length();
+        info.m_nFlags |= wxMEDIAINFO_PROBED | wxMEDIAINFO_VALID;
+        currentpage->m_entries.SetPathInfo(nPath, info);
+        currentpage->m_playlist->RefreshEntry(
+            currentpage->m_order.GetCurrent());
+
+        wxStructStat st;
+        if ( wxStat(currentpage->m_szFile, &st) == 0 )
+        {
+            size_t len;
+            const char* path =
+                currentpage->m_entries.GetPathUTF8(nPath, &len);
+            m_infoCache->Store(path, len, st.st_size, st.st_mtime, info);
+        }
+    }
+
+    currentpage->m_nSwitchMicros =
+        currentpage->m_switchWatch.TimeInMicro().ToLong();
+    wxLogVerbose(wxT("Switched to entry %ld in %.2fms"),
+                 currentpage->m_order.GetCurrent(),
+                 currentpage->m_nSwitchMicros / 1000.0);
+
+    currentpage->UpdateSlider();
+    currentpage->ScheduleLoop();
+    currentpage->PrepareStandby();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnCloseCurrentPage
+//
+// Called when the user wants to close the current notebook page
+//
+// 1) Get the current page number (wxControl::GetSelection)
+// 2) If there is no current page, break out
+// 3) Delete the current page
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnCloseCurrentPage(wxCommandEvent& WXUNUSED(event))
+{
+    if( m_notebook->GetPageCount() > 1 )
+    {
+    int sel = m_notebook->GetSelection();
+
+    if (sel != wxNOT_FOUND)
+        ClosePage((wxMediaPlayerNotebookPage*) m_notebook->GetPage(sel));
+    }
+    else
+    {
+        wxMessageBox(wxT("Cannot close main page"));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::ClosePage
+//
+// The page mustn't be the one whose handler we are called from, as it is
+// destroyed right away
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::ClosePage(wxMediaPlayerNotebookPage* page)
+{
+    int sel = m_notebook->FindPage(page);
+    if (sel == wxNOT_FOUND)
+        return;
+
+    m_scanner->RemovePage(page->m_nPageId);
+    m_watcher->RemovePage(page->m_nPageId);
+    m_prober->RemovePage(page->m_nPageId);
+    m_playlists->RemovePlaylist(page->m_nPlaylistId);
+    m_notebook->DeletePage(sel);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnExportPlaylist
+//
+// Called from file->export playlist.
+// Saves the entries of the current page as M3U, PLS or XSPF
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnExportPlaylist(wxCommandEvent& WXUNUSED(event))
+{
+    wxFileDialog fd(this, wxT("Export playlist"), wxEmptyString,
+                    wxEmptyString,
+                    wxT("M3U playlist (*.m3u8)|*.m3u8|")
+                    wxT("PLS playlist (*.pls)|*.pls|")
+                    wxT("XSPF playlist (*.xspf)|*.xspf"),
+                    wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+
+    if(fd.ShowModal() == wxID_OK)
+    {
+        static const wxChar* const s_szExtensions[] =
+            { wxT(".m3u8"), wxT(".pls"), wxT(".xspf") };
+
+        wxString path = fd.GetPath();
+        if (wxMediaPlayerPlaylistReader::GetFormat(path) ==
+                wxPLAYLISTFORMAT_NONE)
+            path += s_szExtensions[fd.GetFilterIndex()];
+
+        wxMediaPlayerNotebookPage* currentpage =
+            (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+
+        if( !currentpage->ExportPlaylist(path) )
+            wxMessageBox(wxT("Couldn't export playlist!"));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnPlay
+//
+// Called from file->play.
+// Resumes the media if it is paused or stopped.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnPlay(wxCommandEvent& WXUNUSED(event))
+{
+    PlayPage((wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::PlayPage
+//
+// Media already playing is left alone, DoPlayFile() would pause it
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::PlayPage(wxMediaPlayerNotebookPage* page)
+{
+    if ( page->m_mediactrl &&
+         page->m_mediactrl->GetState() == wxMEDIASTATE_PLAYING )
+        return;
+
+    long n = page->m_order.GetCurrent();
+    if ( n == -1 )
+        n = page->m_order.GetNext();
+
+    if ( n == -1 )
+    {
+        // no items in list
+        QueueError(page->m_nPageId, -1, wxT("No items in playlist!"));
+    }
+    else
+    {
+        DoPlayFile(page, n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnPause
+//
+// Called from file->pause.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnPause(wxCommandEvent& WXUNUSED(event))
+{
+    PausePage((wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::PausePage
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::PausePage(wxMediaPlayerNotebookPage* page)
+{
+    if ( page->m_mediactrl &&
+         page->m_mediactrl->GetState() == wxMEDIASTATE_PLAYING &&
+         !page->m_mediactrl->Pause() )
+        QueueError(page->m_nPageId, -1, wxT("Couldn't pause ") + page->m_szFile);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnKeyDown
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnKeyDown(wxKeyEvent& event)
+{
+    wxMediaPlayerNotebookPage* page =
+        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    if (!page || !page->m_mediactrl || page->m_szFile.empty())
+    {
+        event.Skip();
+        return;
+    }
+
+    //  Left and right go from keyframe to keyframe, with shift they step
+    //  exactly a second
+    long nPos = page->GetSeekPosition();
+    switch (event.GetKeyCode())
+    {
+        case WXK_LEFT:
+            nPos = event.ShiftDown() ? nPos - 1000
+                                     : page->FindKeyframe(nPos, -1);
+            break;
+        case WXK_RIGHT:
+            nPos = event.ShiftDown() ? nPos + 1000
+                                     : page->FindKeyframe(nPos, 1);
+            break;
+        case WXK_HOME:
+            nPos = 0;
+            break;
+        default:
+            event.Skip();
+            return;
+    }
+    page->RequestSeek(nPos);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnPrev
+//
+// Goes to the previous entry in the play order of the page: the one before
+// the current one, or when shuffling the one played before it.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnPrev(wxCommandEvent& WXUNUSED(event))
+{
+    PlayPrev((wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::PlayPrev
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::PlayPrev(wxMediaPlayerNotebookPage* page)
+{
+    long n = page->m_order.GetPrev();
+    if (n == -1 || n == page->m_order.GetCurrent())
+        return; // nothing before this... nothing to do
+
+    page->m_nDirection = -1;
+    DoPlayFile(page, n);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::OnNext
+//
+// Goes to the next entry in the play order of the page, starting over from
+// the first one (or a new shuffle) at the end if repeating.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::OnNext(wxCommandEvent& WXUNUSED(event))
+{
+    PlayNext((wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerFrame::PlayNext
+// ----------------------------------------------------------------------------
+void wxMediaPlayerFrame::PlayNext(wxMediaPlayerNotebookPage* page)
+{
+    long n = page->m_order.GetNext();
+    if (n == -1 || n == page->m_order.GetCurrent())
+        return; // already playing... nothing to do
+
+    page->m_nDirection = 1;
+    DoPlayFile(page, n);
+}
+
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerNotebookPage
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// How long a standby load may take before we stop waiting for it, some
+// backends never report a load that failed (milliseconds)
+static const long wxMediaStandbyTimeout = 10000;
+
+// Seamless looping: how close to the end we seek back to the start, from
+// how far out we start closing in on it, and how often we check for the
+// media playing again while it's paused or stopped (all milliseconds)
+static const long wxMediaLoopLead = 10;
+static const long wxMediaLoopApproach = 200;
+static const long wxMediaLoopIdlePoll = 250;
+
+// Seeking: how long a seek gets to settle before the next one goes out,
+// how far keys step without a keyframe index, how far back stepping to
+// the previous keyframe starts looking, and how often the slider follows
+// the media (all milliseconds)
+static const long wxMediaSeekSettle = 40;
+static const long wxMediaSeekFallbackStep = 5000;
+static const long wxMediaSeekSlack = 500;
+static const long wxMediaSliderInterval = 250;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage Constructor
+//
+// Creates a media control and slider and adds it to this panel,
+// along with some sizers for positioning
+// ----------------------------------------------------------------------------
+wxMediaPlayerNotebookPage::wxMediaPlayerNotebookPage(wxMediaPlayerFrame* parentFrame,
+                                                     wxNotebook* theBook,
+                                                     const wxString& szBackend)
+                         : wxPanel(theBook, wxID_ANY),
+                           m_nPlaylistId(0),
+                           m_mediactrl(NULL),
+                           m_nRowEntries(0),
+                           m_sorter(m_entries),
+                           m_bSortDescending(false),
+                           m_nQueuedPaths(0),
+                           m_nSavedEntries(0),
+                           m_nAutoPlay(-1),
+                           m_nDuplicates(0),
+                           m_standby(NULL),
+                           m_bNoStandby(false),
+                           m_nDirection(1),
+                           m_nSwitchMicros(0),
+                           m_bLoop(true),
+                           m_bLoopTimed(false),
+                           m_nResumeAt(-1),
+                           m_szBackend(szBackend),
+                           m_nResidency(wxPAGE_ACTIVE),
+                           m_nLastShown(0),
+                           m_bResumePlaying(false),
+                           m_nSuspendedAt(0),
+                           m_bResumePaused(false),
+                           m_bPlayPending(false),
+                           m_bIsBeingDragged(false),
+                           m_nLastSeek(0),
+                           m_nSeekTarget(-1),
+                           m_parentFrame(parentFrame)
+{
+    static int s_nPageIds = 0;
+    m_nPageId = s_nPageIds++;
+
+    m_order.SetShuffle(parentFrame->m_bShuffle);
+    m_order.SetRepeat(parentFrame->m_bRepeat);
+
+    memset(&m_loopStats, 0, sizeof(m_loopStats));
+    m_loopTimer.SetOwner(this, wxID_LOOPTIMER);
+
+    memset(&m_health, 0, sizeof(m_health));
+    m_healthTimer.SetOwner(this, wxID_HEALTHTIMER);
+    m_retryTimer.SetOwner(this, wxID_RETRYTIMER);
+    m_standbyTimer.SetOwner(this, wxID_STANDBYTIMER);
+    m_loadTimer.SetOwner(this, wxID_LOADTIMER);
+    m_sliderTimer.SetOwner(this, wxID_SLIDERTIMER);
+    m_seekTimer.SetOwner(this, wxID_SEEKTIMER);
+
+    //
+    //  Create and attach a 2-column grid sizer
+    //
+    wxFlexGridSizer* sizer = new wxFlexGridSizer(2);
+    sizer->AddGrowableCol(0);
+    this->SetSizer(sizer);
+
+    //
+    //  Our media control is only created once there is something to load
+    //  into it, as the first one initializes the whole media backend and
+    //  the window shouldn't wait for that.  Until then a spacer holds its
+    //  place, see EnsureMediaCtrl().  The standby control waits for
+    //  PrepareStandby() too.
+    //
+    sizer->Add(0, 0);
+
+    //
+    //  Create the playlist/listctrl
+    //
+    m_playlist = new wxMediaPlayerListCtrl(&m_entries,
+                                           parentFrame->m_thumbnails);
+    m_playlist->Create(this, wxID_LISTCTRL, wxDefaultPosition,
+                    wxDefaultSize,
+                    wxLC_REPORT // wxLC_LIST
+                    | wxLC_VIRTUAL | wxSUNKEN_BORDER);
+
+    //  The thumbnails are shared by all pages, so the frame keeps them
+    m_playlist->SetImageList(parentFrame->m_thumbnails->GetImageList(),
+                             wxIMAGE_LIST_SMALL);
+
+    //  Set the background of our listctrl to white
+    m_playlist->SetBackgroundColour(*wxWHITE);
+
+
+    m_playlist->AppendColumn(_(""), wxLIST_FORMAT_CENTER, 20);
+    m_playlist->AppendColumn(_("File"), wxLIST_FORMAT_LEFT, /*wxLIST_AUTOSIZE_USEHEADER*/305);
+    m_playlist->AppendColumn(_("Length"), wxLIST_FORMAT_CENTER, 75);
+    m_playlist->AppendColumn(_("Info"), wxLIST_FORMAT_LEFT, 200);
+    m_playlist->AppendColumn(_("Health"), wxLIST_FORMAT_LEFT, 200);
+    m_playlist->AppendColumn(_("Plays"), wxLIST_FORMAT_RIGHT, 50);
+    m_playlist->AppendColumn(_("Last played"), wxLIST_FORMAT_LEFT, 120);
+
+#if wxUSE_DRAG_AND_DROP
+    m_playlist->SetDropTarget(new wxPlayListDropTarget(this));
+#endif
+
+    sizer->Add(m_playlist, 0, wxALIGN_CENTER_HORIZONTAL|wxALL|wxEXPAND, 5);
+
+    //
+    //  Create the slider for seeking, under the media control.  Its range
+    //  is the length of the media in milliseconds once it has loaded.
+    //
+    m_slider = new wxSlider(this, wxID_SEEKSLIDER, 0, 0, 1);
+    m_slider->Disable();
+    sizer->Add(m_slider, 0, wxALL|wxEXPAND, 5);
+
+    //
+    //  And the search box under the playlist, which filters it as you type
+    //
+    m_search = new wxSearchCtrl(this, wxID_SEARCHCTRL);
+    m_search->ShowCancelButton(true);
+    m_search->SetDescriptiveText(_("Search"));
+    sizer->Add(m_search, 0, wxALL|wxEXPAND, 5);
+
+    //  Scrubbing with the keyboard, see wxMediaPlayerFrame::OnKeyDown()
+    m_playlist->Connect(wxEVT_KEY_DOWN,
+                        wxKeyEventHandler(wxMediaPlayerFrame::OnKeyDown),
+                        NULL, parentFrame);
+    m_slider->Connect(wxEVT_KEY_DOWN,
+                      wxKeyEventHandler(wxMediaPlayerFrame::OnKeyDown),
+                      NULL, parentFrame);
+
+    // Now that we have all our rows make some of them growable
+    sizer->AddGrowableRow(0);
+
+    //
+    // Media Control events.  The two controls swap roles, so the
+    // handlers check which one an event is from by its id.
+    //
+    this->Connect(wxID_MEDIACTRL, wxID_STANDBYCTRL, wxEVT_MEDIA_PLAY,
+                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaPlay));
+    this->Connect(wxID_MEDIACTRL, wxID_STANDBYCTRL, wxEVT_MEDIA_PAUSE,
+                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaPause));
+    this->Connect(wxID_MEDIACTRL, wxID_STANDBYCTRL, wxEVT_MEDIA_FINISHED,
+                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaFinished));
+    this->Connect(wxID_MEDIACTRL, wxID_STANDBYCTRL, wxEVT_MEDIA_LOADED,
+                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaLoaded));
+    this->Connect(wxID_MEDIACTRL, wxID_STANDBYCTRL, wxEVT_MEDIA_STOP,
+                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaStop));
+
+    //
+    // List control events
+    //
+    this->Connect(wxID_LISTCTRL, wxEVT_LIST_CACHE_HINT,
+                  wxListEventHandler(wxMediaPlayerNotebookPage::OnListCacheHint));
+    this->Connect(wxID_LISTCTRL, wxEVT_LIST_ITEM_ACTIVATED,
+                  wxListEventHandler(wxMediaPlayerNotebookPage::OnListItemActivated));
+    this->Connect(wxID_LISTCTRL, wxEVT_LIST_COL_CLICK,
+                  wxListEventHandler(wxMediaPlayerNotebookPage::OnListColClick));
+    this->Connect(wxID_SEARCHCTRL, wxEVT_TEXT,
+                  wxCommandEventHandler(wxMediaPlayerNotebookPage::OnSearch));
+    this->Connect(wxID_SEARCHCTRL, wxEVT_SEARCHCTRL_CANCEL_BTN,
+                  wxCommandEventHandler(wxMediaPlayerNotebookPage::OnSearchCancel));
+
+    //
+    // Timer events
+    //
+    this->Connect(wxID_LOOPTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnLoopTimer));
+    this->Connect(wxID_HEALTHTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnHealthTimer));
+    this->Connect(wxID_RETRYTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnRetryTimer));
+    this->Connect(wxID_STANDBYTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnStandbyTimer));
+    this->Connect(wxID_LOADTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnLoadTimer));
+    this->Connect(wxID_SEEKTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnSeekTimer));
+    this->Connect(wxID_SLIDERTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerNotebookPage::OnSliderTimer));
+
+    //
+    // Slider events
+    //
+    this->Connect(wxID_SEEKSLIDER, wxEVT_SCROLL_THUMBTRACK,
+                  wxScrollEventHandler(wxMediaPlayerNotebookPage::OnSeekTrack));
+    this->Connect(wxID_SEEKSLIDER, wxEVT_SCROLL_THUMBRELEASE,
+                  wxScrollEventHandler(wxMediaPlayerNotebookPage::OnSeekRelease));
+    this->Connect(wxID_SEEKSLIDER, wxEVT_SCROLL_CHANGED,
+                  wxScrollEventHandler(wxMediaPlayerNotebookPage::OnSeekChanged));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::Import
+//
+// Files are added in the given order right away, or once fingerprinted
+// when duplicates are dropped.  Whatever is in the directories and
+// playlists follows as the scanner finds it.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::Import(const wxVector<wxString>& paths)
+{
+    wxMediaPlayerScanner* scanner = m_parentFrame->m_scanner;
+    wxVector<wxString> files;
+    for (size_t n = 0; n < paths.size(); ++n)
+    {
+        bool bDir = wxDirExists(paths[n]);
+        bool bPlaylist = !bDir &&
+            wxMediaPlayerPlaylistReader::GetFormat(paths[n]) !=
+                wxPLAYLISTFORMAT_NONE && wxFileExists(paths[n]);
+        if (!bDir && !bPlaylist)
+        {
+            if (scanner->IsFingerprinting())
+                files.push_back(paths[n]);
+            else
+                m_entries.Add(paths[n]);
+            continue;
+        }
+
+        //  What's found in there is made absolute with this
+        wxFileName fn(paths[n]);
+        fn.MakeAbsolute();
+        if (bDir)
+        {
+            scanner->Scan(m_nPageId, fn.GetFullPath());
+            if (m_parentFrame->m_bWatchFolders)
+                m_parentFrame->m_watcher->Watch(m_nPageId, fn.GetFullPath());
+        }
+        else
+            scanner->ScanPlaylist(m_nPageId, fn.GetFullPath());
+    }
+
+    scanner->ScanFiles(m_nPageId, files);
+    SyncNewEntries();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::AddImported
+//
+// A path the page already has is dropped, folders the watcher rescans come
+// through here again.  With bDedup so is a file with the same fingerprint
+// as one the page has, and that counts as a duplicate.  An import that was
+// to play a dropped file plays the entry already there instead.  Entries
+// restored from the playlist store have no fingerprint, so those are only
+// matched by path.  Returns whether the file was added.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerNotebookPage::AddImported(const char* path, size_t len,
+                                            bool bDedup, wxUint64 fingerprint)
+{
+    wxUint32 nPath;
+    const bool bKnown = m_entries.FindPath(path, len, &nPath);
+    if (bKnown || (bDedup && m_entries.FindFingerprint(fingerprint, &nPath)))
+    {
+        if (!bKnown)
+            ++m_nDuplicates;
+        if (m_nAutoPlay == (long) m_entries.GetCount())
+            m_nAutoPlay = m_entries.FindEntry(nPath);
+        return false;
+    }
+
+    if (!bDedup)
+    {
+        m_entries.AddUTF8(path, len);
+        return true;
+    }
+
+    size_t n = m_entries.AddUTF8(path, len);
+    m_entries.SetPathFingerprint(m_entries.GetPathId(n), fingerprint);
+    return true;
+}
+
+// Takes path out of files if it's there
+static void wxMediaDropPath(wxVector<wxString>& files, const wxString& path)
+{
+    for (size_t n = 0; n < files.size(); ++n)
+    {
+        if (files[n] == path)
+        {
+            files.erase(files.begin() + n);
+            return;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::ApplyWatchChanges
+//
+// Removals and renames are collected as the new path of each old one and
+// carried out together, in one pass over the entries, unless a later change
+// involves a path changed already, which needs the earlier ones done first.
+// Added files are appended like the scanner's, or handed to it with
+// directories when they have to be fingerprinted.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::ApplyWatchChanges(
+    const wxVector<wxMediaPlayerWatcher::Change>& changes)
+{
+    wxMediaPlayerScanner* scanner = m_parentFrame->m_scanner;
+    const bool bDedup = scanner->IsFingerprinting();
+
+    wxVector<wxUint32> paths;       // For EditEntries(), empty if nothing
+    wxVector<bool>     targets;     // Paths renamed to in it
+    wxVector<wxString> files;       // New, for the scanner to fingerprint
+    for (size_t n = 0; n < changes.size(); ++n)
+    {
+        const wxMediaPlayerWatcher::Change& change = changes[n];
+        const wxScopedCharBuffer utf8 = change.m_szPath.utf8_str();
+        const wxScopedCharBuffer to = change.m_szNewPath.utf8_str();
+        const int event = change.m_nEvent;
+
+        wxUint32 nPath = wxMediaNoPath;
+        bool bFound = event != wxWATCH_DIR_ADDED &&
+                      m_entries.FindPath(utf8.data(), utf8.length(), &nPath);
+        wxUint32 nTo = wxMediaNoPath;
+        if (event == wxWATCH_RENAMED && bFound)
+            nTo = m_entries.AddPath(to.data(), to.length());
+
+        bool bConflict = event == wxWATCH_DIR_REMOVED ||
+                         event == wxWATCH_DIR_RENAMED;
+        if (bFound && nPath < paths.size())
+            bConflict |= paths[nPath] != nPath || targets[nPath];
+        if (nTo != wxMediaNoPath && nTo < paths.size())
+            bConflict |= paths[nTo] != nTo || targets[nTo];
+        if (bConflict && !paths.empty())
+        {
+            EditEntries(paths);
+            paths.clear();
+            targets.clear();
+            bFound = m_entries.FindPath(utf8.data(), utf8.length(), &nPath);
+        }
+
+        switch (event)
+        {
+            case wxWATCH_ADDED:
+                if (bFound)
+                    break;
+                if (bDedup)
+                    files.push_back(change.m_szPath);
+                else
+                    AddImported(utf8.data(), utf8.length(), false, 0);
+                break;
+
+            case wxWATCH_RENAMED:
+                //  Moved in from a name we didn't have, so it is new to us
+                if (!bFound)
+                {
+                    if (bDedup)
+                    {
+                        wxMediaDropPath(files, change.m_szPath);
+                        files.push_back(change.m_szNewPath);
+                    }
+                    else
+                        AddImported(to.data(), to.length(), false, 0);
+                    break;
+                }
+                // fall through
+
+            case wxWATCH_REMOVED:
+                if (!bFound)
+                {
+                    //  Gone again before the scanner got to it
+                    wxMediaDropPath(files, change.m_szPath);
+                    break;
+                }
+                //  Moved over a file we have, which stays
+                if (nTo != wxMediaNoPath && m_entries.GetPathEntries(nTo))
+                    nTo = wxMediaNoPath;
+                while (paths.size() < m_entries.GetPathCount())
+                {
+                    paths.push_back((wxUint32) paths.size());
+                    targets.push_back(false);
+                }
+                paths[nPath] = nTo;
+                if (nTo != wxMediaNoPath)
+                {
+                    targets[nTo] = true;
+                    if (!(m_entries.GetPathInfo(nTo).m_nFlags &
+                          wxMEDIAINFO_PROBED))
+                        m_entries.SetPathInfo(nTo,
+                                              m_entries.GetPathInfo(nPath));
+                }
+                break;
+
+            case wxWATCH_DIR_ADDED:
+                scanner->Scan(m_nPageId, change.m_szPath);
+                break;
+
+            case wxWATCH_DIR_REMOVED:
+            case wxWATCH_DIR_RENAMED:
+            {
+                const size_t nPaths = m_entries.GetPathCount();
+                wxVector<char> renamed(to.data(), to.data() + to.length());
+                for (wxUint32 p = 0; p < nPaths; ++p)
+                {
+                    size_t len;
+                    const char* path = m_entries.GetPathUTF8(p, &len);
+                    if (!m_entries.GetPathEntries(p) ||
+                        len < utf8.length() ||
+                        memcmp(path, utf8.data(), utf8.length()) != 0)
+                        continue;
+
+                    wxUint32 nRenamed = wxMediaNoPath;
+                    if (event == wxWATCH_DIR_RENAMED)
+                    {
+                        renamed.resize(to.length());
+                        renamed.insert(renamed.end(), path + utf8.length(),
+                                       path + len);
+                        nRenamed = m_entries.AddPath(&renamed[0],
+                                                     renamed.size());
+                        //  Adding may have moved the pool
+                        path = m_entries.GetPathUTF8(p, &len);
+                        m_entries.SetPathInfo(nRenamed,
+                                              m_entries.GetPathInfo(p));
+                    }
+
+                    while (paths.size() < m_entries.GetPathCount())
+                    {
+                        paths.push_back((wxUint32) paths.size());
+                        targets.push_back(false);
+                    }
+                    paths[p] = nRenamed;
+                    if (nRenamed != wxMediaNoPath)
+                        targets[nRenamed] = true;
+                }
+                break;
+            }
+        }
+    }
+
+    if (!paths.empty())
+        EditEntries(paths);
+    SyncNewEntries();
+    scanner->ScanFiles(m_nPageId, files);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::EditEntries
+//
+// Everything holding entry indexes follows along.  When the current entry
+// went, a page that was playing it goes on with what would have been next.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::EditEntries(wxVector<wxUint32>& paths)
+{
+    //  The journalled entries that change, by their index before
+    wxVector<wxUint32> indexes;
+    wxVector<wxUint32> saved;
+    for (size_t n = 0; n < m_nSavedEntries; ++n)
+    {
+        wxUint32 nPath = m_entries.GetPathId(n);
+        if (nPath < paths.size() && paths[nPath] != nPath)
+        {
+            indexes.push_back((wxUint32) n);
+            saved.push_back(paths[nPath]);
+        }
+    }
+
+    const long nCurrent = m_order.GetCurrent();
+    const long nOldCount = (long) m_entries.GetCount();
+    const bool bPlaying = m_nResidency == wxPAGE_ACTIVE
+        ? m_mediactrl && m_mediactrl->GetState() == wxMEDIASTATE_PLAYING
+        : m_bResumePlaying;
+
+    wxVector<long> map;
+    m_entries.EditEntries(paths, map);
+    const long nCount = (long) m_entries.GetCount();
+
+    m_parentFrame->m_playlists->ChangeEntries(m_nPlaylistId, m_entries,
+                                              indexes, saved);
+    size_t nSaved = 0;
+    for (size_t n = 0; n < m_nSavedEntries; ++n)
+    {
+        if (map[n] != -1)
+            ++nSaved;
+    }
+    m_nSavedEntries = nSaved;
+
+    //  Past the end stands for entries the scanner hasn't added yet
+    if (m_nAutoPlay >= nOldCount)
+        m_nAutoPlay += nCount - nOldCount;
+    else if (m_nAutoPlay != -1)
+        m_nAutoPlay = map[m_nAutoPlay];
+
+    wxVector<wxMediaPlayerFrame::Error>& errors = m_parentFrame->m_errors;
+    for (size_t n = 0; n < errors.size(); ++n)
+    {
+        if (errors[n].m_nPage == m_nPageId && errors[n].m_nEntry != -1)
+            errors[n].m_nEntry = errors[n].m_nEntry < nOldCount
+                                 ? map[errors[n].m_nEntry] : -1;
+    }
+
+    {
+        wxMediaPlayerStatsScope scope(m_parentFrame->m_stats,
+                                      wxSTATS_LIST_UPDATE);
+        //  Renamed paths are new ones, so the search starts over
+        if (m_sorter.GetKey() != wxSORT_NONE)
+            RemapSorted(paths, map);
+        if (m_playlist->HasRows())
+        {
+            m_query.clear();
+            FilterEntries(m_search->GetValue());
+        }
+        else
+            m_playlist->SetItemCount(nCount);
+        m_playlist->RefreshVisibleItems();
+    }
+
+    long nNext = m_order.RemoveEntries(map, nCount);
+    if (nCurrent == -1)
+        return;
+
+    if (map[nCurrent] != -1)
+    {
+        //  Renamed, the media has the same file open still
+        m_szFile = m_entries.GetPath(map[nCurrent]);
+    }
+    else if (bPlaying && nNext != -1)
+        m_parentFrame->DoPlayFile(this, nNext);
+    else
+        DropCurrentFile();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::DropCurrentFile
+//
+// wxMediaCtrl can't unload media, so it is stopped and the page forgets it.
+// A deleted file would otherwise play on to the end from the open handle.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::DropCurrentFile()
+{
+    m_loadTimer.Stop();
+    m_loopTimer.Stop();
+    m_healthTimer.Stop();
+    m_sliderTimer.Stop();
+    m_seekTimer.Stop();
+    m_nSeekTarget = -1;
+    m_nResumeAt = -1;
+    m_bResumePlaying = false;
+    m_bResumePaused = false;
+    m_bPlayPending = false;
+
+    if (m_mediactrl)
+        m_mediactrl->Stop();
+    m_szFile.clear();
+    UpdateSlider();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::ExportPlaylist
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerNotebookPage::ExportPlaylist(const wxString& path) const
+{
+    wxMediaPlayerPlaylistWriter writer;
+    if (!writer.Create(path, wxMediaPlayerPlaylistReader::GetFormat(path)))
+        return false;
+
+    for (size_t n = 0; n < m_entries.GetCount(); ++n)
+    {
+        wxUint32 nPath = m_entries.GetPathId(n);
+        const wxMediaPlayerMediaInfo& info = m_entries.GetPathInfo(nPath);
+
+        size_t len;
+        const char* entry = m_entries.GetPathUTF8(nPath, &len);
+        writer.Add(entry, len,
+                   info.m_nFlags & wxMEDIAINFO_VALID ? info.m_nDuration : 0);
+    }
+
+    return writer.Commit();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::SyncNewEntries
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::SyncNewEntries()
+{
+    {
+        wxMediaPlayerStatsScope scope(m_parentFrame->m_stats,
+                                      wxSTATS_LIST_UPDATE);
+        SyncRows();
+    }
+    //  Once a page was searched its index keeps up as entries come in,
+    //  rather than the next search catching up with all of them
+    if (m_index.IsBuilt())
+        m_index.Update(m_entries);
+    m_order.SetCount(m_entries.GetCount());
+    SaveNewEntries();
+    QueueNewPaths();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::QueueNewPaths
+//
+// Gives every path added to the playlist since the last call to the prober
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::QueueNewPaths()
+{
+    if (m_nQueuedPaths < m_entries.GetPathCount())
+    {
+        //  Show whatever we knew about these files last time right away,
+        //  the prober will check that they haven't changed since
+        wxMediaPlayerInfoCache* cache = m_parentFrame->m_infoCache;
+        for (size_t n = m_nQueuedPaths; n < m_entries.GetPathCount(); ++n)
+        {
+            size_t len;
+            const char* path = m_entries.GetPathUTF8(n, &len);
+
+            wxMediaPlayerMediaInfo info;
+            wxUint64 size;
+            wxInt64 mtime;
+            if (cache->Lookup(path, len, info, &size, &mtime))
+                m_entries.SetPathInfo(n, info);
+        }
+
+        m_parentFrame->m_prober->Enqueue(m_nPageId, m_entries, m_nQueuedPaths);
+        m_nQueuedPaths = m_entries.GetPathCount();
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::SaveNewEntries
+//
+// Journals every entry added to the playlist since the last call, as one
+// record
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::SaveNewEntries()
+{
+    if (m_nSavedEntries < m_entries.GetCount())
+    {
+        m_parentFrame->m_playlists->AppendEntries(m_nPlaylistId, m_entries,
+                                                  m_nSavedEntries);
+        m_nSavedEntries = m_entries.GetCount();
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnListCacheHint
+//
+// Called by the virtual list control before it paints a range of rows.
+// Anything in there that hasn't been probed yet is moved to the front of
+// the prober's queue, and the thumbnails that aren't on hand replace the
+// ones asked for before, which have scrolled out of view.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnListCacheHint(wxListEvent& event)
+{
+    wxMediaPlayerThumbnailCache* thumbnails = m_parentFrame->m_thumbnails;
+
+    wxVector<wxUint32> paths;
+    wxVector<wxString> posters;
+    long nTo = wxMin(event.GetCacheTo(),
+                     (long) m_playlist->GetItemCount() - 1);
+    for (long row = event.GetCacheFrom(); row <= nTo; ++row)
+    {
+        const long n = m_playlist->GetEntry(row);
+        if ( !(m_entries.GetInfo(n).m_nFlags & wxMEDIAINFO_PROBED) )
+            paths.push_back(m_entries.GetPathId(n));
+
+        size_t len;
+        const char* path = m_entries.GetPathUTF8(m_entries.GetPathId(n), &len);
+        if (thumbnails->Find(path, len) == wxTHUMBNAIL_UNKNOWN)
+            posters.push_back(wxString::FromUTF8(path, len));
+    }
+
+    if (!paths.empty())
+        m_parentFrame->m_prober->Prioritize(m_nPageId, paths);
+    if (!posters.empty())
+        m_parentFrame->m_thumbnailer->Request(posters);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnListItemActivated
+//
+// Double-click or enter on a row plays it
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnListItemActivated(wxListEvent& event)
+{
+    m_parentFrame->DoPlayFile(this, m_playlist->GetEntry(event.GetIndex()));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSearch
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSearch(wxCommandEvent& WXUNUSED(event))
+{
+    wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_SEARCH);
+    FilterEntries(m_search->GetValue());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSearchCancel
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSearchCancel(wxCommandEvent& WXUNUSED(event))
+{
+    m_search->ChangeValue(wxEmptyString);
+    FilterEntries(wxEmptyString);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::FilterEntries
+//
+// Shows the entries whose path contains query, all of them if it's empty.
+// When query contains what was searched for before only the paths found
+// then are looked at again, so each keystroke of a search gets cheaper.
+// The rows are handed to the list control, the entries stay as they are.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::FilterEntries(const wxString& query)
+{
+    wxVector<char> folded;
+    wxMediaPlayerSearchIndex::Fold(query, folded);
+    if (folded.empty())
+    {
+        m_query.clear();
+        m_queryPaths.clear();
+    }
+    else
+    {
+        m_index.Update(m_entries);
+
+        const bool bNarrow = !m_query.empty() &&
+            wxMediaPlayerSearchIndex::Contains(&folded[0], folded.size(),
+                                               &m_query[0], m_query.size());
+        m_index.Find(m_entries, folded, bNarrow ? &m_queryPaths : NULL,
+                     m_foundPaths);
+        m_query.swap(folded);
+        m_queryPaths.swap(m_foundPaths);
+    }
+
+    BuildRows();
+    m_playlist->RefreshVisibleItems();
+    if (m_order.GetCurrent() != -1)
+        m_playlist->EnsureEntryVisible(m_order.GetCurrent());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::SyncRows
+//
+// Shows the entries appended since the last call, only those matching the
+// search if there is one.  They are checked against it directly, the index
+// catches up with their paths when it is next searched.  In a sorted view
+// they are merged into the sort.  Ascending without a search the rows are
+// the sort, and only those from the first merged entry on are replaced,
+// usually just appended as paths mostly come in order.  Otherwise the rows
+// are made again.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::SyncRows()
+{
+    if (!m_playlist->HasRows())
+    {
+        m_playlist->SyncItemCount();
+        return;
+    }
+
+    const size_t nCount = m_entries.GetCount();
+    const bool bSorted = m_sorter.GetKey() != wxSORT_NONE;
+    for (size_t n = m_nRowEntries; n < nCount && !m_query.empty(); ++n)
+    {
+        const wxUint32 nPath = m_entries.GetPathId(n);
+        size_t len;
+        const char* path = m_entries.GetPathUTF8(nPath, &len);
+        if (!wxMediaPlayerSearchIndex::Contains(path, len, &m_query[0],
+                                                m_query.size()))
+            continue;
+
+        if (!bSorted)
+            m_playlist->AppendRow((wxUint32) n);
+
+        //  Mostly a new path, which goes at the end
+        size_t nAt = m_queryPaths.size();
+        while (nAt > 0 && m_queryPaths[nAt - 1] > nPath)
+            --nAt;
+        if (nAt == 0 || m_queryPaths[nAt - 1] != nPath)
+            m_queryPaths.insert(m_queryPaths.begin() + nAt, nPath);
+    }
+
+    if (bSorted)
+    {
+        wxVector<wxMediaPlayerSorter::Item> added;
+        m_sorter.AddEntries(m_nRowEntries, nCount, added);
+        const size_t nFirst = m_sorter.Merge(m_sorted, added);
+        m_sortedAt.clear();
+
+        if (m_query.empty() && !m_bSortDescending)
+        {
+            wxVector<wxUint32> rows;
+            rows.reserve(nCount - nFirst);
+            for (size_t n = nFirst; n < nCount; ++n)
+                rows.push_back(m_sorted[n].m_nEntry);
+            m_playlist->ReplaceRows(nFirst, rows);
+            m_nRowEntries = nCount;
+        }
+        else
+            BuildRows();
+        m_playlist->RefreshVisibleItems();
+    }
+    else
+    {
+        m_nRowEntries = nCount;
+        m_playlist->SyncItemCount();
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnListColClick
+//
+// A header sorts by its column, again to reverse the order.  Shift and the
+// file name sort by the whole path.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnListColClick(wxListEvent& event)
+{
+    int key;
+    switch (event.GetColumn())
+    {
+        case 1:
+            key = wxGetKeyState(WXK_SHIFT) ? wxSORT_PATH : wxSORT_NAME;
+            break;
+        case 2:
+            key = wxSORT_LENGTH;
+            break;
+        case 5:
+            key = wxSORT_PLAYS;
+            break;
+        case 6:
+            key = wxSORT_LAST_PLAYED;
+            break;
+        default:
+            return;
+    }
+
+    SortEntries(key, key == m_sorter.GetKey() && !m_bSortDescending);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::SortEntries
+//
+// The keys are taken again every time, plays and lengths change after all.
+// Only the rows are reordered, the entries and the play order stay as they
+// are.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::SortEntries(int key, bool bDescending)
+{
+    wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_SORT);
+
+    m_sorter.SetKey(key);
+    m_bSortDescending = bDescending;
+    ResortEntries();
+    BuildRows();
+
+#if wxCHECK_VERSION(3, 1, 6)
+    int nColumn;
+    switch (key)
+    {
+        case wxSORT_NAME:
+        case wxSORT_PATH:
+            nColumn = 1;
+            break;
+        case wxSORT_LENGTH:
+            nColumn = 2;
+            break;
+        case wxSORT_PLAYS:
+            nColumn = 5;
+            break;
+        case wxSORT_LAST_PLAYED:
+            nColumn = 6;
+            break;
+        default:
+            nColumn = -1;
+            break;
+    }
+    m_playlist->ShowSortIndicator(nColumn, !bDescending);
+#endif
+
+    m_playlist->RefreshVisibleItems();
+    if (m_order.GetCurrent() != -1)
+        m_playlist->EnsureEntryVisible(m_order.GetCurrent());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::ResortEntries
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::ResortEntries()
+{
+    m_sorted.clear();
+    m_sortedAt.clear();
+    if (m_sorter.GetKey() == wxSORT_NONE)
+        return;
+
+    //  Renamed paths keep their old text, which no entry uses any more
+    m_sorter.SetKey(m_sorter.GetKey());
+    m_sorter.AddEntries(0, m_entries.GetCount(), m_sorted);
+    m_sorter.Sort(m_sorted);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::RemapSorted
+//
+// The items keep their order, the entries that stay do too.  Removed ones
+// go, and those on paths renamed to, which have a new name and may have
+// more plays, get new items merged in like appended ones, as do entries
+// that weren't in the sort yet.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::RemapSorted(const wxVector<wxUint32>& paths,
+                                            const wxVector<long>& map)
+{
+    wxVector<wxUint8> renamed(m_entries.GetPathCount(), 0);
+    for (size_t n = 0; n < paths.size(); ++n)
+    {
+        if (paths[n] != n && paths[n] != wxMediaNoPath)
+            renamed[paths[n]] = 1;
+    }
+
+    wxVector<wxUint32> entries;
+    size_t nKept = 0;
+    for (size_t n = 0; n < m_sorted.size(); ++n)
+    {
+        wxMediaPlayerSorter::Item item = m_sorted[n];
+        if (map[item.m_nEntry] == -1)
+            continue;
+
+        item.m_nEntry = (wxUint32) map[item.m_nEntry];
+        if (renamed[m_entries.GetPathId(item.m_nEntry)])
+            entries.push_back(item.m_nEntry);
+        else
+            m_sorted[nKept++] = item;
+    }
+    m_sorted.resize(nKept);
+
+    for (size_t n = m_nRowEntries; n < map.size(); ++n)
+    {
+        if (map[n] != -1)
+            entries.push_back((wxUint32) map[n]);
+    }
+
+    wxVector<wxMediaPlayerSorter::Item> added;
+    m_sorter.AddEntries(entries, added);
+    m_sorter.Merge(m_sorted, added);
+    m_sortedAt.clear();
+}
+
+// Searches matching fewer than one entry in this many gather their rows
+// from the entries of the paths found, instead of looking at every entry
+static const size_t wxMediaRowsGatherRatio = 16;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::BuildRows
+//
+// The entries matching the search, in the order of the sort.  Without
+// either the list control shows the entries themselves.  A search that
+// finds little goes from its paths to their entries, and sorts only those
+// by where they are in the sort, so narrowing it down doesn't cost a walk
+// over the whole playlist every keystroke.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::BuildRows()
+{
+    const size_t nCount = m_entries.GetCount();
+    m_nRowEntries = nCount;
+
+    const bool bSorted = m_sorter.GetKey() != wxSORT_NONE;
+    if (m_query.empty() && !bSorted)
+    {
+        m_playlist->ClearRows();
+        return;
+    }
+
+    size_t nMatches = nCount;
+    if (!m_query.empty())
+    {
+        nMatches = 0;
+        for (size_t n = 0; n < m_queryPaths.size(); ++n)
+            nMatches += m_entries.GetPathEntries(m_queryPaths[n]);
+    }
+
+    wxVector<wxUint32>& rows = m_spareRows;
+    rows.clear();
+    if (nMatches * wxMediaRowsGatherRatio < nCount)
+    {
+        rows.reserve(nMatches);
+        for (size_t n = 0; n < m_queryPaths.size(); ++n)
+        {
+            for (long nEntry = m_entries.GetLastPathEntry(m_queryPaths[n]);
+                 nEntry != -1; nEntry = m_entries.GetPrevPathEntry(nEntry))
+                rows.push_back((wxUint32) nEntry);
+        }
+
+        if (bSorted)
+        {
+            if (m_sortedAt.size() != nCount)
+            {
+                m_sortedAt.resize(nCount);
+                for (size_t n = 0; n < nCount; ++n)
+                    m_sortedAt[m_sorted[n].m_nEntry] = (wxUint32) n;
+            }
+
+            for (size_t n = 0; n < rows.size(); ++n)
+                rows[n] = m_sortedAt[rows[n]];
+            wxVectorSort(rows);
+
+            const size_t nRows = rows.size();
+            for (size_t n = 0; n < nRows; ++n)
+                rows[n] = m_sorted[rows[n]].m_nEntry;
+            for (size_t n = 0; m_bSortDescending && n < nRows / 2; ++n)
+            {
+                const wxUint32 swap = rows[n];
+                rows[n] = rows[nRows - 1 - n];
+                rows[nRows - 1 - n] = swap;
+            }
+        }
+        else
+            wxVectorSort(rows);
+    }
+    else
+    {
+        if (!m_query.empty())
+        {
+            m_pathMatches.resize(m_entries.GetPathCount(), 0);
+            for (size_t n = 0; n < m_queryPaths.size(); ++n)
+                m_pathMatches[m_queryPaths[n]] = 1;
+        }
+
+        rows.reserve(nMatches);
+        for (size_t n = 0; n < nCount; ++n)
+        {
+            wxUint32 nEntry = (wxUint32) n;
+            if (bSorted)
+                nEntry = m_sorted[m_bSortDescending ? nCount - 1 - n
+                                                    : n].m_nEntry;
+
+            if (m_query.empty() || m_pathMatches[m_entries.GetPathId(nEntry)])
+                rows.push_back(nEntry);
+        }
+
+        for (size_t n = 0; n < m_queryPaths.size(); ++n)
+            m_pathMatches[m_queryPaths[n]] = 0;
+    }
+    m_playlist->SetRows(rows, bSorted);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::PredictNextEntry
+//
+// Where OnNext/OnPrev would go from here, in the direction the user last
+// moved.  Nothing if that is the same file, some backends can't have it open
+// twice.
+// ----------------------------------------------------------------------------
+long wxMediaPlayerNotebookPage::PredictNextEntry() const
+{
+    long nCurrent = m_order.GetCurrent();
+    if (nCurrent == -1)
+        return -1;
+
+    long nNext = m_nDirection < 0 ? m_order.GetPrev() : m_order.PeekNext();
+    if (nNext == -1 ||
+        m_entries.GetPathId(nNext) == m_entries.GetPathId(nCurrent))
+        return -1;
+    return nNext;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::PrepareStandby
+//
+// Starts loading the predicted entry into the standby control.  Like
+// DoPlayFile only local files are loaded.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::PrepareStandby()
+{
+    if (m_bNoStandby)
+        return;
+
+    long nNext = PredictNextEntry();
+    if (nNext == -1)
+        return;
+
+    wxString path = m_entries.GetPath(nNext);
+    if (path == m_szStandbyFile || !wxURI(path).IsReference())
+        return;
+
+    //  The standby control is only an optimization, so do without if the
+    //  backend won't give us two
+    if (!m_standby)
+    {
+        m_standby = CreateMediaCtrl(wxID_STANDBYCTRL);
+        if (!m_standby)
+        {
+            m_bNoStandby = true;
+            return;
+        }
+        m_standby->Hide();
+    }
+
+    //  A load still in flight is superseded, whatever it reports later
+    CancelStandby();
+    if (m_standby->Load(path))
+    {
+        m_szStandbyFile = path;
+        m_szStandbyLoading = path;
+        m_standbyTimer.StartOnce(wxMediaStandbyTimeout);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::CancelStandby
+//
+// The standby control keeps whatever it has, but nothing is swapped in
+// until the next PrepareStandby() finishes
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::CancelStandby()
+{
+    m_standbyTimer.Stop();
+    m_szStandbyLoading.clear();
+    m_szStandbyFile.clear();
+}
+
+void wxMediaPlayerNotebookPage::OnStandbyTimer(wxTimerEvent& WXUNUSED(event))
+{
+    if (!m_szStandbyLoading.empty())
+        wxLogVerbose(wxT("Page %d: gave up preloading %s"), m_nPageId,
+                     m_szStandbyLoading.c_str());
+    CancelStandby();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::SwapInStandby
+//
+// If the standby control has finished loading path, stops the current
+// control and puts the standby one in its place in the sizer.  The old
+// control becomes the standby one.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerNotebookPage::SwapInStandby(const wxString& path)
+{
+    if (!m_standby || !m_szStandbyLoading.empty() ||
+        m_szStandbyFile != path)
+        return false;
+
+    m_mediactrl->Stop();
+
+    GetSizer()->Replace(m_mediactrl, m_standby);
+    m_standby->Show();
+    m_mediactrl->Hide();
+    Layout();
+
+    wxMediaCtrl* old = m_mediactrl;
+    m_mediactrl = m_standby;
+    m_standby = old;
+    m_szStandbyFile.clear();
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnMediaLoaded
+//
+// The standby control is ready once the load in flight finished; loads of
+// the visible control are played by the frame
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnMediaLoaded(wxMediaEvent& event)
+{
+    wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_MEDIA_LOADED);
+
+    if (m_standby && event.GetId() == m_standby->GetId())
+    {
+        if (!m_szStandbyLoading.empty())
+        {
+            m_standbyTimer.Stop();
+            m_szStandbyLoading.clear();
+            m_standby->SetVolume(0.0);
+        }
+        return;
+    }
+
+    //  From a control destroyed by Evict(), or media DropCurrentFile()
+    //  stopped
+    if (!m_mediactrl || event.GetId() != m_mediactrl->GetId() ||
+        m_order.GetCurrent() == -1)
+        return;
+
+    m_loadTimer.Stop();
+    gs_startupTrace.Mark(wxSTARTUP_FIRST_LOADED);
+
+    //  Reloaded after a stall or eviction, carry on where it was
+    if (m_nResumeAt >= 0)
+    {
+        m_mediactrl->Seek(m_nResumeAt);
+        m_nResumeAt = -1;
+    }
+
+    //  Evicted while paused, so it comes back paused
+    if (m_bResumePaused)
+    {
+        m_bResumePaused = false;
+        m_playlist->SetEntryState(m_order.GetCurrent(), wxMEDIAENTRY_PAUSED);
+        UpdateSlider();
+        ScheduleLoop();
+        PrepareStandby();
+        return;
+    }
+
+    if (m_parentFrame->m_bench)
+        m_parentFrame->m_bench->OnLoaded(this);
+    m_parentFrame->PlayLoadedFile(this);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnMediaPlay
+//
+// Called when the media plays.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnMediaPlay(wxMediaEvent& event)
+{
+    wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_MEDIA_PLAY);
+
+    if (!m_mediactrl || event.GetId() != m_mediactrl->GetId() ||
+        m_order.GetCurrent() == -1)
+        return;
+
+    if (gs_startupTrace.Mark(wxSTARTUP_FIRST_FRAME) &&
+        !gs_startupTrace.WriteReport())
+        wxLogError(wxT("Couldn't write the startup trace"));
+
+    long n = m_order.GetCurrent();
+    m_playlist->SetEntryState(n, wxMEDIAENTRY_PLAYING);
+    StartHealthSampler();
+
+    //  Not when it goes on after a pause or a reload
+    if (m_bPlayPending)
+    {
+        m_bPlayPending = false;
+        m_entries.RecordPlay(m_entries.GetPathId(n),
+                             (wxUint32) wxGetLocalTime());
+    }
+    m_sliderTimer.Start(wxMediaSliderInterval);
+
+    //  Whatever made it fail before has passed
+    const wxMediaPlayerHealth* health = m_entries.FindHealth(n);
+    if (health && health->m_nFailures)
+    {
+        wxMediaPlayerHealth& failed =
+            m_entries.GetPathHealth(m_entries.GetPathId(n));
+        failed.m_nFailures = 0;
+        failed.m_nRetryAt = 0;
+    }
+
+    if (m_parentFrame->m_bench)
+        m_parentFrame->m_bench->OnPlaying(this);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnMediaPause
+//
+// Called when the media is paused.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnMediaPause(wxMediaEvent& event)
+{
+    wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_MEDIA_PAUSE);
+
+    if (!m_mediactrl || event.GetId() != m_mediactrl->GetId() ||
+        m_order.GetCurrent() == -1)
+        return;
+
+    m_playlist->SetEntryState(m_order.GetCurrent(), wxMEDIAENTRY_PAUSED);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::ScheduleLoop
+//
+// Waiting for wxEVT_MEDIA_FINISHED and calling Play() again stalls the
+// picture and clicks the audio, as the backend has already torn playback
+// down by then.  Instead a timer closes in on the end while the media plays
+// and seeks back to the start while it's still running, the same thing a
+// segment seek does.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::ScheduleLoop()
+{
+    m_bLoopTimed = false;
+    ArmLoopTimer();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::ArmLoopTimer
+//
+// Timers only fire roughly on time, so rather than aiming straight at the
+// end we wake up a little before it and halve the distance each time until
+// we are within wxMediaLoopLead of it.  While paused or stopped we only
+// check back every so often.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::ArmLoopTimer()
+{
+    m_loopTimer.Stop();
+    if (!m_bLoop)
+        return;
+
+    wxFileOffset nLength = m_mediactrl->Length();
+    if (m_mediactrl->GetState() != wxMEDIASTATE_PLAYING || nLength <= 0)
+    {
+        m_bLoopTimed = false;
+        m_loopTimer.StartOnce(wxMediaLoopIdlePoll);
+        return;
+    }
+
+    long nRemaining = (long) (nLength - m_mediactrl->Tell());
+    if (nRemaining <= wxMediaLoopLead)
+    {
+        WrapLoop(nRemaining);
+        return;
+    }
+
+    long nWait = nRemaining > wxMediaLoopApproach
+                    ? nRemaining - wxMediaLoopApproach
+                    : (nRemaining - wxMediaLoopLead) / 2;
+    m_loopTimer.StartOnce(wxMax(nWait, 1L));
+}
+
+void wxMediaPlayerNotebookPage::OnLoopTimer(wxTimerEvent& WXUNUSED(event))
+{
+    ArmLoopTimer();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::WrapLoop
+//
+// Seeks back to the start with nRemaining milliseconds of media left, and
+// records the gap and, if we saw the whole loop, its drift
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::WrapLoop(long nRemaining)
+{
+    wxFileOffset nLength = m_mediactrl->Length();
+    if (!m_mediactrl->Seek(0))
+    {
+        // Let wxEVT_MEDIA_FINISHED deal with it
+        m_bLoopTimed = false;
+        return;
+    }
+
+    wxMediaPlayerLoopStats& stats = m_loopStats;
+    ++stats.m_nLoops;
+    stats.m_nLastGap = wxMax(nRemaining, 0L);
+    stats.m_nMaxGap = wxMax(stats.m_nMaxGap, stats.m_nLastGap);
+
+    if (m_bLoopTimed)
+    {
+        stats.m_nLastDrift = m_loopWatch.Time() - (long) (nLength - nRemaining);
+        stats.m_nMaxDrift = wxMax(stats.m_nMaxDrift, labs(stats.m_nLastDrift));
+        stats.m_nTotalDrift += stats.m_nLastDrift;
+
+        wxLogVerbose(wxT("Loop %ld: gap %ldms, drift %ldms"),
+                     stats.m_nLoops, stats.m_nLastGap, stats.m_nLastDrift);
+    }
+
+    m_loopWatch.Start();
+    m_bLoopTimed = true;
+    ArmLoopTimer();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnMediaFinished
+//
+// Called when the media finishes playing.
+// Here we loop it if the user wants to (has been selected from file menu)
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnMediaFinished(wxMediaEvent& event)
+{
+    wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_MEDIA_FINISHED);
+
+    if (!m_mediactrl || event.GetId() != m_mediactrl->GetId() ||
+        m_order.GetCurrent() == -1)
+        return;
+
+    if(m_bLoop)
+    {
+        //  We wrapped around just before the end, but the backend had
+        //  already queued this
+        if ( m_bLoopTimed && m_loopWatch.Time() < 4 * wxMediaLoopLead )
+            return;
+
+        //  The timer missed the end, restart the old fashioned way
+        if ( !m_mediactrl->Play() )
+        {
+            ReportError(m_order.GetCurrent(), wxT("Couldn't loop"));
+        }
+        else
+        {
+            ++m_loopStats.m_nLoops;
+            ++m_loopStats.m_nLateLoops;
+            ScheduleLoop();
+        }
+    }
+    else
+    {
+        m_playlist->SetEntryState(m_order.GetCurrent(), wxMEDIAENTRY_FINISHED);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnMediaStop
+//
+// Some backends stop a control whose load failed rather than saying so; a
+// standby control that does has nothing to swap in
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnMediaStop(wxMediaEvent& event)
+{
+    if (m_standby && event.GetId() == m_standby->GetId() &&
+        !m_szStandbyLoading.empty())
+        CancelStandby();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::StartHealthSampler
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::StartHealthSampler()
+{
+    m_sampler.Reset();
+    m_healthWatch.Start();
+
+    if (m_parentFrame->m_nHealthInterval > 0)
+        m_healthTimer.Start(m_parentFrame->m_nHealthInterval);
+    else
+        m_healthTimer.Stop();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnHealthTimer
+//
+// Samples where the media is while it plays, and counts what went wrong
+// for the file, the page and the stats
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnHealthTimer(wxTimerEvent& WXUNUSED(event))
+{
+    long n = m_order.GetCurrent();
+    if (n == -1 || m_mediactrl->GetState() != wxMEDIASTATE_PLAYING)
+    {
+        m_healthTimer.Stop();   // until the next wxEVT_MEDIA_PLAY
+        return;
+    }
+
+    wxFileOffset nTotal = m_mediactrl->GetDownloadTotal();
+    bool bDownloading = nTotal > 0 &&
+                        m_mediactrl->GetDownloadProgress() < nTotal;
+
+    int event = m_sampler.Sample((long) m_mediactrl->Tell(),
+                                 m_healthWatch.Time(), bDownloading,
+                                 m_parentFrame->m_nStallTimeout);
+    if (event == wxHEALTH_OK)
+        return;
+
+    m_entries.GetPathHealth(m_entries.GetPathId(n))
+        .Add(event, m_sampler.GetJump());
+    m_health.Add(event, m_sampler.GetJump());
+    if (m_parentFrame->m_stats)
+        m_parentFrame->m_stats->CountEvent(event);
+    m_playlist->RefreshEntry(n);
+
+    wxLogVerbose(wxT("Entry %ld: %s at %ldms, %ldms behind at %.2fx"), n,
+                 wxGetMediaHealthEventText(event), m_sampler.GetPosition(),
+                 m_sampler.GetDrift(), m_sampler.GetRate() / 1000.0);
+
+    if (event == wxHEALTH_STALLED)
+        RecoverPlayback();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::RecoverPlayback
+//
+// Gets stalled media going again the way --on-stall says.  Nobody might be
+// there to click a message box away, so this only logs what it did.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::RecoverPlayback()
+{
+    long n = m_order.GetCurrent();
+    int action = m_parentFrame->m_nStallAction;
+
+    if (action == wxSTALL_RELOAD)
+    {
+        m_healthTimer.Stop();
+        m_loopTimer.Stop();
+
+        wxURI uripath(m_szFile);
+        bool bOK = uripath.IsReference() ? m_mediactrl->Load(m_szFile)
+                                         : m_mediactrl->Load(uripath);
+        if (!bOK)
+        {
+            ReportError(n, wxT("Couldn't reload"));
+            return;
+        }
+
+        m_nResumeAt = m_sampler.GetPosition();
+        m_playlist->SetEntryState(n, wxMEDIAENTRY_OPENED);
+    }
+    else if (action == wxSTALL_SKIP)
+    {
+        m_parentFrame->PlayNext(this);
+    }
+    else
+    {
+        return;
+    }
+
+    m_entries.GetPathHealth(m_entries.GetPathId(n)).Add(wxHEALTH_RECOVERED, 0);
+    m_health.Add(wxHEALTH_RECOVERED, 0);
+    if (m_parentFrame->m_stats)
+        m_parentFrame->m_stats->CountEvent(wxHEALTH_RECOVERED);
+    m_playlist->RefreshEntry(n);
+
+    wxLogVerbose(wxT("Entry %ld: %s after stalling"), n,
+                 action == wxSTALL_RELOAD ? wxT("reloaded") : wxT("skipped"));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::ReportError
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::ReportError(long n, const wxString& what)
+{
+    wxMediaPlayerHealth& health =
+        m_entries.GetPathHealth(m_entries.GetPathId(n));
+    health.Add(wxHEALTH_FAILED, 0);
+    m_health.Add(wxHEALTH_FAILED, 0);
+
+    wxMediaPlayerStats* stats = m_parentFrame->m_stats;
+    if (stats)
+        stats->CountEvent(wxHEALTH_FAILED);
+
+    wxString message = what + wxT(" ") + m_entries.GetPath(n);
+    if (health.m_nFailures >= wxMediaQuarantineFailures)
+    {
+        if (stats && health.m_nFailures == wxMediaQuarantineFailures)
+            stats->CountEvent(wxHEALTH_QUARANTINED);
+
+        m_playlist->SetEntryState(n, wxMEDIAENTRY_QUARANTINED);
+        message += wxT(", quarantined");
+    }
+    else
+    {
+        long nDelay = wxMediaRetryDelay << (health.m_nFailures - 1);
+        health.m_nRetryAt =
+            m_parentFrame->m_retryClock.TimeInMicro().GetValue() / 1000 +
+            nDelay;
+
+        m_playlist->SetEntryState(n, wxMEDIAENTRY_ERROR);
+        message += wxString::Format(wxT(", retrying in %lds"), nDelay / 1000);
+    }
+
+    m_parentFrame->QueueError(m_nPageId, n, message);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::IsPlayable
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerNotebookPage::IsPlayable(long n) const
+{
+    const wxMediaPlayerHealth* health = m_entries.FindHealth(n);
+    if (!health || !health->m_nFailures)
+        return true;
+
+    const wxInt64 nNow =
+        m_parentFrame->m_retryClock.TimeInMicro().GetValue() / 1000;
+    return health->m_nFailures < wxMediaQuarantineFailures &&
+           nNow >= health->m_nRetryAt;
+}
+
+void wxMediaPlayerNotebookPage::OnRetryTimer(wxTimerEvent& WXUNUSED(event))
+{
+    m_parentFrame->SkipToPlayable(this);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnLoadTimer
+//
+// A stuck backend or a dead network share may never send
+// wxEVT_MEDIA_LOADED.  The load fails like any other, which moves on to
+// the next playable entry through wxMediaPlayerFrame::OnErrors().
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnLoadTimer(wxTimerEvent& WXUNUSED(event))
+{
+    if (m_order.GetCurrent() != -1)
+        ReportError(m_order.GetCurrent(), wxT("Timed out loading"));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::CreateMediaCtrl
+//
+// NULL if the backend won't give us another one
+// ----------------------------------------------------------------------------
+wxMediaCtrl* wxMediaPlayerNotebookPage::CreateMediaCtrl(wxWindowID id)
+{
+    wxMediaCtrl* ctrl = new wxMediaCtrl();
+    if ( !ctrl->Create(this, id, wxEmptyString, wxDefaultPosition,
+                       wxDefaultSize, 0, m_szBackend) )
+    {
+        ctrl->Destroy();
+        return NULL;
+    }
+    return ctrl;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::Suspend
+//
+// The timers would only find the media paused, and the retry timer would
+// start playing on a page nobody looks at
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::Suspend()
+{
+    if (m_nResidency != wxPAGE_ACTIVE || !m_mediactrl)
+        return;
+
+    m_loadTimer.Stop();
+    m_loopTimer.Stop();
+    m_healthTimer.Stop();
+    m_retryTimer.Stop();
+    m_sliderTimer.Stop();
+    m_seekTimer.Stop();
+    m_nSeekTarget = -1;
+
+    m_nResidency = wxPAGE_SUSPENDED;
+    m_bResumePlaying = m_mediactrl->GetState() == wxMEDIASTATE_PLAYING;
+    m_nSuspendedAt = (long) m_mediactrl->Tell();
+
+    if (m_bResumePlaying && !m_mediactrl->Pause())
+        m_parentFrame->QueueError(m_nPageId, -1,
+                                  wxT("Couldn't pause hidden ") + m_szFile);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::Evict
+//
+// wxMediaCtrl can't unload media, so the controls go and the page is left
+// the way it was before it loaded anything.  Restore() loads it again.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::Evict()
+{
+    if (m_nResidency != wxPAGE_SUSPENDED)
+        return;
+
+    GetSizer()->Detach(m_mediactrl);
+    GetSizer()->Insert(0, 0, 0);
+    m_mediactrl->Destroy();
+    m_mediactrl = NULL;
+    UpdateSlider();
+    Layout();
+
+    if (m_standby)
+    {
+        m_standby->Destroy();
+        m_standby = NULL;
+    }
+    CancelStandby();
+
+    m_nResidency = wxPAGE_EVICTED;
+    wxLogVerbose(wxT("Page %d: unloaded %s at %ldms"), m_nPageId,
+                 m_szFile.c_str(), m_nSuspendedAt);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::Activate
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerNotebookPage::Activate()
+{
+    bool bEvicted = m_nResidency == wxPAGE_EVICTED;
+    m_nResidency = wxPAGE_ACTIVE;
+    return bEvicted;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::EnsureMediaCtrl
+//
+// Takes the place of the spacer holding it.  The first media control
+// anywhere starts up the backend, which is most of what this costs.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::EnsureMediaCtrl()
+{
+    if (m_mediactrl)
+        return;
+
+    gs_startupTrace.Mark(wxSTARTUP_BACKEND_START);
+    m_mediactrl = new wxMediaCtrl();
+
+    //  Make sure creation was successful
+    bool bOK = m_mediactrl->Create(this, wxID_MEDIACTRL, wxEmptyString,
+                                   wxDefaultPosition, wxDefaultSize, 0,
+                                   m_szBackend);
+    wxASSERT_MSG(bOK, wxT("Could not create media control!"));
+    wxUnusedVar(bOK);
+    gs_startupTrace.Mark(wxSTARTUP_BACKEND_DONE);
+
+    GetSizer()->Detach(0);
+    GetSizer()->Insert(0, m_mediactrl, 0,
+                       wxALIGN_CENTER_HORIZONTAL|wxALL|wxEXPAND, 5);
+    Layout();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::Restore
+//
+// A suspended page plays on if it did, an evicted one loads its entry again
+// and OnMediaLoaded() seeks back to where it was
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::Restore()
+{
+    if (m_nResidency == wxPAGE_ACTIVE)
+        return;
+
+    bool bEvicted = Activate();
+    long n = m_order.GetCurrent();
+    if (n == -1)
+        return;
+
+    //  Failed while shown, so try what's next instead
+    wxUint8 nState = m_entries.GetState(n);
+    if (nState == wxMEDIAENTRY_ERROR || nState == wxMEDIAENTRY_QUARANTINED)
+    {
+        m_parentFrame->SkipToPlayable(this);
+        return;
+    }
+
+    if (!bEvicted)
+    {
+        if (m_bResumePlaying && !m_mediactrl->Play())
+            ReportError(n, wxT("Couldn't resume"));
+        else
+            ScheduleLoop();
+        return;
+    }
+
+    EnsureMediaCtrl();
+
+    wxURI uripath(m_szFile);
+    bool bOK = uripath.IsReference() ? m_mediactrl->Load(m_szFile)
+                                     : m_mediactrl->Load(uripath);
+    if (!bOK)
+    {
+        ReportError(n, wxT("Couldn't restore"));
+        return;
+    }
+
+    m_nResumeAt = m_nSuspendedAt;
+    m_bResumePaused = !m_bResumePlaying;
+    m_playlist->SetEntryState(n, wxMEDIAENTRY_OPENED);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::IsBeingDragged
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerNotebookPage::IsBeingDragged()
+{
+    return m_bIsBeingDragged;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::RequestKeyframes
+//
+// Until the index arrives seeks go exactly where they're asked to
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::RequestKeyframes()
+{
+    m_keyframes.clear();
+
+    if (wxURI(m_szFile).IsReference())
+        m_parentFrame->m_prober->RequestIndex(m_nPageId, m_szFile);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::FindKeyframe
+// ----------------------------------------------------------------------------
+long wxMediaPlayerNotebookPage::FindKeyframe(long nPos, int nDirection) const
+{
+    if (m_keyframes.empty())
+        return nPos + nDirection * wxMediaSeekFallbackStep;
+
+    //  Back from a bit before, so stepping back while playing gets past
+    //  the keyframe the media just went through
+    wxUint32 nFrom = (wxUint32) wxMax(nDirection < 0 ? nPos - wxMediaSeekSlack
+                                                     : nPos, 0L);
+
+    //  First keyframe after nFrom
+    size_t nLow = 0, nHigh = m_keyframes.size();
+    while (nLow < nHigh)
+    {
+        size_t nMid = (nLow + nHigh) / 2;
+        if (m_keyframes[nMid] <= nFrom)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+
+    if (nDirection > 0)
+        return nLow < m_keyframes.size() ? (long) m_keyframes[nLow] : nPos;
+
+    //  m_keyframes[nLow - 1] is at or before nFrom
+    if (nDirection < 0)
+    {
+        if (nLow && m_keyframes[nLow - 1] == nFrom)
+            --nLow;
+        return nLow ? (long) m_keyframes[nLow - 1] : 0;
+    }
+
+    if (!nLow)
+        return m_keyframes[0];
+    if (nLow == m_keyframes.size() ||
+        nFrom - m_keyframes[nLow - 1] <= m_keyframes[nLow] - nFrom)
+        return m_keyframes[nLow - 1];
+    return m_keyframes[nLow];
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::GetSeekPosition
+//
+// Keys held down step on from where the last step goes, not from where
+// the backend has got to
+// ----------------------------------------------------------------------------
+long wxMediaPlayerNotebookPage::GetSeekPosition() const
+{
+    if (m_nSeekTarget != -1)
+        return m_nSeekTarget;
+    if (m_seekTimer.IsRunning())
+        return m_nLastSeek;
+    return m_mediactrl ? (long) m_mediactrl->Tell() : 0;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::RequestSeek
+//
+// A drag sends many more positions than a backend can seek to, and each
+// seek flushes the pipeline and decodes from a keyframe again.  Only the
+// first goes out right away; the rest wait for m_seekTimer, by when only
+// the last of them counts.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::RequestSeek(long nPos)
+{
+    if (!m_mediactrl || m_szFile.empty())
+        return;
+
+    long nLength = (long) m_mediactrl->Length();
+    nPos = wxMax(0L, nLength > 0 ? wxMin(nPos, nLength) : nPos);
+
+    if (m_seekTimer.IsRunning())
+    {
+        m_nSeekTarget = nPos != m_nLastSeek ? nPos : -1;
+        return;
+    }
+
+    DoSeek(nPos);
+}
+
+void wxMediaPlayerNotebookPage::DoSeek(long nPos)
+{
+    {
+        wxMediaPlayerStatsScope scope(m_parentFrame->m_stats, wxSTATS_SEEK);
+        if (m_mediactrl->Seek(nPos) == wxInvalidOffset)
+            m_parentFrame->QueueError(m_nPageId, -1,
+                                      wxT("Couldn't seek in ") + m_szFile);
+    }
+
+    m_nLastSeek = nPos;
+    m_seekTimer.StartOnce(wxMediaSeekSettle);
+
+    //  The position jumped, which is neither a drop nor the end coming up
+    m_sampler.Reset();
+    m_healthWatch.Start();
+    if (m_mediactrl->GetState() == wxMEDIASTATE_PLAYING)
+        ScheduleLoop();
+
+    if (!m_bIsBeingDragged)
+        m_slider->SetValue(nPos);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSeekTimer
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSeekTimer(wxTimerEvent& WXUNUSED(event))
+{
+    if (m_nSeekTarget == -1 || !m_mediactrl)
+        return;
+
+    long nPos = m_nSeekTarget;
+    m_nSeekTarget = -1;
+    DoSeek(nPos);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSeekTrack
+//
+// While dragging, seeks snap to the nearest keyframe, which shows a frame
+// without decoding the ones before it
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSeekTrack(wxScrollEvent& event)
+{
+    m_bIsBeingDragged = true;
+    RequestSeek(FindKeyframe(event.GetPosition(), 0));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSeekRelease
+//
+// ...and once the slider is let go, go exactly where it was let go
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSeekRelease(wxScrollEvent& event)
+{
+    m_bIsBeingDragged = false;
+    RequestSeek(event.GetPosition());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSeekChanged
+//
+// Clicks beside the thumb and the slider's own keys; the end of a drag was
+// handled by OnSeekRelease() already
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSeekChanged(wxScrollEvent& event)
+{
+    if (!m_bIsBeingDragged)
+        RequestSeek(event.GetPosition());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::OnSliderTimer
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::OnSliderTimer(wxTimerEvent& WXUNUSED(event))
+{
+    UpdateSlider();
+
+    if (!m_mediactrl || m_mediactrl->GetState() != wxMEDIASTATE_PLAYING)
+        m_sliderTimer.Stop();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerNotebookPage::UpdateSlider
+//
+// Leaves the thumb alone while it's dragged or a seek is settling, the
+// backend would only report where it was before
+// ----------------------------------------------------------------------------
+void wxMediaPlayerNotebookPage::UpdateSlider()
+{
+    if (!m_mediactrl || m_szFile.empty())
+    {
+        m_slider->SetRange(0, 1);
+        m_slider->SetValue(0);
+        m_slider->Disable();
+        return;
+    }
+
+    long nLength = (long) m_mediactrl->Length();
+    if (nLength > 0 && nLength != m_slider->GetMax())
+        m_slider->SetRange(0, nLength);
+    m_slider->Enable(nLength > 0);
+
+    if (!m_bIsBeingDragged && !m_seekTimer.IsRunning())
+        m_slider->SetValue((long) m_mediactrl->Tell());
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerEntryStore
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+wxMediaPlayerEntryStore::wxMediaPlayerEntryStore()
+                       : m_nFingerprints(0)
+{
+    // Byte 0 of the pool is never used by a path, it's only there so that
+    // &m_pool[0] is valid even for a store holding just empty paths
+    m_pool.push_back('\0');
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::Add
+//
+// Converts the path to UTF-8 once, interns it and appends a new idle entry
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerEntryStore::Add(const wxString& path)
+{
+    const wxScopedCharBuffer utf8 = path.utf8_str();
+    return AddUTF8(utf8.data(), utf8.length());
+}
+
+size_t wxMediaPlayerEntryStore::AddUTF8(const char* path, size_t len)
+{
+    Entry entry;
+    entry.m_nPath = InternPath(path, len);
+    entry.m_nState = wxMEDIAENTRY_IDLE;
+
+    PathRecord& rec = m_paths[entry.m_nPath];
+    entry.m_nPrevEntry = rec.m_nLastEntry;
+    m_entries.push_back(entry);
+    ++rec.m_nEntries;
+    rec.m_nLastEntry = (wxUint32) m_entries.size();
+
+    return m_entries.size() - 1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::EditEntries
+//
+// Paths stay interned after their last entry went, so that the ids held by
+// the prober and others stay valid
+// ----------------------------------------------------------------------------
+void wxMediaPlayerEntryStore::EditEntries(const wxVector<wxUint32>& paths,
+                                          wxVector<long>& map)
+{
+    map.resize(m_entries.size());
+
+    size_t nKept = 0;
+    for ( size_t n = 0; n < m_entries.size(); ++n )
+    {
+        Entry entry = m_entries[n];
+        const wxUint32 path = entry.m_nPath;
+        const wxUint32 to = path < paths.size() ? paths[path] : path;
+        if ( to != path )
+        {
+            --m_paths[path].m_nEntries;
+            if ( to == wxMediaNoPath )
+            {
+                map[n] = -1;
+                continue;
+            }
+            ++m_paths[to].m_nEntries;
+            entry.m_nPath = to;
+        }
+
+        map[n] = (long) nKept;
+        m_entries[nKept++] = entry;
+    }
+    m_entries.resize(nKept);
+
+    //  The entries of each path are linked again with their new indexes
+    for ( size_t path = 0; path < m_paths.size(); ++path )
+        m_paths[path].m_nLastEntry = 0;
+    for ( size_t n = 0; n < m_entries.size(); ++n )
+    {
+        PathRecord& rec = m_paths[m_entries[n].m_nPath];
+        m_entries[n].m_nPrevEntry = rec.m_nLastEntry;
+        rec.m_nLastEntry = (wxUint32) n + 1;
+    }
+
+    //  Fingerprints follow their files
+    for ( size_t n = 0; n < m_fingerprints.size(); ++n )
+    {
+        const wxUint32 path = m_fingerprints[n].m_nPath;
+        if ( m_fingerprints[n].m_nFingerprint && path < paths.size() &&
+             paths[path] != wxMediaNoPath )
+            m_fingerprints[n].m_nPath = paths[path];
+    }
+
+    //  So do their plays
+    for ( size_t path = 0; path < paths.size(); ++path )
+    {
+        const wxUint32 to = paths[path];
+        if ( to == path || to == wxMediaNoPath || !m_paths[path].m_nPlays )
+            continue;
+
+        m_paths[to].m_nPlays += m_paths[path].m_nPlays;
+        m_paths[to].m_nLastPlayed = wxMax(m_paths[to].m_nLastPlayed,
+                                          m_paths[path].m_nLastPlayed);
+        m_paths[path].m_nPlays = 0;
+        m_paths[path].m_nLastPlayed = 0;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::Reserve
+//
+// Pre-sizes the tables when the caller knows how much is coming, so that a
+// large batch doesn't go through repeated reallocations
+// ----------------------------------------------------------------------------
+void wxMediaPlayerEntryStore::Reserve(size_t count)
+{
+    m_entries.reserve(count);
+    m_paths.reserve(count);
+    m_info.reserve(count);
+}
+
+void wxMediaPlayerEntryStore::Clear()
+{
+    m_pool.clear();
+    m_pool.push_back('\0');
+    m_paths.clear();
+    m_info.clear();
+    m_entries.clear();
+    m_intern.clear();
+    m_health.clear();
+    m_fingerprints.clear();
+    m_nFingerprints = 0;
+}
+
+wxString wxMediaPlayerEntryStore::GetPath(size_t n) const
+{
+    const PathRecord& rec = m_paths[m_entries[n].m_nPath];
+    return wxString::FromUTF8(&m_pool[0] + rec.m_nOffset, rec.m_nLength);
+}
+
+const char* wxMediaPlayerEntryStore::GetPathUTF8(wxUint32 path,
+                                                 size_t* len) const
+{
+    const PathRecord& rec = m_paths[path];
+    *len = rec.m_nLength;
+    return &m_pool[0] + rec.m_nOffset;
+}
+
+wxString wxMediaPlayerEntryStore::GetName(size_t n) const
+{
+    size_t len;
+    const char* name = GetNameUTF8(m_entries[n].m_nPath, &len);
+    return wxString::FromUTF8(name, len);
+}
+
+const char* wxMediaPlayerEntryStore::GetNameUTF8(wxUint32 path,
+                                                 size_t* len) const
+{
+    const PathRecord& rec = m_paths[path];
+    *len = rec.m_nNameLength;
+    return &m_pool[0] + rec.m_nOffset + rec.m_nNameStart;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::InternPath
+//
+// Returns the index of the path in m_paths, adding it to the pool if this
+// is the first time we see it.  The display name is worked out here, once,
+// the same way wxFileName::GetName() would: everything after the last path
+// separator up to the last dot.
+// ----------------------------------------------------------------------------
+wxUint32 wxMediaPlayerEntryStore::InternPath(const char* data, size_t len)
+{
+    const wxUint32 hash = wxMediaPlayerHashPath(data, len);
+
+    // Keep the load factor under 3/4
+    if ( (m_paths.size() + 1) * 4 > m_intern.size() * 3 )
+        GrowInternTable();
+
+    const size_t mask = m_intern.size() - 1;
+    size_t slot = hash & mask;
+    while ( m_intern[slot] )
+    {
+        const PathRecord& rec = m_paths[m_intern[slot] - 1];
+        if ( rec.m_nHash == hash && rec.m_nLength == len &&
+             memcmp(&m_pool[0] + rec.m_nOffset, data, len) == 0 )
+            return m_intern[slot] - 1;
+
+        slot = (slot + 1) & mask;
+    }
+
+    PathRecord rec;
+    rec.m_nOffset = m_pool.size();
+    rec.m_nLength = len;
+    rec.m_nHash = hash;
+    rec.m_nEntries = 0;
+    rec.m_nLastEntry = 0;
+    rec.m_nPlays = 0;
+    rec.m_nLastPlayed = 0;
+
+    size_t nameStart = len;
+    while ( nameStart > 0 && data[nameStart - 1] != '/'
+#ifdef __WINDOWS__
+            && data[nameStart - 1] != '\\'
+#endif
+          )
+        --nameStart;
+
+    size_t nameEnd = len;
+    while ( nameEnd > nameStart + 1 && data[nameEnd - 1] != '.' )
+        --nameEnd;
+    if ( nameEnd > nameStart + 1 )
+        --nameEnd;          // drop the extension
+    else
+        nameEnd = len;      // no extension
+
+    rec.m_nNameStart = nameStart;
+    rec.m_nNameLength = nameEnd - nameStart;
+
+    m_pool.resize(rec.m_nOffset + len);
+    memcpy(&m_pool[0] + rec.m_nOffset, data, len);
+
+    wxMediaPlayerMediaInfo info;
+    memset(&info, 0, sizeof(info));
+
+    m_paths.push_back(rec);
+    m_info.push_back(info);
+    m_intern[slot] = m_paths.size();
+
+    return m_paths.size() - 1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::GrowInternTable
+//
+// Doubles the intern table and reinserts every path using its cached hash
+// ----------------------------------------------------------------------------
+void wxMediaPlayerEntryStore::GrowInternTable()
+{
+    size_t size = m_intern.empty() ? 1024 : m_intern.size() * 2;
+
+    m_intern.clear();
+    m_intern.resize(size, 0);
+
+    const size_t mask = size - 1;
+    for ( size_t n = 0; n < m_paths.size(); ++n )
+    {
+        size_t slot = m_paths[n].m_nHash & mask;
+        while ( m_intern[slot] )
+            slot = (slot + 1) & mask;
+        m_intern[slot] = n + 1;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::FindPath
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerEntryStore::FindPath(const char* data, size_t len,
+                                       wxUint32* path) const
+{
+    if ( m_intern.empty() )
+        return false;
+
+    const wxUint32 hash = wxMediaPlayerHashPath(data, len);
+    const size_t mask = m_intern.size() - 1;
+    for ( size_t slot = hash & mask; m_intern[slot]; slot = (slot + 1) & mask )
+    {
+        const PathRecord& rec = m_paths[m_intern[slot] - 1];
+        if ( rec.m_nHash == hash && rec.m_nLength == len &&
+             memcmp(&m_pool[0] + rec.m_nOffset, data, len) == 0 )
+        {
+            *path = m_intern[slot] - 1;
+            return rec.m_nEntries != 0;
+        }
+    }
+    return false;
+}
+
+size_t wxMediaPlayerEntryStore::FindEntry(wxUint32 path) const
+{
+    wxUint32 n = m_paths[path].m_nLastEntry;
+    if ( !n )
+        return m_entries.size();
+
+    while ( m_entries[n - 1].m_nPrevEntry )
+        n = m_entries[n - 1].m_nPrevEntry;
+    return n - 1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::SetPathFingerprint
+//
+// The table is keyed by the fingerprint alone, which is already a good hash
+// ----------------------------------------------------------------------------
+void wxMediaPlayerEntryStore::SetPathFingerprint(wxUint32 path,
+                                                 wxUint64 fingerprint)
+{
+    if ( !fingerprint )
+        return;
+
+    if ( (m_nFingerprints + 1) * 4 > m_fingerprints.size() * 3 )
+        GrowFingerprintTable();
+
+    const size_t mask = m_fingerprints.size() - 1;
+    size_t slot = (size_t) fingerprint & mask;
+    while ( m_fingerprints[slot].m_nFingerprint )
+    {
+        if ( m_fingerprints[slot].m_nFingerprint == fingerprint )
+        {
+            if ( !m_paths[m_fingerprints[slot].m_nPath].m_nEntries )
+                m_fingerprints[slot].m_nPath = path;
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    m_fingerprints[slot].m_nFingerprint = fingerprint;
+    m_fingerprints[slot].m_nPath = path;
+    ++m_nFingerprints;
+}
+
+bool wxMediaPlayerEntryStore::FindFingerprint(wxUint64 fingerprint,
+                                              wxUint32* path) const
+{
+    if ( !fingerprint || m_fingerprints.empty() )
+        return false;
+
+    const size_t mask = m_fingerprints.size() - 1;
+    for ( size_t slot = (size_t) fingerprint & mask;
+          m_fingerprints[slot].m_nFingerprint; slot = (slot + 1) & mask )
+    {
+        if ( m_fingerprints[slot].m_nFingerprint == fingerprint )
+        {
+            *path = m_fingerprints[slot].m_nPath;
+            return m_paths[*path].m_nEntries != 0;
+        }
+    }
+    return false;
+}
+
+void wxMediaPlayerEntryStore::GrowFingerprintTable()
+{
+    wxVector<FingerprintSlot> old;
+    old.swap(m_fingerprints);
+
+    FingerprintSlot empty;
+    empty.m_nFingerprint = 0;
+    empty.m_nPath = 0;
+    m_fingerprints.resize(old.empty() ? 1024 : old.size() * 2, empty);
+
+    const size_t mask = m_fingerprints.size() - 1;
+    for ( size_t n = 0; n < old.size(); ++n )
+    {
+        if ( !old[n].m_nFingerprint )
+            continue;
+
+        size_t slot = (size_t) old[n].m_nFingerprint & mask;
+        while ( m_fingerprints[slot].m_nFingerprint )
+            slot = (slot + 1) & mask;
+        m_fingerprints[slot] = old[n];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerEntryStore::FindHealthRecord
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerEntryStore::FindHealthRecord(wxUint32 path) const
+{
+    size_t nLow = 0, nHigh = m_health.size();
+    while (nLow < nHigh)
+    {
+        size_t nMid = (nLow + nHigh) / 2;
+        if (m_health[nMid].m_nPath < path)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    return nLow;
+}
+
+const wxMediaPlayerHealth* wxMediaPlayerEntryStore::FindHealth(size_t n) const
+{
+    const wxUint32 path = m_entries[n].m_nPath;
+    size_t i = FindHealthRecord(path);
+    if (i < m_health.size() && m_health[i].m_nPath == path)
+        return &m_health[i].m_health;
+    return NULL;
+}
+
+wxMediaPlayerHealth& wxMediaPlayerEntryStore::GetPathHealth(wxUint32 path)
+{
+    size_t i = FindHealthRecord(path);
+    if (i == m_health.size() || m_health[i].m_nPath != path)
+    {
+        HealthRecord record;
+        memset(&record, 0, sizeof(record));
+        record.m_nPath = path;
+        m_health.insert(m_health.begin() + i, record);
+    }
+    return m_health[i].m_health;
+}
+
+void wxMediaPlayerEntryStore::RecordPlay(wxUint32 path, wxUint32 when)
+{
+    ++m_paths[path].m_nPlays;
+    m_paths[path].m_nLastPlayed = when;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerSearchIndex
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Bytes in a block of a list: the offset of the next block, then varints.
+// Blocks start at multiples of it, so a list's tail is full when the next
+// byte would go at one.
+static const wxUint32 wxMediaSearchBlock = 32;
+
+// A list is only merged with the candidates while it is at most this many
+// times longer, past that checking the candidates' paths is cheaper
+static const size_t wxMediaSearchMergeRatio = 32;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::Cursor
+// ----------------------------------------------------------------------------
+wxMediaPlayerSearchIndex::Cursor::Cursor(const wxVector<wxUint8>& blocks,
+                                         const Slot& slot)
+                                 : m_blocks(&blocks[0]),
+                                   m_nBlock(slot.m_nHead),
+                                   m_nAt(sizeof(wxUint32)),
+                                   m_nLeft(slot.m_nCount),
+                                   m_nPath(0)
+{
+}
+
+bool wxMediaPlayerSearchIndex::Cursor::Next()
+{
+    if (!m_nLeft)
+        return false;
+    --m_nLeft;
+
+    wxUint32 delta = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        if (m_nAt == wxMediaSearchBlock)
+        {
+            memcpy(&m_nBlock, m_blocks + m_nBlock, sizeof(wxUint32));
+            m_nAt = sizeof(wxUint32);
+        }
+
+        const wxUint8 byte = m_blocks[m_nBlock + m_nAt++];
+        delta |= (wxUint32) (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    m_nPath += delta;
+    return true;
+}
+
+wxMediaPlayerSearchIndex::wxMediaPlayerSearchIndex()
+{
+    Clear();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::Clear
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::Clear()
+{
+    m_slots.clear();
+    m_nSlots = 0;
+    m_blocks.assign(wxMediaSearchBlock, 0);
+    m_nPaths = 0;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::Fold
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::Fold(const wxString& text,
+                                    wxVector<char>& folded)
+{
+    const wxScopedCharBuffer utf8 = text.utf8_str();
+    folded.assign(utf8.data(), utf8.data() + utf8.length());
+    for (size_t n = 0; n < folded.size(); ++n)
+    {
+        if (folded[n] >= 'A' && folded[n] <= 'Z')
+            folded[n] += 'a' - 'A';
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::Contains
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerSearchIndex::Contains(const char* text, size_t len,
+                                        const char* query, size_t queryLen)
+{
+    if (queryLen > len)
+        return false;
+
+    //  memchr() finds where the query could start much quicker than a loop
+    //  of ours, it looks for either case of a letter separately
+    const char first = query[0];
+    const char other = first >= 'a' && first <= 'z' ? first - 'a' + 'A'
+                                                    : '\0';
+    const char* const end = text + len - queryLen + 1;
+    const char* lower = (const char*) memchr(text, first, end - text);
+    const char* upper = other ? (const char*) memchr(text, other, end - text)
+                              : NULL;
+    while (lower || upper)
+    {
+        const char* p;
+        if (!upper || (lower && lower < upper))
+        {
+            p = lower;
+            lower = (const char*) memchr(p + 1, first, end - p - 1);
+        }
+        else
+        {
+            p = upper;
+            upper = (const char*) memchr(p + 1, other, end - p - 1);
+        }
+
+        size_t n = 1;
+        for (; n < queryLen; ++n)
+        {
+            char c = p[n];
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            if (c != query[n])
+                break;
+        }
+        if (n == queryLen)
+            return true;
+    }
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::Update
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::Update(const wxMediaPlayerEntryStore& entries)
+{
+    const wxUint32 nPaths = (wxUint32) entries.GetPathCount();
+    for (; m_nPaths < nPaths; ++m_nPaths)
+    {
+        size_t len;
+        const char* path = entries.GetPathUTF8(m_nPaths, &len);
+        m_folded.assign(path, path + len);
+        while ((m_nSlots + len) * 3 > m_slots.size() * 2)
+            GrowTable();
+        for (size_t n = 0; n < len; ++n)
+        {
+            if (m_folded[n] >= 'A' && m_folded[n] <= 'Z')
+                m_folded[n] += 'a' - 'A';
+        }
+
+        for (size_t n = 0; n + 2 < len; ++n)
+        {
+            const wxUint32 key = ((wxUint32) (wxUint8) m_folded[n] << 16 |
+                                  (wxUint32) (wxUint8) m_folded[n + 1] << 8 |
+                                  (wxUint32) (wxUint8) m_folded[n + 2]) + 1;
+            AddPosting(key, m_nPaths);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::FindSlot
+//
+// The slot of key, or the free one it would go in
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerSearchIndex::FindSlot(wxUint32 key) const
+{
+    //  The low bits of the product only depend on the last byte
+    const wxUint32 hash = key * 2654435761U;
+    const size_t mask = m_slots.size() - 1;
+    size_t slot = (size_t) ((hash ^ hash >> 16) & mask);
+    while (m_slots[slot].m_nKey && m_slots[slot].m_nKey != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::AddPosting
+//
+// A trigram that comes up twice in a path is only listed once
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::AddPosting(wxUint32 key, wxUint32 path)
+{
+    Slot& slot = m_slots[FindSlot(key)];
+    if (!slot.m_nKey)
+    {
+        slot.m_nKey = key;
+        ++m_nSlots;
+    }
+    else if (slot.m_nLast == path)
+        return;
+
+    wxUint32 delta = slot.m_nCount ? path - slot.m_nLast : path;
+    while (delta >= 0x80)
+    {
+        PutByte(slot, (wxUint8) (delta | 0x80));
+        delta >>= 7;
+    }
+    PutByte(slot, (wxUint8) delta);
+
+    slot.m_nLast = path;
+    ++slot.m_nCount;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::PutByte
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::PutByte(Slot& slot, wxUint8 byte)
+{
+    if (slot.m_nTail % wxMediaSearchBlock == 0)
+    {
+        const wxUint32 block = (wxUint32) m_blocks.size();
+        m_blocks.resize(m_blocks.size() + wxMediaSearchBlock, 0);
+        if (slot.m_nTail)
+            memcpy(&m_blocks[slot.m_nTail - wxMediaSearchBlock], &block,
+                   sizeof(wxUint32));
+        else
+            slot.m_nHead = block;
+        slot.m_nTail = block + sizeof(wxUint32);
+    }
+    m_blocks[slot.m_nTail++] = byte;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::GrowTable
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::GrowTable()
+{
+    wxVector<Slot> old;
+    old.swap(m_slots);
+
+    Slot empty;
+    memset(&empty, 0, sizeof(empty));
+    m_slots.resize(old.empty() ? 4096 : old.size() * 2, empty);
+
+    for (size_t n = 0; n < old.size(); ++n)
+    {
+        if (old[n].m_nKey)
+            m_slots[FindSlot(old[n].m_nKey)] = old[n];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSearchIndex::Find
+//
+// The list of the rarest trigram of the query gives the candidates, unless
+// there are some already, which the lists of the other trigrams whittle
+// down while that's cheaper than reading the paths.  What is left is then
+// checked for the whole query, as trigrams don't say where in the path
+// they are; a query of one trigram is answered by its list alone.  A query
+// shorter than that has to look at every path, or every candidate.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSearchIndex::Find(const wxMediaPlayerEntryStore& entries,
+                                    const wxVector<char>& query,
+                                    const wxVector<wxUint32>* candidates,
+                                    wxVector<wxUint32>& paths) const
+{
+    paths.clear();
+    if (query.empty())
+        return;
+
+    //  The query's lists, rarest first
+    wxVector<size_t> lists;
+    for (size_t n = 0; n + 2 < query.size() && !m_slots.empty(); ++n)
+    {
+        const wxUint32 key = ((wxUint32) (wxUint8) query[n] << 16 |
+                              (wxUint32) (wxUint8) query[n + 1] << 8 |
+                              (wxUint32) (wxUint8) query[n + 2]) + 1;
+        const size_t slot = FindSlot(key);
+        if (!m_slots[slot].m_nKey)
+            return;
+
+        size_t at = lists.size();
+        while (at > 0 &&
+               m_slots[lists[at - 1]].m_nCount > m_slots[slot].m_nCount)
+            --at;
+        if (at > 0 && lists[at - 1] == slot)
+            continue;
+        lists.insert(lists.begin() + at, slot);
+    }
+
+    wxVector<wxUint32> found;
+    size_t nMerged = 0;
+    if (!lists.empty() && !candidates)
+    {
+        Cursor first(m_blocks, m_slots[lists[0]]);
+        found.reserve(m_slots[lists[0]].m_nCount);
+        while (first.Next())
+            found.push_back(first.m_nPath);
+        candidates = &found;
+        nMerged = 1;
+    }
+    else if (!lists.empty() && m_slots[lists[0]].m_nCount /
+                               wxMediaSearchMergeRatio <= candidates->size())
+    {
+        found = *candidates;
+        candidates = &found;
+    }
+
+    for (; nMerged < lists.size() && candidates == &found; ++nMerged)
+    {
+        const Slot& slot = m_slots[lists[nMerged]];
+        if (found.empty() ||
+            slot.m_nCount / wxMediaSearchMergeRatio > found.size())
+            break;
+
+        Cursor cursor(m_blocks, slot);
+        size_t nKept = 0;
+        bool bMore = cursor.Next();
+        for (size_t n = 0; n < found.size() && bMore; ++n)
+        {
+            while (bMore && cursor.m_nPath < found[n])
+                bMore = cursor.Next();
+            if (bMore && cursor.m_nPath == found[n])
+                found[nKept++] = found[n];
+        }
+        found.resize(nKept);
+    }
+
+    const bool bExact = query.size() == 3 && nMerged == 1;
+    const bool bAll = !candidates;
+    const size_t nPaths = bAll ? entries.GetPathCount() : candidates->size();
+    for (size_t n = 0; n < nPaths; ++n)
+    {
+        const wxUint32 nPath = bAll ? (wxUint32) n : (*candidates)[n];
+        if (!entries.GetPathEntries(nPath))
+            continue;
+
+        size_t len;
+        const char* path = entries.GetPathUTF8(nPath, &len);
+        if (bExact || Contains(path, len, &query[0], query.size()))
+            paths.push_back(nPath);
+    }
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerSorter
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Sorts with fewer items than this aren't worth starting threads for
+static const size_t wxMediaSortParallel = 65536;
+
+// At most this many threads share a sort
+static const int wxMediaSortThreads = 8;
+
+// Runs this short are insertion sorted
+static const size_t wxMediaSortRun = 16;
+
+static inline wxUint8 wxMediaSortFold(char c)
+{
+    return c >= 'A' && c <= 'Z' ? (wxUint8) (c + 'a' - 'A') : (wxUint8) c;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorterThread
+//
+// Runs one job of a sort
+// ----------------------------------------------------------------------------
+class wxMediaPlayerSorterThread : public wxThread
+{
+public:
+    wxMediaPlayerSorterThread(const wxMediaPlayerSorter* sorter,
+                              const wxMediaPlayerSorter::Job& job)
+        : wxThread(wxTHREAD_JOINABLE), m_sorter(sorter), m_job(job) {}
+
+protected:
+    virtual ExitCode Entry()
+    {
+        m_sorter->RunJob(m_job);
+        return 0;
+    }
+
+private:
+    const wxMediaPlayerSorter* m_sorter;
+    wxMediaPlayerSorter::Job   m_job;
+};
+
+wxMediaPlayerSorter::wxMediaPlayerSorter(
+    const wxMediaPlayerEntryStore& entries)
+    : m_entries(entries)
+{
+    SetKey(wxSORT_NONE);
+}
+
+void wxMediaPlayerSorter::SetKey(int key)
+{
+    m_nKey = key;
+    m_text.clear();
+    m_textAt.assign(1, 0);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::FoldNewPaths
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSorter::FoldNewPaths()
+{
+    for (size_t path = m_textAt.size() - 1; path < m_entries.GetPathCount();
+         ++path)
+    {
+        size_t len;
+        const char* text = m_nKey == wxSORT_NAME
+                           ? m_entries.GetNameUTF8(path, &len)
+                           : m_entries.GetPathUTF8(path, &len);
+
+        const size_t nAt = m_text.size();
+        m_text.resize(nAt + len);
+        for (size_t i = 0; i < len; ++i)
+            m_text[nAt + i] = (char) wxMediaSortFold(text[i]);
+        m_textAt.push_back((wxUint32) m_text.size());
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::AddEntries
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSorter::AddEntries(size_t nFrom, size_t nTo,
+                                     wxVector<Item>& items)
+{
+    if (IsText())
+        FoldNewPaths();
+
+    items.reserve(items.size() + (nTo - nFrom));
+    for (size_t n = nFrom; n < nTo; ++n)
+        items.push_back(MakeItem(n));
+}
+
+void wxMediaPlayerSorter::AddEntries(const wxVector<wxUint32>& entries,
+                                     wxVector<Item>& items)
+{
+    if (IsText())
+        FoldNewPaths();
+
+    items.reserve(items.size() + entries.size());
+    for (size_t n = 0; n < entries.size(); ++n)
+        items.push_back(MakeItem(entries[n]));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::MakeItem
+//
+// Text keys are the first eight folded bytes, big-endian and padded with
+// zeros, so comparing them orders as comparing those bytes would
+// ----------------------------------------------------------------------------
+wxMediaPlayerSorter::Item wxMediaPlayerSorter::MakeItem(size_t n) const
+{
+    const wxUint32 path = m_entries.GetPathId(n);
+
+    Item item;
+    item.m_nEntry = (wxUint32) n;
+    item.m_nText = 0;
+    item.m_nLength = 0;
+    switch (m_nKey)
+    {
+        case wxSORT_NAME:
+        case wxSORT_PATH:
+        {
+            item.m_nText = m_textAt[path];
+            item.m_nLength = m_textAt[path + 1] - item.m_nText;
+
+            const size_t len = item.m_nLength;
+            const char* text = len ? &m_text[item.m_nText] : NULL;
+            item.m_nKey = 0;
+            for (size_t i = 0; i < 8; ++i)
+            {
+                item.m_nKey <<= 8;
+                if (i < len)
+                    item.m_nKey |= (wxUint8) text[i];
+            }
+            break;
+        }
+        case wxSORT_LENGTH:
+        {
+            const wxMediaPlayerMediaInfo& info = m_entries.GetPathInfo(path);
+            item.m_nKey = info.m_nFlags & wxMEDIAINFO_VALID
+                          ? info.m_nDuration : 0;
+            break;
+        }
+        case wxSORT_PLAYS:
+            item.m_nKey = m_entries.GetPathPlays(path);
+            break;
+        case wxSORT_LAST_PLAYED:
+            item.m_nKey = m_entries.GetPathLastPlayed(path);
+            break;
+        default:
+            item.m_nKey = 0;
+            break;
+    }
+    return item;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::Less
+//
+// Text only has to be looked at when the first eight bytes are the same.
+// The items say where it is, going through the entries and paths for it
+// would be two more cache misses.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerSorter::Less(const Item& a, const Item& b) const
+{
+    if (a.m_nKey != b.m_nKey)
+        return a.m_nKey < b.m_nKey;
+
+    if (IsText())
+    {
+        const size_t len = wxMin(a.m_nLength, b.m_nLength);
+        if (len > 8)
+        {
+            const char* text = &m_text[0];
+            const int nCompare = memcmp(text + a.m_nText + 8,
+                                        text + b.m_nText + 8, len - 8);
+            if (nCompare)
+                return nCompare < 0;
+        }
+        if (a.m_nLength != b.m_nLength)
+            return a.m_nLength < b.m_nLength;
+    }
+    return a.m_nEntry < b.m_nEntry;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::SortRange
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSorter::SortRange(Item* items, Item* scratch,
+                                    size_t count) const
+{
+    if (count <= wxMediaSortRun)
+    {
+        for (size_t n = 1; n < count; ++n)
+        {
+            const Item item = items[n];
+            size_t i = n;
+            for (; i > 0 && Less(item, items[i - 1]); --i)
+                items[i] = items[i - 1];
+            items[i] = item;
+        }
+        return;
+    }
+
+    const size_t nHalf = count / 2;
+    SortRange(items, scratch, nHalf);
+    SortRange(items + nHalf, scratch + nHalf, count - nHalf);
+
+    //  Often the case when the entries were added in order already
+    if (!Less(items[nHalf], items[nHalf - 1]))
+        return;
+
+    MergeRuns(items, nHalf, items + nHalf, count - nHalf, scratch);
+    memcpy(items, scratch, count * sizeof(Item));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::MergeRuns
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSorter::MergeRuns(const Item* a, size_t nA,
+                                    const Item* b, size_t nB,
+                                    Item* out) const
+{
+    size_t i = 0, j = 0;
+    while (i < nA && j < nB)
+    {
+        if (Less(b[j], a[i]))
+            *out++ = b[j++];
+        else
+            *out++ = a[i++];
+    }
+    if (i < nA)
+        memcpy(out, a + i, (nA - i) * sizeof(Item));
+    if (j < nB)
+        memcpy(out, b + j, (nB - j) * sizeof(Item));
+}
+
+void wxMediaPlayerSorter::RunJob(const Job& job) const
+{
+    if (job.m_b)
+        MergeRuns(job.m_a, job.m_nA, job.m_b, job.m_nB, job.m_out);
+    else
+        SortRange(job.m_a, job.m_out, job.m_nA);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::RunJobs
+//
+// A job whose thread can't be started is run here instead
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSorter::RunJobs(const wxVector<Job>& jobs) const
+{
+    wxVector<wxThread*> threads;
+    for (size_t n = 0; n + 1 < jobs.size(); ++n)
+    {
+        wxThread* thread = new wxMediaPlayerSorterThread(this, jobs[n]);
+        if (thread->Run() != wxTHREAD_NO_ERROR)
+        {
+            delete thread;
+            RunJob(jobs[n]);
+            continue;
+        }
+        threads.push_back(thread);
+    }
+
+    if (!jobs.empty())
+        RunJob(jobs.back());
+
+    for (size_t n = 0; n < threads.size(); ++n)
+    {
+        threads[n]->Wait();
+        delete threads[n];
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::Sort
+//
+// The slices are sorted in place, then each round merges neighbours from
+// items into scratch or back, until one is left
+// ----------------------------------------------------------------------------
+void wxMediaPlayerSorter::Sort(wxVector<Item>& items) const
+{
+    const size_t count = items.size();
+    if (count < 2)
+        return;
+
+    int nSlices = 1;
+    if (count >= wxMediaSortParallel)
+    {
+        nSlices = wxMin(wxThread::GetCPUCount(), wxMediaSortThreads);
+        if (nSlices < 1)
+            nSlices = 1;    // GetCPUCount() returns -1 if it doesn't know
+    }
+
+    wxVector<size_t> bounds;
+    for (int n = 0; n <= nSlices; ++n)
+        bounds.push_back(count * n / nSlices);
+
+    wxVector<Item> scratch(count);
+    Item* from = &items[0];
+    Item* to = &scratch[0];
+
+    wxVector<Job> jobs;
+    for (size_t n = 0; n + 1 < bounds.size(); ++n)
+    {
+        Job job = { from + bounds[n], bounds[n + 1] - bounds[n],
+                    NULL, 0, to + bounds[n] };
+        jobs.push_back(job);
+    }
+    RunJobs(jobs);
+
+    while (bounds.size() > 2)
+    {
+        jobs.clear();
+        wxVector<size_t> merged;
+        for (size_t n = 0; n + 1 < bounds.size(); n += 2)
+        {
+            //  The odd one out is only copied
+            const size_t nEnd = n + 2 < bounds.size() ? bounds[n + 2]
+                                                      : bounds[n + 1];
+            Job job = { from + bounds[n], bounds[n + 1] - bounds[n],
+                        from + bounds[n + 1], nEnd - bounds[n + 1],
+                        to + bounds[n] };
+            jobs.push_back(job);
+            merged.push_back(bounds[n]);
+        }
+        merged.push_back(count);
+        RunJobs(jobs);
+
+        bounds.swap(merged);
+        Item* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != &items[0])
+        memcpy(&items[0], from, count * sizeof(Item));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerSorter::Merge
+//
+// For entries appended to a sorted view, cheaper than sorting all again.
+// The merge goes from the back into items grown in place, so only the
+// items that sort after the first of added are moved, none when they all
+// go at the end.
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerSorter::Merge(wxVector<Item>& items,
+                                  wxVector<Item>& added) const
+{
+    size_t i = items.size();
+    if (added.empty())
+        return i;
+
+    Sort(added);
+    size_t j = added.size();
+    items.resize(i + j);
+
+    size_t nAt = items.size();
+    while (j > 0)
+    {
+        if (i > 0 && Less(added[j - 1], items[i - 1]))
+            items[--nAt] = items[--i];
+        else
+            items[--nAt] = added[--j];
+    }
+    return i;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerPlayOrder
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// How many shuffled plays Prev can go back through
+static const size_t wxMediaMaxHistory = 1024;
+
+wxMediaPlayerPlayOrder::wxMediaPlayerPlayOrder()
+    : m_nCount(0), m_nCurrent(-1), m_bShuffle(false), m_bRepeat(true),
+      m_nPos(-1)
+{
+    //  Pages opened in the same millisecond, like the --bench-pages ones,
+    //  still shuffle differently: a count of the orders made is mixed in,
+    //  and splitmix64's finalizer spreads both over all the bits
+    static wxUint64 s_nOrders = 0;
+    wxUint64 seed = (wxUint64) wxGetLocalTimeMillis().GetValue() +
+                    ++s_nOrders * wxULL(0x9e3779b97f4a7c15);
+    seed = (seed ^ (seed >> 30)) * wxULL(0xbf58476d1ce4e5b9);
+    seed = (seed ^ (seed >> 27)) * wxULL(0x94d049bb133111eb);
+    m_nSeed = (seed ^ (seed >> 31)) | 1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::SetCount
+//
+// New entries go at random places among the ones still to come in this
+// cycle, so they play before it is over
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlayOrder::SetCount(size_t count)
+{
+    if (count < m_nCount)
+    {
+        m_nCount = 0;
+        m_nCurrent = -1;
+        m_nPos = -1;
+        m_order.clear();
+        m_position.clear();
+        m_history.clear();
+    }
+
+    m_order.reserve(count);
+    m_position.reserve(count);
+    for (size_t n = m_nCount; n < count; ++n)
+    {
+        m_order.push_back((wxUint32) n);
+        m_position.push_back((wxUint32) n);
+
+        if (m_bShuffle)
+        {
+            size_t nFirst = (size_t)(m_nPos + 1);
+            SwapPositions(nFirst + Random((wxUint32)(n + 1 - nFirst)), n);
+        }
+    }
+    m_nCount = count;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::RemoveEntries
+//
+// The shuffled order and the history keep the entries that are left in the
+// order they had, and the cursor stays after the ones played this cycle
+// ----------------------------------------------------------------------------
+long wxMediaPlayerPlayOrder::RemoveEntries(const wxVector<long>& map,
+                                           size_t count)
+{
+    const bool bGone = m_nCurrent != -1 && map[m_nCurrent] == -1;
+
+    long nNext = -1;
+    if (bGone && !m_bShuffle)
+    {
+        for (size_t n = m_nCurrent + 1; n < m_nCount && nNext == -1; ++n)
+            nNext = map[n];
+        for (long n = 0; m_bRepeat && n < m_nCurrent && nNext == -1; ++n)
+            nNext = map[n];
+    }
+
+    size_t nKept = 0;
+    long nPos = -1;
+    for (size_t n = 0; n < m_order.size(); ++n)
+    {
+        long nEntry = map[m_order[n]];
+        if (nEntry == -1)
+            continue;
+        if ((long) n <= m_nPos)
+            nPos = (long) nKept;
+        m_order[nKept++] = (wxUint32) nEntry;
+    }
+    m_order.resize(nKept);
+    m_position.resize(nKept);
+    for (size_t n = 0; n < nKept; ++n)
+        m_position[m_order[n]] = (wxUint32) n;
+    m_nPos = nPos;
+
+    nKept = 0;
+    for (size_t n = 0; n < m_history.size(); ++n)
+    {
+        if (map[m_history[n]] != -1)
+            m_history[nKept++] = (wxUint32) map[m_history[n]];
+    }
+    m_history.resize(nKept);
+
+    wxASSERT(m_order.size() == count);
+    m_nCount = count;
+    if (!bGone)
+    {
+        if (m_nCurrent != -1)
+            m_nCurrent = map[m_nCurrent];
+        return -1;
+    }
+
+    m_nCurrent = -1;
+    if (m_bShuffle)
+        nNext = GetNext();
+    return nNext;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::SetShuffle
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlayOrder::SetShuffle(bool bShuffle)
+{
+    if (bShuffle == m_bShuffle)
+        return;
+
+    m_bShuffle = bShuffle;
+    m_history.clear();
+    if (m_bShuffle)
+    {
+        StartCycle();
+
+        //  The current entry counts as played in the new cycle
+        if (m_nCurrent != -1)
+        {
+            SwapPositions(m_position[m_nCurrent], 0);
+            m_nPos = 0;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::Reshuffle
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlayOrder::Reshuffle()
+{
+    //  Fisher-Yates over the part after the cursor
+    size_t nFirst = (size_t)(m_nPos + 1);
+    for (size_t n = m_nCount; n > nFirst + 1; --n)
+        SwapPositions(nFirst + Random((wxUint32)(n - nFirst)), n - 1);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::GetNext
+// ----------------------------------------------------------------------------
+long wxMediaPlayerPlayOrder::GetNext()
+{
+    long nNext = PeekNext();
+    if (nNext != -1 || !m_bShuffle || !m_bRepeat || m_nCount == 0)
+        return nNext;
+
+    //  Every entry has played, go round again without starting on the
+    //  one that played last
+    StartCycle();
+    if (m_nCount > 1 && (long) m_order[0] == m_nCurrent)
+        SwapPositions(0, 1 + Random((wxUint32)(m_nCount - 1)));
+    return m_order[0];
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::PeekNext
+// ----------------------------------------------------------------------------
+long wxMediaPlayerPlayOrder::PeekNext() const
+{
+    if (m_nCount == 0)
+        return -1;
+
+    if (m_bShuffle)
+    {
+        if ((size_t)(m_nPos + 1) < m_nCount)
+            return m_order[m_nPos + 1];
+        return -1;
+    }
+
+    if ((size_t)(m_nCurrent + 1) < m_nCount)
+        return m_nCurrent + 1;
+    return m_bRepeat ? 0 : -1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::GetPrev
+// ----------------------------------------------------------------------------
+long wxMediaPlayerPlayOrder::GetPrev() const
+{
+    if (m_nCount == 0)
+        return -1;
+
+    if (m_bShuffle)
+    {
+        if (!m_history.empty())
+            return m_history.back();
+        if (m_nPos > 0)
+            return m_order[m_nPos - 1];
+        return -1;
+    }
+
+    if (m_nCurrent > 0)
+        return m_nCurrent - 1;
+    if (m_nCurrent == -1 || m_bRepeat)
+        return (long) m_nCount - 1;
+    return -1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::MoveTo
+//
+// Going back to the entry played before moves the cursor back with it, so
+// Next returns to where we were.  Anything else is swapped in right after
+// the cursor: entries that haven't played yet this cycle lose their later
+// turn, and the order of the rest stays the same.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlayOrder::MoveTo(long n, bool bRecord)
+{
+    wxASSERT(n >= 0 && (size_t) n < m_nCount);
+    if (n == m_nCurrent)
+        return;
+
+    if (m_bShuffle)
+    {
+        size_t nPos = m_position[n];
+        bool bBack = !m_history.empty() && (long) m_history.back() == n;
+
+        if (bBack)
+            m_history.pop_back();
+        else if (m_nCurrent != -1 && bRecord)
+        {
+            if (m_history.size() >= wxMediaMaxHistory)
+                m_history.erase(m_history.begin(),
+                                m_history.begin() + wxMediaMaxHistory / 2);
+            m_history.push_back((wxUint32) m_nCurrent);
+        }
+
+        if ((long) nPos > m_nPos)
+        {
+            SwapPositions(nPos, m_nPos + 1);
+            ++m_nPos;
+        }
+        else if ((bBack || m_history.empty()) && m_nPos > 0)
+        {
+            SwapPositions(nPos, m_nPos - 1);
+            --m_nPos;
+        }
+    }
+
+    m_nCurrent = n;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::StartCycle
+//
+// Shuffles every entry and puts the cursor before the first one
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlayOrder::StartCycle()
+{
+    m_nPos = -1;
+    Reshuffle();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::SwapPositions
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlayOrder::SwapPositions(size_t a, size_t b)
+{
+    wxUint32 n = m_order[a];
+    m_order[a] = m_order[b];
+    m_order[b] = n;
+    m_position[m_order[a]] = (wxUint32) a;
+    m_position[m_order[b]] = (wxUint32) b;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlayOrder::Random
+//
+// A number in [0, n), from xorshift64*
+// ----------------------------------------------------------------------------
+wxUint32 wxMediaPlayerPlayOrder::Random(wxUint32 n)
+{
+    m_nSeed ^= m_nSeed >> 12;
+    m_nSeed ^= m_nSeed << 25;
+    m_nSeed ^= m_nSeed >> 27;
+    wxUint32 r = (wxUint32)((m_nSeed * wxULL(2685821657736338717)) >> 32);
+    return (wxUint32)(((wxUint64) r * n) >> 32);
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerHealthSampler
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// How far the position may get ahead of the clock between two samples, in
+// milliseconds, before it counts as dropping frames.  Covers the timer and
+// the backend updating the position a little late.
+static const long wxMediaHealthJump = 250;
+
+void wxMediaPlayerHealth::Add(int event, long nJump)
+{
+    switch(event)
+    {
+        case wxHEALTH_DROPPED:
+            ++m_nDrops;
+            m_nDroppedTime += nJump;
+            break;
+        case wxHEALTH_UNDERRUN:
+            ++m_nUnderruns;
+            break;
+        case wxHEALTH_STALLED:
+            ++m_nStalls;
+            break;
+        case wxHEALTH_RECOVERED:
+            ++m_nRecoveries;
+            break;
+        case wxHEALTH_FAILED:
+            ++m_nErrors;
+            ++m_nFailures;
+            break;
+    }
+}
+
+void wxMediaPlayerHealthSampler::Reset()
+{
+    m_nBasePos = m_nLastPos = -1;
+    m_nBaseTime = m_nLastTime = -1;
+    m_nStopTime = -1;
+    m_bUnderrun = m_bStalled = false;
+    m_nJump = 0;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerHealthSampler::Sample
+//
+// Playback going backwards is a loop wrapping around (or a seek nobody told
+// us about), which starts the samples over
+// ----------------------------------------------------------------------------
+int wxMediaPlayerHealthSampler::Sample(long nPos, long nTime,
+                                       bool bDownloading, long nStallTimeout)
+{
+    if (m_nLastTime < 0 || nPos < m_nLastPos)
+    {
+        Reset();
+        m_nBasePos = m_nLastPos = nPos;
+        m_nBaseTime = m_nLastTime = nTime;
+        return wxHEALTH_OK;
+    }
+
+    const long nMoved = nPos - m_nLastPos;
+    const long nElapsed = nTime - m_nLastTime;
+    m_nLastPos = nPos;
+    m_nLastTime = nTime;
+
+    if (nMoved == 0)
+    {
+        if (m_nStopTime < 0)
+            m_nStopTime = nTime - nElapsed;
+
+        if (bDownloading && !m_bUnderrun)
+        {
+            m_bUnderrun = true;
+            return wxHEALTH_UNDERRUN;
+        }
+        if (!m_bStalled && nTime - m_nStopTime >= nStallTimeout)
+        {
+            m_bStalled = true;
+            return wxHEALTH_STALLED;
+        }
+        return wxHEALTH_OK;
+    }
+
+    m_nStopTime = -1;
+    m_bUnderrun = m_bStalled = false;
+
+    if (nMoved > nElapsed + wxMediaHealthJump)
+    {
+        m_nJump = nMoved - nElapsed;
+        return wxHEALTH_DROPPED;
+    }
+    return wxHEALTH_OK;
+}
+
+long wxMediaPlayerHealthSampler::GetDrift() const
+{
+    if (m_nLastTime < 0)
+        return 0;
+    return (m_nLastTime - m_nBaseTime) - (m_nLastPos - m_nBasePos);
+}
+
+long wxMediaPlayerHealthSampler::GetRate() const
+{
+    if (m_nLastTime <= m_nBaseTime)
+        return 1000;
+    return (long) ((wxInt64) (m_nLastPos - m_nBasePos) * 1000 /
+                   (m_nLastTime - m_nBaseTime));
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerListCtrl
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl::OnGetItemText
+//
+// Called by the virtual list control only for rows that are being painted
+// ----------------------------------------------------------------------------
+wxString wxMediaPlayerListCtrl::OnGetItemText(long item, long column) const
+{
+    item = GetEntry(item);
+    switch(column)
+    {
+        case 0:
+            return wxGetMediaEntryStateText(m_entries->GetState(item));
+        case 1:
+            return m_entries->GetName(item);
+        case 2:
+        {
+            const wxMediaPlayerMediaInfo& info = m_entries->GetInfo(item);
+            if ((info.m_nFlags & wxMEDIAINFO_VALID) && info.m_nDuration)
+                return wxGetMediaDurationText(info.m_nDuration);
+            return wxEmptyString;
+        }
+        case 3:
+        {
+            const wxMediaPlayerMediaInfo& info = m_entries->GetInfo(item);
+            if (info.m_nFlags & wxMEDIAINFO_VALID)
+                return wxGetMediaInfoText(info);
+            return wxEmptyString;
+        }
+        case 4:
+        {
+            const wxMediaPlayerHealth* health = m_entries->FindHealth(item);
+            if (health)
+                return wxGetMediaHealthText(*health);
+            return wxEmptyString;
+        }
+        case 5:
+        {
+            wxUint32 nPlays =
+                m_entries->GetPathPlays(m_entries->GetPathId(item));
+            if (nPlays)
+                return wxString::Format(wxT("%u"), nPlays);
+            return wxEmptyString;
+        }
+        case 6:
+        {
+            time_t nLast =
+                m_entries->GetPathLastPlayed(m_entries->GetPathId(item));
+            if (nLast)
+                return wxDateTime(nLast).Format(wxT("%Y-%m-%d %H:%M"));
+            return wxEmptyString;
+        }
+        default:
+            return wxEmptyString;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl::OnGetItemColumnImage
+//
+// The thumbnail goes next to the file name.  Only what is on hand is shown,
+// the page asks for the rest when it gets the cache hint for the rows.
+// ----------------------------------------------------------------------------
+int wxMediaPlayerListCtrl::OnGetItemColumnImage(long item, long column) const
+{
+    if (column != 1)
+        return -1;
+
+    size_t len;
+    const char* path =
+        m_entries->GetPathUTF8(m_entries->GetPathId(GetEntry(item)), &len);
+    int image = m_thumbnails->Find(path, len);
+    return image >= 0 ? image : -1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl::OnGetItemAttr
+//
+// Every other row gets a grey background
+// ----------------------------------------------------------------------------
+wxListItemAttr* wxMediaPlayerListCtrl::OnGetItemAttr(long item) const
+{
+    return item % 2 ? (wxListItemAttr*)&m_attrOdd : NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl::SetRows
+//
+// Ascending rows are binary searched for an entry, sorted ones get a map
+// from entry to row
+// ----------------------------------------------------------------------------
+void wxMediaPlayerListCtrl::SetRows(wxVector<wxUint32>& rows, bool bSorted)
+{
+    m_rows.swap(rows);
+    m_rowOf.clear();
+    if (bSorted)
+    {
+        m_rowOf.resize(m_entries->GetCount(), 0);
+        for (size_t row = 0; row < m_rows.size(); ++row)
+            m_rowOf[m_rows[row]] = (wxUint32) row + 1;
+    }
+    m_bRows = true;
+    SyncItemCount();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl::ReplaceRows
+//
+// Entries merged into a sort only move the rows after them
+// ----------------------------------------------------------------------------
+void wxMediaPlayerListCtrl::ReplaceRows(size_t nRow,
+                                        const wxVector<wxUint32>& rows)
+{
+    wxASSERT(m_bRows && nRow <= m_rows.size());
+
+    m_rows.resize(nRow + rows.size());
+    m_rowOf.resize(m_entries->GetCount(), 0);
+    for (size_t n = 0; n < rows.size(); ++n)
+    {
+        m_rows[nRow + n] = rows[n];
+        m_rowOf[rows[n]] = (wxUint32) (nRow + n) + 1;
+    }
+    SyncItemCount();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerListCtrl::FindRow
+// ----------------------------------------------------------------------------
+long wxMediaPlayerListCtrl::FindRow(long n) const
+{
+    if (!m_bRows)
+        return n;
+    if (!m_rowOf.empty())
+        return (size_t) n < m_rowOf.size() ? (long) m_rowOf[n] - 1 : -1;
+
+    size_t nLow = 0, nHigh = m_rows.size();
+    while (nLow < nHigh)
+    {
+        size_t nMid = (nLow + nHigh) / 2;
+        if ((long) m_rows[nMid] < n)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    return nLow < m_rows.size() && (long) m_rows[nLow] == n ? (long) nLow
+                                                            : -1;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerProber
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProberThread
+//
+// A worker of the prober: takes jobs until the prober is stopped
+// ----------------------------------------------------------------------------
+class wxMediaPlayerProberThread : public wxThread
+{
+public:
+    wxMediaPlayerProberThread(wxMediaPlayerProber* prober)
+        : wxThread(wxTHREAD_JOINABLE), m_prober(prober)
+    {
+    }
+
+protected:
+    virtual ExitCode Entry()
+    {
+        wxMediaPlayerStats* stats = m_prober->m_stats;
+        wxMediaPlayerStats::Shard* shard = stats ? stats->AddShard() : NULL;
+
+        wxMediaPlayerProber::Result result;
+        wxString file;
+        bool bIndex;
+        while (m_prober->GetJob(result.m_nPage, result.m_nPath, file, bIndex))
+        {
+            if (bIndex)
+            {
+                wxMediaPlayerProber::Index index;
+                index.m_nPage = result.m_nPage;
+                index.m_szFile = file;
+                m_prober->BuildIndex(file, index.m_keyframes);
+                m_prober->AddIndex(index);
+                continue;
+            }
+
+            {
+                wxMediaPlayerStatsScope scope(stats, wxSTATS_PROBE, shard);
+                m_prober->Probe(file, result.m_info);
+            }
+            m_prober->AddResult(result);
+        }
+        return 0;
+    }
+
+private:
+    wxMediaPlayerProber* m_prober;
+};
+
+wxMediaPlayerProber::wxMediaPlayerProber()
+                   : m_cond(m_mutex),
+                     m_handler(NULL),
+                     m_cache(NULL),
+                     m_stats(NULL),
+                     m_bStopping(false)
+{
+}
+
+wxMediaPlayerProber::~wxMediaPlayerProber()
+{
+    Stop();
+
+    for (size_t n = 0; n < m_queues.size(); ++n)
+        delete m_queues[n];
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::Start
+//
+// Starts one worker per core.  Probing is mostly waiting on the disk, so
+// even on our single core kiosks it keeps the UI thread free.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::Start(wxEvtHandler* handler,
+                                wxMediaPlayerInfoCache* cache,
+                                wxMediaPlayerStats* stats)
+{
+    m_handler = handler;
+    m_cache = cache;
+    m_stats = stats;
+
+    int nThreads = wxThread::GetCPUCount();
+    if (nThreads < 1)
+        nThreads = 1;   // GetCPUCount() returns -1 if it doesn't know
+
+    for (int n = 0; n < nThreads; ++n)
+    {
+        wxThread* thread = new wxMediaPlayerProberThread(this);
+        if (thread->Run() != wxTHREAD_NO_ERROR)
+        {
+            delete thread;
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::Stop
+//
+// Wakes up all workers, lets them finish the file they're on and waits for
+// them to exit.  Results still pending are never delivered.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::Stop()
+{
+    {
+        wxMutexLocker lock(m_mutex);
+        m_bStopping = true;
+        m_cond.Broadcast();
+    }
+
+    for (size_t n = 0; n < m_threads.size(); ++n)
+    {
+        m_threads[n]->Wait();
+        delete m_threads[n];
+    }
+    m_threads.clear();
+}
+
+wxMediaPlayerProber::Queue* wxMediaPlayerProber::FindQueue(int page)
+{
+    for (size_t n = 0; n < m_queues.size(); ++n)
+    {
+        if (m_queues[n]->m_nPage == page)
+            return m_queues[n];
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::Enqueue
+//
+// Copies the paths into the page's queue, since the entry store belongs to
+// the UI thread and may be reallocated while the workers run
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::Enqueue(int page,
+                                  const wxMediaPlayerEntryStore& store,
+                                  wxUint32 from)
+{
+    const size_t nCount = store.GetPathCount();
+    if (from >= nCount)
+        return;
+
+    wxMutexLocker lock(m_mutex);
+
+    Queue* queue = FindQueue(page);
+    if (!queue)
+    {
+        queue = new Queue;
+        queue->m_nPage = page;
+        queue->m_nBase = from;
+        queue->m_nNext = 0;
+        queue->m_offsets.push_back(0);
+        m_queues.push_back(queue);
+    }
+
+    wxASSERT(queue->m_nBase + queue->m_claimed.size() == from);
+
+    for (size_t path = from; path < nCount; ++path)
+    {
+        size_t len;
+        const char* data = store.GetPathUTF8(path, &len);
+
+        size_t offset = queue->m_pool.size();
+        queue->m_pool.resize(offset + len);
+        if (len)
+            memcpy(&queue->m_pool[offset], data, len);
+
+        queue->m_offsets.push_back(queue->m_pool.size());
+        queue->m_claimed.push_back(0);
+    }
+
+    m_cond.Broadcast();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::Prioritize
+//
+// Replaces the page's hint with the given paths - only the rows currently
+// being shown matter, not the ones the user has scrolled past
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::Prioritize(int page, const wxVector<wxUint32>& paths)
+{
+    wxMutexLocker lock(m_mutex);
+
+    Queue* queue = FindQueue(page);
+    if (!queue)
+        return;
+
+    // m_hint is used as a stack, keep the first row on top
+    queue->m_hint.clear();
+    for (size_t n = paths.size(); n > 0; --n)
+        queue->m_hint.push_back(paths[n - 1]);
+}
+
+void wxMediaPlayerProber::RemovePage(int page)
+{
+    wxMutexLocker lock(m_mutex);
+
+    for (size_t n = 0; n < m_queues.size(); ++n)
+    {
+        if (m_queues[n]->m_nPage == page)
+        {
+            delete m_queues[n];
+            m_queues.erase(m_queues.begin() + n);
+            break;
+        }
+    }
+}
+
+void wxMediaPlayerProber::RequestIndex(int page, const wxString& file)
+{
+    wxMutexLocker lock(m_mutex);
+
+    Index job;
+    job.m_nPage = page;
+    job.m_szFile = file;
+    m_indexJobs.push_back(job);
+    m_cond.Signal();
+}
+
+void wxMediaPlayerProber::TakeResults(wxVector<Result>& results)
+{
+    wxMutexLocker lock(m_mutex);
+
+    results = m_results;
+    m_results.clear();
+}
+
+void wxMediaPlayerProber::TakeIndexes(wxVector<Index>& indexes)
+{
+    wxMutexLocker lock(m_mutex);
+
+    indexes = m_indexes;
+    m_indexes.clear();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::ClaimJob
+//
+// Takes the given path of the queue if nobody has done so yet.
+// Must be called with m_mutex held.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerProber::ClaimJob(Queue* queue, wxUint32 path,
+                                   int& page, wxUint32& jobPath,
+                                   wxString& file)
+{
+    if (path < queue->m_nBase)
+        return false;
+
+    size_t index = path - queue->m_nBase;
+    if (index >= queue->m_claimed.size() || queue->m_claimed[index])
+        return false;
+
+    queue->m_claimed[index] = 1;
+
+    page = queue->m_nPage;
+    jobPath = path;
+
+    size_t offset = queue->m_offsets[index];
+    size_t len = queue->m_offsets[index + 1] - offset;
+    file = len ? wxString::FromUTF8(&queue->m_pool[offset], len)
+               : wxString();
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::GetJob
+//
+// Called by the workers.  Blocks until there is something to probe and
+// returns it, or returns false once the prober is stopping.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerProber::GetJob(int& page, wxUint32& path, wxString& file,
+                                 bool& bIndex)
+{
+    wxMutexLocker lock(m_mutex);
+
+    bIndex = false;
+    for ( ;; )
+    {
+        if (m_bStopping)
+            return false;
+
+        // Files being played first, as someone may be about to seek...
+        if (!m_indexJobs.empty())
+        {
+            page = m_indexJobs.front().m_nPage;
+            file = m_indexJobs.front().m_szFile;
+            m_indexJobs.erase(m_indexJobs.begin());
+            bIndex = true;
+            return true;
+        }
+
+        // ...then rows that are on screen...
+        for (size_t n = 0; n < m_queues.size(); ++n)
+        {
+            Queue* queue = m_queues[n];
+            while (!queue->m_hint.empty())
+            {
+                wxUint32 hint = queue->m_hint.back();
+                queue->m_hint.pop_back();
+                if (ClaimJob(queue, hint, page, path, file))
+                    return true;
+            }
+        }
+
+        // ...then everything else in playlist order
+        for (size_t n = 0; n < m_queues.size(); ++n)
+        {
+            Queue* queue = m_queues[n];
+
+            bool bFound = false;
+            while (!bFound && queue->m_nNext < queue->m_claimed.size())
+            {
+                bFound = ClaimJob(queue, queue->m_nBase + queue->m_nNext,
+                                  page, path, file);
+                ++queue->m_nNext;
+            }
+
+            // Everything in the queue has been claimed, so drop our copies
+            // of the paths until more are queued
+            if (!queue->m_claimed.empty() &&
+                queue->m_nNext == queue->m_claimed.size())
+            {
+                queue->m_nBase += queue->m_claimed.size();
+                queue->m_nNext = 0;
+                queue->m_pool = wxVector<char>();
+                queue->m_offsets = wxVector<wxUint32>();
+                queue->m_offsets.push_back(0);
+                queue->m_claimed = wxVector<wxUint8>();
+                queue->m_hint.clear();
+            }
+
+            if (bFound)
+                return true;
+        }
+
+        m_cond.Wait();
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::Probe
+//
+// Called by the workers.  Files that haven't changed since they were last
+// probed are answered from the cache after a stat(), without opening them.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::Probe(const wxString& file,
+                                wxMediaPlayerMediaInfo& info)
+{
+    wxStructStat st;
+    if (!m_cache || wxStat(file, &st) != 0)
+    {
+        wxProbeMediaFile(file, info);
+        return;
+    }
+
+    const wxScopedCharBuffer utf8 = file.utf8_str();
+
+    wxUint64 size;
+    wxInt64 mtime;
+    if (m_cache->Lookup(utf8.data(), utf8.length(), info, &size, &mtime) &&
+        size == (wxUint64)st.st_size && mtime == (wxInt64)st.st_mtime)
+        return;
+
+    wxProbeMediaFile(file, info);
+    m_cache->Store(utf8.data(), utf8.length(), st.st_size, st.st_mtime, info);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::BuildIndex
+//
+// Called by the workers.  The same as Probe(), for keyframe indexes.  Files
+// that aren't ISO media aren't remembered, there's nothing to save there.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::BuildIndex(const wxString& file,
+                                     wxVector<wxUint32>& keyframes)
+{
+    wxStructStat st;
+    if (!m_cache || wxStat(file, &st) != 0)
+    {
+        wxBuildMediaKeyframeIndex(file, keyframes);
+        return;
+    }
+
+    const wxScopedCharBuffer utf8 = file.utf8_str();
+    if (m_cache->LookupKeyframes(utf8.data(), utf8.length(), st.st_size,
+                                 st.st_mtime, keyframes))
+        return;
+
+    if (wxBuildMediaKeyframeIndex(file, keyframes))
+        m_cache->StoreKeyframes(utf8.data(), utf8.length(), st.st_size,
+                                st.st_mtime, keyframes);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerProber::AddResult
+//
+// Called by the workers.  Only the first result of a batch posts an event,
+// the rest pile up until the UI thread gets round to taking them.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerProber::AddResult(const Result& result)
+{
+    wxMutexLocker lock(m_mutex);
+
+    bool bFirst = m_results.empty() && m_indexes.empty();
+    m_results.push_back(result);
+
+    if (bFirst && m_handler && !m_bStopping)
+        wxQueueEvent(m_handler, new wxThreadEvent(wxEVT_THREAD, wxID_PROBER));
+}
+
+void wxMediaPlayerProber::AddIndex(const Index& index)
+{
+    wxMutexLocker lock(m_mutex);
+
+    bool bFirst = m_results.empty() && m_indexes.empty();
+    m_indexes.push_back(index);
+
+    if (bFirst && m_handler && !m_bStopping)
+        wxQueueEvent(m_handler, new wxThreadEvent(wxEVT_THREAD, wxID_PROBER));
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerScanner
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// What gets imported from a directory unless --ext says otherwise
+static const char wxMediaDefaultExtensions[] =
+    "3gp,aac,aif,aiff,asf,avi,flac,flv,m2ts,m4a,m4v,mid,midi,mkv,mov,mp2,"
+    "mp3,mp4,mpeg,mpg,oga,ogg,ogv,opus,qt,ts,vob,wav,webm,wma,wmv";
+
+// Longest extension IsMediaFile() looks at
+static const size_t wxMediaMaxExtension = 8;
+
+// How much of a playlist file is read and parsed at a time
+static const size_t wxMediaPlaylistChunk = 1024 * 1024;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScannerThread
+//
+// A worker of the scanner: reads directories until the scanner is stopped
+// ----------------------------------------------------------------------------
+class wxMediaPlayerScannerThread : public wxThread
+{
+public:
+    wxMediaPlayerScannerThread(wxMediaPlayerScanner* scanner)
+        : wxThread(wxTHREAD_JOINABLE), m_scanner(scanner)
+    {
+    }
+
+protected:
+    virtual ExitCode Entry()
+    {
+        wxMediaPlayerScanner::Job job;
+        while (m_scanner->GetJob(job))
+        {
+            if (!job.m_files.empty())
+                m_scanner->ReadFiles(job);
+            else if (job.m_bPlaylist)
+                m_scanner->ReadPlaylist(job);
+            else
+                m_scanner->Walk(job);
+        }
+        return 0;
+    }
+
+private:
+    wxMediaPlayerScanner* m_scanner;
+};
+
+wxMediaPlayerScanner::wxMediaPlayerScanner()
+                    : m_bFingerprint(true),
+                      m_cond(m_mutex),
+                      m_handler(NULL),
+                      m_bStopping(false)
+{
+    SetExtensions(wxMediaDefaultExtensions);
+}
+
+wxMediaPlayerScanner::~wxMediaPlayerScanner()
+{
+    Stop();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::Start
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::Start(wxEvtHandler* handler)
+{
+    m_handler = handler;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::Stop
+//
+// Drops the directories not read yet and waits for the workers to finish
+// the one they're on
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::Stop()
+{
+    {
+        wxMutexLocker lock(m_mutex);
+        m_bStopping = true;
+        m_jobs.clear();
+        m_cond.Broadcast();
+    }
+
+    for (size_t n = 0; n < m_threads.size(); ++n)
+    {
+        m_threads[n]->Wait();
+        delete m_threads[n];
+    }
+    m_threads.clear();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::SetExtensions
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::SetExtensions(const wxString& extensions)
+{
+    wxASSERT_MSG(m_threads.empty(), wxT("can't change extensions mid scan"));
+
+    m_extensions.clear();
+    m_extensions.push_back(',');
+
+    const wxScopedCharBuffer utf8 = extensions.utf8_str();
+    for (const char* p = utf8.data(); *p; ++p)
+    {
+        char c = *p;
+        if (c == ' ' || c == '.')
+            continue;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != ',' || m_extensions.back() != ',')
+            m_extensions.push_back(c);
+    }
+
+    if (m_extensions.back() != ',')
+        m_extensions.push_back(',');
+    m_extensions.push_back('\0');
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::SetFingerprinting
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::SetFingerprinting(bool bFingerprint)
+{
+    wxASSERT_MSG(m_threads.empty(),
+                 wxT("can't change fingerprinting mid scan"));
+
+    m_bFingerprint = bFingerprint;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::IsMediaFile
+//
+// Whether the extension of a file name is one of m_extensions
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerScanner::IsMediaFile(const char* name, size_t len) const
+{
+    size_t nDot = len;
+    while (nDot > 0 && name[nDot - 1] != '.')
+        --nDot;
+
+    size_t nExt = len - nDot;
+    if (nDot < 2 || nExt == 0 || nExt > wxMediaMaxExtension)
+        return false;   // no extension, or a dot file like ".mp3"
+
+    char ext[wxMediaMaxExtension + 3];
+    ext[0] = ',';
+    for (size_t n = 0; n < nExt; ++n)
+    {
+        char c = name[nDot + n];
+        ext[n + 1] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+    }
+    ext[nExt + 1] = ',';
+    ext[nExt + 2] = '\0';
+
+    return strstr(&m_extensions[0], ext) != NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::Scan
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::Scan(int page, const wxString& dir)
+{
+    Job job;
+    job.m_nPage = page;
+    job.m_szPath = dir;
+    job.m_bPlaylist = false;
+    AddJob(job);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::ScanPlaylist
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::ScanPlaylist(int page, const wxString& file)
+{
+    Job job;
+    job.m_nPage = page;
+    job.m_szPath = file;
+    job.m_bPlaylist = true;
+    AddJob(job);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::ScanFiles
+//
+// The files go as a single job, so they arrive in the given order
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::ScanFiles(int page,
+                                     const wxVector<wxString>& files)
+{
+    if (files.empty())
+        return;
+
+    Job job;
+    job.m_nPage = page;
+    job.m_bPlaylist = false;
+    job.m_files = files;
+    AddJob(job);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::AddJob
+//
+// Starts the workers the first time round.  Listing a directory is nearly
+// all waiting on the server, so there are more of them than cores.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::AddJob(const Job& job)
+{
+    wxMutexLocker lock(m_mutex);
+    if (m_bStopping)
+        return;
+
+    m_jobs.push_back(job);
+    m_cond.Signal();
+
+    if (m_threads.empty())
+    {
+        int nThreads = wxThread::GetCPUCount();
+        nThreads = wxMin(wxMax(nThreads * 2, 4), 16);
+
+        for (int n = 0; n < nThreads; ++n)
+        {
+            wxThread* thread = new wxMediaPlayerScannerThread(this);
+            if (thread->Run() != wxTHREAD_NO_ERROR)
+            {
+                delete thread;
+                break;
+            }
+            m_threads.push_back(thread);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::RemovePage
+//
+// Jobs of the page that are running already see it at their next
+// AddResults(), and stop there
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::RemovePage(int page)
+{
+    wxMutexLocker lock(m_mutex);
+    m_removedPages.push_back(page);
+
+    size_t nKept = 0;
+    for (size_t n = 0; n < m_jobs.size(); ++n)
+    {
+        if (m_jobs[n].m_nPage != page)
+            m_jobs[nKept++] = m_jobs[n];
+    }
+    m_jobs.resize(nKept);
+
+    for (size_t n = 0; n < m_batches.size(); ++n)
+    {
+        if (m_batches[n].m_nPage == page)
+        {
+            m_batches.erase(m_batches.begin() + n);
+            break;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::IsWanted
+//
+// Pages are only ever removed once, so a handful of ids is all there is
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerScanner::IsWanted(int page) const
+{
+    if (m_bStopping)
+        return false;
+
+    for (size_t n = 0; n < m_removedPages.size(); ++n)
+    {
+        if (m_removedPages[n] == page)
+            return false;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::TakeBatches
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::TakeBatches(wxVector<Batch>& batches)
+{
+    wxMutexLocker lock(m_mutex);
+    batches.swap(m_batches);
+    m_batches.clear();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::GetJob
+//
+// Blocks until there is something to read or the scanner is stopped.  The
+// most recently found directory is read first, which keeps m_jobs short on
+// deep trees.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerScanner::GetJob(Job& job)
+{
+    wxMutexLocker lock(m_mutex);
+
+    for (;;)
+    {
+        while (!m_bStopping && m_jobs.empty())
+            m_cond.Wait();
+
+        if (m_bStopping)
+            return false;
+
+        job = m_jobs.back();
+        m_jobs.pop_back();
+        if (IsWanted(job.m_nPage))
+            return true;
+    }
+}
+
+// A file name in a directory listing, sorted with wxVectorSort()
+struct wxMediaPlayerDirName
+{
+    const char* m_szName;
+
+    bool operator<(const wxMediaPlayerDirName& other) const
+    {
+        return strcmp(m_szName, other.m_szName) < 0;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::Walk
+//
+// Lists one directory without holding the lock.  Subdirectories are queued
+// for any worker to pick up, and media files are added to the page's batch
+// in name order.  Symbolic links to directories aren't followed, so a
+// link back up the tree can't make us go round forever.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::Walk(const Job& dir)
+{
+    wxVector<char>     names;       // Matching file names, NUL terminated
+    wxVector<wxUint32> nameStarts;
+    wxVector<wxString> subdirs;
+
+    wxString szDir = dir.m_szPath;
+    if (!szDir.empty() && !wxFileName::IsPathSeparator(szDir.Last()))
+        szDir += wxFileName::GetPathSeparator();
+    const wxScopedCharBuffer dirUTF8 = szDir.utf8_str();
+
+#ifdef __UNIX__
+    DIR* handle = opendir(dirUTF8.data());
+    if (!handle)
+        return;
+
+    while (struct dirent* entry = readdir(handle))
+    {
+        const char* name = entry->d_name;
+        if (name[0] == '.' &&
+            (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+
+        //  Only ask the file system when readdir() didn't say what it is
+        bool bDir = false;
+        bool bFile = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type == DT_DIR)
+            bDir = true;
+        else if (entry->d_type == DT_REG)
+            bFile = true;
+        else if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+#endif
+        {
+            wxVector<char> full(dirUTF8.data(),
+                                dirUTF8.data() + dirUTF8.length());
+            full.insert(full.end(), name, name + strlen(name) + 1);
+
+            struct stat st;
+            if (lstat(&full[0], &st) == 0 && S_ISDIR(st.st_mode))
+                bDir = true;
+            else if (stat(&full[0], &st) == 0 && S_ISREG(st.st_mode))
+                bFile = true;
+        }
+
+        size_t len = strlen(name);
+        if (bDir)
+            subdirs.push_back(szDir + wxString::FromUTF8(name, len));
+        else if (bFile && IsMediaFile(name, len))
+        {
+            nameStarts.push_back((wxUint32) names.size());
+            names.insert(names.end(), name, name + len + 1);
+        }
+    }
+    closedir(handle);
+#else
+    wxLogNull noLog;
+    wxDir handle;
+    if (!handle.Open(szDir))
+        return;
+
+    wxString name;
+    for (bool bCont = handle.GetFirst(&name, wxEmptyString,
+                                      wxDIR_DIRS | wxDIR_HIDDEN);
+         bCont; bCont = handle.GetNext(&name))
+        subdirs.push_back(szDir + name);
+
+    for (bool bCont = handle.GetFirst(&name, wxEmptyString,
+                                      wxDIR_FILES | wxDIR_HIDDEN);
+         bCont; bCont = handle.GetNext(&name))
+    {
+        const wxScopedCharBuffer utf8 = name.utf8_str();
+        if (IsMediaFile(utf8.data(), utf8.length()))
+        {
+            nameStarts.push_back((wxUint32) names.size());
+            names.insert(names.end(), utf8.data(),
+                         utf8.data() + utf8.length() + 1);
+        }
+    }
+#endif
+
+    wxVector<wxMediaPlayerDirName> sorted(nameStarts.size());
+    for (size_t n = 0; n < nameStarts.size(); ++n)
+        sorted[n].m_szName = &names[nameStarts[n]];
+    wxVectorSort(sorted);
+
+    //  Build the full paths before taking the lock
+    wxVector<char>     pool;
+    wxVector<wxUint32> offsets;
+    pool.reserve(sorted.size() * dirUTF8.length() + names.size());
+    offsets.reserve(sorted.size() + 1);
+    for (size_t n = 0; n < sorted.size(); ++n)
+    {
+        const char* name = sorted[n].m_szName;
+        offsets.push_back((wxUint32) pool.size());
+        pool.insert(pool.end(), dirUTF8.data(),
+                    dirUTF8.data() + dirUTF8.length());
+        pool.insert(pool.end(), name, name + strlen(name));
+    }
+    offsets.push_back((wxUint32) pool.size());
+
+    AddResults(dir.m_nPage, pool, offsets, subdirs);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::ReadPlaylist
+//
+// Parses a playlist a chunk at a time, handing over the entries of every
+// chunk as a batch so that the first of them can play while the rest are
+// still read
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::ReadPlaylist(const Job& playlist)
+{
+    wxLogNull noLog;
+    wxFile file;
+    if (!file.Open(playlist.m_szPath))
+        return;
+
+    wxMediaPlayerPlaylistReader reader(
+        wxMediaPlayerPlaylistReader::GetFormat(playlist.m_szPath),
+        wxPathOnly(playlist.m_szPath));
+
+    wxVector<char>     chunk(wxMediaPlaylistChunk);
+    wxVector<char>     pool;
+    wxVector<wxUint32> offsets(1, 0);
+    const wxVector<wxString> noSubdirs;
+
+    for (;;)
+    {
+        ssize_t nRead = file.Read(&chunk[0], chunk.size());
+        if (nRead <= 0)
+            break;
+
+        reader.Feed(&chunk[0], nRead, pool, offsets);
+        if (offsets.size() > 1)
+        {
+            if (!AddResults(playlist.m_nPage, pool, offsets, noSubdirs))
+                return;
+            pool.clear();
+            offsets.resize(1);
+        }
+    }
+
+    reader.Finish(pool, offsets);
+    AddResults(playlist.m_nPage, pool, offsets, noSubdirs);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::ReadFiles
+// ----------------------------------------------------------------------------
+void wxMediaPlayerScanner::ReadFiles(const Job& files)
+{
+    wxVector<char>     pool;
+    wxVector<wxUint32> offsets;
+    for (size_t n = 0; n < files.m_files.size(); ++n)
+    {
+        const wxScopedCharBuffer utf8 = files.m_files[n].utf8_str();
+        offsets.push_back((wxUint32) pool.size());
+        pool.insert(pool.end(), utf8.data(), utf8.data() + utf8.length());
+    }
+    offsets.push_back((wxUint32) pool.size());
+
+    AddResults(files.m_nPage, pool, offsets, wxVector<wxString>());
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::Fingerprint
+//
+// Of every path in pool, without holding the lock.  A playlist chunk can
+// name thousands of files, so this gives up early, returning false, once
+// the scanner is being stopped or the page is removed.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerScanner::Fingerprint(int page, const wxVector<char>& pool,
+                                       const wxVector<wxUint32>& offsets,
+                                       wxVector<wxUint64>& fingerprints)
+{
+    fingerprints.clear();
+    if (!m_bFingerprint)
+        return true;
+
+    fingerprints.reserve(offsets.size());
+    for (size_t n = 0; n + 1 < offsets.size(); ++n)
+    {
+        if (n % 64 == 0)
+        {
+            wxMutexLocker lock(m_mutex);
+            if (!IsWanted(page))
+                return false;
+        }
+
+        const wxUint32 start = offsets[n];
+        fingerprints.push_back(wxFingerprintMediaFile(
+            wxString::FromUTF8(&pool[0] + start, offsets[n + 1] - start)));
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerScanner::AddResults
+//
+// Called by the workers once per directory or playlist chunk.  Only the
+// first batch since the last TakeBatches() posts an event.  Returns false
+// once the scanner is being stopped or the page was removed, and then
+// neither files nor subdirectories are taken.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerScanner::AddResults(int page, const wxVector<char>& pool,
+                                      const wxVector<wxUint32>& offsets,
+                                      const wxVector<wxString>& subdirs)
+{
+    //  The slow part, reading the files, comes first
+    wxVector<wxUint64> fingerprints;
+    if (offsets.size() > 1 && !Fingerprint(page, pool, offsets, fingerprints))
+        return false;
+
+    wxMutexLocker lock(m_mutex);
+    if (!IsWanted(page))
+        return false;
+
+    //  Subdirectories in reverse so that the first one is read next
+    for (size_t n = subdirs.size(); n > 0; --n)
+    {
+        Job job;
+        job.m_nPage = page;
+        job.m_szPath = subdirs[n - 1];
+        job.m_bPlaylist = false;
+        m_jobs.push_back(job);
+    }
+    if (subdirs.size() == 1)
+        m_cond.Signal();
+    else if (!subdirs.empty())
+        m_cond.Broadcast();
+
+    if (offsets.size() < 2)
+        return true;
+
+    bool bFirst = m_batches.empty();
+
+    Batch* batch = NULL;
+    for (size_t n = 0; n < m_batches.size(); ++n)
+    {
+        if (m_batches[n].m_nPage == page)
+            batch = &m_batches[n];
+    }
+    if (!batch)
+    {
+        m_batches.push_back(Batch());
+        batch = &m_batches.back();
+        batch->m_nPage = page;
+        batch->m_offsets.push_back(0);
+    }
+
+    wxUint32 nBase = (wxUint32) batch->m_pool.size();
+    batch->m_pool.insert(batch->m_pool.end(), pool.begin(), pool.end());
+    for (size_t n = 1; n < offsets.size(); ++n)
+        batch->m_offsets.push_back(nBase + offsets[n]);
+    batch->m_fingerprints.insert(batch->m_fingerprints.end(),
+                                 fingerprints.begin(), fingerprints.end());
+
+    if (bFirst && m_handler)
+        wxQueueEvent(m_handler, new wxThreadEvent(wxEVT_THREAD, wxID_SCANNER));
+    return true;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerWatcher
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Milliseconds without events before the pending changes are handed over
+static const long wxMediaWatchQuiet = 300;
+
+// And the longest a change is held back however busy the trees are
+static const long wxMediaWatchLatency = 2000;
+
+#ifdef __LINUX__
+// What we ask inotify about each directory
+static const wxUint32 wxMediaWatchMask = IN_CLOSE_WRITE | IN_CREATE |
+                                         IN_DELETE | IN_MOVED_FROM |
+                                         IN_MOVED_TO | IN_DELETE_SELF |
+                                         IN_MOVE_SELF | IN_ONLYDIR |
+                                         IN_DONT_FOLLOW;
+#endif
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcherThread
+// ----------------------------------------------------------------------------
+class wxMediaPlayerWatcherThread : public wxThread
+{
+public:
+    wxMediaPlayerWatcherThread(wxMediaPlayerWatcher* watcher)
+        : wxThread(wxTHREAD_JOINABLE), m_watcher(watcher)
+    {
+    }
+
+protected:
+    virtual ExitCode Entry()
+    {
+        m_watcher->Run();
+        return 0;
+    }
+
+private:
+    wxMediaPlayerWatcher* m_watcher;
+};
+
+wxMediaPlayerWatcher::wxMediaPlayerWatcher()
+                    : m_nInotify(-1),
+                      m_scanner(NULL),
+                      m_bWatchesFull(false),
+                      m_thread(NULL),
+                      m_handler(NULL),
+                      m_bStopping(false)
+{
+    m_wake[0] = -1;
+    m_wake[1] = -1;
+}
+
+wxMediaPlayerWatcher::~wxMediaPlayerWatcher()
+{
+    Stop();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::Start
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::Start(wxEvtHandler* handler,
+                                 const wxMediaPlayerScanner* scanner)
+{
+    m_handler = handler;
+    m_scanner = scanner;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::Stop
+//
+// Changes still held back by the thread are dropped
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::Stop()
+{
+    wxThread* thread;
+    {
+        wxMutexLocker lock(m_mutex);
+        m_bStopping = true;
+        m_requests.clear();
+        thread = m_thread;
+        m_thread = NULL;
+        Wake();
+    }
+
+    if (thread)
+    {
+        thread->Wait();
+        delete thread;
+    }
+
+#ifdef __LINUX__
+    for (int n = 0; n < 2; ++n)
+    {
+        if (m_wake[n] != -1)
+            close(m_wake[n]);
+        m_wake[n] = -1;
+    }
+    if (m_nInotify != -1)
+        close(m_nInotify);
+    m_nInotify = -1;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::Watch
+//
+// The trees are read by the thread, which starts with the first one
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::Watch(int page, const wxString& dir)
+{
+#ifdef __LINUX__
+    Dir request;
+    request.m_nWatch = -1;
+    request.m_nPage = page;
+    request.m_szPath = dir;
+    request.m_bRoot = true;
+    if (!dir.empty() && !wxFileName::IsPathSeparator(dir.Last()))
+        request.m_szPath += wxFileName::GetPathSeparator();
+
+    wxMutexLocker lock(m_mutex);
+    if (m_bStopping)
+        return;
+
+    if (m_nInotify == -1)
+    {
+        m_nInotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_nInotify == -1)
+        {
+            wxLogSysError(wxT("Can't watch \"%s\" for changes"), dir);
+            return;
+        }
+        if (pipe2(m_wake, O_CLOEXEC | O_NONBLOCK) != 0)
+        {
+            close(m_nInotify);
+            m_nInotify = -1;
+            m_wake[0] = -1;
+            m_wake[1] = -1;
+            return;
+        }
+    }
+
+    m_requests.push_back(request);
+    Wake();
+
+    if (!m_thread)
+    {
+        wxThread* thread = new wxMediaPlayerWatcherThread(this);
+        if (thread->Run() != wxTHREAD_NO_ERROR)
+            delete thread;
+        else
+            m_thread = thread;
+    }
+#else
+    wxUnusedVar(page);
+    wxUnusedVar(dir);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::RemovePage
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::RemovePage(int page)
+{
+    wxMutexLocker lock(m_mutex);
+    if (!m_thread)
+        return;
+
+    m_removedPages.push_back(page);
+
+    size_t nKept = 0;
+    for (size_t n = 0; n < m_requests.size(); ++n)
+    {
+        if (m_requests[n].m_nPage != page)
+            m_requests[nKept++] = m_requests[n];
+    }
+    m_requests.resize(nKept);
+
+    nKept = 0;
+    for (size_t n = 0; n < m_changes.size(); ++n)
+    {
+        if (m_changes[n].m_nPage != page)
+            m_changes[nKept++] = m_changes[n];
+    }
+    m_changes.resize(nKept);
+
+    Wake();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::TakeChanges
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::TakeChanges(wxVector<Change>& changes)
+{
+    wxMutexLocker lock(m_mutex);
+    changes.swap(m_changes);
+    m_changes.clear();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::Wake
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::Wake()
+{
+#ifdef __LINUX__
+    if (m_wake[1] == -1)
+        return;
+
+    //  A full pipe wakes it just as well
+    char c = 0;
+    ssize_t written = write(m_wake[1], &c, 1);
+    wxUnusedVar(written);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::Run
+//
+// The thread's loop: waits for events, requests, or the pending changes to
+// be due
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::Run()
+{
+#ifdef __LINUX__
+    m_buffer.resize(64 * 1024);
+
+    wxStopWatch quiet;              // Since the last event
+    wxStopWatch held;               // Since the oldest pending change
+    while (TakeRequests())
+    {
+        int timeout = -1;
+        if (!m_pending.empty())
+        {
+            long wait = wxMin(wxMediaWatchQuiet - quiet.Time(),
+                              wxMediaWatchLatency - held.Time());
+            if (wait <= 0)
+            {
+                Flush();
+                continue;
+            }
+            timeout = (int) wait;
+        }
+
+        struct pollfd fds[2];
+        fds[0].fd = m_nInotify;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = m_wake[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if (poll(fds, 2, timeout) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            char drain[64];
+            while (read(m_wake[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            const bool bHeld = !m_pending.empty();
+            if (ReadEvents())
+            {
+                quiet.Start();
+                if (!bHeld)
+                    held.Start();
+            }
+        }
+    }
+#endif
+}
+
+#ifdef __LINUX__
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::TakeRequests
+//
+// Returns false once the watcher is stopped
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerWatcher::TakeRequests()
+{
+    wxVector<Dir> requests;
+    wxVector<int> removedPages;
+    {
+        wxMutexLocker lock(m_mutex);
+        if (m_bStopping)
+            return false;
+
+        requests.swap(m_requests);
+        m_requests.clear();
+        removedPages.swap(m_removedPages);
+        m_removedPages.clear();
+    }
+
+    for (size_t i = 0; i < removedPages.size(); ++i)
+    {
+        const int page = removedPages[i];
+        for (size_t n = m_dirs.size(); n-- > 0; )
+        {
+            if (m_dirs[n].m_nPage == page)
+                RemoveWatch(n);
+        }
+
+        size_t nKept = 0;
+        for (size_t n = 0; n < m_pending.size(); ++n)
+        {
+            if (m_pending[n].m_nPage == page)
+                continue;
+            m_pending[nKept] = m_pending[n];
+            m_cookies[nKept++] = m_cookies[n];
+        }
+        m_pending.resize(nKept);
+        m_cookies.resize(nKept);
+    }
+
+    for (size_t n = 0; n < requests.size(); ++n)
+        AddTree(requests[n].m_nPage, requests[n].m_szPath, true);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::AddTree
+//
+// Watches dir and the directories under it, except those the page has
+// already.  As with the scanner symbolic links aren't followed.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::AddTree(int page, const wxString& dir, bool bRoot)
+{
+    wxVector<wxString> stack(1, dir);
+    while (!stack.empty())
+    {
+        const wxString path = stack.back();
+        stack.pop_back();
+        const wxScopedCharBuffer utf8 = path.utf8_str();
+
+        int watch = inotify_add_watch(m_nInotify, utf8.data(),
+                                      wxMediaWatchMask);
+        if (watch == -1)
+        {
+            //  Past fs.inotify.max_user_watches the rest goes unwatched
+            if (errno == ENOSPC && !m_bWatchesFull)
+            {
+                m_bWatchesFull = true;
+                wxLogWarning(wxT("Out of inotify watches at \"%s\", ")
+                             wxT("changes below it and in folders not ")
+                             wxT("watched yet are missed"), path);
+            }
+            continue;
+        }
+
+        size_t nDir = FindWatch(watch);
+        bool bKnown = false;
+        for (; nDir < m_dirs.size() && m_dirs[nDir].m_nWatch == watch; ++nDir)
+        {
+            if (m_dirs[nDir].m_nPage == page)
+            {
+                bKnown = true;
+                m_dirs[nDir].m_bRoot |= bRoot && path == dir;
+                break;
+            }
+        }
+        if (bKnown)
+            continue;
+
+        Dir added;
+        added.m_nWatch = watch;
+        added.m_nPage = page;
+        added.m_szPath = path;
+        added.m_bRoot = bRoot && path == dir;
+        m_dirs.insert(m_dirs.begin() + nDir, added);
+
+        DIR* handle = opendir(utf8.data());
+        if (!handle)
+            continue;
+
+        while (struct dirent* entry = readdir(handle))
+        {
+            const char* name = entry->d_name;
+            if (name[0] == '.' &&
+                (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+                continue;
+
+            bool bDir = false;
+#ifdef _DIRENT_HAVE_D_TYPE
+            if (entry->d_type == DT_DIR)
+                bDir = true;
+            else if (entry->d_type == DT_UNKNOWN)
+#endif
+            {
+                wxVector<char> full(utf8.data(), utf8.data() + utf8.length());
+                full.insert(full.end(), name, name + strlen(name) + 1);
+
+                struct stat st;
+                bDir = lstat(&full[0], &st) == 0 && S_ISDIR(st.st_mode);
+            }
+
+            if (bDir)
+                stack.push_back(path + wxString::FromUTF8(name) +
+                                wxFileName::GetPathSeparator());
+        }
+        closedir(handle);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::RemoveTree
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::RemoveTree(int page, const wxString& dir)
+{
+    for (size_t n = m_dirs.size(); n-- > 0; )
+    {
+        if (m_dirs[n].m_nPage == page && m_dirs[n].m_szPath.StartsWith(dir))
+            RemoveWatch(n);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::RenameTree
+//
+// The watch descriptors follow a moved directory, only our paths change
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::RenameTree(int page, const wxString& dir,
+                                      const wxString& newDir)
+{
+    for (size_t n = 0; n < m_dirs.size(); ++n)
+    {
+        Dir& moved = m_dirs[n];
+        if (moved.m_nPage == page && moved.m_szPath.StartsWith(dir))
+            moved.m_szPath = newDir + moved.m_szPath.Mid(dir.length());
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::RemoveWatch
+//
+// Gives the watch back to inotify once no page has the directory
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::RemoveWatch(size_t nDir)
+{
+    const int watch = m_dirs[nDir].m_nWatch;
+    m_dirs.erase(m_dirs.begin() + nDir);
+
+    size_t nOther = FindWatch(watch);
+    if (nOther == m_dirs.size() || m_dirs[nOther].m_nWatch != watch)
+        inotify_rm_watch(m_nInotify, watch);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::FindWatch
+//
+// The first of m_dirs with watch or a later one
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerWatcher::FindWatch(int watch) const
+{
+    size_t nLow = 0;
+    size_t nHigh = m_dirs.size();
+    while (nLow < nHigh)
+    {
+        size_t nMid = nLow + (nHigh - nLow) / 2;
+        if (m_dirs[nMid].m_nWatch < watch)
+            nLow = nMid + 1;
+        else
+            nHigh = nMid;
+    }
+    return nLow;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::ReadEvents
+//
+// Returns whether there were any
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerWatcher::ReadEvents()
+{
+    bool bRead = false;
+    for (;;)
+    {
+        ssize_t len = read(m_nInotify, &m_buffer[0], m_buffer.size());
+        if (len <= 0)
+            break;
+
+        bRead = true;
+        for (ssize_t offset = 0; offset < len; )
+        {
+            const struct inotify_event* event =
+                (const struct inotify_event*) (&m_buffer[0] + offset);
+            HandleEvent(*event);
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return bRead;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::HandleEvent
+//
+// A directory's events are the same for every page watching it, each page
+// gets its own changes.  inotify reports a move as a move out followed by a
+// move in with the same cookie, which PairMove() makes a rename of.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::HandleEvent(const struct inotify_event& event)
+{
+    //  Events were lost, so the pages have their trees listed again; they
+    //  don't add the files they have twice
+    if (event.mask & IN_Q_OVERFLOW)
+    {
+        for (size_t n = 0; n < m_dirs.size(); ++n)
+        {
+            if (m_dirs[n].m_bRoot)
+                AddChange(m_dirs[n], wxWATCH_DIR_ADDED, NULL, 0);
+        }
+        return;
+    }
+
+    wxVector<Dir> dirs;
+    size_t nDir = FindWatch(event.wd);
+    for (; nDir < m_dirs.size() && m_dirs[nDir].m_nWatch == event.wd; ++nDir)
+        dirs.push_back(m_dirs[nDir]);
+
+    //  The directory went and inotify dropped the watch
+    if (event.mask & IN_IGNORED)
+    {
+        nDir = FindWatch(event.wd);
+        m_dirs.erase(m_dirs.begin() + nDir,
+                     m_dirs.begin() + nDir + dirs.size());
+        return;
+    }
+
+    const char* name = event.len ? event.name : "";
+    const size_t len = strlen(name);
+    const bool bMedia = m_scanner && m_scanner->IsMediaFile(name, len);
+    for (size_t n = 0; n < dirs.size(); ++n)
+    {
+        const Dir& dir = dirs[n];
+
+        //  Others are reported by their parent directory too
+        if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+        {
+            if (dir.m_bRoot)
+                AddChange(dir, wxWATCH_DIR_REMOVED, NULL, 0);
+        }
+        else if (event.mask & IN_ISDIR)
+        {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                if ((event.mask & IN_MOVED_TO) &&
+                    PairMove(dir, name, event.cookie, true))
+                    continue;
+
+                AddTree(dir.m_nPage, dir.m_szPath +
+                        wxString::FromUTF8(name, len) +
+                        wxFileName::GetPathSeparator(), false);
+                AddChange(dir, wxWATCH_DIR_ADDED, name, 0);
+            }
+            else if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+                AddChange(dir, wxWATCH_DIR_REMOVED, name,
+                          event.mask & IN_MOVED_FROM ? event.cookie : 0);
+        }
+        else if (event.mask & IN_CLOSE_WRITE)
+        {
+            if (bMedia)
+                AddChange(dir, wxWATCH_ADDED, name, 0);
+        }
+        else if (event.mask & IN_MOVED_TO)
+        {
+            if (!PairMove(dir, name, event.cookie, false) && bMedia)
+                AddChange(dir, wxWATCH_ADDED, name, 0);
+        }
+        else if (event.mask & (IN_DELETE | IN_MOVED_FROM))
+        {
+            if (bMedia)
+                AddChange(dir, wxWATCH_REMOVED, name,
+                          event.mask & IN_MOVED_FROM ? event.cookie : 0);
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::PairMove
+//
+// Makes the pending move out with cookie a rename to name in dir.  A file
+// renamed to a name that isn't media stays removed.  Returns false if
+// there was no such move.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerWatcher::PairMove(const Dir& dir, const char* name,
+                                    wxUint32 cookie, bool bDir)
+{
+    if (!cookie)
+        return false;
+
+    size_t n = m_pending.size();
+    while (n-- > 0)
+    {
+        if (m_cookies[n] == cookie && m_pending[n].m_nPage == dir.m_nPage)
+            break;
+    }
+    if (n == (size_t) -1)
+        return false;
+
+    Change& change = m_pending[n];
+    m_cookies[n] = 0;
+    if (!bDir && !m_scanner->IsMediaFile(name, strlen(name)))
+        return true;
+
+    change.m_szNewPath = dir.m_szPath + wxString::FromUTF8(name);
+    if (bDir)
+    {
+        change.m_nEvent = wxWATCH_DIR_RENAMED;
+        change.m_szNewPath += wxFileName::GetPathSeparator();
+        RenameTree(dir.m_nPage, change.m_szPath, change.m_szNewPath);
+    }
+    else
+        change.m_nEvent = wxWATCH_RENAMED;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::AddChange
+//
+// Without name the change is to dir itself
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::AddChange(const Dir& dir, int event,
+                                     const char* name, wxUint32 cookie)
+{
+    Change change;
+    change.m_nPage = dir.m_nPage;
+    change.m_nEvent = event;
+    change.m_szPath = dir.m_szPath;
+    if (name)
+    {
+        change.m_szPath += wxString::FromUTF8(name);
+        if (event == wxWATCH_DIR_ADDED || event == wxWATCH_DIR_REMOVED)
+            change.m_szPath += wxFileName::GetPathSeparator();
+    }
+
+    m_pending.push_back(change);
+    m_cookies.push_back(cookie);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerWatcher::Flush
+//
+// Hands the pending changes over.  Moves out that weren't paired by now
+// went out of the trees.  Added files are fingerprinted here, as the
+// scanner does, so the page can drop duplicates without reading them.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerWatcher::Flush()
+{
+    for (size_t n = 0; n < m_pending.size(); ++n)
+    {
+        if (m_pending[n].m_nEvent == wxWATCH_DIR_REMOVED)
+            RemoveTree(m_pending[n].m_nPage, m_pending[n].m_szPath);
+    }
+
+    bool bFirst;
+    {
+        wxMutexLocker lock(m_mutex);
+        bFirst = m_changes.empty();
+        m_changes.insert(m_changes.end(), m_pending.begin(), m_pending.end());
+    }
+    m_pending.clear();
+    m_cookies.clear();
+
+    if (bFirst && m_handler)
+        wxQueueEvent(m_handler, new wxThreadEvent(wxEVT_THREAD, wxID_WATCHER));
+}
+#endif // __LINUX__
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerPlaylistReader
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static bool wxMediaIsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static int wxMediaHexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Whether [p, end) starts with a lower case ASCII prefix, ignoring case
+static bool wxMediaStartsWith(const char* p, const char* end, const char* prefix)
+{
+    for (; *prefix; ++p, ++prefix)
+    {
+        if (p == end)
+            return false;
+        char c = *p;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (c != *prefix)
+            return false;
+    }
+    return true;
+}
+
+// Finds the first occurrence of a string in [p, end), or NULL
+static const char* wxMediaFind(const char* p, const char* end,
+                               const char* sz, size_t len)
+{
+    while ((size_t)(end - p) >= len)
+    {
+        p = (const char*) memchr(p, sz[0], end - p - len + 1);
+        if (!p)
+            return NULL;
+        if (memcmp(p, sz, len) == 0)
+            return p;
+        ++p;
+    }
+    return NULL;
+}
+
+// Whether [p, end) is well formed UTF-8
+static bool wxMediaIsUTF8(const char* p, const char* end)
+{
+    while (p < end)
+    {
+        wxUint8 c = (wxUint8) *p++;
+        int nMore = c < 0x80 ? 0 : c < 0xc2 ? -1 : c < 0xe0 ? 1 :
+                    c < 0xf0 ? 2 : c < 0xf5 ? 3 : -1;
+        if (nMore < 0 || end - p < nMore)
+            return false;
+        for (; nMore > 0; --nMore)
+        {
+            if (((wxUint8) *p++ & 0xc0) != 0x80)
+                return false;
+        }
+    }
+    return true;
+}
+
+wxMediaPlayerPlaylistReader::wxMediaPlayerPlaylistReader(int format,
+                                                         const wxString& dir)
+                           : m_nFormat(format), m_bStart(true)
+{
+    if (!dir.empty())
+    {
+        const wxScopedCharBuffer utf8 = dir.utf8_str();
+        m_base.assign(utf8.data(), utf8.data() + utf8.length());
+        if (!wxFileName::IsPathSeparator(dir.Last()))
+        {
+            const wxScopedCharBuffer sep =
+                wxFileName::GetPathSeparator().utf8_str();
+            m_base.insert(m_base.end(), sep.data(), sep.data() + sep.length());
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader::GetFormat
+// ----------------------------------------------------------------------------
+int wxMediaPlayerPlaylistReader::GetFormat(const wxString& path)
+{
+    wxString ext = path.AfterLast(wxT('.')).Lower();
+    if (ext.length() == path.length())
+        return wxPLAYLISTFORMAT_NONE;
+
+    if (ext == wxT("m3u") || ext == wxT("m3u8"))
+        return wxPLAYLISTFORMAT_M3U;
+    if (ext == wxT("pls"))
+        return wxPLAYLISTFORMAT_PLS;
+    if (ext == wxT("xspf"))
+        return wxPLAYLISTFORMAT_XSPF;
+    return wxPLAYLISTFORMAT_NONE;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader::Feed
+//
+// Only the incomplete line or element at the end of the chunk is kept, so
+// the buffer stays about one chunk long however big the file is
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlaylistReader::Feed(const char* data, size_t len,
+                                       wxVector<char>& pool,
+                                       wxVector<wxUint32>& offsets)
+{
+    m_buffer.insert(m_buffer.end(), data, data + len);
+    if (m_bStart && m_buffer.size() >= 3)
+        SkipBOM();
+    if (m_buffer.empty())
+        return;
+
+    size_t nParsed = m_nFormat == wxPLAYLISTFORMAT_XSPF
+                        ? ParseXSPF(pool, offsets)
+                        : ParseLines(false, pool, offsets);
+    m_buffer.erase(m_buffer.begin(), m_buffer.begin() + nParsed);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader::Finish
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlaylistReader::Finish(wxVector<char>& pool,
+                                         wxVector<wxUint32>& offsets)
+{
+    if (m_bStart)
+        SkipBOM();
+
+    //  An XSPF location is only complete with its end tag, but the last
+    //  line of the others needn't end in a newline
+    if (!m_buffer.empty() && m_nFormat != wxPLAYLISTFORMAT_XSPF)
+        ParseLines(true, pool, offsets);
+    m_buffer.clear();
+}
+
+void wxMediaPlayerPlaylistReader::SkipBOM()
+{
+    m_bStart = false;
+    if (m_buffer.size() >= 3 && (wxUint8) m_buffer[0] == 0xef &&
+        (wxUint8) m_buffer[1] == 0xbb && (wxUint8) m_buffer[2] == 0xbf)
+        m_buffer.erase(m_buffer.begin(), m_buffer.begin() + 3);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader::ParseLines
+//
+// M3U is a path per line with '#' comments and directives, PLS has
+// "FileN=path" lines among others.  Returns how much of m_buffer was used.
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerPlaylistReader::ParseLines(bool bLast,
+                                               wxVector<char>& pool,
+                                               wxVector<wxUint32>& offsets)
+{
+    const char* const begin = &m_buffer[0];
+    const char* const end = begin + m_buffer.size();
+    const char* p = begin;
+
+    while (p < end)
+    {
+        const char* eol = (const char*) memchr(p, '\n', end - p);
+        if (!eol)
+        {
+            if (!bLast)
+                break;
+            eol = end;
+        }
+
+        const char* line = p;
+        const char* lineEnd = eol;
+        p = eol < end ? eol + 1 : end;
+
+        while (line < lineEnd && wxMediaIsSpace(*line))
+            ++line;
+        while (lineEnd > line && wxMediaIsSpace(lineEnd[-1]))
+            --lineEnd;
+        if (line == lineEnd)
+            continue;
+
+        if (m_nFormat == wxPLAYLISTFORMAT_PLS)
+        {
+            if (!wxMediaStartsWith(line, lineEnd, "file"))
+                continue;
+
+            const char* value = line + 4;
+            while (value < lineEnd && *value >= '0' && *value <= '9')
+                ++value;
+            if (value == line + 4 || value == lineEnd || *value != '=')
+                continue;
+            line = value + 1;
+        }
+        else if (*line == '#')
+        {
+            continue;
+        }
+
+        AddPath(line, lineEnd, false, pool, offsets);
+    }
+
+    return p - begin;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader::ParseXSPF
+//
+// Picks the <location> elements out without parsing the rest of the XML.
+// Returns how much of m_buffer was used, keeping an unfinished element (or
+// what could be the start of one) for the next chunk.
+// ----------------------------------------------------------------------------
+size_t wxMediaPlayerPlaylistReader::ParseXSPF(wxVector<char>& pool,
+                                              wxVector<wxUint32>& offsets)
+{
+    static const char szOpen[] = "<location>";
+    static const char szClose[] = "</location>";
+    const size_t nOpen = sizeof(szOpen) - 1;
+    const size_t nClose = sizeof(szClose) - 1;
+
+    const char* const begin = &m_buffer[0];
+    const char* const end = begin + m_buffer.size();
+    const char* p = begin;
+
+    for (;;)
+    {
+        const char* tag = wxMediaFind(p, end, szOpen, nOpen);
+        if (!tag)
+        {
+            //  Keep what may be the start of a tag split by the chunk
+            size_t nKeep = wxMin((size_t)(end - p), nOpen - 1);
+            return (end - nKeep) - begin;
+        }
+
+        const char* value = tag + nOpen;
+        const char* close = wxMediaFind(value, end, szClose, nClose);
+        if (!close)
+            return tag - begin;
+
+        //  Decode the entities, the only markup a location can contain
+        m_scratch.clear();
+        for (const char* q = value; q < close; ++q)
+        {
+            if (*q != '&')
+            {
+                m_scratch.push_back(*q);
+                continue;
+            }
+
+            const char* semi = (const char*) memchr(q, ';', close - q);
+            if (!semi)
+            {
+                m_scratch.push_back(*q);
+                continue;
+            }
+
+            const char* name = q + 1;
+            wxUint32 ch = 0;
+            if (semi - name == 3 && memcmp(name, "amp", 3) == 0)
+                ch = '&';
+            else if (semi - name == 2 && memcmp(name, "lt", 2) == 0)
+                ch = '<';
+            else if (semi - name == 2 && memcmp(name, "gt", 2) == 0)
+                ch = '>';
+            else if (semi - name == 4 && memcmp(name, "quot", 4) == 0)
+                ch = '"';
+            else if (semi - name == 4 && memcmp(name, "apos", 4) == 0)
+                ch = '\'';
+            else if (semi - name > 1 && *name == '#')
+            {
+                bool bHex = name[1] == 'x' || name[1] == 'X';
+                for (const char* d = name + (bHex ? 2 : 1); d < semi; ++d)
+                {
+                    int digit = wxMediaHexValue(*d);
+                    if (digit < 0 || (!bHex && digit > 9) || ch > 0x10ffff)
+                    {
+                        ch = 0;
+                        break;
+                    }
+                    ch = ch * (bHex ? 16 : 10) + digit;
+                }
+            }
+
+            if (ch == 0 || ch > 0x10ffff)
+            {
+                m_scratch.push_back(*q);
+                continue;
+            }
+
+            //  Back to UTF-8
+            if (ch < 0x80)
+                m_scratch.push_back((char) ch);
+            else if (ch < 0x800)
+            {
+                m_scratch.push_back((char)(0xc0 | (ch >> 6)));
+                m_scratch.push_back((char)(0x80 | (ch & 0x3f)));
+            }
+            else if (ch < 0x10000)
+            {
+                m_scratch.push_back((char)(0xe0 | (ch >> 12)));
+                m_scratch.push_back((char)(0x80 | ((ch >> 6) & 0x3f)));
+                m_scratch.push_back((char)(0x80 | (ch & 0x3f)));
+            }
+            else
+            {
+                m_scratch.push_back((char)(0xf0 | (ch >> 18)));
+                m_scratch.push_back((char)(0x80 | ((ch >> 12) & 0x3f)));
+                m_scratch.push_back((char)(0x80 | ((ch >> 6) & 0x3f)));
+                m_scratch.push_back((char)(0x80 | (ch & 0x3f)));
+            }
+            q = semi;
+        }
+
+        const char* location = m_scratch.empty() ? NULL : &m_scratch[0];
+        const char* locationEnd = location + m_scratch.size();
+        while (location < locationEnd && wxMediaIsSpace(*location))
+            ++location;
+        while (locationEnd > location && wxMediaIsSpace(locationEnd[-1]))
+            --locationEnd;
+        if (location < locationEnd)
+            AddPath(location, locationEnd, true, pool, offsets);
+
+        p = close + nClose;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistReader::AddPath
+//
+// Appends an entry to the pool.  file:// URLs and, in XSPF, relative URIs
+// are percent decoded; other URLs are kept as they are.  Relative paths
+// are made absolute with the playlist's directory.  Old style M3U files are
+// often in Latin-1, so lines that aren't UTF-8 are taken as that.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlaylistReader::AddPath(const char* p, const char* end,
+                                          bool bURI,
+                                          wxVector<char>& pool,
+                                          wxVector<wxUint32>& offsets)
+{
+    const size_t nStart = pool.size();
+
+    //  A URL scheme is letters, digits, '+', '-' and '.' before "://"
+    const char* scheme = p;
+    while (scheme < end &&
+           ((*scheme >= 'a' && *scheme <= 'z') ||
+            (*scheme >= 'A' && *scheme <= 'Z') ||
+            (scheme > p && ((*scheme >= '0' && *scheme <= '9') ||
+                            *scheme == '+' || *scheme == '-' ||
+                            *scheme == '.'))))
+        ++scheme;
+
+    bool bDecode = bURI;
+    if (scheme > p + 1 && end - scheme >= 3 && memcmp(scheme, "://", 3) == 0)
+    {
+        if (!wxMediaStartsWith(p, end, "file://"))
+        {
+            pool.insert(pool.end(), p, end);
+            offsets.push_back((wxUint32) pool.size());
+            return;
+        }
+
+        //  Drop the host, normally empty or localhost
+        p = (const char*) memchr(p + 7, '/', end - (p + 7));
+        if (!p)
+            return;
+#ifdef __WINDOWS__
+        if (end - p >= 3 && p[2] == ':')
+            ++p;    // file:///C:/...
+#endif
+        bDecode = true;
+    }
+    else
+    {
+        bool bAbsolute = *p == '/' || *p == '\\' ||
+                         (end - p >= 2 && p[1] == ':');
+        if (!bAbsolute)
+            pool.insert(pool.end(), m_base.begin(), m_base.end());
+    }
+
+    if (!bDecode)
+    {
+        pool.insert(pool.end(), p, end);
+    }
+    else
+    {
+        for (; p < end; ++p)
+        {
+            int hi, lo;
+            if (*p == '%' && end - p >= 3 &&
+                (hi = wxMediaHexValue(p[1])) >= 0 &&
+                (lo = wxMediaHexValue(p[2])) >= 0)
+            {
+                pool.push_back((char)(hi * 16 + lo));
+                p += 2;
+            }
+            else
+            {
+                pool.push_back(*p);
+            }
+        }
+    }
+
+    if (!bURI && pool.size() > nStart &&
+        !wxMediaIsUTF8(&pool[0] + nStart, &pool[0] + pool.size()))
+    {
+        wxVector<char> latin1(pool.begin() + nStart, pool.end());
+        pool.resize(nStart);
+        for (size_t n = 0; n < latin1.size(); ++n)
+        {
+            wxUint8 c = (wxUint8) latin1[n];
+            if (c < 0x80)
+                pool.push_back((char) c);
+            else
+            {
+                pool.push_back((char)(0xc0 | (c >> 6)));
+                pool.push_back((char)(0x80 | (c & 0x3f)));
+            }
+        }
+    }
+
+    offsets.push_back((wxUint32) pool.size());
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerPlaylistWriter
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// How much the writer collects before writing it out
+static const size_t wxMediaPlaylistWriteBuffer = 64 * 1024;
+
+wxMediaPlayerPlaylistWriter::wxMediaPlayerPlaylistWriter()
+                           : m_nFormat(wxPLAYLISTFORMAT_NONE),
+                             m_nEntries(0),
+                             m_bOK(false)
+{
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistWriter::Create
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerPlaylistWriter::Create(const wxString& path, int format)
+{
+    m_nFormat = format;
+    m_nEntries = 0;
+    m_buffer.clear();
+    m_buffer.reserve(wxMediaPlaylistWriteBuffer + 1024);
+
+    {
+        wxLogNull noLog;
+        m_bOK = format != wxPLAYLISTFORMAT_NONE && m_file.Open(path);
+    }
+    if (!m_bOK)
+        return false;
+
+    switch (m_nFormat)
+    {
+        case wxPLAYLISTFORMAT_M3U:
+            Write("#EXTM3U\n");
+            break;
+        case wxPLAYLISTFORMAT_PLS:
+            Write("[playlist]\n");
+            break;
+        case wxPLAYLISTFORMAT_XSPF:
+            Write("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                  "<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n"
+                  "  <trackList>\n");
+            break;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistWriter::Add
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlaylistWriter::Add(const char* path, size_t len,
+                                      wxUint32 duration)
+{
+    ++m_nEntries;
+    switch (m_nFormat)
+    {
+        case wxPLAYLISTFORMAT_M3U:
+            if (duration)
+            {
+                const char* name = path + len;
+                while (name > path && name[-1] != '/' && name[-1] != '\\')
+                    --name;
+
+                Write("#EXTINF:");
+                WriteNumber((duration + 500) / 1000);
+                Write(",");
+                Write(name, path + len - name);
+                Write("\n");
+            }
+            Write(path, len);
+            Write("\n");
+            break;
+
+        case wxPLAYLISTFORMAT_PLS:
+            Write("File");
+            WriteNumber(m_nEntries);
+            Write("=");
+            Write(path, len);
+            Write("\n");
+            if (duration)
+            {
+                Write("Length");
+                WriteNumber(m_nEntries);
+                Write("=");
+                WriteNumber((duration + 500) / 1000);
+                Write("\n");
+            }
+            break;
+
+        case wxPLAYLISTFORMAT_XSPF:
+            Write("    <track><location>");
+            WriteLocation(path, len);
+            Write("</location>");
+            if (duration)
+            {
+                Write("<duration>");
+                WriteNumber(duration);
+                Write("</duration>");
+            }
+            Write("</track>\n");
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistWriter::Commit
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerPlaylistWriter::Commit()
+{
+    switch (m_nFormat)
+    {
+        case wxPLAYLISTFORMAT_PLS:
+            Write("NumberOfEntries=");
+            WriteNumber(m_nEntries);
+            Write("\nVersion=2\n");
+            break;
+        case wxPLAYLISTFORMAT_XSPF:
+            Write("  </trackList>\n</playlist>\n");
+            break;
+    }
+
+    Flush();
+
+    wxLogNull noLog;
+    if (!m_bOK || !m_file.Commit())
+    {
+        m_file.Discard();
+        return false;
+    }
+    return true;
+}
+
+void wxMediaPlayerPlaylistWriter::Write(const char* data, size_t len)
+{
+    m_buffer.insert(m_buffer.end(), data, data + len);
+    if (m_buffer.size() >= wxMediaPlaylistWriteBuffer)
+        Flush();
+}
+
+void wxMediaPlayerPlaylistWriter::WriteNumber(wxUint32 n)
+{
+    char sz[10];
+    size_t nDigits = 0;
+    do
+    {
+        sz[sizeof(sz) - ++nDigits] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    Write(sz + sizeof(sz) - nDigits, nDigits);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistWriter::WriteLocation
+//
+// XSPF wants URIs: local paths become percent encoded file:// URLs, and
+// anything else only needs escaping for XML
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlaylistWriter::WriteLocation(const char* path, size_t len)
+{
+    static const char szHex[] = "0123456789ABCDEF";
+
+    const char* end = path + len;
+    const char* scheme = wxMediaFind(path, end, "://", 3);
+    if (scheme && scheme > path)
+    {
+        for (const char* p = path; p < end; ++p)
+        {
+            switch (*p)
+            {
+                case '&':   Write("&amp;");     break;
+                case '<':   Write("&lt;");      break;
+                case '>':   Write("&gt;");      break;
+                default:    Write(p, 1);        break;
+            }
+        }
+        return;
+    }
+
+    Write(*path == '/' ? "file://" : "file:///");
+    for (const char* p = path; p < end; ++p)
+    {
+        char c = *p;
+        if (c == '\\')
+            c = '/';
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || (c && strchr("/-._~:", c)))
+        {
+            Write(&c, 1);
+        }
+        else
+        {
+            char sz[3] = { '%', szHex[(wxUint8) c >> 4], szHex[c & 0xf] };
+            Write(sz, 3);
+        }
+    }
+}
+
+void wxMediaPlayerPlaylistWriter::Flush()
+{
+    if (m_bOK && !m_buffer.empty())
+        m_bOK = m_file.Write(&m_buffer[0], m_buffer.size());
+    m_buffer.clear();
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerStartupTrace
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Names of the marks in the report
+static const char* const wxMediaStartupMarkNames[wxSTARTUP_MARKS] =
+{
+    "app",
+    "init",
+    "frame",
+    "shown",
+    "first_paint",
+    "backend_start",
+    "backend_done",
+    "first_load",
+    "first_loaded",
+    "first_frame"
+};
+
+wxMediaPlayerStartupTrace::wxMediaPlayerStartupTrace()
+{
+    for (int n = 0; n < wxSTARTUP_MARKS; ++n)
+        m_nMarks[n] = -1;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStartupTrace::WriteReport
+//
+// Milliseconds since static initialization for each mark, or null if it
+// wasn't reached
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerStartupTrace::WriteReport() const
+{
+    if (m_szReport.empty())
+        return true;
+
+    wxString json;
+    json << wxT("{\n")
+         << wxT("  \"version\": 1,\n")
+         << wxT("  \"marks_ms\": {");
+
+    for (int n = 0; n < wxSTARTUP_MARKS; ++n)
+    {
+        json << (n ? wxT(",\n") : wxT("\n"))
+             << wxT("    \"") << wxMediaStartupMarkNames[n] << wxT("\": ");
+        if (m_nMarks[n] < 0)
+            json << wxT("null");
+        else
+            json << wxString::FromCDouble(m_nMarks[n] / 1000.0, 3);
+    }
+    json << wxT("\n  }\n}\n");
+
+    wxLogNull noLog;
+    wxTempFile out(m_szReport);
+    return out.IsOpened() && out.Write(json) && out.Commit();
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerBench
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// How long each entry plays before Next, and how long it gets to start
+// playing before it counts as a timeout (milliseconds)
+static const int wxMediaBenchDwell = 500;
+static const int wxMediaBenchTimeout = 10000;
+
+#ifdef wxMEDIA_USE_REMOTE
+// How many instances are started to hand over a file
+static const long wxMediaBenchHandoffs = 5;
+
+// Commands sent one at a time, and sent at once, how many times
+static const int wxMediaBenchCommands = 200;
+static const int wxMediaBenchBurst = 50;
+static const int wxMediaBenchBursts = 20;
+#endif // wxMEDIA_USE_REMOTE
+
+// Names of the phases in the report
+static const char* const wxMediaBenchPhaseNames[wxBENCH_PHASES] =
+{
+    "startup_to_first_play",
+    "open_to_loaded",
+    "loaded_to_playing",
+    "switch",
+    "concurrent_open_to_playing",
+    "handoff",
+    "control_round_trip",
+    "control_pipelined",
+    "control_batch"
+};
+
+wxMediaPlayerBench::wxMediaPlayerBench(const wxString& report,
+                                       long nSwitches, long nPages)
+                  : m_szReport(report),
+                    m_nSwitches(nSwitches),
+                    m_frame(NULL),
+                    m_nPage(-1),
+                    m_nOpened(-1),
+                    m_nLoaded(-1),
+                    m_bWaiting(false),
+                    m_nDone(0),
+                    m_nPreloaded(0),
+                    m_nFailed(0),
+                    m_nTimeouts(0),
+                    m_nPages(nPages),
+                    m_nPagesWaiting(0),
+                    m_bPagesOpened(false),
+                    m_nMisrouted(0),
+                    m_nHandoffs(0),
+                    m_nHandoffStart(-1),
+                    m_client(NULL),
+                    m_bCommandsTimed(false)
+{
+    m_clock.Start();
+
+    m_timer.SetOwner(this, wxID_BENCHTIMER);
+    this->Connect(wxID_BENCHTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerBench::OnTimer));
+#ifdef wxMEDIA_USE_REMOTE
+    this->Connect(wxID_BENCHCLIENT, wxEVT_THREAD,
+                  wxThreadEventHandler(wxMediaPlayerBench::OnClientDone));
+#endif // wxMEDIA_USE_REMOTE
+}
+
+wxMediaPlayerBench::~wxMediaPlayerBench()
+{
+    m_timer.Stop();
+
+#ifdef wxMEDIA_USE_REMOTE
+    if (m_client)
+    {
+        m_client->Wait();
+        delete m_client;
+    }
+#endif // wxMEDIA_USE_REMOTE
+
+    wxLogNull noLog;
+    for (size_t n = 0; n < m_clips.size(); ++n)
+        wxRemoveFile(m_clips[n]);
+    if (!m_szClipDir.empty())
+        wxRmdir(m_szClipDir);
+}
+
+// Stores the low nBytes of value little endian, as WAV wants it
+static void wxMediaBenchPutLE(char* p, wxUint32 value, int nBytes)
+{
+    for (int n = 0; n < nBytes; ++n)
+        p[n] = (char)(value >> (n * 8));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::GenerateClips
+//
+// Mono 16 bit WAV files of a few lengths, which every backend can play.
+// A square wave will do, nobody listens.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerBench::GenerateClips(wxVector<wxString>& files)
+{
+    static const wxUint32 s_nRate = 8000;
+    static const wxUint32 s_nSeconds[] = { 1, 2, 3, 5 };
+
+    m_szClipDir = wxStandardPaths::Get().GetTempDir() +
+                  wxFileName::GetPathSeparator() +
+                  wxString::Format(wxT("wxmediaplayer-bench-%lu"),
+                                   wxGetProcessId());
+    if (!wxDirExists(m_szClipDir) && !wxMkdir(m_szClipDir))
+        return false;
+
+    for (size_t n = 0; n < WXSIZEOF(s_nSeconds); ++n)
+    {
+        const wxUint32 nSamples = s_nRate * s_nSeconds[n];
+        const wxUint32 nData = nSamples * 2;
+
+        wxVector<char> wav(44 + nData);
+        char* p = &wav[0];
+        memcpy(p, "RIFF", 4);
+        wxMediaBenchPutLE(p + 4, 36 + nData, 4);
+        memcpy(p + 8, "WAVEfmt ", 8);
+        wxMediaBenchPutLE(p + 16, 16, 4);
+        wxMediaBenchPutLE(p + 20, 1, 2);                // PCM
+        wxMediaBenchPutLE(p + 22, 1, 2);                // mono
+        wxMediaBenchPutLE(p + 24, s_nRate, 4);
+        wxMediaBenchPutLE(p + 28, s_nRate * 2, 4);      // bytes per second
+        wxMediaBenchPutLE(p + 32, 2, 2);                // bytes per sample
+        wxMediaBenchPutLE(p + 34, 16, 2);               // bits per sample
+        memcpy(p + 36, "data", 4);
+        wxMediaBenchPutLE(p + 40, nData, 4);
+
+        const wxUint32 nPeriod = s_nRate / (220 * (n + 1));
+        for (wxUint32 i = 0; i < nSamples; ++i)
+        {
+            wxInt16 sample = (i % nPeriod) < nPeriod / 2 ? 4000 : -4000;
+            wxMediaBenchPutLE(p + 44 + i * 2, (wxUint16) sample, 2);
+        }
+
+        wxString path = m_szClipDir + wxFileName::GetPathSeparator() +
+                        wxString::Format(wxT("clip%lu.wav"), (unsigned long) n);
+        wxFile file;
+        if (!file.Create(path, true) ||
+            file.Write(&wav[0], wav.size()) != wav.size())
+            return false;
+
+        m_clips.push_back(path);
+        files.push_back(path);
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::Start
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::Start(wxMediaPlayerFrame* frame)
+{
+    m_frame = frame;
+
+    wxMediaPlayerNotebookPage* page =
+        new wxMediaPlayerNotebookPage(frame, frame->m_notebook);
+    page->m_nPlaylistId = frame->m_playlists->CreatePlaylist();
+    frame->m_notebook->AddPage(page, wxT("bench"), true);
+    m_nPage = page->m_nPageId;
+
+    //  In case nothing ever gets opened
+    m_timer.StartOnce(wxMediaBenchTimeout);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnOpen
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnOpen(wxMediaPlayerNotebookPage* page)
+{
+    if (page->m_nPageId != m_nPage)
+    {
+        Page* bench = FindPage(page->m_nPageId);
+        if (bench)
+        {
+            bench->m_nOpened = m_clock.TimeInMicro().GetValue();
+            bench->m_bWaiting = true;
+        }
+        return;
+    }
+
+    m_nOpened = m_clock.TimeInMicro().GetValue();
+    m_nLoaded = -1;
+    m_bWaiting = true;
+    m_timer.StartOnce(wxMediaBenchTimeout);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnPreloaded
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnPreloaded(wxMediaPlayerNotebookPage* page)
+{
+    if (page->m_nPageId == m_nPage)
+        ++m_nPreloaded;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnFailed
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnFailed(wxMediaPlayerNotebookPage* page)
+{
+    if (page->m_nPageId != m_nPage)
+    {
+        Page* bench = FindPage(page->m_nPageId);
+        if (bench && bench->m_bWaiting)
+        {
+            ++m_nFailed;
+            bench->m_bWaiting = false;
+            if (--m_nPagesWaiting == 0)
+                m_timer.StartOnce(1);
+        }
+        return;
+    }
+
+    ++m_nFailed;
+    m_bWaiting = false;
+    m_timer.StartOnce(1);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnLoaded
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnLoaded(wxMediaPlayerNotebookPage* page)
+{
+    if (page->m_nPageId != m_nPage || !m_bWaiting || m_nLoaded != -1)
+        return;
+
+    m_nLoaded = m_clock.TimeInMicro().GetValue();
+    m_samples[wxBENCH_OPEN_TO_LOADED].push_back(
+        (wxUint32)(m_nLoaded - m_nOpened));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnPlaying
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnPlaying(wxMediaPlayerNotebookPage* page)
+{
+    if (page->m_nPageId != m_nPage)
+    {
+        Page* bench = FindPage(page->m_nPageId);
+        if (bench && bench->m_bWaiting)
+            OnPagePlaying(*bench, page);
+        return;
+    }
+
+    if (!m_bWaiting)
+        return;
+    m_bWaiting = false;
+
+    wxInt64 nNow = m_clock.TimeInMicro().GetValue();
+    if (m_nLoaded != -1)
+        m_samples[wxBENCH_LOADED_TO_PLAYING].push_back(
+            (wxUint32)(nNow - m_nLoaded));
+
+    if (m_samples[wxBENCH_STARTUP].empty())
+        m_samples[wxBENCH_STARTUP].push_back((wxUint32) nNow);
+    else
+        m_samples[wxBENCH_SWITCH].push_back((wxUint32)(nNow - m_nOpened));
+
+    m_timer.StartOnce(wxMediaBenchDwell);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnPagePlaying
+//
+// Each page has to be playing what it was told to with its own control,
+// not something another page loaded meanwhile
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnPagePlaying(Page& bench,
+                                       wxMediaPlayerNotebookPage* page)
+{
+    bench.m_bWaiting = false;
+    m_samples[wxBENCH_CONCURRENT].push_back(
+        (wxUint32)(m_clock.TimeInMicro().GetValue() - bench.m_nOpened));
+
+    if (page->m_order.GetCurrent() != bench.m_nEntry ||
+        page->m_szFile != page->m_entries.GetPath(bench.m_nEntry) ||
+        page->m_entries.GetState(bench.m_nEntry) != wxMEDIAENTRY_PLAYING)
+        ++m_nMisrouted;
+
+    //  Pages are closed from the timer, not from their own handlers
+    if (--m_nPagesWaiting == 0)
+        m_timer.StartOnce(1);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnTimer
+//
+// Either the entry has played long enough or it never started, or the
+// pages started at once are all done
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnTimer(wxTimerEvent& WXUNUSED(event))
+{
+    if (m_bWaiting)
+    {
+        ++m_nTimeouts;
+        m_bWaiting = false;
+    }
+
+    for (size_t n = 0; n < m_pages.size(); ++n)
+    {
+        if (m_pages[n].m_bWaiting)
+        {
+            ++m_nTimeouts;
+            m_pages[n].m_bWaiting = false;
+        }
+    }
+    m_nPagesWaiting = 0;
+
+    if (m_nHandoffStart != -1)
+    {
+        ++m_nTimeouts;
+        m_nHandoffStart = -1;
+    }
+
+    Next();
+}
+
+#ifdef wxMEDIA_USE_REMOTE
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::StartHandoff
+//
+// The time includes starting the process and its toolkit, which is what
+// a scheduler launching the player for each change waits for
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::StartHandoff(wxMediaPlayerNotebookPage* page)
+{
+    wxString cmd = wxString::Format(wxT("\"%s\" --single-instance \"%s\""),
+                        wxStandardPaths::Get().GetExecutablePath().c_str(),
+                        page->m_entries.GetPath(0).c_str());
+
+    m_nHandoffStart = m_clock.TimeInMicro().GetValue();
+    if (!wxExecute(cmd, wxEXEC_ASYNC))
+    {
+        ++m_nFailed;
+        m_nHandoffStart = -1;
+        m_timer.StartOnce(1);
+        return;
+    }
+    m_timer.StartOnce(wxMediaBenchTimeout);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnHandoff
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnHandoff()
+{
+    if (m_nHandoffStart == -1)
+        return;
+
+    m_samples[wxBENCH_HANDOFF].push_back(
+        (wxUint32)(m_clock.TimeInMicro().GetValue() - m_nHandoffStart));
+    m_nHandoffStart = -1;
+    m_timer.StartOnce(1);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OnClientDone
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OnClientDone(wxThreadEvent& WXUNUSED(event))
+{
+    m_client->Wait();
+    m_samples[wxBENCH_CONTROL_ROUND_TRIP] = m_client->m_roundTrip;
+    m_samples[wxBENCH_CONTROL_PIPELINED] = m_client->m_pipelined;
+    m_samples[wxBENCH_CONTROL_BATCH] = m_client->m_batch;
+    if (m_client->m_batch.size() < (size_t) wxMediaBenchBursts)
+        ++m_nFailed;
+
+    delete m_client;
+    m_client = NULL;
+    Next();
+}
+
+#endif // wxMEDIA_USE_REMOTE
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::FindPage
+// ----------------------------------------------------------------------------
+wxMediaPlayerBench::Page* wxMediaPlayerBench::FindPage(int nPageId)
+{
+    for (size_t n = 0; n < m_pages.size(); ++n)
+    {
+        if (m_pages[n].m_nPage == nPageId)
+            return &m_pages[n];
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::OpenPages
+//
+// Gives every page the entries of the bench page, then starts a different
+// one on each, all from the same handler.  Loading and pre-rolling then
+// goes on side by side, and each page's events have to find their way to
+// it alone.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::OpenPages()
+{
+    wxMediaPlayerNotebookPage* source = m_frame->FindPage(m_nPage);
+    size_t nEntries = source ? source->m_entries.GetCount() : 0;
+
+    for (long i = 0; nEntries && i < m_nPages; ++i)
+    {
+        wxMediaPlayerNotebookPage* page =
+            new wxMediaPlayerNotebookPage(m_frame, m_frame->m_notebook);
+        page->m_nPlaylistId = m_frame->m_playlists->CreatePlaylist();
+        m_frame->m_notebook->AddPage(page,
+                                     wxString::Format(wxT("bench %ld"), i + 1));
+
+        for (size_t n = 0; n < nEntries; ++n)
+        {
+            size_t len;
+            const char* path = source->m_entries.GetPathUTF8(
+                                    source->m_entries.GetPathId(n), &len);
+            page->m_entries.AddUTF8(path, len);
+        }
+        page->SyncNewEntries();
+
+        Page bench;
+        bench.m_nPage = page->m_nPageId;
+        bench.m_nEntry = i % nEntries;
+        bench.m_nOpened = -1;
+        bench.m_bWaiting = false;
+        m_pages.push_back(bench);
+    }
+
+    m_nPagesWaiting = m_pages.size();
+    for (size_t n = 0; n < m_pages.size(); ++n)
+    {
+        m_frame->DoPlayFile(m_frame->FindPage(m_pages[n].m_nPage),
+                            m_pages[n].m_nEntry);
+    }
+
+    m_timer.StartOnce(m_pages.empty() ? 1 : wxMediaBenchTimeout);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::ClosePages
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::ClosePages()
+{
+    for (size_t n = 0; n < m_pages.size(); ++n)
+    {
+        wxMediaPlayerNotebookPage* page = m_frame->FindPage(m_pages[n].m_nPage);
+        if (page)
+            m_frame->ClosePage(page);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::Next
+//
+// Switches to the next entry, or when done writes the report and closes
+// the frame
+// ----------------------------------------------------------------------------
+void wxMediaPlayerBench::Next()
+{
+    wxMediaPlayerNotebookPage* page = m_frame->FindPage(m_nPage);
+    if (page && m_nDone < m_nSwitches && page->m_entries.GetCount() > 1)
+    {
+        ++m_nDone;
+        wxCommandEvent theEvent(wxEVT_MENU, wxID_NEXT);
+        m_frame->AddPendingEvent(theEvent);
+        return;
+    }
+
+    if (page && m_nPages > 0 && !m_bPagesOpened)
+    {
+        m_bPagesOpened = true;
+        OpenPages();
+        return;
+    }
+    ClosePages();
+
+#ifdef wxMEDIA_USE_REMOTE
+    //  Only if this instance got the socket
+    if (page && m_frame->m_remote && page->m_entries.GetCount() &&
+        m_nHandoffs < wxMediaBenchHandoffs)
+    {
+        ++m_nHandoffs;
+        StartHandoff(page);
+        return;
+    }
+
+    if (m_frame->m_remote && !m_bCommandsTimed)
+    {
+        m_bCommandsTimed = true;
+
+        //  Sockets have to be set up on the main thread first
+        wxSocketBase::Initialize();
+        m_client = new wxMediaPlayerBenchClient(this,
+                                                m_frame->m_remote->GetPath());
+        if (m_client->Run() == wxTHREAD_NO_ERROR)
+            return;
+
+        delete m_client;
+        m_client = NULL;
+        ++m_nFailed;
+    }
+#endif // wxMEDIA_USE_REMOTE
+
+    if (!WriteReport())
+        wxLogError(wxT("Couldn't write the benchmark report to %s"),
+                   m_szReport.c_str());
+
+    if (page)
+        m_frame->m_playlists->RemovePlaylist(page->m_nPlaylistId);
+    m_frame->Close(true);
+}
+
+// Nearest rank percentile of sorted samples, in milliseconds
+static wxString wxMediaBenchPercentile(const wxVector<wxUint32>& sorted,
+                                       int nPercent)
+{
+    size_t n = (sorted.size() * nPercent + 99) / 100;
+    return wxString::FromCDouble(sorted[n ? n - 1 : 0] / 1000.0, 3);
+}
+
+// Count and distribution of samples in microseconds, as a JSON object
+static wxString wxMediaBenchSummary(const wxVector<wxUint32>& samples)
+{
+    wxVector<wxUint32> sorted = samples;
+    wxVectorSort(sorted);
+
+    wxString json;
+    json << wxT("{ \"count\": ") << (unsigned long) sorted.size();
+    if (!sorted.empty())
+    {
+        wxInt64 nTotal = 0;
+        for (size_t i = 0; i < sorted.size(); ++i)
+            nTotal += sorted[i];
+
+        json << wxT(", \"mean_ms\": ")
+             << wxString::FromCDouble(nTotal / 1000.0 / sorted.size(), 3)
+             << wxT(", \"p50_ms\": ") << wxMediaBenchPercentile(sorted, 50)
+             << wxT(", \"p90_ms\": ") << wxMediaBenchPercentile(sorted, 90)
+             << wxT(", \"p99_ms\": ") << wxMediaBenchPercentile(sorted, 99)
+             << wxT(", \"max_ms\": ")
+             << wxString::FromCDouble(sorted.back() / 1000.0, 3);
+    }
+    json << wxT(" }");
+    return json;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::WriteReport
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerBench::WriteReport() const
+{
+    wxString json;
+    json << wxT("{\n")
+         << wxT("  \"version\": 1,\n")
+         << wxT("  \"switches\": ") << m_nDone << wxT(",\n")
+         << wxT("  \"preloaded\": ") << m_nPreloaded << wxT(",\n")
+         << wxT("  \"failed\": ") << m_nFailed << wxT(",\n")
+         << wxT("  \"timeouts\": ") << m_nTimeouts << wxT(",\n")
+         << wxT("  \"pages\": ") << (unsigned long) m_pages.size() << wxT(",\n")
+         << wxT("  \"misrouted\": ") << m_nMisrouted << wxT(",\n")
+         << wxT("  \"handoffs\": ") << m_nHandoffs << wxT(",\n")
+         << wxT("  \"phases\": {");
+
+    for (int n = 0; n < wxBENCH_PHASES; ++n)
+    {
+        json << (n ? wxT(",\n") : wxT("\n"))
+             << wxT("    \"") << wxMediaBenchPhaseNames[n] << wxT("\": ")
+             << wxMediaBenchSummary(m_samples[n]);
+    }
+    json << wxT("\n  }\n}\n");
+
+    wxLogNull noLog;
+    wxTempFile out(m_szReport);
+    return out.IsOpened() && out.Write(json) && out.Commit();
+}
+
+// Frames each kernel is timed on
+static const int wxMediaBenchKernelRuns = 50;
+
+// Sizes the kernels are checked at: odd ones leave tails for the scalar
+// code, and the last is narrower than any SIMD loop
+static const int wxMediaBenchKernelSizes[][2] =
+    { { 1920, 1080 }, { 1917, 1079 }, { 35, 3 } };
+
+// How much an image is shrunk when timing that, and what else is checked
+static const int wxMediaBenchShrink = 4;
+static const int wxMediaBenchShrinkChecks[] = { 2, 3, 7, 16, 256 };
+
+// Fills a buffer with noise from a fixed seed, which hits every byte value
+static void wxMediaBenchNoise(wxVector<unsigned char>& buffer, wxUint32 seed)
+{
+    for (size_t n = 0; n < buffer.size(); ++n)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        buffer[n] = (unsigned char)(seed >> 24);
+    }
+}
+
+// A frame of noise with its planes in buffer
+static wxMediaYUVFrame wxMediaBenchFrame(int format, int width, int height,
+                                         wxVector<unsigned char>& buffer)
+{
+    const int nChromaWidth = (width + 1) / 2;
+    const size_t nChroma = (size_t)nChromaWidth * ((height + 1) / 2);
+    const size_t nLuma = (size_t)width * height;
+    buffer.resize(nLuma + nChroma * 2);
+    wxMediaBenchNoise(buffer, width * 31 + height);
+
+    wxMediaYUVFrame frame;
+    frame.m_nFormat = format;
+    frame.m_nWidth = width;
+    frame.m_nHeight = height;
+    frame.m_planes[0] = &buffer[0];
+    frame.m_planes[1] = &buffer[nLuma];
+    frame.m_strides[0] = width;
+    if (format == wxPIXELFORMAT_NV12)
+    {
+        frame.m_planes[2] = NULL;
+        frame.m_strides[1] = nChromaWidth * 2;
+        frame.m_strides[2] = 0;
+    }
+    else
+    {
+        frame.m_planes[2] = &buffer[nLuma + nChroma];
+        frame.m_strides[1] = nChromaWidth;
+        frame.m_strides[2] = nChromaWidth;
+    }
+    return frame;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBench::BenchKernels
+//
+// Checks that every SIMD level of the pixel kernels gives the same bytes as
+// the scalar one, then times each level on 1080p frames.  Returns 1 if any
+// level differs and 2 if the report couldn't be written.
+// ----------------------------------------------------------------------------
+int wxMediaPlayerBench::BenchKernels(const wxString& report)
+{
+    static const int formats[] = { wxPIXELFORMAT_I420, wxPIXELFORMAT_NV12 };
+    static const char* const formatNames[] = { "i420", "nv12" };
+
+    const int nBest = wxGetMediaKernelLevel();
+    long nMismatches = 0;
+
+    //
+    //  Bit exactness
+    //
+    wxVector<unsigned char> buffer, expected, actual;
+    for (size_t f = 0; f < WXSIZEOF(formats); ++f)
+    {
+        for (size_t n = 0; n < WXSIZEOF(wxMediaBenchKernelSizes); ++n)
+        {
+            const wxMediaYUVFrame frame =
+                wxMediaBenchFrame(formats[f], wxMediaBenchKernelSizes[n][0],
+                                  wxMediaBenchKernelSizes[n][1], buffer);
+            expected.resize((size_t)frame.m_nWidth * frame.m_nHeight * 3);
+            actual.resize(expected.size());
+            wxConvertMediaFrame(frame, &expected[0], wxKERNELS_SCALAR);
+
+            for (int level = wxKERNELS_SCALAR + 1; level <= nBest; ++level)
+            {
+                wxConvertMediaFrame(frame, &actual[0], level);
+                if (memcmp(&actual[0], &expected[0], expected.size()) != 0)
+                    ++nMismatches;
+            }
+        }
+    }
+
+    for (size_t n = 0; n < WXSIZEOF(wxMediaBenchShrinkChecks); ++n)
+    {
+        const int factor = wxMediaBenchShrinkChecks[n];
+        const int width = factor * 5 + 1;
+        const int height = factor * 3 + 2;
+        buffer.resize((size_t)width * height * 3);
+        wxMediaBenchNoise(buffer, factor);
+
+        //  All white sums to the most the 16 bits have to hold
+        if (factor == wxMediaMaxShrink)
+            memset(&buffer[0], 0xff, buffer.size());
+
+        expected.resize((size_t)(width / factor) * (height / factor) * 3);
+        actual.resize(expected.size());
+        wxShrinkMediaImage(&buffer[0], width, height, factor, &expected[0],
+                           wxKERNELS_SCALAR);
+
+        for (int level = wxKERNELS_SCALAR + 1; level <= nBest; ++level)
+        {
+            wxShrinkMediaImage(&buffer[0], width, height, factor, &actual[0],
+                               level);
+            if (memcmp(&actual[0], &expected[0], expected.size()) != 0)
+                ++nMismatches;
+        }
+    }
+
+    //
+    //  Timing
+    //
+    wxString json;
+    json << wxT("{\n")
+         << wxT("  \"version\": 1,\n")
+         << wxT("  \"level\": \"") << wxMediaKernelLevelNames[nBest]
+         << wxT("\",\n")
+         << wxT("  \"mismatches\": ") << nMismatches << wxT(",\n")
+         << wxT("  \"kernels\": {");
+
+    const int width = wxMediaBenchKernelSizes[0][0];
+    const int height = wxMediaBenchKernelSizes[0][1];
+    wxVector<unsigned char> rgb((size_t)width * height * 3);
+    wxVector<unsigned char> shrunk(rgb.size() /
+                                   (wxMediaBenchShrink * wxMediaBenchShrink));
+    wxStopWatch watch;
+    bool bFirst = true;
+
+    for (int level = wxKERNELS_SCALAR; level <= nBest; ++level)
+    {
+        for (size_t f = 0; f <= WXSIZEOF(formats); ++f)
+        {
+            wxVector<wxUint32> samples;
+            wxString name;
+            if (f < WXSIZEOF(formats))
+            {
+                const wxMediaYUVFrame frame =
+                    wxMediaBenchFrame(formats[f], width, height, buffer);
+                for (int n = 0; n < wxMediaBenchKernelRuns; ++n)
+                {
+                    watch.Start();
+                    wxConvertMediaFrame(frame, &rgb[0], level);
+                    samples.push_back(
+                        (wxUint32) watch.TimeInMicro().GetValue());
+                }
+                name << formatNames[f] << wxT("_to_rgb24_");
+            }
+            else
+            {
+                for (int n = 0; n < wxMediaBenchKernelRuns; ++n)
+                {
+                    watch.Start();
+                    wxShrinkMediaImage(&rgb[0], width, height,
+                                       wxMediaBenchShrink, &shrunk[0], level);
+                    samples.push_back(
+                        (wxUint32) watch.TimeInMicro().GetValue());
+                }
+                name << wxT("shrink_rgb24_");
+            }
+            name << wxMediaKernelLevelNames[level];
+
+            json << (bFirst ? wxT("\n") : wxT(",\n"))
+                 << wxT("    \"") << name << wxT("\": ")
+                 << wxMediaBenchSummary(samples);
+            bFirst = false;
+        }
+    }
+    json << wxT("\n  }\n}\n");
+
+    wxLogNull noLog;
+    wxTempFile out(report);
+    if (!out.IsOpened() || !out.Write(json) || !out.Commit())
+        return 2;
+    return nMismatches ? 1 : 0;
+}
+
+#ifdef wxMEDIA_USE_REMOTE
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerBenchClient
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+wxMediaPlayerBenchClient::wxMediaPlayerBenchClient(wxEvtHandler* handler,
+                                                   const wxString& path)
+                        : wxThread(wxTHREAD_JOINABLE),
+                          m_handler(handler),
+                          m_szPath(path)
+{
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerBenchClient::Entry
+//
+// Asks for the state, which goes through the whole request path without
+// changing what the player does
+// ----------------------------------------------------------------------------
+wxThread::ExitCode wxMediaPlayerBenchClient::Entry()
+{
+    wxUNIXaddress addr;
+    addr.Filename(m_szPath);
+
+    wxSocketClient client(wxSOCKET_BLOCK | wxSOCKET_WAITALL_WRITE);
+    client.SetTimeout(wxMediaBenchTimeout / 1000);
+    if (client.Connect(addr, true))
+    {
+        const wxString command(wxT("{\"cmd\":\"state\"}"));
+        wxStopWatch watch;
+
+        for (int n = 0; n < wxMediaBenchCommands; ++n)
+        {
+            watch.Start();
+            if (!Exchange(client, command + wxT("\n"), 1))
+                break;
+            m_roundTrip.push_back((wxUint32) watch.TimeInMicro().GetValue());
+        }
+
+        wxString burst, batch(wxT("["));
+        for (int n = 0; n < wxMediaBenchBurst; ++n)
+        {
+            burst << command << wxT("\n");
+            batch << (n ? wxT(",") : wxT("")) << command;
+        }
+        batch << wxT("]\n");
+
+        for (int n = 0; n < wxMediaBenchBursts; ++n)
+        {
+            watch.Start();
+            if (!Exchange(client, burst, wxMediaBenchBurst))
+                break;
+            m_pipelined.push_back((wxUint32)
+                (watch.TimeInMicro().GetValue() / wxMediaBenchBurst));
+
+            watch.Start();
+            if (!Exchange(client, batch, 1))
+                break;
+            m_batch.push_back((wxUint32)
+                (watch.TimeInMicro().GetValue() / wxMediaBenchBurst));
+        }
+    }
+
+    wxQueueEvent(m_handler, new wxThreadEvent(wxEVT_THREAD, wxID_BENCHCLIENT));
+    return 0;
+}
+
+bool wxMediaPlayerBenchClient::Exchange(wxSocketClient& client,
+                                        const wxString& request, int nLines)
+{
+    const wxScopedCharBuffer utf8 = request.utf8_str();
+    client.Write(utf8.data(), utf8.length());
+    if (client.Error() || client.LastWriteCount() != utf8.length())
+        return false;
+
+    char chunk[4096];
+    while (nLines > 0)
+    {
+        client.Read(chunk, sizeof(chunk));
+        wxUint32 nRead = client.LastReadCount();
+        if (client.Error() || !nRead)
+            return false;
+
+        for (wxUint32 n = 0; n < nRead; ++n)
+        {
+            if (chunk[n] == '\n')
+                --nLines;
+        }
+    }
+    return true;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerJSONValue
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Deeper than any request needs to be, and shallow enough for the stack
+static const int wxMediaJSONMaxDepth = 16;
+
+// Recursive descent over the text given to wxMediaPlayerJSONValue::Parse()
+class wxMediaJSONParser
+{
+public:
+    wxMediaJSONParser(const char* p, size_t len) : m_p(p), m_end(p + len) { }
+
+    bool ParseValue(wxMediaPlayerJSONValue& value, int nDepth);
+
+    bool AtEnd()
+    {
+        SkipSpace();
+        return m_p == m_end;
+    }
+
+private:
+    void SkipSpace()
+    {
+        while (m_p < m_end && (*m_p == ' ' || *m_p == '\t' ||
+                               *m_p == '\r' || *m_p == '\n'))
+            ++m_p;
+    }
+
+    bool Expect(const char* word);
+    bool ParseString(wxString& s);
+    bool ParseHex4(wxUint32& code);
+    bool ParseNumber(double& d);
+
+    const char* m_p;
+    const char* m_end;
+};
+
+bool wxMediaJSONParser::Expect(const char* word)
+{
+    size_t len = strlen(word);
+    if ((size_t)(m_end - m_p) < len || memcmp(m_p, word, len) != 0)
+        return false;
+    m_p += len;
+    return true;
+}
+
+bool wxMediaJSONParser::ParseHex4(wxUint32& code)
+{
+    if (m_end - m_p < 4)
+        return false;
+
+    code = 0;
+    for (int n = 0; n < 4; ++n)
+    {
+        int digit = wxMediaHexValue(*m_p++);
+        if (digit == -1)
+            return false;
+        code = code * 16 + digit;
+    }
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaJSONParser::ParseString
+//
+// Unescapes into UTF-8 first, so the string is converted only once
+// ----------------------------------------------------------------------------
+bool wxMediaJSONParser::ParseString(wxString& s)
+{
+    if (m_p == m_end || *m_p != '"')
+        return false;
+    ++m_p;
+
+    wxVector<char> utf8;
+    for (;;)
+    {
+        if (m_p == m_end || (unsigned char)*m_p < 0x20)
+            return false;
+
+        char c = *m_p++;
+        if (c == '"')
+            break;
+        if (c != '\\')
+        {
+            utf8.push_back(c);
+            continue;
+        }
+
+        if (m_p == m_end)
+            return false;
+        c = *m_p++;
+        switch (c)
+        {
+            case '"':
+            case '\\':
+            case '/':
+                utf8.push_back(c);
+                continue;
+            case 'b': utf8.push_back('\b'); continue;
+            case 'f': utf8.push_back('\f'); continue;
+            case 'n': utf8.push_back('\n'); continue;
+            case 'r': utf8.push_back('\r'); continue;
+            case 't': utf8.push_back('\t'); continue;
+            case 'u': break;
+            default:
+                return false;
+        }
+
+        //  \uXXXX, maybe the high half of a surrogate pair
+        wxUint32 code;
+        if (!ParseHex4(code))
+            return false;
+        if (code >= 0xD800 && code < 0xDC00)
+        {
+            wxUint32 low;
+            if (!Expect("\\u") || !ParseHex4(low) ||
+                low < 0xDC00 || low >= 0xE000)
+                return false;
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        else if (code >= 0xDC00 && code < 0xE000)
+            return false;
+
+        if (code < 0x80)
+            utf8.push_back((char) code);
+        else if (code < 0x800)
+        {
+            utf8.push_back((char)(0xC0 | (code >> 6)));
+            utf8.push_back((char)(0x80 | (code & 0x3F)));
+        }
+        else if (code < 0x10000)
+        {
+            utf8.push_back((char)(0xE0 | (code >> 12)));
+            utf8.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+            utf8.push_back((char)(0x80 | (code & 0x3F)));
+        }
+        else
+        {
+            utf8.push_back((char)(0xF0 | (code >> 18)));
+            utf8.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+            utf8.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+            utf8.push_back((char)(0x80 | (code & 0x3F)));
+        }
+    }
+
+    s = utf8.empty() ? wxString() : wxString::FromUTF8(&utf8[0], utf8.size());
+    return true;
+}
+
+bool wxMediaJSONParser::ParseNumber(double& d)
+{
+    const char* start = m_p;
+    while (m_p < m_end && (isdigit((unsigned char)*m_p) || *m_p == '-' ||
+                           *m_p == '+' || *m_p == '.' ||
+                           *m_p == 'e' || *m_p == 'E'))
+        ++m_p;
+
+    return m_p > start &&
+           wxString(start, m_p - start).ToCDouble(&d);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaJSONParser::ParseValue
+// ----------------------------------------------------------------------------
+bool wxMediaJSONParser::ParseValue(wxMediaPlayerJSONValue& value, int nDepth)
+{
+    SkipSpace();
+    if (m_p == m_end || nDepth > wxMediaJSONMaxDepth)
+        return false;
+
+    value = wxMediaPlayerJSONValue();
+    switch (*m_p)
+    {
+        case 'n':
+            return Expect("null");
+
+        case 't':
+        case 'f':
+            value.m_nType = wxJSON_BOOL;
+            value.m_dNumber = *m_p == 't';
+            return Expect(*m_p == 't' ? "true" : "false");
+
+        case '"':
+            value.m_nType = wxJSON_STRING;
+            return ParseString(value.m_szValue);
+
+        case '[':
+        case '{':
+        {
+            bool bObject = *m_p++ == '{';
+            char close = bObject ? '}' : ']';
+            value.m_nType = bObject ? wxJSON_OBJECT : wxJSON_ARRAY;
+
+            SkipSpace();
+            if (m_p < m_end && *m_p == close)
+            {
+                ++m_p;
+                return true;
+            }
+
+            for (;;)
+            {
+                if (bObject)
+                {
+                    wxString name;
+                    SkipSpace();
+                    if (!ParseString(name))
+                        return false;
+                    SkipSpace();
+                    if (!Expect(":"))
+                        return false;
+                    value.m_names.push_back(name);
+                }
+
+                value.m_items.push_back(wxMediaPlayerJSONValue());
+                if (!ParseValue(value.m_items.back(), nDepth + 1))
+                    return false;
+
+                SkipSpace();
+                if (m_p == m_end)
+                    return false;
+                char c = *m_p++;
+                if (c == close)
+                    return true;
+                if (c != ',')
+                    return false;
+            }
+        }
+
+        default:
+            value.m_nType = wxJSON_NUMBER;
+            return ParseNumber(value.m_dNumber);
+    }
+}
+
+bool wxMediaPlayerJSONValue::Parse(const char* p, size_t len)
+{
+    wxMediaJSONParser parser(p, len);
+    return parser.ParseValue(*this, 0) && parser.AtEnd();
+}
+
+const wxMediaPlayerJSONValue*
+wxMediaPlayerJSONValue::Get(const char* name) const
+{
+    for (size_t n = 0; n < m_names.size(); ++n)
+    {
+        if (m_names[n] == name)
+            return &m_items[n];
+    }
+    return NULL;
+}
+
+wxString wxMediaPlayerJSONValue::GetString(const char* name,
+                                           const wxString& def) const
+{
+    const wxMediaPlayerJSONValue* value = Get(name);
+    return value && value->m_nType == wxJSON_STRING ? value->m_szValue : def;
+}
+
+double wxMediaPlayerJSONValue::GetNumber(const char* name, double def) const
+{
+    const wxMediaPlayerJSONValue* value = Get(name);
+    return value && value->m_nType == wxJSON_NUMBER ? value->m_dNumber : def;
+}
+
+bool wxMediaPlayerJSONValue::GetBool(const char* name, bool def) const
+{
+    const wxMediaPlayerJSONValue* value = Get(name);
+    return value && value->m_nType == wxJSON_BOOL ? value->m_dNumber != 0
+                                                  : def;
+}
+
+// A JSON string literal for s
+static wxString wxMediaJSONQuote(const wxString& s)
+{
+    const wxScopedCharBuffer utf8 = s.utf8_str();
+
+    wxVector<char> out;
+    out.push_back('"');
+    for (size_t n = 0; n < utf8.length(); ++n)
+    {
+        char c = utf8.data()[n];
+        if (c == '"' || c == '\\')
+        {
+            out.push_back('\\');
+            out.push_back(c);
+        }
+        else if ((unsigned char) c < 0x20)
+        {
+            char escape[8];
+            sprintf(escape, "\\u%04x", (unsigned) c);
+            out.insert(out.end(), escape, escape + 6);
+        }
+        else
+            out.push_back(c);
+    }
+    out.push_back('"');
+
+    return wxString::FromUTF8(&out[0], out.size());
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerRemote
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Names of the open modes in requests and on the command line
+static const char* const wxMediaRemoteModeNames[wxOPEN_MODES] =
+{
+    "append",
+    "replace",
+    "play"
+};
+
+// Seconds a later instance waits for the running one before starting up
+// by itself after all
+static const long wxMediaRemoteTimeout = 5;
+
+// Bytes a client may send without ending the line, before it's dropped
+static const size_t wxMediaRemoteMaxLine = 1024 * 1024;
+
+// Bytes of answers a client may leave unread, before it's dropped
+static const size_t wxMediaRemoteMaxOutput = 4 * 1024 * 1024;
+
+wxMediaPlayerRemote::wxMediaPlayerRemote()
+                   : m_server(NULL),
+                     m_frame(NULL)
+{
+    this->Connect(wxID_REMOTE, wxEVT_SOCKET,
+                  wxSocketEventHandler(wxMediaPlayerRemote::OnServerEvent));
+    this->Connect(wxID_REMOTECLIENT, wxEVT_SOCKET,
+                  wxSocketEventHandler(wxMediaPlayerRemote::OnClientEvent));
+}
+
+wxMediaPlayerRemote::~wxMediaPlayerRemote()
+{
+    while (!m_clients.empty())
+        DropClient(m_clients.back());
+
+    if (m_server)
+        m_server->Destroy();
+
+    if (!m_szPath.empty())
+    {
+        wxLogNull noLog;
+        wxRemoveFile(m_szPath);
+    }
+}
+
+int wxMediaPlayerRemote::GetOpenMode(const wxString& name)
+{
+    for (int n = 0; n < wxOPEN_MODES; ++n)
+    {
+        if (name == wxMediaRemoteModeNames[n])
+            return n;
+    }
+    return -1;
+}
+
+wxString wxMediaPlayerRemote::GetInstancePath()
+{
+    return wxStandardPaths::Get().GetUserLocalDataDir() +
+           wxFileName::GetPathSeparator() + wxT("instance.sock");
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::Forward
+//
+// Relative paths are made absolute, as the running instance has a working
+// directory of its own
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerRemote::Forward(const wxVector<wxString>& paths, int mode)
+{
+    wxUNIXaddress addr;
+    addr.Filename(GetInstancePath());
+
+    wxSocketClient client(wxSOCKET_BLOCK | wxSOCKET_WAITALL);
+    client.SetTimeout(wxMediaRemoteTimeout);
+    if (!client.Connect(addr, true))
+        return false;
+
+    wxString request;
+    request << wxT("{\"cmd\":\"open\",\"mode\":\"")
+            << wxMediaRemoteModeNames[mode] << wxT("\",\"paths\":[");
+    for (size_t n = 0; n < paths.size(); ++n)
+    {
+        wxString path = paths[n];
+        if (wxURI(path).IsReference())
+        {
+            wxFileName name(path);
+            name.MakeAbsolute();
+            path = name.GetFullPath();
+        }
+        request << (n ? wxT(",") : wxT("")) << wxMediaJSONQuote(path);
+    }
+    request << wxT("]}\n");
+
+    const wxScopedCharBuffer utf8 = request.utf8_str();
+    client.Write(utf8.data(), utf8.length());
+    if (client.LastWriteCount() != utf8.length())
+        return false;
+
+    //  Only the start of the answer line matters
+    static const char s_ok[] = "{\"ok\":true";
+    char reply[sizeof(s_ok) - 1];
+    client.Read(reply, sizeof(reply));
+    return client.LastReadCount() == sizeof(reply) &&
+           memcmp(reply, s_ok, sizeof(reply)) == 0;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::Listen
+//
+// A socket left behind by an instance that crashed refuses connections, and
+// is removed
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerRemote::Listen(wxMediaPlayerFrame* frame,
+                                 const wxString& path)
+{
+    m_frame = frame;
+
+    wxUNIXaddress addr;
+    addr.Filename(path);
+
+    {
+        wxSocketClient client(wxSOCKET_BLOCK);
+        client.SetTimeout(wxMediaRemoteTimeout);
+        if (client.Connect(addr, true))
+            return false;
+    }
+
+    {
+        wxLogNull noLog;
+        wxRemoveFile(path);
+    }
+
+    m_server = new wxSocketServer(addr);
+    if (!m_server->IsOk())
+    {
+        m_server->Destroy();
+        m_server = NULL;
+        return false;
+    }
+
+    m_szPath = path;
+    m_server->SetEventHandler(*this, wxID_REMOTE);
+    m_server->SetNotify(wxSOCKET_CONNECTION_FLAG);
+    m_server->Notify(true);
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::OnServerEvent
+//
+// Neither reads nor writes wait, the handler would hold up the UI thread
+// for as long as a client takes to read its answers
+// ----------------------------------------------------------------------------
+void wxMediaPlayerRemote::OnServerEvent(wxSocketEvent& WXUNUSED(event))
+{
+    wxSocketBase* socket = m_server->Accept(false);
+    if (!socket)
+        return;
+
+    Client* client = new Client;
+    client->m_socket = socket;
+    m_clients.push_back(client);
+
+    socket->SetFlags(wxSOCKET_NOWAIT);
+    socket->SetClientData(client);
+    socket->SetEventHandler(*this, wxID_REMOTECLIENT);
+    socket->SetNotify(wxSOCKET_INPUT_FLAG | wxSOCKET_OUTPUT_FLAG |
+                      wxSOCKET_LOST_FLAG);
+    socket->Notify(true);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::OnClientEvent
+//
+// Reads whatever there is and carries out each complete line in it.  The
+// answers to all of them are queued together and go out in as few writes
+// as the socket allows, so a client that pipelines its requests gets them
+// back with as few system calls as it sent them.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerRemote::OnClientEvent(wxSocketEvent& event)
+{
+    Client* client = (Client*) event.GetClientData();
+    if (event.GetSocketEvent() == wxSOCKET_LOST)
+    {
+        DropClient(client);
+        return;
+    }
+
+    if (event.GetSocketEvent() == wxSOCKET_OUTPUT)
+    {
+        if (!FlushClient(client))
+            DropClient(client);
+        return;
+    }
+
+    char chunk[4096];
+    for (;;)
+    {
+        client->m_socket->Read(chunk, sizeof(chunk));
+        wxUint32 nRead = client->m_socket->LastReadCount();
+        if (!nRead)
+            break;
+        client->m_buffer.insert(client->m_buffer.end(), chunk, chunk + nRead);
+    }
+
+    wxVector<char>& buffer = client->m_buffer;
+    wxString reply;
+    size_t nStart = 0;
+    for (size_t n = 0; n < buffer.size(); ++n)
+    {
+        if (buffer[n] != '\n')
+            continue;
+        if (n > nStart)
+            HandleRequest(&buffer[nStart], n - nStart, reply);
+        nStart = n + 1;
+    }
+    buffer.erase(buffer.begin(), buffer.begin() + nStart);
+
+    if (buffer.size() > wxMediaRemoteMaxLine)
+    {
+        DropClient(client);
+        return;
+    }
+
+    if (!reply.empty())
+    {
+        const wxScopedCharBuffer utf8 = reply.utf8_str();
+        client->m_output.insert(client->m_output.end(), utf8.data(),
+                                utf8.data() + utf8.length());
+        if (!FlushClient(client))
+            DropClient(client);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::FlushClient
+//
+// What the socket doesn't take now waits for the next wxSOCKET_OUTPUT
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerRemote::FlushClient(Client* client)
+{
+    wxVector<char>& output = client->m_output;
+    size_t nWritten = 0;
+    while (nWritten < output.size())
+    {
+        client->m_socket->Write(&output[nWritten],
+                                (wxUint32) (output.size() - nWritten));
+        wxUint32 nCount = client->m_socket->LastWriteCount();
+        if (!nCount)
+        {
+            if (client->m_socket->Error() &&
+                client->m_socket->LastError() != wxSOCKET_WOULDBLOCK)
+                return false;
+            break;
+        }
+        nWritten += nCount;
+    }
+    output.erase(output.begin(), output.begin() + nWritten);
+
+    return output.size() <= wxMediaRemoteMaxOutput;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::HandleRequest
+//
+// The commands of a batch are carried out in order, and each is answered
+// even if one before it failed
+// ----------------------------------------------------------------------------
+void wxMediaPlayerRemote::HandleRequest(const char* p, size_t len,
+                                        wxString& reply)
+{
+    wxMediaPlayerJSONValue request;
+    if (!request.Parse(p, len))
+        reply << wxT("{\"ok\":false,\"error\":\"not JSON\"}");
+    else if (request.m_nType == wxJSON_ARRAY)
+    {
+        reply << wxT("[");
+        for (size_t n = 0; n < request.m_items.size(); ++n)
+        {
+            if (n)
+                reply << wxT(",");
+            HandleCommand(request.m_items[n], reply);
+        }
+        reply << wxT("]");
+    }
+    else
+        HandleCommand(request, reply);
+
+    reply << wxT("\n");
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::HandleCommand
+// ----------------------------------------------------------------------------
+void wxMediaPlayerRemote::HandleCommand(const wxMediaPlayerJSONValue& command,
+                                        wxString& reply)
+{
+    wxMediaPlayerStatsScope scope(m_frame->m_stats, wxSTATS_REMOTE);
+
+    wxString result;
+    wxString error = command.m_nType == wxJSON_OBJECT
+                        ? RunCommand(command, result)
+                        : wxString(wxT("not an object"));
+
+    reply << (error.empty() ? wxT("{\"ok\":true") : wxT("{\"ok\":false"));
+
+    //  Only numbers and strings make sense as ids
+    const wxMediaPlayerJSONValue* id = command.Get("id");
+    if (id && id->m_nType == wxJSON_NUMBER)
+        reply << wxT(",\"id\":") << wxString::FromCDouble(id->m_dNumber);
+    else if (id && id->m_nType == wxJSON_STRING)
+        reply << wxT(",\"id\":") << wxMediaJSONQuote(id->m_szValue);
+
+    if (error.empty())
+        reply << result;
+    else
+        reply << wxT(",\"error\":") << wxMediaJSONQuote(error);
+    reply << wxT("}");
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::RunCommand
+//
+// Goes through the same frame methods as the menu and the buttons
+// ----------------------------------------------------------------------------
+wxString wxMediaPlayerRemote::RunCommand(const wxMediaPlayerJSONValue& command,
+                                         wxString& result)
+{
+    wxNotebook* notebook = m_frame->m_notebook;
+    wxString name = command.GetString("cmd");
+
+    wxMediaPlayerNotebookPage* page =
+        (wxMediaPlayerNotebookPage*) notebook->GetCurrentPage();
+    const wxMediaPlayerJSONValue* index = command.Get("page");
+    if (index)
+    {
+        if (index->m_nType != wxJSON_NUMBER || index->m_dNumber < 0 ||
+            index->m_dNumber >= notebook->GetPageCount())
+            return wxT("no such page");
+        page = (wxMediaPlayerNotebookPage*)
+                    notebook->GetPage((size_t) index->m_dNumber);
+    }
+    if (!page)
+        return wxT("no page");
+
+    if (name == wxT("ping"))
+        ;
+    else if (name == wxT("play"))
+        m_frame->PlayPage(page);
+    else if (name == wxT("pause"))
+        m_frame->PausePage(page);
+    else if (name == wxT("next"))
+        m_frame->PlayNext(page);
+    else if (name == wxT("prev"))
+        m_frame->PlayPrev(page);
+    else if (name == wxT("seek"))
+    {
+        double pos = command.GetNumber("pos", -1);
+        if (pos < 0)
+            return wxT("seek needs a pos in milliseconds");
+        if (!page->m_mediactrl || page->m_szFile.empty())
+            return wxT("nothing loaded");
+        page->RequestSeek((long) pos);
+    }
+    else if (name == wxT("open") || name == wxT("enqueue"))
+    {
+        const wxMediaPlayerJSONValue* list = command.Get("paths");
+        wxVector<wxString> paths;
+        for (size_t n = 0; list && n < list->m_items.size(); ++n)
+        {
+            if (list->m_items[n].m_nType != wxJSON_STRING)
+                return wxT("paths must be strings");
+            paths.push_back(list->m_items[n].m_szValue);
+        }
+
+        if (name == wxT("enqueue"))
+        {
+            if (!paths.empty())
+                m_frame->ImportPaths(page, paths,
+                                     command.GetBool("play", false));
+        }
+        else
+        {
+            int mode = GetOpenMode(command.GetString("mode", wxT("append")));
+            if (mode == -1)
+                return wxT("mode must be append, replace or play");
+            m_frame->OpenForwarded(paths, mode);
+
+            if (m_frame->m_bench)
+                m_frame->m_bench->OnHandoff();
+        }
+    }
+    else if (name == wxT("select"))
+    {
+        if (!index)
+            return wxT("select needs a page");
+        notebook->SetSelection((size_t) index->m_dNumber);
+    }
+    else if (name == wxT("sort"))
+    {
+        static const char* const s_keys[] =
+        {
+            "none",
+            "name",
+            "path",
+            "length",
+            "plays",
+            "last_played"
+        };
+
+        wxString by = command.GetString("by");
+        int key = wxSORT_NONE;
+        while (key < (int) WXSIZEOF(s_keys) && by != s_keys[key])
+            ++key;
+        if (key == (int) WXSIZEOF(s_keys))
+            return wxT("by must be none, name, path, length, plays or "
+                       "last_played");
+        page->SortEntries(key, command.GetBool("descending", false));
+    }
+    else if (name == wxT("export"))
+    {
+        //  The client's working directory isn't ours
+        wxString path = command.GetString("path");
+        if (path.empty() || !wxFileName(path).IsAbsolute())
+            return wxT("export needs an absolute path");
+        if (wxMediaPlayerPlaylistReader::GetFormat(path) ==
+                wxPLAYLISTFORMAT_NONE)
+            return wxT("path must end in .m3u, .m3u8, .pls or .xspf");
+        if (!page->ExportPlaylist(path))
+            return wxT("couldn't export the playlist");
+    }
+    else if (name == wxT("close"))
+    {
+        if (notebook->GetPageCount() < 2)
+            return wxT("can't close the last page");
+        m_frame->ClosePage(page);
+    }
+    else if (name == wxT("state"))
+    {
+        static const char* const s_residency[] =
+        {
+            "active",
+            "suspended",
+            "evicted"
+        };
+
+        wxString state = wxT("stopped");
+        long position = 0, length = 0;
+        if (page->m_szFile.empty())
+            state = wxT("empty");
+        else if (page->m_nResidency == wxPAGE_EVICTED)
+            position = page->m_nSuspendedAt;
+        else if (page->m_mediactrl)
+        {
+            if (page->m_mediactrl->GetState() == wxMEDIASTATE_PLAYING)
+                state = wxT("playing");
+            else if (page->m_mediactrl->GetState() == wxMEDIASTATE_PAUSED)
+                state = wxT("paused");
+            position = (long) page->m_mediactrl->Tell();
+            length = (long) page->m_mediactrl->Length();
+        }
+
+        result << wxT(",\"pages\":") << (unsigned long) notebook->GetPageCount()
+               << wxT(",\"selected\":") << notebook->GetSelection()
+               << wxT(",\"page\":") << notebook->FindPage(page)
+               << wxT(",\"entries\":")
+               << (unsigned long) page->m_entries.GetCount()
+               << wxT(",\"duplicates\":")
+               << (unsigned long) page->m_nDuplicates
+               << wxT(",\"entry\":") << page->m_order.GetCurrent()
+               << wxT(",\"file\":") << wxMediaJSONQuote(page->m_szFile)
+               << wxT(",\"state\":\"") << state
+               << wxT("\",\"position\":") << position
+               << wxT(",\"length\":") << length
+               << wxT(",\"residency\":\"")
+               << s_residency[page->m_nResidency] << wxT("\"");
+    }
+    else
+        return wxT("unknown command");
+
+    return wxEmptyString;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerRemote::DropClient
+// ----------------------------------------------------------------------------
+void wxMediaPlayerRemote::DropClient(Client* client)
+{
+    for (size_t n = 0; n < m_clients.size(); ++n)
+    {
+        if (m_clients[n] == client)
+        {
+            m_clients.erase(m_clients.begin() + n);
+            break;
+        }
+    }
+
+    client->m_socket->Destroy();
+    delete client;
+}
+
+#endif // wxMEDIA_USE_REMOTE
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerStats
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Names of the metrics in the export, as label values
+static const char* const wxMediaStatsNames[wxSTATS_METRICS] =
+{
+    "play_file",
+    "media_loaded",
+    "media_play",
+    "media_pause",
+    "media_finished",
+    "seek",
+    "list_update",
+    "search",
+    "sort",
+    "probe",
+    "remote_command",
+    "idle"
+};
+
+// The "le" buckets of the exported histograms, in microseconds
+static const wxUint32 wxMediaStatsBounds[] =
+{
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+    250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+// Index of the highest bit set in n, which mustn't be 0
+static inline int wxMediaHighBit(wxUint32 n)
+{
+#ifdef __GNUC__
+    return 31 - __builtin_clz(n);
+#else
+    int nBit = 0;
+    while (n >>= 1)
+        ++nBit;
+    return nBit;
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerHistogram::GetBucket
+//
+// Below 16us every value has a bucket, above that the 4 bits after the
+// highest one pick one of 16 buckets for its power of two
+// ----------------------------------------------------------------------------
+inline size_t wxMediaPlayerHistogram::GetBucket(wxUint32 nMicro)
+{
+    if (nMicro < wxMEDIASTATS_SUBBUCKETS)
+        return nMicro;
+
+    const int nBit = wxMediaHighBit(nMicro);
+    return (nBit - 3) * wxMEDIASTATS_SUBBUCKETS +
+           ((nMicro >> (nBit - 4)) & (wxMEDIASTATS_SUBBUCKETS - 1));
+}
+
+wxUint32 wxMediaPlayerHistogram::GetBucketMax(size_t bucket)
+{
+    if (bucket < wxMEDIASTATS_SUBBUCKETS)
+        return bucket;
+
+    const int nShift = bucket / wxMEDIASTATS_SUBBUCKETS - 1;
+    const wxUint32 nFirst = (wxMEDIASTATS_SUBBUCKETS +
+                             bucket % wxMEDIASTATS_SUBBUCKETS) << nShift;
+    return nFirst + ((1u << nShift) - 1);
+}
+
+void wxMediaPlayerHistogram::Add(const wxMediaPlayerHistogram& other)
+{
+    for (size_t n = 0; n < wxMEDIASTATS_BUCKETS; ++n)
+        m_counts[n] += other.m_counts[n];
+    m_nCount += other.m_nCount;
+    m_nSum += other.m_nSum;
+    m_nMax = wxMax(m_nMax, other.m_nMax);
+}
+
+wxUint64 wxMediaPlayerHistogram::CountUpTo(wxUint32 nMicro) const
+{
+    wxUint64 nCount = 0;
+    for (size_t n = 0; n < wxMEDIASTATS_BUCKETS &&
+                       GetBucketMax(n) <= nMicro; ++n)
+        nCount += m_counts[n];
+    return nCount;
+}
+
+wxUint32 wxMediaPlayerHistogram::GetPercentile(int nPercent) const
+{
+    // Nearest rank, like the bench report
+    const wxUint64 nRank = (m_nCount * nPercent + 99) / 100;
+    wxUint64 nCount = 0;
+    for (size_t n = 0; n < wxMEDIASTATS_BUCKETS; ++n)
+    {
+        nCount += m_counts[n];
+        if (nCount && nCount >= nRank)
+            return wxMin(GetBucketMax(n), m_nMax);
+    }
+    return m_nMax;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStats Constructor
+// ----------------------------------------------------------------------------
+wxMediaPlayerStats::wxMediaPlayerStats(const wxString& file, long nInterval)
+                  : m_szFile(file),
+                    m_nIdleSince(-1),
+                    m_nSampleCost(0),
+                    m_nExportTime(0)
+{
+    memset(&m_main, 0, sizeof(m_main));
+    m_clock.Start();
+    Calibrate();
+
+    m_timer.SetOwner(this, wxID_STATSTIMER);
+    this->Connect(wxID_STATSTIMER, wxEVT_TIMER,
+                  wxTimerEventHandler(wxMediaPlayerStats::OnTimer));
+    m_timer.Start(wxMax(nInterval, 1L) * 1000);
+}
+
+wxMediaPlayerStats::~wxMediaPlayerStats()
+{
+    m_timer.Stop();
+
+    for (size_t n = 0; n < m_shards.size(); ++n)
+        delete m_shards[n];
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStats::Calibrate
+//
+// Times what taking a sample costs on this machine, so the export can say
+// how much of the run went into the stats themselves
+// ----------------------------------------------------------------------------
+void wxMediaPlayerStats::Calibrate()
+{
+    static const int nSamples = 10000;
+
+    Shard* scratch = new Shard;
+    memset(scratch, 0, sizeof(*scratch));
+
+    const wxInt64 nStart = Now();
+    for (int n = 0; n < nSamples; ++n)
+    {
+        wxMediaPlayerStatsScope scope(this, wxSTATS_PLAY_FILE, scratch);
+    }
+    m_nSampleCost = double(Now() - nStart) / nSamples;
+
+    delete scratch;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStats::AddShard
+// ----------------------------------------------------------------------------
+wxMediaPlayerStats::Shard* wxMediaPlayerStats::AddShard()
+{
+    Shard* shard = new Shard;
+    memset(shard, 0, sizeof(*shard));
+
+    wxMutexLocker lock(m_mutex);
+    m_shards.push_back(shard);
+    return shard;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStats::OnTimer
+// ----------------------------------------------------------------------------
+void wxMediaPlayerStats::OnTimer(wxTimerEvent& WXUNUSED(event))
+{
+    Export();
+}
+
+// Writes one histogram in the Prometheus text format, label being the
+// "name=\"value\"" that tells it from the others of its family, if any
+static void wxMediaStatsWriteHistogram(wxString& out, const char* family,
+                                       const wxString& label,
+                                       const wxMediaPlayerHistogram& hist)
+{
+    wxString prefix, labels;
+    if (!label.empty())
+    {
+        prefix = label + wxT(",");
+        labels = wxT("{") + label + wxT("}");
+    }
+
+    for (size_t n = 0; n < WXSIZEOF(wxMediaStatsBounds); ++n)
+    {
+        out << family << wxT("_bucket{") << prefix << wxT("le=\"")
+            << wxString::FromCDouble(wxMediaStatsBounds[n] / 1e6)
+            << wxT("\"} ") << hist.CountUpTo(wxMediaStatsBounds[n])
+            << wxT("\n");
+    }
+    out << family << wxT("_bucket{") << prefix << wxT("le=\"+Inf\"} ")
+        << hist.m_nCount << wxT("\n")
+        << family << wxT("_sum") << labels << wxT(" ")
+        << wxString::FromCDouble(hist.m_nSum / 1e6, 6) << wxT("\n")
+        << family << wxT("_count") << labels << wxT(" ")
+        << hist.m_nCount << wxT("\n");
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerStats::Export
+//
+// Sums the shards and replaces the file with them in one rename, so a
+// scrape never sees half of it.  The worker shards are read while they may
+// be written to; a sample or two missing from a snapshot doesn't matter
+// and is in the next one.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerStats::Export()
+{
+    const wxInt64 nStart = Now();
+
+    Shard total = m_main;
+    {
+        wxMutexLocker lock(m_mutex);
+        for (size_t n = 0; n < m_shards.size(); ++n)
+        {
+            for (int i = 0; i < wxSTATS_METRICS; ++i)
+                total.m_hist[i].Add(m_shards[n]->m_hist[i]);
+            for (int i = 0; i < wxHEALTH_EVENTS; ++i)
+                total.m_events[i] += m_shards[n]->m_events[i];
+        }
+    }
+
+    wxString out;
+    out << wxT("# HELP wxmediaplayer_handler_seconds ")
+        << wxT("Time spent in event handlers and prober jobs.\n")
+        << wxT("# TYPE wxmediaplayer_handler_seconds histogram\n");
+    for (int n = 0; n < wxSTATS_METRICS; ++n)
+    {
+        if (n == wxSTATS_IDLE)
+            continue;
+
+        wxString label;
+        label << wxT("handler=\"") << wxMediaStatsNames[n] << wxT("\"");
+        wxMediaStatsWriteHistogram(out, "wxmediaplayer_handler_seconds",
+                                   label, total.m_hist[n]);
+    }
+
+    out << wxT("# HELP wxmediaplayer_handler_quantile_seconds ")
+        << wxT("Percentiles of wxmediaplayer_handler_seconds, ")
+        << wxT("within 6%.\n")
+        << wxT("# TYPE wxmediaplayer_handler_quantile_seconds gauge\n");
+    static const int quantiles[] = { 50, 90, 99, 100 };
+    for (int n = 0; n < wxSTATS_METRICS; ++n)
+    {
+        if (n == wxSTATS_IDLE || !total.m_hist[n].m_nCount)
+            continue;
+
+        for (size_t i = 0; i < WXSIZEOF(quantiles); ++i)
+        {
+            out << wxT("wxmediaplayer_handler_quantile_seconds{handler=\"")
+                << wxMediaStatsNames[n] << wxT("\",quantile=\"")
+                << wxString::FromCDouble(quantiles[i] / 100.0) << wxT("\"} ")
+                << wxString::FromCDouble(
+                        total.m_hist[n].GetPercentile(quantiles[i]) / 1e6, 6)
+                << wxT("\n");
+        }
+    }
+
+    out << wxT("# HELP wxmediaplayer_idle_seconds ")
+        << wxT("Time the event loop waited for events.\n")
+        << wxT("# TYPE wxmediaplayer_idle_seconds histogram\n");
+    wxMediaStatsWriteHistogram(out, "wxmediaplayer_idle_seconds",
+                               wxEmptyString, total.m_hist[wxSTATS_IDLE]);
+
+    out << wxT("# HELP wxmediaplayer_playback_events_total ")
+        << wxT("Playback problems the pages' health samplers saw.\n")
+        << wxT("# TYPE wxmediaplayer_playback_events_total counter\n");
+    for (int n = wxHEALTH_OK + 1; n < wxHEALTH_EVENTS; ++n)
+    {
+        out << wxT("wxmediaplayer_playback_events_total{event=\"")
+            << wxGetMediaHealthEventText(n) << wxT("\"} ")
+            << total.m_events[n] << wxT("\n");
+    }
+
+    //
+    //  What the stats cost: every sample at the calibrated price, plus the
+    //  exports so far
+    //
+    wxUint64 nSamples = 0;
+    for (int n = 0; n < wxSTATS_METRICS; ++n)
+        nSamples += total.m_hist[n].m_nCount;
+    const double nOverhead = nSamples * m_nSampleCost + m_nExportTime;
+    const wxInt64 nUptime = wxMax(nStart, (wxInt64) 1);
+
+    out << wxT("# HELP wxmediaplayer_uptime_seconds ")
+        << wxT("Time since the stats were started.\n")
+        << wxT("# TYPE wxmediaplayer_uptime_seconds gauge\n")
+        << wxT("wxmediaplayer_uptime_seconds ")
+        << wxString::FromCDouble(nUptime / 1e6, 3) << wxT("\n")
+        << wxT("# HELP wxmediaplayer_stats_sample_seconds ")
+        << wxT("Measured cost of taking one sample.\n")
+        << wxT("# TYPE wxmediaplayer_stats_sample_seconds gauge\n")
+        << wxT("wxmediaplayer_stats_sample_seconds ")
+        << wxString::FromCDouble(m_nSampleCost / 1e6, 9) << wxT("\n")
+        << wxT("# HELP wxmediaplayer_stats_overhead_seconds_total ")
+        << wxT("Time spent sampling and exporting.\n")
+        << wxT("# TYPE wxmediaplayer_stats_overhead_seconds_total counter\n")
+        << wxT("wxmediaplayer_stats_overhead_seconds_total ")
+        << wxString::FromCDouble(nOverhead / 1e6, 6) << wxT("\n")
+        << wxT("# HELP wxmediaplayer_stats_overhead_ratio ")
+        << wxT("Share of the uptime spent on the stats.\n")
+        << wxT("# TYPE wxmediaplayer_stats_overhead_ratio gauge\n")
+        << wxT("wxmediaplayer_stats_overhead_ratio ")
+        << wxString::FromCDouble(nOverhead / nUptime, 6) << wxT("\n");
+
+    bool bOk;
+    {
+        wxLogNull noLog;
+        wxTempFile file(m_szFile);
+        bOk = file.IsOpened() && file.Write(out) && file.Commit();
+    }
+
+    m_nExportTime += Now() - nStart;
+    return bOk;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerInfoCache
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Bump whenever Header, Record or wxMediaPlayerHashPath() change, older
+// files are then simply ignored and rebuilt
+#define wxMEDIAINFOCACHE_VERSION 1
+
+static const char wxMediaInfoCacheMagic[8] =
+    { 'w', 'x', 'M', 'P', 'I', 'n', 'f', 'o' };
+static const char wxMediaInfoJournalMagic[8] =
+    { 'w', 'x', 'M', 'P', 'J', 'r', 'n', 'l' };
+static const char wxMediaInfoKeyframeMagic[8] =
+    { 'w', 'x', 'M', 'P', 'K', 'e', 'y', 's' };
+static const wxUint32 wxMediaInfoByteOrder = 0x01020304;
+
+// Tag in front of every journal record, to spot a torn write after a crash
+static const wxUint32 wxMediaInfoJournalTag = 0x4a524543;
+
+// Journal records needed before it is worth writing a new snapshot
+static const size_t wxMediaInfoCompactThreshold = 4096;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCacheCompactor
+//
+// Writes a new snapshot out of the current one plus the journal
+// ----------------------------------------------------------------------------
+class wxMediaPlayerInfoCacheCompactor : public wxThread
+{
+public:
+    wxMediaPlayerInfoCacheCompactor(wxMediaPlayerInfoCache* cache)
+        : wxThread(wxTHREAD_JOINABLE), m_cache(cache)
+    {
+    }
+
+protected:
+    virtual ExitCode Entry()
+    {
+        m_cache->DoCompaction();
+        return 0;
+    }
+
+private:
+    wxMediaPlayerInfoCache* m_cache;
+};
+
+wxMediaPlayerInfoCache::wxMediaPlayerInfoCache()
+                      : m_pMap(NULL),
+                        m_nMapSize(0),
+                        m_nBuckets(0),
+                        m_buckets(NULL),
+                        m_records(NULL),
+                        m_nRecords(0),
+                        m_pool(NULL),
+                        m_nPoolSize(0),
+                        m_compactor(NULL),
+                        m_nCompacting(0),
+                        m_bCompactionDone(false)
+{
+    wxCOMPILE_TIME_ASSERT(sizeof(Header) == 64, BadInfoCacheHeaderSize);
+    wxCOMPILE_TIME_ASSERT(sizeof(Record) == 64, BadInfoCacheRecordSize);
+    wxCOMPILE_TIME_ASSERT(sizeof(KeyframeHeader) == 40,
+                          BadInfoCacheKeyframeHeaderSize);
+
+    // Like the entry store's pool, byte 0 is only there to keep
+    // &m_journalPool[offset] valid for empty paths
+    m_journalPool.push_back('\0');
+}
+
+wxMediaPlayerInfoCache::~wxMediaPlayerInfoCache()
+{
+    Close();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::Open
+//
+// 1) Map the snapshot
+// 2) Replay the journal of a compaction that didn't finish, if any
+// 3) Replay the journal and keep it open for appending
+// 4) Start a compaction if the journal has grown large enough
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerInfoCache::Open(const wxString& dir)
+{
+    if (!wxFileName::DirExists(dir) &&
+        !wxFileName::Mkdir(dir, 0777, wxPATH_MKDIR_FULL))
+        return false;
+
+    wxString base = dir + wxFileName::GetPathSeparator() + wxT("mediainfo");
+    m_szSnapshot = base + wxT(".cache");
+    m_szJournal = base + wxT(".journal");
+    m_szOldJournal = base + wxT(".journal.old");
+    m_szKeyframeDir = dir + wxFileName::GetPathSeparator() + wxT("keyframes");
+
+    wxMutexLocker lock(m_mutex);
+
+    MapSnapshot();
+
+    bool bInterrupted = wxFileExists(m_szOldJournal);
+    if (bInterrupted)
+        LoadJournal(m_szOldJournal, false);
+
+    if (!LoadJournal(m_szJournal, true))
+        return false;
+
+    if (bInterrupted ||
+        m_journal.size() >= wxMax(wxMediaInfoCompactThreshold,
+                                  (size_t)m_nRecords / 8))
+        StartCompaction();
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::Close
+//
+// Everything was written to the journal as it came in, so all that's left
+// is to wait for a running compaction
+// ----------------------------------------------------------------------------
+void wxMediaPlayerInfoCache::Close()
+{
+    if (m_compactor)
+    {
+        m_compactor->Wait();
+        delete m_compactor;
+        m_compactor = NULL;
+    }
+
+    wxMutexLocker lock(m_mutex);
+
+    m_journalFile.Close();
+    UnmapSnapshot();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::Lookup
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerInfoCache::Lookup(const char* path, size_t len,
+                                    wxMediaPlayerMediaInfo& info,
+                                    wxUint64* size, wxInt64* mtime)
+{
+    const wxUint32 hash = wxMediaPlayerHashPath(path, len);
+
+    wxMutexLocker lock(m_mutex);
+
+    // The journal is newer than the snapshot
+    const Record* rec = FindInJournal(path, len, hash);
+    if (!rec)
+        rec = FindInSnapshot(path, len, hash);
+    if (!rec)
+        return false;
+
+    info.m_nDuration = rec->m_nDuration;
+    info.m_nBitrate = rec->m_nBitrate;
+    info.m_nVideoCodec = rec->m_nVideoCodec;
+    info.m_nAudioCodec = rec->m_nAudioCodec;
+    info.m_nWidth = rec->m_nWidth;
+    info.m_nHeight = rec->m_nHeight;
+    info.m_nFlags = (wxUint8)rec->m_nFlags;
+
+    *size = rec->m_nSize;
+    *mtime = rec->m_nMTime;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::Store
+//
+// Appends the info to the journal with a single write(), so that a crash
+// leaves at most one torn record at the end which the next Open() drops
+// ----------------------------------------------------------------------------
+void wxMediaPlayerInfoCache::Store(const char* path, size_t len,
+                                   wxUint64 size, wxInt64 mtime,
+                                   const wxMediaPlayerMediaInfo& info)
+{
+    Record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.m_nSize = size;
+    rec.m_nMTime = mtime;
+    rec.m_nProbed = (wxInt64)time(NULL);
+    rec.m_nHash = wxMediaPlayerHashPath(path, len);
+    rec.m_nPathLength = len;
+    rec.m_nDuration = info.m_nDuration;
+    rec.m_nBitrate = info.m_nBitrate;
+    rec.m_nVideoCodec = info.m_nVideoCodec;
+    rec.m_nAudioCodec = info.m_nAudioCodec;
+    rec.m_nWidth = info.m_nWidth;
+    rec.m_nHeight = info.m_nHeight;
+    rec.m_nFlags = info.m_nFlags;
+
+    wxVector<char> buf(sizeof(wxUint32) + sizeof(rec) + len);
+    memcpy(&buf[0], &wxMediaInfoJournalTag, sizeof(wxUint32));
+    memcpy(&buf[sizeof(wxUint32)], &rec, sizeof(rec));
+    if (len)
+        memcpy(&buf[sizeof(wxUint32) + sizeof(rec)], path, len);
+
+    wxMutexLocker lock(m_mutex);
+
+    if (m_journalFile.IsOpened())
+        m_journalFile.Write(&buf[0], buf.size());
+
+    AddToJournal(rec, path);
+
+    if (m_bCompactionDone)
+    {
+        m_compactor->Wait();
+        delete m_compactor;
+        m_compactor = NULL;
+        m_bCompactionDone = false;
+    }
+
+    if (m_journal.size() >= wxMax(wxMediaInfoCompactThreshold,
+                                  (size_t)m_nRecords / 8))
+        StartCompaction();
+}
+
+wxString wxMediaPlayerInfoCache::GetKeyframeFile(const char* path,
+                                                 size_t len) const
+{
+    return m_szKeyframeDir + wxFileName::GetPathSeparator() +
+           wxString::Format(wxT("%08x.keys"),
+                            (unsigned) wxMediaPlayerHashPath(path, len));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::LookupKeyframes
+//
+// Files are named by the hash of the path, and hold the path too for when
+// two paths share one
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerInfoCache::LookupKeyframes(const char* path, size_t len,
+                                             wxUint64 size, wxInt64 mtime,
+                                             wxVector<wxUint32>& keyframes)
+{
+    wxLogNull noLog;
+    wxFile file;
+    wxString name = GetKeyframeFile(path, len);
+    if (m_szKeyframeDir.empty() || !wxFileExists(name) || !file.Open(name))
+        return false;
+
+    KeyframeHeader header;
+    if (file.Read(&header, sizeof(header)) != (ssize_t)sizeof(header) ||
+        memcmp(header.m_szMagic, wxMediaInfoKeyframeMagic, 8) != 0 ||
+        header.m_nVersion != wxMEDIAINFOCACHE_VERSION ||
+        header.m_nByteOrder != wxMediaInfoByteOrder ||
+        header.m_nSize != size || header.m_nMTime != mtime ||
+        header.m_nPathLength != len ||
+        file.Length() != (wxFileOffset)(sizeof(header) + len +
+                                        header.m_nCount * sizeof(wxUint32)))
+        return false;
+
+    wxVector<char> stored(len + 1);
+    if (file.Read(&stored[0], len) != (ssize_t)len ||
+        memcmp(&stored[0], path, len) != 0)
+        return false;
+
+    keyframes.resize(header.m_nCount);
+    return !header.m_nCount ||
+           file.Read(&keyframes[0], header.m_nCount * sizeof(wxUint32)) ==
+                (ssize_t)(header.m_nCount * sizeof(wxUint32));
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::StoreKeyframes
+//
+// Written to a temporary file and renamed, so workers indexing the same
+// file at once or a crash never leave half an index behind
+// ----------------------------------------------------------------------------
+void wxMediaPlayerInfoCache::StoreKeyframes(const char* path, size_t len,
+                                            wxUint64 size, wxInt64 mtime,
+                                            const wxVector<wxUint32>& keyframes)
+{
+    if (m_szKeyframeDir.empty())
+        return;
+
+    wxLogNull noLog;
+    if (!wxFileName::DirExists(m_szKeyframeDir) &&
+        !wxFileName::Mkdir(m_szKeyframeDir, 0777, wxPATH_MKDIR_FULL))
+        return;
+
+    KeyframeHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_szMagic, wxMediaInfoKeyframeMagic, 8);
+    header.m_nVersion = wxMEDIAINFOCACHE_VERSION;
+    header.m_nByteOrder = wxMediaInfoByteOrder;
+    header.m_nSize = size;
+    header.m_nMTime = mtime;
+    header.m_nPathLength = len;
+    header.m_nCount = keyframes.size();
+
+    wxTempFile out(GetKeyframeFile(path, len));
+    if (out.IsOpened() &&
+        out.Write(&header, sizeof(header)) &&
+        (!len || out.Write(path, len)) &&
+        (keyframes.empty() ||
+         out.Write(&keyframes[0], keyframes.size() * sizeof(wxUint32))))
+        out.Commit();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::MapSnapshot
+//
+// Maps the snapshot and checks that the header agrees with the file size,
+// after which every offset in it can be trusted.  Called with m_mutex held.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerInfoCache::MapSnapshot()
+{
+    wxLogNull noLog;
+    wxFile file;
+    if (!wxFileExists(m_szSnapshot) || !file.Open(m_szSnapshot))
+        return false;
+
+    wxFileOffset length = file.Length();
+    if (length < (wxFileOffset)sizeof(Header))
+        return false;
+
+#ifdef __UNIX__
+    void* map = mmap(NULL, length, PROT_READ, MAP_SHARED, file.fd(), 0);
+    if (map == MAP_FAILED)
+        return false;
+#else
+    m_mapBuffer.resize(length);
+    if (file.Read(&m_mapBuffer[0], length) != length)
+    {
+        m_mapBuffer.clear();
+        return false;
+    }
+    void* map = &m_mapBuffer[0];
+#endif
+
+    m_pMap = (const char*)map;
+    m_nMapSize = length;
+
+    const Header* header = (const Header*)m_pMap;
+    wxUint64 expected = sizeof(Header) +
+                        (wxUint64)header->m_nBuckets * sizeof(wxUint32) +
+                        (wxUint64)header->m_nRecords * sizeof(Record) +
+                        header->m_nPoolSize;
+
+    if (memcmp(header->m_szMagic, wxMediaInfoCacheMagic, 8) != 0 ||
+        header->m_nVersion != wxMEDIAINFOCACHE_VERSION ||
+        header->m_nByteOrder != wxMediaInfoByteOrder ||
+        header->m_nBuckets == 0 ||
+        (header->m_nBuckets & (header->m_nBuckets - 1)) != 0 ||
+        expected != (wxUint64)length)
+    {
+        UnmapSnapshot();
+        return false;
+    }
+
+    m_nBuckets = header->m_nBuckets;
+    m_buckets = (const wxUint32*)(m_pMap + sizeof(Header));
+    m_nRecords = header->m_nRecords;
+    m_records = (const Record*)(m_buckets + m_nBuckets);
+    m_nPoolSize = header->m_nPoolSize;
+    m_pool = (const char*)(m_records + m_nRecords);
+
+    return true;
+}
+
+void wxMediaPlayerInfoCache::UnmapSnapshot()
+{
+#ifdef __UNIX__
+    if (m_pMap)
+        munmap((void*)m_pMap, m_nMapSize);
+#else
+    m_mapBuffer.clear();
+#endif
+
+    m_pMap = NULL;
+    m_nMapSize = 0;
+    m_nBuckets = 0;
+    m_buckets = NULL;
+    m_records = NULL;
+    m_nRecords = 0;
+    m_pool = NULL;
+    m_nPoolSize = 0;
+}
+
+const wxMediaPlayerInfoCache::Record*
+wxMediaPlayerInfoCache::FindInSnapshot(const char* path, size_t len,
+                                       wxUint32 hash) const
+{
+    if (!m_nBuckets)
+        return NULL;
+
+    const wxUint32 mask = m_nBuckets - 1;
+    wxUint32 slot = hash & mask;
+    for (wxUint32 n = 0; n < m_nBuckets; ++n)
+    {
+        wxUint32 index = m_buckets[slot];
+        if (!index)
+            return NULL;
+
+        if (index <= m_nRecords)
+        {
+            const Record* rec = &m_records[index - 1];
+            if (rec->m_nHash == hash && rec->m_nPathLength == len &&
+                (wxUint64)rec->m_nPath + len <= m_nPoolSize &&
+                memcmp(m_pool + rec->m_nPath, path, len) == 0)
+                return rec;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::LoadJournal
+//
+// Replays a journal in one sequential read, stopping at the first record
+// that is torn or corrupt.  If bKeep is set the journal is then opened for
+// appending, after cutting off anything past the last good record.
+// Called with m_mutex held.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerInfoCache::LoadJournal(const wxString& file, bool bKeep)
+{
+    wxLogNull noLog;
+
+    wxVector<char> data;
+    {
+        wxFile in;
+        if (wxFileExists(file) && in.Open(file))
+        {
+            wxFileOffset length = in.Length();
+            if (length > 0)
+            {
+                data.resize(length);
+                if (in.Read(&data[0], length) != length)
+                    data.clear();
+            }
+        }
+    }
+
+    const size_t headerSize = sizeof(wxMediaInfoJournalMagic) +
+                              2 * sizeof(wxUint32);
+    size_t valid = 0;
+
+    wxUint32 version = 0, byteOrder = 0;
+    if (data.size() >= headerSize)
+    {
+        memcpy(&version, &data[8], sizeof(version));
+        memcpy(&byteOrder, &data[12], sizeof(byteOrder));
+    }
+
+    if (version == wxMEDIAINFOCACHE_VERSION &&
+        byteOrder == wxMediaInfoByteOrder &&
+        memcmp(&data[0], wxMediaInfoJournalMagic, 8) == 0)
+    {
+        valid = headerSize;
+        while (valid + sizeof(wxUint32) + sizeof(Record) <= data.size())
+        {
+            wxUint32 tag;
+            memcpy(&tag, &data[valid], sizeof(tag));
+            if (tag != wxMediaInfoJournalTag)
+                break;
+
+            Record rec;
+            memcpy(&rec, &data[valid + sizeof(tag)], sizeof(rec));
+
+            size_t next = valid + sizeof(tag) + sizeof(rec) +
+                          rec.m_nPathLength;
+            if (next > data.size())
+                break;
+
+            const char* path = &data[valid + sizeof(tag) + sizeof(rec)];
+            if (wxMediaPlayerHashPath(path, rec.m_nPathLength) != rec.m_nHash)
+                break;
+
+            AddToJournal(rec, path);
+            valid = next;
+        }
+    }
+
+    if (!bKeep)
+        return true;
+
+    if (valid == 0 || valid != data.size())
+    {
+        wxTempFile out(file);
+        if (valid == 0)
+        {
+            version = wxMEDIAINFOCACHE_VERSION;
+            byteOrder = wxMediaInfoByteOrder;
+            out.Write(wxMediaInfoJournalMagic, 8);
+            out.Write(&version, sizeof(version));
+            out.Write(&byteOrder, sizeof(byteOrder));
+        }
+        else
+        {
+            out.Write(&data[0], valid);
+        }
+
+        if (!out.Commit())
+            return false;
+    }
+
+    return m_journalFile.Open(file, wxFile::write_append);
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::AddToJournal
+//
+// Adds a record to the in-memory journal.  Records are only ever appended
+// so a running compaction can rely on the first m_nCompacting of them; the
+// index always points at the newest record of a path.
+// Called with m_mutex held.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerInfoCache::AddToJournal(const Record& rec, const char* path)
+{
+    Record copy = rec;
+    copy.m_nPath = m_journalPool.size();
+    m_journalPool.resize(copy.m_nPath + copy.m_nPathLength);
+    if (copy.m_nPathLength)
+        memcpy(&m_journalPool[copy.m_nPath], path, copy.m_nPathLength);
+
+    m_journal.push_back(copy);
+
+    if (m_journal.size() * 2 > m_journalIndex.size())
+    {
+        RebuildJournalIndex();
+        return;
+    }
+
+    const size_t mask = m_journalIndex.size() - 1;
+    size_t slot = copy.m_nHash & mask;
+    while (m_journalIndex[slot])
+    {
+        const Record& other = m_journal[m_journalIndex[slot] - 1];
+        if (other.m_nHash == copy.m_nHash &&
+            other.m_nPathLength == copy.m_nPathLength &&
+            memcmp(&m_journalPool[other.m_nPath],
+                   &m_journalPool[copy.m_nPath], copy.m_nPathLength) == 0)
+            break;
+
+        slot = (slot + 1) & mask;
+    }
+    m_journalIndex[slot] = m_journal.size();
+}
+
+void wxMediaPlayerInfoCache::RebuildJournalIndex()
+{
+    size_t size = 256;
+    while (size < m_journal.size() * 4)
+        size *= 2;
+
+    m_journalIndex.clear();
+    m_journalIndex.resize(size, 0);
+
+    const size_t mask = size - 1;
+    for (size_t n = 0; n < m_journal.size(); ++n)
+    {
+        const Record& rec = m_journal[n];
+        size_t slot = rec.m_nHash & mask;
+        while (m_journalIndex[slot])
+        {
+            const Record& other = m_journal[m_journalIndex[slot] - 1];
+            if (other.m_nHash == rec.m_nHash &&
+                other.m_nPathLength == rec.m_nPathLength &&
+                memcmp(&m_journalPool[other.m_nPath],
+                       &m_journalPool[rec.m_nPath], rec.m_nPathLength) == 0)
+                break;
+
+            slot = (slot + 1) & mask;
+        }
+        m_journalIndex[slot] = n + 1;
+    }
+}
+
+const wxMediaPlayerInfoCache::Record*
+wxMediaPlayerInfoCache::FindInJournal(const char* path, size_t len,
+                                      wxUint32 hash) const
+{
+    if (m_journalIndex.empty())
+        return NULL;
+
+    const size_t mask = m_journalIndex.size() - 1;
+    size_t slot = hash & mask;
+    while (m_journalIndex[slot])
+    {
+        const Record* rec = &m_journal[m_journalIndex[slot] - 1];
+        if (rec->m_nHash == hash && rec->m_nPathLength == len &&
+            memcmp(&m_journalPool[rec->m_nPath], path, len) == 0)
+            return rec;
+
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::StartCompaction
+//
+// Moves the journal aside so that new results go to a fresh one while the
+// compactor works, then starts the compactor.  If an earlier compaction
+// never finished its journal is still there, and still in memory, so the
+// current journal is appended to it instead.
+// Called with m_mutex held.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerInfoCache::StartCompaction()
+{
+    if (m_compactor || m_journal.empty())
+        return;
+
+    wxLogNull noLog;
+
+    m_journalFile.Close();
+
+    if (wxFileExists(m_szOldJournal))
+    {
+        wxFile in(m_szJournal);
+        wxFile out(m_szOldJournal, wxFile::write_append);
+
+        const size_t headerSize = sizeof(wxMediaInfoJournalMagic) +
+                                  2 * sizeof(wxUint32);
+        wxFileOffset length = in.IsOpened() ? in.Length() : 0;
+        if (length > (wxFileOffset)headerSize && out.IsOpened())
+        {
+            wxVector<char> data(length - headerSize);
+            in.Seek(headerSize);
+            if (in.Read(&data[0], data.size()) == (ssize_t)data.size())
+                out.Write(&data[0], data.size());
+        }
+        in.Close();
+        wxRemoveFile(m_szJournal);
+    }
+    else
+    {
+        wxRenameFile(m_szJournal, m_szOldJournal);
+    }
+
+    const wxUint32 version = wxMEDIAINFOCACHE_VERSION;
+    if (m_journalFile.Create(m_szJournal, true))
+    {
+        m_journalFile.Write(wxMediaInfoJournalMagic, 8);
+        m_journalFile.Write(&version, sizeof(version));
+        m_journalFile.Write(&wxMediaInfoByteOrder,
+                            sizeof(wxMediaInfoByteOrder));
+    }
+
+    m_nCompacting = m_journal.size();
+    m_bCompactionDone = false;
+
+    m_compactor = new wxMediaPlayerInfoCacheCompactor(this);
+    if (m_compactor->Run() != wxTHREAD_NO_ERROR)
+    {
+        delete m_compactor;
+        m_compactor = NULL;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerInfoCache::DoCompaction
+//
+// Runs on the compactor thread.  Merges the first m_nCompacting journal
+// records with the snapshot into a new snapshot, newest record winning,
+// writes it next to the old one and renames it into place.  The old mapping
+// stays valid until we swap it out at the end, so lookups carry on
+// meanwhile.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerInfoCache::InsertRecord(wxVector<wxUint32>& buckets,
+                                          wxVector<Record>& records,
+                                          wxVector<char>& pool,
+                                          const Record& rec,
+                                          const char* path)
+{
+    const size_t mask = buckets.size() - 1;
+    size_t slot = rec.m_nHash & mask;
+    while (buckets[slot])
+    {
+        const Record& other = records[buckets[slot] - 1];
+        if (other.m_nHash == rec.m_nHash &&
+            other.m_nPathLength == rec.m_nPathLength &&
+            memcmp(&pool[other.m_nPath], path, rec.m_nPathLength) == 0)
+            return;     // a newer record of this path is already in
+
+        slot = (slot + 1) & mask;
+    }
+
+    Record copy = rec;
+    copy.m_nPath = pool.size();
+    pool.resize(copy.m_nPath + copy.m_nPathLength);
+    if (copy.m_nPathLength)
+        memcpy(&pool[copy.m_nPath], path, copy.m_nPathLength);
+
+    records.push_back(copy);
+    buckets[slot] = records.size();
+}
+
+void wxMediaPlayerInfoCache::DoCompaction()
+{
+    //
+    //  Take a copy of the journal records we are folding in, Store()
+    //  keeps appending to m_journal meanwhile
+    //
+    wxVector<Record> journal;
+    wxVector<char> journalPool;
+    {
+        wxMutexLocker lock(m_mutex);
+        journal.reserve(m_nCompacting);
+        for (size_t n = 0; n < m_nCompacting; ++n)
+            journal.push_back(m_journal[n]);
+        journalPool = m_journalPool;
+    }
+
+    //
+    //  Merge, newest first so that older records of a path are skipped.
+    //  The snapshot is only ever replaced by this thread, so reading it
+    //  without the lock is fine.
+    //
+    size_t nBuckets = 1024;
+    while (nBuckets < (journal.size() + m_nRecords) * 2)
+        nBuckets *= 2;
+
+    wxVector<wxUint32> buckets(nBuckets, 0);
+    wxVector<Record> records;
+    wxVector<char> pool;
+    records.reserve(journal.size() + m_nRecords);
+    pool.push_back('\0');  // so &pool[0] is always valid
+
+    for (size_t n = journal.size(); n > 0; --n)
+    {
+        const Record& rec = journal[n - 1];
+        InsertRecord(buckets, records, pool, rec, &journalPool[rec.m_nPath]);
+    }
+    for (wxUint32 n = 0; n < m_nRecords; ++n)
+    {
+        const Record& rec = m_records[n];
+        if ((wxUint64)rec.m_nPath + rec.m_nPathLength <= m_nPoolSize)
+            InsertRecord(buckets, records, pool, rec, m_pool + rec.m_nPath);
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_szMagic, wxMediaInfoCacheMagic, 8);
+    header.m_nVersion = wxMEDIAINFOCACHE_VERSION;
+    header.m_nByteOrder = wxMediaInfoByteOrder;
+    header.m_nBuckets = nBuckets;
+    header.m_nRecords = records.size();
+    header.m_nPoolSize = pool.size();
+
+    bool bOK;
+    {
+        wxLogNull noLog;
+        wxTempFile out(m_szSnapshot);
+        bOK = out.IsOpened() &&
+              out.Write(&header, sizeof(header)) &&
+              out.Write(&buckets[0], nBuckets * sizeof(wxUint32)) &&
+              (records.empty() ||
+               out.Write(&records[0], records.size() * sizeof(Record))) &&
+              out.Write(&pool[0], pool.size()) &&
+              out.Commit();
+    }
+
+    wxMutexLocker lock(m_mutex);
+
+    if (bOK)
+    {
+        UnmapSnapshot();
+        MapSnapshot();
+
+        //
+        //  Drop the records that are in the snapshot now, keeping the ones
+        //  stored while we were busy
+        //
+        wxVector<Record> rest;
+        wxVector<char> restPool;
+        restPool.push_back('\0');
+        for (size_t n = m_nCompacting; n < m_journal.size(); ++n)
+        {
+            Record rec = m_journal[n];
+            size_t at = restPool.size();
+            restPool.resize(at + rec.m_nPathLength);
+            if (rec.m_nPathLength)
+                memcpy(&restPool[at], &m_journalPool[rec.m_nPath],
+                       rec.m_nPathLength);
+            rec.m_nPath = at;
+            rest.push_back(rec);
+        }
+        m_journal = rest;
+        m_journalPool = restPool;
+        RebuildJournalIndex();
+
+        wxRemoveFile(m_szOldJournal);
+    }
+
+    m_nCompacting = 0;
+    m_bCompactionDone = true;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerThumbnailer
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Bump whenever PackHeader or PackRecord change, older packs are then
+// simply started over
+#define wxMEDIATHUMBNAIL_VERSION 1
+
+static const char wxMediaThumbnailMagic[8] =
+    { 'w', 'x', 'M', 'P', 'T', 'h', 'm', 'b' };
+
+// Tag in front of every pack record, to spot a torn write after a crash
+static const wxUint32 wxMediaThumbnailTag = 0x54484d42;
+
+// Bytes of RGB in a thumbnail
+static const wxUint32 wxMediaThumbnailBytes =
+    wxMediaThumbnailWidth * wxMediaThumbnailHeight * 3;
+
+// Longest path a pack record may have, anything longer is a torn record
+static const wxUint32 wxMediaThumbnailMaxPath = 32768;
+
+// Nothing more is added to a pack once it is this big, and the next run
+// starts it over.  That is some 35000 thumbnails.
+static const wxFileOffset wxMediaThumbnailPackLimit = 256 * 1024 * 1024;
+
+// Most workers there are, decoding images is work the player needs the
+// cores for
+static const int wxMediaThumbnailThreads = 2;
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailerThread
+//
+// A worker of the thumbnailer: makes files until the thumbnailer is stopped
+// ----------------------------------------------------------------------------
+class wxMediaPlayerThumbnailerThread : public wxThread
+{
+public:
+    wxMediaPlayerThumbnailerThread(wxMediaPlayerThumbnailer* thumbnailer)
+        : wxThread(wxTHREAD_JOINABLE), m_thumbnailer(thumbnailer)
+    {
+    }
+
+protected:
+    virtual ExitCode Entry()
+    {
+        wxMediaPlayerThumbnailer::Result result;
+        while (m_thumbnailer->GetJob(result.m_szFile))
+        {
+            m_thumbnailer->Make(result.m_szFile, result.m_rgb);
+            m_thumbnailer->AddResult(result);
+        }
+        return 0;
+    }
+
+private:
+    wxMediaPlayerThumbnailer* m_thumbnailer;
+};
+
+wxMediaPlayerThumbnailer::wxMediaPlayerThumbnailer()
+                        : m_cond(m_mutex),
+                          m_nNextJob(0),
+                          m_handler(NULL),
+                          m_bStopping(false),
+                          m_bPackOpened(false),
+                          m_nPackEnd(0),
+                          m_nPackRecords(0)
+{
+}
+
+wxMediaPlayerThumbnailer::~wxMediaPlayerThumbnailer()
+{
+    Stop();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailer::Start
+//
+// The pack is only read by the first worker that needs it, so a big one
+// doesn't hold up startup
+// ----------------------------------------------------------------------------
+void wxMediaPlayerThumbnailer::Start(wxEvtHandler* handler,
+                                     const wxString& dir)
+{
+    m_handler = handler;
+    m_szPack = dir + wxFileName::GetPathSeparator() + wxT("thumbnails.pack");
+
+    int nThreads = wxMin(wxThread::GetCPUCount(), wxMediaThumbnailThreads);
+    if (nThreads < 1)
+        nThreads = 1;   // GetCPUCount() returns -1 if it doesn't know
+
+    for (int n = 0; n < nThreads; ++n)
+    {
+        wxThread* thread = new wxMediaPlayerThumbnailerThread(this);
+        if (thread->Run() != wxTHREAD_NO_ERROR)
+        {
+            delete thread;
+            break;
+        }
+        m_threads.push_back(thread);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailer::Stop
+//
+// Wakes up all workers, lets them finish the file they're on and waits for
+// them to exit.  Results still pending are never delivered.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerThumbnailer::Stop()
+{
+    {
+        wxMutexLocker lock(m_mutex);
+        m_bStopping = true;
+        m_cond.Broadcast();
+    }
+
+    for (size_t n = 0; n < m_threads.size(); ++n)
+    {
+        m_threads[n]->Wait();
+        delete m_threads[n];
+    }
+    m_threads.clear();
+
+    wxMutexLocker lock(m_packMutex);
+    if (m_pack.IsOpened())
+        m_pack.Close();
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailer::Request
+//
+// Files asked for earlier that no worker has got to yet have scrolled out
+// of view, so they are dropped
+// ----------------------------------------------------------------------------
+void wxMediaPlayerThumbnailer::Request(const wxVector<wxString>& files)
+{
+    wxMutexLocker lock(m_mutex);
+
+    m_jobs = files;
+    m_nNextJob = 0;
+    m_cond.Broadcast();
+}
+
+void wxMediaPlayerThumbnailer::TakeResults(wxVector<Result>& results)
 {
-    SetIcon(wxICON(sample));
+    wxMutexLocker lock(m_mutex);
 
-    //
-    // Create our notebook - using wxNotebook is luckily pretty
-    // simple and self-explanatory in most cases
-    //
-    m_notebook = new wxNotebook(this, wxID_NOTEBOOK);
+    results = m_results;
+    m_results.clear();
+}
 
-    this->Connect(wxID_NEXT, wxEVT_MENU,
-                  wxCommandEventHandler(wxMediaPlayerFrame::OnNext));
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailer::GetJob
+//
+// Blocks until there is a file to make or the thumbnailer is stopped.  A
+// file another worker is already making is skipped, as a page asks for all
+// the rows on screen each time the list scrolls.
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerThumbnailer::GetJob(wxString& file)
+{
+    wxMutexLocker lock(m_mutex);
 
-    //
-    // Close events
-    //
-    this->Connect(wxID_ANY, wxEVT_CLOSE_WINDOW,
-                wxCloseEventHandler(wxMediaPlayerFrame::OnClose));
+    for ( ;; )
+    {
+        if (m_bStopping)
+            return false;
 
-    //
-    // End of Events
-    //
+        while (m_nNextJob < m_jobs.size())
+        {
+            file = m_jobs[m_nNextJob++];
 
-    //
-    //  Create an initial notebook page so the user has something
-    //  to work with without having to go file->open every time :).
-    //
-    wxMediaPlayerNotebookPage* page =
-        new wxMediaPlayerNotebookPage(this, m_notebook);
-    m_notebook->AddPage(page,
-                        wxT(""),
-                        true);
+            bool bBusy = false;
+            for (size_t n = 0; n < m_busy.size(); ++n)
+                bBusy |= m_busy[n] == file;
+            if (!bBusy)
+            {
+                m_busy.push_back(file);
+                return true;
+            }
+        }
 
+        m_jobs.clear();
+        m_nNextJob = 0;
+        m_cond.Wait();
+    }
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame Destructor
+// wxMediaPlayerThumbnailer::Make
 //
-// 1) Deletes child objects implicitly
-// 2) Delete our timer explicitly
+// Takes the thumbnail from the pack if the file hasn't changed since it
+// was made, and makes and stores it otherwise
 // ----------------------------------------------------------------------------
-wxMediaPlayerFrame::~wxMediaPlayerFrame()
+void wxMediaPlayerThumbnailer::Make(const wxString& file,
+                                    wxVector<unsigned char>& rgb)
 {
+    rgb.clear();
 
-    //
-    //  Here we save our info to the registry or whatever
-    //  mechanism the OS uses.
-    //
-    //  This makes it so that when mediaplayer loads up again
-    //  it restores the same files that were in the playlist
-    //  this time, rather than the user manually re-adding them.
-    //
-    //  We need to do conf->DeleteAll() here because by default
-    //  the config still contains the same files as last time
-    //  so we need to clear it before writing our new ones.
-    //
-    //  TODO:  Maybe you could add a menu option to the
-    //  options menu to delete the configuration on exit -
-    //  all you'd need to do is just remove everything after
-    //  conf->DeleteAll() here
-    //
-    //  As an exercise to the reader, try modifying this so
-    //  that it saves the data for each notebook page
-    //
-    wxMediaPlayerListCtrl* playlist =
-        ((wxMediaPlayerNotebookPage*)m_notebook->GetPage(0))->m_playlist;
+    wxStructStat st;
+    const bool bStat = wxStat(file, &st) == 0;
+    const wxScopedCharBuffer utf8 = file.utf8_str();
+
+    if (bStat)
+    {
+        wxMutexLocker lock(m_packMutex);
+        if (!m_bPackOpened)
+        {
+            m_bPackOpened = true;
+            OpenPack();
+        }
+
+        if (LookupPack(utf8.data(), utf8.length(), st.st_size, st.st_mtime,
+                       rgb))
+            return;
+    }
+
+    wxImage poster;
+    if (wxExtractMediaPoster(file, poster))
+    {
+        const unsigned char* data = poster.GetData();
+        rgb.insert(rgb.end(), data, data + wxMediaThumbnailBytes);
+    }
+
+    //  A file that can't be read now may well be readable later
+    if (bStat)
+    {
+        wxMutexLocker lock(m_packMutex);
+        StorePack(utf8.data(), utf8.length(), st.st_size, st.st_mtime, rgb);
+    }
+}
 
-    wxConfig conf;
-    conf.DeleteAll();
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailer::AddResult
+//
+// Called by the workers.  Only the first result of a batch posts an event,
+// the rest pile up until the UI thread gets round to taking them.
+// ----------------------------------------------------------------------------
+void wxMediaPlayerThumbnailer::AddResult(const Result& result)
+{
+    wxMutexLocker lock(m_mutex);
 
-    for(int i = 0; i < playlist->GetItemCount(); ++i)
+    for (size_t n = 0; n < m_busy.size(); ++n)
     {
-        wxString* pData = (wxString*) playlist->GetItemData(i);
-        wxString s;
-        s << i;
-        conf.Write(s, *(pData));
-        delete pData;
+        if (m_busy[n] == result.m_szFile)
+        {
+            m_busy.erase(m_busy.begin() + n);
+            break;
+        }
     }
+
+    bool bFirst = m_results.empty();
+    m_results.push_back(result);
+
+    if (bFirst && m_handler && !m_bStopping)
+        wxQueueEvent(m_handler,
+                     new wxThreadEvent(wxEVT_THREAD, wxID_THUMBNAILER));
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnClose
+// wxMediaPlayerThumbnailer::OpenPack
+//
+// Indexes the records of the pack by the hash of their path; only the
+// record headers are read.  Whatever follows the last whole record is left
+// over from a crash and gets overwritten.  A pack that is from another
+// version, or too big, is started over.
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnClose(wxCloseEvent& event)
+bool wxMediaPlayerThumbnailer::OpenPack()
 {
-    event.Skip(); // really close the frame
+    wxLogNull noLog;
+
+    const wxString dir = wxPathOnly(m_szPack);
+    if (m_szPack.empty() ||
+        (!wxFileName::DirExists(dir) &&
+         !wxFileName::Mkdir(dir, 0777, wxPATH_MKDIR_FULL)))
+        return false;
+
+    PackHeader header;
+    if (wxFileExists(m_szPack) && m_pack.Open(m_szPack, wxFile::read_write))
+    {
+        const wxFileOffset length = m_pack.Length();
+        if (length < wxMediaThumbnailPackLimit &&
+            m_pack.Read(&header, sizeof(header)) == (ssize_t)sizeof(header) &&
+            memcmp(header.m_szMagic, wxMediaThumbnailMagic, 8) == 0 &&
+            header.m_nVersion == wxMEDIATHUMBNAIL_VERSION &&
+            header.m_nByteOrder == wxMediaInfoByteOrder &&
+            header.m_nWidth == (wxUint32)wxMediaThumbnailWidth &&
+            header.m_nHeight == (wxUint32)wxMediaThumbnailHeight)
+        {
+            wxFileOffset pos = sizeof(header);
+            PackRecord rec;
+            while (m_pack.Seek(pos) == pos &&
+                   m_pack.Read(&rec, sizeof(rec)) == (ssize_t)sizeof(rec) &&
+                   rec.m_nTag == wxMediaThumbnailTag &&
+                   rec.m_nPathLength <= wxMediaThumbnailMaxPath &&
+                   (rec.m_nPixels == 0 ||
+                    rec.m_nPixels == wxMediaThumbnailBytes))
+            {
+                wxFileOffset next = pos + sizeof(rec) + rec.m_nPathLength +
+                                    rec.m_nPixels;
+                if (next > length)
+                    break;
+
+                IndexPackRecord(rec.m_nHash, (wxUint32)pos);
+                pos = next;
+            }
+
+            m_nPackEnd = pos;
+            return true;
+        }
+        m_pack.Close();
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_szMagic, wxMediaThumbnailMagic, 8);
+    header.m_nVersion = wxMEDIATHUMBNAIL_VERSION;
+    header.m_nByteOrder = wxMediaInfoByteOrder;
+    header.m_nWidth = wxMediaThumbnailWidth;
+    header.m_nHeight = wxMediaThumbnailHeight;
+
+    //  wxFile::Create() only opens for writing
+    {
+        wxFile file;
+        if (!file.Create(m_szPack, true) ||
+            file.Write(&header, sizeof(header)) != sizeof(header))
+            return false;
+    }
+
+    if (!m_pack.Open(m_szPack, wxFile::read_write))
+        return false;
+
+    m_nPackEnd = sizeof(header);
+    return true;
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::AddToPlayList
+// wxMediaPlayerThumbnailer::IndexPackRecord
+//
+// A later record of the same hash replaces the earlier one; that is either
+// the same file made again after it changed, or a collision that costs
+// making one of the two files again
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::AddToPlayList(const wxString& szString)
+void wxMediaPlayerThumbnailer::IndexPackRecord(wxUint32 hash,
+                                               wxUint32 offset)
 {
-    wxMediaPlayerNotebookPage* currentpage =
-        ((wxMediaPlayerNotebookPage*)m_notebook->GetCurrentPage());
+    if ((m_nPackRecords + 1) * 2 > m_packHashes.size())
+    {
+        wxVector<wxUint32> hashes = m_packHashes;
+        wxVector<wxUint32> offsets = m_packOffsets;
 
-    currentpage->m_playlist->AddToPlayList(szString);
+        size_t size = wxMax(hashes.size() * 2, (size_t)1024);
+        m_packHashes.clear();
+        m_packHashes.resize(size, 0);
+        m_packOffsets.clear();
+        m_packOffsets.resize(size, 0);
+        m_nPackRecords = 0;
+
+        for (size_t n = 0; n < offsets.size(); ++n)
+        {
+            if (offsets[n])
+                IndexPackRecord(hashes[n], offsets[n]);
+        }
+    }
+
+    const size_t mask = m_packHashes.size() - 1;
+    size_t slot = hash & mask;
+    while (m_packOffsets[slot] && m_packHashes[slot] != hash)
+        slot = (slot + 1) & mask;
+
+    if (!m_packOffsets[slot])
+        ++m_nPackRecords;
+    m_packHashes[slot] = hash;
+    m_packOffsets[slot] = offset;
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnQuit
+// wxMediaPlayerThumbnailer::LookupPack
 //
-// Called from file->quit.
-// Closes this application.
+// True if the pack has the file at this size and mtime, rgb being empty if
+// it had no poster then
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnQuit(wxCommandEvent& WXUNUSED(event))
+bool wxMediaPlayerThumbnailer::LookupPack(const char* path, size_t len,
+                                          wxUint64 size, wxInt64 mtime,
+                                          wxVector<unsigned char>& rgb)
 {
-    // true is to force the frame to close
-    Close(true);
+    if (!m_pack.IsOpened() || m_packOffsets.empty())
+        return false;
+
+    const wxUint32 hash = wxMediaPlayerHashPath(path, len);
+    const size_t mask = m_packHashes.size() - 1;
+    size_t slot = hash & mask;
+    while (m_packOffsets[slot] && m_packHashes[slot] != hash)
+        slot = (slot + 1) & mask;
+
+    const wxFileOffset pos = m_packOffsets[slot];
+    PackRecord rec;
+    if (!pos || m_pack.Seek(pos) != pos ||
+        m_pack.Read(&rec, sizeof(rec)) != (ssize_t)sizeof(rec) ||
+        rec.m_nSize != size || rec.m_nMTime != mtime ||
+        rec.m_nPathLength != len)
+        return false;
+
+    wxVector<char> stored(len + rec.m_nPixels);
+    if (!stored.empty() &&
+        m_pack.Read(&stored[0], stored.size()) != (ssize_t)stored.size())
+        return false;
+
+    if (len && memcmp(&stored[0], path, len) != 0)
+        return false;
+
+    rgb.clear();
+    if (rec.m_nPixels)
+        rgb.insert(rgb.end(), &stored[0] + len, &stored[0] + stored.size());
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailer::StorePack
+//
+// Appends a record with a single write(), which a crash can only leave torn
+// at the end of the pack
+// ----------------------------------------------------------------------------
+void wxMediaPlayerThumbnailer::StorePack(const char* path, size_t len,
+                                         wxUint64 size, wxInt64 mtime,
+                                         const wxVector<unsigned char>& rgb)
+{
+    if (!m_pack.IsOpened() || len > wxMediaThumbnailMaxPath)
+        return;
+
+    PackRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.m_nTag = wxMediaThumbnailTag;
+    rec.m_nHash = wxMediaPlayerHashPath(path, len);
+    rec.m_nSize = size;
+    rec.m_nMTime = mtime;
+    rec.m_nPathLength = len;
+    rec.m_nPixels = rgb.empty() ? 0 : wxMediaThumbnailBytes;
+
+    const size_t nBytes = sizeof(rec) + len + rec.m_nPixels;
+    if (m_nPackEnd + (wxFileOffset)nBytes > wxMediaThumbnailPackLimit)
+        return;
+
+    wxVector<char> buffer(nBytes);
+    memcpy(&buffer[0], &rec, sizeof(rec));
+    if (len)
+        memcpy(&buffer[sizeof(rec)], path, len);
+    if (rec.m_nPixels)
+        memcpy(&buffer[sizeof(rec) + len], &rgb[0], rec.m_nPixels);
+
+    if (m_pack.Seek(m_nPackEnd) != m_nPackEnd ||
+        m_pack.Write(&buffer[0], nBytes) != nBytes)
+    {
+        //  Don't append after a record that may only be partly there
+        m_pack.Close();
+        return;
+    }
+
+    IndexPackRecord(rec.m_nHash, (wxUint32)m_nPackEnd);
+    m_nPackEnd += nBytes;
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerThumbnailCache
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+wxMediaPlayerThumbnailCache::wxMediaPlayerThumbnailCache()
+    : m_images(wxMediaThumbnailWidth, wxMediaThumbnailHeight, false,
+               wxMediaThumbnailSlots),
+      m_nFirst(-1),
+      m_nLast(-1)
+{
+    m_entries.reserve(wxMediaThumbnailSlots);
+    m_buckets.resize(wxMediaThumbnailSlots * 2, -1);
+}
+
+int wxMediaPlayerThumbnailCache::FindEntry(const char* path, size_t len,
+                                           wxUint32 hash) const
+{
+    int n = m_buckets[hash & (m_buckets.size() - 1)];
+    while (n != -1)
+    {
+        const Entry& entry = m_entries[n];
+        if (entry.m_nHash == hash && entry.m_path.size() == len &&
+            (!len || memcmp(&entry.m_path[0], path, len) == 0))
+            return n;
+        n = entry.m_nChain;
+    }
+    return -1;
+}
+
+void wxMediaPlayerThumbnailCache::Unlink(int n)
+{
+    Entry& entry = m_entries[n];
+    if (entry.m_nPrev != -1)
+        m_entries[entry.m_nPrev].m_nNext = entry.m_nNext;
+    else
+        m_nFirst = entry.m_nNext;
+
+    if (entry.m_nNext != -1)
+        m_entries[entry.m_nNext].m_nPrev = entry.m_nPrev;
+    else
+        m_nLast = entry.m_nPrev;
+}
+
+void wxMediaPlayerThumbnailCache::LinkFirst(int n)
+{
+    Entry& entry = m_entries[n];
+    entry.m_nPrev = -1;
+    entry.m_nNext = m_nFirst;
+    if (m_nFirst != -1)
+        m_entries[m_nFirst].m_nPrev = n;
+    else
+        m_nLast = n;
+    m_nFirst = n;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailCache::Find
+//
+// Called for every row that is painted, so this mustn't allocate
+// ----------------------------------------------------------------------------
+int wxMediaPlayerThumbnailCache::Find(const char* path, size_t len)
+{
+    int n = FindEntry(path, len, wxMediaPlayerHashPath(path, len));
+    if (n == -1)
+        return wxTHUMBNAIL_UNKNOWN;
+
+    if (n != m_nFirst)
+    {
+        Unlink(n);
+        LinkFirst(n);
+    }
+    return m_entries[n].m_bPoster ? n : wxTHUMBNAIL_NONE;
+}
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerThumbnailCache::Add
+//
+// Once all images are taken the least recently shown one is replaced
+// ----------------------------------------------------------------------------
+void wxMediaPlayerThumbnailCache::Add(const wxString& file,
+                                      const wxVector<unsigned char>& rgb)
+{
+    const wxScopedCharBuffer utf8 = file.utf8_str();
+    const char* path = utf8.data();
+    const size_t len = utf8.length();
+    const wxUint32 hash = wxMediaPlayerHashPath(path, len);
+    const size_t mask = m_buckets.size() - 1;
+
+    int n = FindEntry(path, len, hash);
+    if (n != -1)
+    {
+        Unlink(n);
+    }
+    else
+    {
+        if (m_entries.size() < (size_t)wxMediaThumbnailSlots)
+        {
+            n = m_entries.size();
+            m_entries.push_back(Entry());
+        }
+        else
+        {
+            n = m_nLast;
+            Unlink(n);
+
+            int* link = &m_buckets[m_entries[n].m_nHash & mask];
+            while (*link != n)
+                link = &m_entries[*link].m_nChain;
+            *link = m_entries[n].m_nChain;
+        }
+
+        Entry& entry = m_entries[n];
+        entry.m_path.clear();
+        entry.m_path.insert(entry.m_path.end(), path, path + len);
+        entry.m_nHash = hash;
+        entry.m_nChain = m_buckets[hash & mask];
+        m_buckets[hash & mask] = n;
+    }
+    LinkFirst(n);
+
+    Entry& entry = m_entries[n];
+    entry.m_bPoster = rgb.size() == wxMediaThumbnailBytes;
+
+    //  Image n has to exist for the next entry to get image n + 1
+    if (entry.m_bPoster || n == m_images.GetImageCount())
+    {
+        wxImage image(wxMediaThumbnailWidth, wxMediaThumbnailHeight);
+        if (entry.m_bPoster)
+            memcpy(image.GetData(), &rgb[0], wxMediaThumbnailBytes);
+
+        if (n < m_images.GetImageCount())
+            m_images.Replace(n, wxBitmap(image));
+        else
+            m_images.Add(wxBitmap(image));
+    }
+}
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+//
+// wxMediaPlayerPlaylistStore
+//
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// Bump whenever Header or Op change, older files are then ignored
+#define wxMEDIAPLAYLIST_VERSION 1
+
+static const char wxMediaPlaylistMagic[8] =
+    { 'w', 'x', 'M', 'P', 'L', 'i', 's', 't' };
+static const char wxMediaPlaylistJournalMagic[8] =
+    { 'w', 'x', 'M', 'P', 'L', 'J', 'n', 'l' };
+static const wxUint32 wxMediaPlaylistByteOrder = 0x01020304;
+
+// Tag in front of every record, to spot a torn write after a crash
+static const wxUint32 wxMediaPlaylistOpTag = 0x504c4f50;
+
+// Journal bytes needed before it is worth writing a new snapshot; past
+// that we compact once the journal is bigger than the snapshot
+static const wxFileOffset wxMediaPlaylistCompactThreshold = 1024 * 1024;
+
+// The records of both the snapshot and the journal
+enum
+{
+    wxPLAYLISTOP_CREATE = 1,    // A page was added
+    wxPLAYLISTOP_REMOVE,        // A page was closed
+    wxPLAYLISTOP_APPEND,        // Paths were added to the end of a page,
+                                // each as a wxUint32 length and UTF-8 bytes
+    wxPLAYLISTOP_CHANGE         // Entries of a page were removed or renamed,
+                                // each as its wxUint32 index followed by a
+                                // path like the above, or wxMediaNoPath
+                                // instead of the length if it was removed
+};
+
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistCompactor
+//
+// Writes a new snapshot out of the current one plus the rotated journal
+// ----------------------------------------------------------------------------
+class wxMediaPlayerPlaylistCompactor : public wxThread
+{
+public:
+    wxMediaPlayerPlaylistCompactor(wxMediaPlayerPlaylistStore* store)
+        : wxThread(wxTHREAD_JOINABLE), m_store(store)
+    {
+    }
+
+protected:
+    virtual ExitCode Entry()
+    {
+        m_store->DoCompaction();
+        return 0;
+    }
+
+private:
+    wxMediaPlayerPlaylistStore* m_store;
+};
+
+wxMediaPlayerPlaylistStore::wxMediaPlayerPlaylistStore()
+                          : m_nGeneration(0),
+                            m_nJournalSize(0),
+                            m_nNextId(0),
+                            m_compactor(NULL),
+                            m_nSnapshotSize(0),
+                            m_bCompactionDone(false),
+                            m_bStopping(false)
+{
+    wxCOMPILE_TIME_ASSERT(sizeof(Header) == 32, BadPlaylistHeaderSize);
+    wxCOMPILE_TIME_ASSERT(sizeof(Op) == 24, BadPlaylistOpSize);
+}
+
+wxMediaPlayerPlaylistStore::~wxMediaPlayerPlaylistStore()
+{
+    Close();
 }
 
-// ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnOpenFileSamePage
-//
-// Called from file->openfile.
-// Opens and plays a media file in the current notebook page
-// ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnOpenFileSamePage(wxCommandEvent& WXUNUSED(event))
-{
-    OpenFile(false);
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistStore::Open
+//
+// 1) Replay the snapshot
+// 2) Replay the journal of a compaction that didn't finish, if any
+// 3) Replay the journal and keep it open for appending
+// 4) Start a compaction if one was interrupted or is due
+// ----------------------------------------------------------------------------
+bool wxMediaPlayerPlaylistStore::Open(const wxString& dir,
+                                      wxVector<Playlist>& playlists)
+{
+    if (!wxFileName::DirExists(dir) &&
+        !wxFileName::Mkdir(dir, 0777, wxPATH_MKDIR_FULL))
+        return false;
+
+    wxString base = dir + wxFileName::GetPathSeparator() + wxT("playlists");
+    m_szSnapshot = base + wxT(".dat");
+    m_szJournal = base + wxT(".journal");
+    m_szOldJournal = base + wxT(".journal.old");
+
+    playlists.clear();
+    m_nNextId = 0;
+
+    wxVector<char> data;
+    wxUint32 snapshotGeneration = 0;
+    if (ReadFile(m_szSnapshot, wxMediaPlaylistMagic, data,
+                 &snapshotGeneration))
+    {
+        Replay(data, playlists, &m_nNextId);
+
+        wxMutexLocker lock(m_mutex);
+        m_nSnapshotSize = data.size();
+    }
+
+    //
+    //  A journal whose generation isn't newer than the snapshot's is
+    //  already in it; that happens when we stopped right after a
+    //  compaction wrote the snapshot
+    //
+    wxUint32 generation = snapshotGeneration;
+    bool bInterrupted = false;
+    if (ReadFile(m_szOldJournal, wxMediaPlaylistJournalMagic, data,
+                 &generation) && generation > snapshotGeneration)
+    {
+        Replay(data, playlists, &m_nNextId);
+        bInterrupted = true;
+    }
+    else
+    {
+        wxLogNull noLog;
+        wxRemoveFile(m_szOldJournal);
+        generation = snapshotGeneration;
+    }
+
+    size_t valid = 0;
+    wxUint32 journalGeneration = 0;
+    if (ReadFile(m_szJournal, wxMediaPlaylistJournalMagic, data,
+                 &journalGeneration) && journalGeneration > generation)
+    {
+        valid = Replay(data, playlists, &m_nNextId);
+        m_nGeneration = journalGeneration;
+    }
+    else
+    {
+        m_nGeneration = generation + 1;
+    }
+
+    //
+    //  Cut off a torn record at the end, or start a new journal
+    //
+    if (valid == 0 || valid != data.size())
+    {
+        wxLogNull noLog;
+        wxTempFile out(m_szJournal);
+
+        wxVector<char> header;
+        WriteHeader(header, wxMediaPlaylistJournalMagic, m_nGeneration);
+        bool bOK = valid == 0 ? out.Write(&header[0], header.size())
+                              : out.Write(&data[0], valid);
+        if (!bOK || !out.Commit())
+            return false;
+        if (valid == 0)
+            valid = header.size();
+    }
+
+    m_nJournalSize = valid;
+    if (!m_journalFile.Open(m_szJournal, wxFile::write_append))
+        return false;
+
+    if (bInterrupted)
+        StartCompaction(false);
+    else if (m_nJournalSize > wxMax(wxMediaPlaylistCompactThreshold,
+                                    m_nSnapshotSize))
+        StartCompaction(true);
+
+    return true;
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OpenFile
+// wxMediaPlayerPlaylistStore::Close
 //
-// Opens a file dialog asking the user for a filename, then
-// calls DoOpenFile which will add the file to the playlist and play it
+// Every edit is in the journal already.  A running compaction is told to
+// give up, its work would only be redone from the same files next time.
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OpenFile(bool bNewPage)
+void wxMediaPlayerPlaylistStore::Close()
 {
-    wxFileDialog fd(this);
+    {
+        wxMutexLocker lock(m_mutex);
+        m_bStopping = true;
+    }
 
-    if(fd.ShowModal() == wxID_OK)
+    if (m_compactor)
     {
-        DoOpenFile(fd.GetPath(), bNewPage);
+        m_compactor->Wait();
+        delete m_compactor;
+        m_compactor = NULL;
     }
+
+    m_journalFile.Close();
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::DoOpenFile
+// wxMediaPlayerPlaylistStore::CreatePlaylist
 //
-// Adds the file to our playlist, selects it in the playlist,
-// and then calls DoPlayFile to play it
+// Returns the id of a new, empty playlist
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::DoOpenFile(const wxString& path, bool bNewPage)
+wxUint32 wxMediaPlayerPlaylistStore::CreatePlaylist()
 {
-    if(bNewPage)
-    {
-        m_notebook->AddPage(
-            new wxMediaPlayerNotebookPage(this, m_notebook),
-            path,
-            true);
-    }
-
-    wxMediaPlayerNotebookPage* currentpage =
-        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    const wxUint32 id = m_nNextId++;
 
-    if(currentpage->m_nLastFileId != -1)
-        currentpage->m_playlist->SetItemState(currentpage->m_nLastFileId,
-                                              0, wxLIST_STATE_SELECTED);
+    wxVector<char> buf(sizeof(Op));
+    FinishOp(buf, 0, wxPLAYLISTOP_CREATE, id, 0);
+    Append(buf);
 
-    wxListItem newlistitem;
-    newlistitem.SetAlign(wxLIST_FORMAT_LEFT);
-
-    int nID;
+    return id;
+}
 
-    newlistitem.SetId(nID = currentpage->m_playlist->GetItemCount());
-    newlistitem.SetMask(wxLIST_MASK_DATA | wxLIST_MASK_STATE);
-    newlistitem.SetState(wxLIST_STATE_SELECTED);
-    newlistitem.SetData(new wxString(path));
+void wxMediaPlayerPlaylistStore::RemovePlaylist(wxUint32 id)
+{
+    wxVector<char> buf(sizeof(Op));
+    FinishOp(buf, 0, wxPLAYLISTOP_REMOVE, id, 0);
+    Append(buf);
+}
 
-    currentpage->m_playlist->InsertItem(newlistitem);
-    currentpage->m_playlist->SetItem(nID, 0, wxT("*"));
-    currentpage->m_playlist->SetItem(nID, 1, wxFileName(path).GetName());
+// ----------------------------------------------------------------------------
+// wxMediaPlayerPlaylistStore::AppendEntries
+//
+// Journals the entries from "from" onwards as a single record, however many
+// there are
+// ----------------------------------------------------------------------------
+void wxMediaPlayerPlaylistStore::AppendEntries(wxUint32 id,
+                                     const wxMediaPlayerEntryStore& entries,
+                                     size_t from)
+{
+    if (from >= entries.GetCount())
+        return;
 
-    if (nID % 2)
+    wxVector<char> buf(sizeof(Op));
+    for (size_t n = from; n < entries.GetCount(); ++n)
     {
-        newlistitem.SetBackgroundColour(wxColour(192,192,192));
-        currentpage->m_playlist->SetItem(newlistitem);
+        size_t len;
+        const char* path = entries.GetPathUTF8(entries.GetPathId(n), &len);
+        AddPath(buf, path, len);
     }
 
-    DoPlayFile(path);
+    FinishOp(buf, 0, wxPLAYLISTOP_APPEND, id, entries.GetCount() - from);
+    Append(buf);
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::DoPlayFile
-//
-// Pauses the file if its the currently playing file,
-// otherwise it plays the file
+// wxMediaPlayerPlaylistStore::ChangeEntries
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::DoPlayFile(const wxString& path)
+void wxMediaPlayerPlaylistStore::ChangeEntries(wxUint32 id,
+                                     const wxMediaPlayerEntryStore& entries,
+                                     const wxVector<wxUint32>& indexes,
+                                     const wxVector<wxUint32>& paths)
 {
-    wxMediaPlayerNotebookPage* currentpage =
-        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
-
-    wxListItem listitem;
-    currentpage->m_playlist->GetSelectedItem(listitem);
+    if (indexes.empty())
+        return;
 
-    if( (  listitem.GetData() &&
-           currentpage->m_nLastFileId == listitem.GetId() &&
-           currentpage->m_szFile.compare(path) == 0 ) ||
-        (  !listitem.GetData() &&
-            currentpage->m_nLastFileId != -1 &&
-            currentpage->m_szFile.compare(path) == 0)
-      )
-    {
-        if(currentpage->m_mediactrl->GetState() == wxMEDIASTATE_PLAYING)
-        {
-            if( !currentpage->m_mediactrl->Pause() )
-                wxMessageBox(wxT("Couldn't pause movie!"));
-        }
-        else
-        {
-            if( !currentpage->m_mediactrl->Play() )
-                wxMessageBox(wxT("Couldn't play movie!"));
-        }
-    }
-    else
+    wxVector<char> buf(sizeof(Op));
+    for (size_t n = 0; n < indexes.size(); ++n)
     {
-        int nNewId = listitem.GetData() ? listitem.GetId() :
-                            currentpage->m_playlist->GetItemCount()-1;
-        m_notebook->SetPageText(m_notebook->GetSelection(),
-                                wxFileName(path).GetName());
-
-        if(currentpage->m_nLastFileId != -1)
-           currentpage->m_playlist->SetItem(
-                    currentpage->m_nLastFileId, 0, wxT("*"));
+        size_t at = buf.size();
+        buf.resize(at + sizeof(wxUint32));
+        memcpy(&buf[at], &indexes[n], sizeof(wxUint32));
 
-        wxURI uripath(path);
-        if( uripath.IsReference() )
-        {
-            if( !currentpage->m_mediactrl->Load(path) )
-            {
-                wxMessageBox(wxT("Couldn't load file!"));
-                currentpage->m_playlist->SetItem(nNewId, 0, wxT("E"));
-            }
-            else
-            {
-                currentpage->m_playlist->SetItem(nNewId, 0, wxT("O"));
-            }
-        }
-        else
+        if (paths[n] == wxMediaNoPath)
         {
-			currentpage->m_playlist->SetItem(nNewId, 0, wxT("O"));
+            at = buf.size();
+            buf.resize(at + sizeof(wxUint32));
+            memcpy(&buf[at], &wxMediaNoPath, sizeof(wxUint32));
+            continue;
         }
 
-        currentpage->m_nLastFileId = nNewId;
-        currentpage->m_szFile = path;
-        currentpage->m_playlist->SetItem(currentpage->m_nLastFileId,
-                                         1, wxFileName(path).GetName());
-        currentpage->m_playlist->SetItem(currentpage->m_nLastFileId,
-                                         2, wxT(""));
+        size_t len;
+        const char* path = entries.GetPathUTF8(paths[n], &len);
+        AddPath(buf, path, len);
     }
+
+    FinishOp(buf, 0, wxPLAYLISTOP_CHANGE, id, indexes.size());
+    Append(buf);
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnMediaLoaded
+// wxMediaPlayerPlaylistStore::Append
 //
-// Called when the media is ready to be played - and does
-// so, also gets the length of media and shows that in the list control
+// Writes a finished record to the journal with a single write(), so that a
+// crash leaves at most one torn record at the end which the next Open()
+// drops.  Also the only place compactions are started and reaped.
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnMediaLoaded(wxMediaEvent& WXUNUSED(evt))
+void wxMediaPlayerPlaylistStore::Append(const wxVector<char>& buf)
 {
-    wxMediaPlayerNotebookPage* currentpage =
-        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    if (!m_journalFile.IsOpened())
+        return;
 
-    if( !currentpage->m_mediactrl->Play() )
-    {
-            wxMessageBox(wxT("Couldn't play movie!"));
-        currentpage->m_playlist->SetItem(currentpage->m_nLastFileId, 0, wxT("E"));
-    }
-    else
+    m_journalFile.Write(&buf[0], buf.size());
+    m_nJournalSize += buf.size();
+
+    bool bDone;
+    wxFileOffset snapshotSize;
     {
-		currentpage->m_mediactrl->SetVolume(0.0);
-        currentpage->m_playlist->SetItem(currentpage->m_nLastFileId, 0, wxT(">"));
+        wxMutexLocker lock(m_mutex);
+        bDone = m_bCompactionDone;
+        snapshotSize = m_nSnapshotSize;
     }
 
+    if (bDone)
+        JoinCompactor();
+
+    if (m_nJournalSize > wxMax(wxMediaPlaylistCompactThreshold, snapshotSize))
+        StartCompaction(true);
 }
 
-// ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnCloseCurrentPage
-//
-// Called when the user wants to close the current notebook page
-//
-// 1) Get the current page number (wxControl::GetSelection)
-// 2) If there is no current page, break out
-// 3) Delete the current page
-// ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnCloseCurrentPage(wxCommandEvent& WXUNUSED(event))
+void wxMediaPlayerPlaylistStore::JoinCompactor()
 {
-    if( m_notebook->GetPageCount() > 1 )
-    {
-    int sel = m_notebook->GetSelection();
+    m_compactor->Wait();
+    delete m_compactor;
+    m_compactor = NULL;
 
-    if (sel != wxNOT_FOUND)
-    {
-        m_notebook->DeletePage(sel);
-    }
-    }
-    else
-    {
-        wxMessageBox(wxT("Cannot close main page"));
-    }
+    wxMutexLocker lock(m_mutex);
+    m_bCompactionDone = false;
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnPlay
+// wxMediaPlayerPlaylistStore::StartCompaction
 //
-// Called from file->play.
-// Resumes the media if it is paused or stopped.
+// With bRotate, moves the journal aside so that edits go to a fresh one
+// while the compactor replays it.  The journal of an earlier compaction that
+// never finished is compacted as is first, the current one waits its turn.
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnPlay(wxCommandEvent& WXUNUSED(event))
+void wxMediaPlayerPlaylistStore::StartCompaction(bool bRotate)
 {
-    wxMediaPlayerNotebookPage* currentpage =
-        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    if (m_compactor)
+        return;
+
+    wxLogNull noLog;
 
-    wxListItem listitem;
-    currentpage->m_playlist->GetSelectedItem(listitem);
-    if ( !listitem.GetData() )
+    if (bRotate && !wxFileExists(m_szOldJournal))
     {
-        int nLast = -1;
-        if ((nLast = currentpage->m_playlist->GetNextItem(nLast,
-                                         wxLIST_NEXT_ALL,
-                                         wxLIST_STATE_DONTCARE)) == -1)
-        {
-            // no items in list
-            wxMessageBox(wxT("No items in playlist!"));
-    }
-        else
+        m_journalFile.Close();
+        if (!wxRenameFile(m_szJournal, m_szOldJournal))
         {
-        listitem.SetId(nLast);
-            currentpage->m_playlist->GetItem(listitem);
-        listitem.SetMask(listitem.GetMask() | wxLIST_MASK_STATE);
-        listitem.SetState(listitem.GetState() | wxLIST_STATE_SELECTED);
-            currentpage->m_playlist->SetItem(listitem);
-            wxASSERT(listitem.GetData());
-            DoPlayFile((*((wxString*) listitem.GetData())));
-    }
+            m_journalFile.Open(m_szJournal, wxFile::write_append);
+            return;
+        }
+
+        wxVector<char> header;
+        WriteHeader(header, wxMediaPlaylistJournalMagic, ++m_nGeneration);
+        if (m_journalFile.Create(m_szJournal, true))
+            m_journalFile.Write(&header[0], header.size());
+        m_nJournalSize = header.size();
     }
-    else
+
+    m_compactor = new wxMediaPlayerPlaylistCompactor(this);
+    if (m_compactor->Run() != wxTHREAD_NO_ERROR)
     {
-        wxASSERT(listitem.GetData());
-        DoPlayFile((*((wxString*) listitem.GetData())));
+        delete m_compactor;
+        m_compactor = NULL;
     }
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnKeyDown
-// ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnKeyDown(wxKeyEvent& event)
-{
-}
-
-// ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnPrev
+// wxMediaPlayerPlaylistStore::DoCompaction
 //
-// Tedious wxListCtrl stuff.  Goes to prevous song in list, or if at the
-// beginning goes to the last in the list.
+// Runs on the compactor thread.  Only reads the snapshot and the rotated
+// journal, which nothing else touches while it runs, and replaces the
+// snapshot with a new one stamped with the journal's generation, so that
+// Open() knows the journal is in it even if we stop before deleting it.
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnPrev(wxCommandEvent& WXUNUSED(event))
+void wxMediaPlayerPlaylistStore::DoCompaction()
 {
-    wxMediaPlayerNotebookPage* currentpage =
-        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    wxVector<Playlist> playlists;
+    wxVector<char> data;
+    wxUint32 nextId = 0;
 
-    if (currentpage->m_playlist->GetItemCount() == 0)
-        return;
+    wxUint32 generation = 0;
+    if (ReadFile(m_szSnapshot, wxMediaPlaylistMagic, data, &generation))
+        Replay(data, playlists, &nextId);
 
-    wxInt32 nLastSelectedItem = -1;
-    while(true)
-    {
-        wxInt32 nSelectedItem = currentpage->m_playlist->GetNextItem(nLastSelectedItem,
-                                                     wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
-        if (nSelectedItem == -1)
-            break;
-        nLastSelectedItem = nSelectedItem;
-        currentpage->m_playlist->SetItemState(nSelectedItem, 0, wxLIST_STATE_SELECTED);
-    }
+    wxUint32 journalGeneration;
+    bool bOK = ReadFile(m_szOldJournal, wxMediaPlaylistJournalMagic, data,
+                        &journalGeneration) &&
+               journalGeneration > generation;
+    if (bOK)
+        Replay(data, playlists, &nextId);
+
+    data.clear();
 
-    if (nLastSelectedItem == -1)
     {
-        // nothing selected, default to the file before the currently playing one
-        if(currentpage->m_nLastFileId == 0)
-            nLastSelectedItem = currentpage->m_playlist->GetItemCount() - 1;
-    else
-            nLastSelectedItem = currentpage->m_nLastFileId - 1;
+        wxMutexLocker lock(m_mutex);
+        if (m_bStopping)
+            bOK = false;
     }
-    else if (nLastSelectedItem == 0)
-        nLastSelectedItem = currentpage->m_playlist->GetItemCount() - 1;
-    else
-        nLastSelectedItem -= 1;
 
-    if(nLastSelectedItem == currentpage->m_nLastFileId)
-        return; // already playing... nothing to do
+    wxFileOffset size = 0;
+    if (bOK)
+        bOK = WriteSnapshot(m_szSnapshot, journalGeneration, playlists, &size);
 
-    wxListItem listitem;
-    listitem.SetId(nLastSelectedItem);
-    listitem.SetMask(wxLIST_MASK_TEXT |  wxLIST_MASK_DATA);
-    currentpage->m_playlist->GetItem(listitem);
-    listitem.SetMask(listitem.GetMask() | wxLIST_MASK_STATE);
-    listitem.SetState(listitem.GetState() | wxLIST_STATE_SELECTED);
-    currentpage->m_playlist->SetItem(listitem);
+    if (bOK)
+    {
+        wxLogNull noLog;
+        wxRemoveFile(m_szOldJournal);
+    }
 
-    wxASSERT(listitem.GetData());
-    DoPlayFile((*((wxString*) listitem.GetData())));
+    wxMutexLocker lock(m_mutex);
+    if (bOK)
+        m_nSnapshotSize = size;
+    m_bCompactionDone = true;
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerFrame::OnNext
+// wxMediaPlayerPlaylistStore::ReadFile
 //
-// Tedious wxListCtrl stuff.  Goes to next song in list, or if at the
-// end goes to the first in the list.
+// Reads a snapshot or journal in one go and checks its header
 // ----------------------------------------------------------------------------
-void wxMediaPlayerFrame::OnNext(wxCommandEvent& WXUNUSED(event))
+bool wxMediaPlayerPlaylistStore::ReadFile(const wxString& file,
+                                          const char* magic,
+                                          wxVector<char>& data,
+                                          wxUint32* generation)
 {
-    wxMediaPlayerNotebookPage* currentpage =
-        (wxMediaPlayerNotebookPage*) m_notebook->GetCurrentPage();
+    wxLogNull noLog;
 
-    if (currentpage->m_playlist->GetItemCount() == 0)
-        return;
+    data.clear();
+
+    wxFile in;
+    if (!wxFileExists(file) || !in.Open(file))
+        return false;
+
+    wxFileOffset length = in.Length();
+    if (length < (wxFileOffset)sizeof(Header))
+        return false;
 
-    wxInt32 nLastSelectedItem = -1;
-    while(true)
+    data.resize(length);
+    if (in.Read(&data[0], length) != length)
     {
-        wxInt32 nSelectedItem = currentpage->m_playlist->GetNextItem(nLastSelectedItem,
-                                                     wxLIST_NEXT_ALL, wxLIST_STATE_SELECTED);
-        if (nSelectedItem == -1)
-            break;
-        nLastSelectedItem = nSelectedItem;
-        currentpage->m_playlist->SetItemState(nSelectedItem, 0, wxLIST_STATE_SELECTED);
+        data.clear();
+        return false;
     }
 
-    if (nLastSelectedItem == -1)
+    Header header;
+    memcpy(&header, &data[0], sizeof(header));
+    if (memcmp(header.m_szMagic, magic, 8) != 0 ||
+        header.m_nVersion != wxMEDIAPLAYLIST_VERSION ||
+        header.m_nByteOrder != wxMediaPlaylistByteOrder)
     {
-        if(currentpage->m_nLastFileId == currentpage->m_playlist->GetItemCount() - 1)
-        nLastSelectedItem = 0;
-    else
-            nLastSelectedItem = currentpage->m_nLastFileId + 1;
+        data.clear();
+        return false;
     }
-    else if (nLastSelectedItem == currentpage->m_playlist->GetItemCount() - 1)
-            nLastSelectedItem = 0;
-        else
-            nLastSelectedItem += 1;
-
-    if(nLastSelectedItem == currentpage->m_nLastFileId)
-        return; // already playing... nothing to do
 
-    wxListItem listitem;
-    listitem.SetMask(wxLIST_MASK_TEXT |  wxLIST_MASK_DATA);
-    listitem.SetId(nLastSelectedItem);
-    currentpage->m_playlist->GetItem(listitem);
-    listitem.SetMask(listitem.GetMask() | wxLIST_MASK_STATE);
-    listitem.SetState(listitem.GetState() | wxLIST_STATE_SELECTED);
-    currentpage->m_playlist->SetItem(listitem);
-
-    wxASSERT(listitem.GetData());
-    DoPlayFile((*((wxString*) listitem.GetData())));
+    *generation = header.m_nGeneration;
+    return true;
 }
 
-
-
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-//
-// wxMediaPlayerNotebookPage
-//
-// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-
 // ----------------------------------------------------------------------------
-// wxMediaPlayerNotebookPage Constructor
+// wxMediaPlayerPlaylistStore::Replay
 //
-// Creates a media control and slider and adds it to this panel,
-// along with some sizers for positioning
+// Applies the records of a file read by ReadFile() and returns how many of
+// its bytes were good.  Stops at the first record that is torn or corrupt.
 // ----------------------------------------------------------------------------
-wxMediaPlayerNotebookPage::wxMediaPlayerNotebookPage(wxMediaPlayerFrame* parentFrame,
-                                                     wxNotebook* theBook,
-                                                     const wxString& szBackend)
-                         : wxPanel(theBook, wxID_ANY),
-                           m_nLastFileId(-1),
-                           m_nLoops(0),
-                           m_bLoop(true),
-                           m_bIsBeingDragged(false),
-                           m_parentFrame(parentFrame)
+size_t wxMediaPlayerPlaylistStore::Replay(const wxVector<char>& data,
+                                          wxVector<Playlist>& playlists,
+                                          wxUint32* nextId)
 {
-    //
-    //  Create and attach a 2-column grid sizer
-    //
-    wxFlexGridSizer* sizer = new wxFlexGridSizer(2);
-    sizer->AddGrowableCol(0);
-    this->SetSizer(sizer);
+    size_t valid = sizeof(Header);
+    while (valid + sizeof(Op) <= data.size())
+    {
+        Op op;
+        memcpy(&op, &data[valid], sizeof(op));
+        if (op.m_nTag != wxMediaPlaylistOpTag ||
+            op.m_nSize > data.size() - valid - sizeof(op))
+            break;
 
-    //
-    //  Create our media control
-    //
-    m_mediactrl = new wxMediaCtrl();
+        const char* payload = &data[0] + valid + sizeof(op);
+        if (wxMediaPlayerHashPath(payload, op.m_nSize) != op.m_nHash ||
+            !ApplyOp(op, payload, playlists, nextId))
+            break;
 
-    //  Make sure creation was successful
-    bool bOK = m_mediactrl->Create(this, wxID_MEDIACTRL, wxEmptyString,
-                                    wxDefaultPosition, wxDefaultSize, 0,
-                                   szBackend);
-    wxASSERT_MSG(bOK, wxT("Could not create media control!"));
-    wxUnusedVar(bOK);
+        valid += sizeof(op) + op.m_nSize;
+    }
+    return valid;
+}
 
-    sizer->Add(m_mediactrl, 0, wxALIGN_CENTER_HORIZONTAL|wxALL|wxEXPAND, 5);
+bool wxMediaPlayerPlaylistStore::ApplyOp(const Op& op, const char* payload,
+                                         wxVector<Playlist>& playlists,
+                                         wxUint32* nextId)
+{
+    size_t n = 0;
+    while (n < playlists.size() && playlists[n].m_nId != op.m_nPlaylist)
+        ++n;
 
-    //
-    //  Create the playlist/listctrl
-    //
-    m_playlist = new wxMediaPlayerListCtrl();
-    m_playlist->Create(this, wxID_LISTCTRL, wxDefaultPosition,
-                    wxDefaultSize,
-                    wxLC_REPORT // wxLC_LIST
-                    | wxSUNKEN_BORDER);
+    switch (op.m_nOp)
+    {
+        case wxPLAYLISTOP_CREATE:
+            if (n == playlists.size())
+            {
+                playlists.push_back(Playlist());
+                playlists.back().m_nId = op.m_nPlaylist;
+                playlists.back().m_pool.push_back('\0');
+                playlists.back().m_offsets.push_back(1);
+            }
+            *nextId = wxMax(*nextId, op.m_nPlaylist + 1);
+            return true;
 
-    //  Set the background of our listctrl to white
-    m_playlist->SetBackgroundColour(*wxWHITE);
+        case wxPLAYLISTOP_REMOVE:
+            if (n < playlists.size())
+                playlists.erase(playlists.begin() + n);
+            return true;
 
+        case wxPLAYLISTOP_APPEND:
+        {
+            //  Check the payload before touching the playlist, so that a
+            //  bad record changes nothing
+            size_t at = 0;
+            for (wxUint32 i = 0; i < op.m_nCount; ++i)
+            {
+                wxUint32 len;
+                if (op.m_nSize - at < sizeof(len))
+                    return false;
+                memcpy(&len, payload + at, sizeof(len));
+                at += sizeof(len);
+                if (op.m_nSize - at < len)
+                    return false;
+                at += len;
+            }
+            if (at != op.m_nSize)
+                return false;
 
-    m_playlist->AppendColumn(_(""), wxLIST_FORMAT_CENTER, 20);
-    m_playlist->AppendColumn(_("File"), wxLIST_FORMAT_LEFT, /*wxLIST_AUTOSIZE_USEHEADER*/305);
-    m_playlist->AppendColumn(_("Length"), wxLIST_FORMAT_CENTER, 75);
+            if (n == playlists.size())
+                return true;    // page was closed later on
 
-    sizer->Add(m_playlist, 0, wxALIGN_CENTER_HORIZONTAL|wxALL|wxEXPAND, 5);
+            Playlist& playlist = playlists[n];
+            playlist.m_pool.reserve(playlist.m_pool.size() + op.m_nSize);
+            playlist.m_offsets.reserve(playlist.m_offsets.size() +
+                                       op.m_nCount);
 
+            at = 0;
+            for (wxUint32 i = 0; i < op.m_nCount; ++i)
+            {
+                wxUint32 len;
+                memcpy(&len, payload + at, sizeof(len));
+                at += sizeof(len);
+
+                size_t end = playlist.m_pool.size();
+                playlist.m_pool.resize(end + len);
+                if (len)
+                    memcpy(&playlist.m_pool[end], payload + at, len);
+                playlist.m_offsets.push_back(end + len);
+                at += len;
+            }
+            return true;
+        }
 
-    // Now that we have all our rows make some of them growable
-    sizer->AddGrowableRow(0);
+        case wxPLAYLISTOP_CHANGE:
+        {
+            //  Indexes have to go up, and be of entries the page has
+            size_t at = 0;
+            wxUint32 nLast = 0;
+            for (wxUint32 i = 0; i < op.m_nCount; ++i)
+            {
+                wxUint32 index, len;
+                if (op.m_nSize - at < sizeof(index) + sizeof(len))
+                    return false;
+                memcpy(&index, payload + at, sizeof(index));
+                memcpy(&len, payload + at + sizeof(index), sizeof(len));
+                at += sizeof(index) + sizeof(len);
+                if (i > 0 && index <= nLast)
+                    return false;
+                nLast = index;
+                if (len == wxMediaNoPath)
+                    continue;
+                if (op.m_nSize - at < len)
+                    return false;
+                at += len;
+            }
+            if (at != op.m_nSize)
+                return false;
+
+            if (n == playlists.size() || op.m_nCount == 0)
+                return true;
+
+            Playlist& playlist = playlists[n];
+            if (nLast >= playlist.GetCount())
+                return false;
+
+            Playlist changed;
+            changed.m_nId = playlist.m_nId;
+            changed.m_pool.reserve(playlist.m_pool.size() + op.m_nSize);
+            changed.m_pool.push_back('\0');
+            changed.m_offsets.reserve(playlist.m_offsets.size());
+            changed.m_offsets.push_back(1);
+
+            at = 0;
+            wxUint32 nChanged = 0;
+            for (size_t e = 0; e < playlist.GetCount(); ++e)
+            {
+                const char* path = &playlist.m_pool[0] +
+                                   playlist.m_offsets[e];
+                wxUint32 len = playlist.m_offsets[e + 1] -
+                               playlist.m_offsets[e];
+
+                wxUint32 index = 0;
+                if (nChanged < op.m_nCount)
+                    memcpy(&index, payload + at, sizeof(index));
+                if (nChanged < op.m_nCount && index == e)
+                {
+                    memcpy(&len, payload + at + sizeof(index), sizeof(len));
+                    at += sizeof(index) + sizeof(len);
+                    ++nChanged;
+                    if (len == wxMediaNoPath)
+                        continue;
+                    path = payload + at;
+                    at += len;
+                }
+
+                size_t end = changed.m_pool.size();
+                changed.m_pool.resize(end + len);
+                if (len)
+                    memcpy(&changed.m_pool[end], path, len);
+                changed.m_offsets.push_back(end + len);
+            }
 
-    //
-    // Media Control events
-    //
-    this->Connect(wxID_MEDIACTRL, wxEVT_MEDIA_PLAY,
-                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaPlay));
-    this->Connect(wxID_MEDIACTRL, wxEVT_MEDIA_PAUSE,
-                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaPause));
-    this->Connect(wxID_MEDIACTRL, wxEVT_MEDIA_FINISHED,
-                  wxMediaEventHandler(wxMediaPlayerNotebookPage::OnMediaFinished));
-    this->Connect(wxID_MEDIACTRL, wxEVT_MEDIA_LOADED,
-                  wxMediaEventHandler(wxMediaPlayerFrame::OnMediaLoaded),
-                  (wxObject*)0, parentFrame);
+            playlist.m_pool.swap(changed.m_pool);
+            playlist.m_offsets.swap(changed.m_offsets);
+            return true;
+        }
+
+        default:
+            return false;
+    }
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerNotebookPage::OnMediaPlay
+// wxMediaPlayerPlaylistStore record writing helpers
 //
-// Called when the media plays.
+// A record is built by reserving sizeof(Op) bytes, adding the payload after
+// them with AddPath() and then filling in the Op with FinishOp()
 // ----------------------------------------------------------------------------
-void wxMediaPlayerNotebookPage::OnMediaPlay(wxMediaEvent& WXUNUSED(event))
+void wxMediaPlayerPlaylistStore::WriteHeader(wxVector<char>& buf,
+                                             const char* magic,
+                                             wxUint32 generation)
 {
-    m_playlist->SetItem(m_nLastFileId, 0, wxT(">"));
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_szMagic, magic, 8);
+    header.m_nVersion = wxMEDIAPLAYLIST_VERSION;
+    header.m_nByteOrder = wxMediaPlaylistByteOrder;
+    header.m_nGeneration = generation;
+
+    size_t at = buf.size();
+    buf.resize(at + sizeof(header));
+    memcpy(&buf[at], &header, sizeof(header));
 }
 
-// ----------------------------------------------------------------------------
-// wxMediaPlayerNotebookPage::OnMediaPause
-//
-// Called when the media is paused.
-// ----------------------------------------------------------------------------
-void wxMediaPlayerNotebookPage::OnMediaPause(wxMediaEvent& WXUNUSED(event))
+void wxMediaPlayerPlaylistStore::AddPath(wxVector<char>& buf,
+                                         const char* path, wxUint32 len)
+{
+    size_t at = buf.size();
+    buf.resize(at + sizeof(len) + len);
+    memcpy(&buf[at], &len, sizeof(len));
+    if (len)
+        memcpy(&buf[at + sizeof(len)], path, len);
+}
+
+void wxMediaPlayerPlaylistStore::FinishOp(wxVector<char>& buf, size_t at,
+                                          wxUint32 op, wxUint32 id,
+                                          wxUint32 count)
 {
-    m_playlist->SetItem(m_nLastFileId, 0, wxT("||"));
+    Op rec;
+    rec.m_nTag = wxMediaPlaylistOpTag;
+    rec.m_nOp = op;
+    rec.m_nPlaylist = id;
+    rec.m_nCount = count;
+    rec.m_nSize = buf.size() - at - sizeof(Op);
+    rec.m_nHash = wxMediaPlayerHashPath(&buf[0] + at + sizeof(Op),
+                                        rec.m_nSize);
+    memcpy(&buf[at], &rec, sizeof(rec));
 }
 
 // ----------------------------------------------------------------------------
-// wxMediaPlayerNotebookPage::OnMediaFinished
+// wxMediaPlayerPlaylistStore::WriteSnapshot
 //
-// Called when the media finishes playing.
-// Here we loop it if the user wants to (has been selected from file menu)
+// Writes each playlist as a create record followed by one append record
+// holding all of its paths, and renames the result into place
 // ----------------------------------------------------------------------------
-void wxMediaPlayerNotebookPage::OnMediaFinished(wxMediaEvent& WXUNUSED(event))
+bool wxMediaPlayerPlaylistStore::WriteSnapshot(const wxString& file,
+                                     wxUint32 generation,
+                                     const wxVector<Playlist>& playlists,
+                                     wxFileOffset* size)
 {
-    if(m_bLoop)
+    wxLogNull noLog;
+    wxTempFile out(file);
+
+    wxVector<char> buf;
+    WriteHeader(buf, wxMediaPlaylistMagic, generation);
+    bool bOK = out.IsOpened() && out.Write(&buf[0], buf.size());
+    *size = buf.size();
+
+    for (size_t n = 0; bOK && n < playlists.size(); ++n)
     {
-        if ( !m_mediactrl->Play() )
+        const Playlist& playlist = playlists[n];
+
+        buf.clear();
+        buf.resize(sizeof(Op));
+        FinishOp(buf, 0, wxPLAYLISTOP_CREATE, playlist.m_nId, 0);
+
+        const size_t at = buf.size();
+        buf.resize(at + sizeof(Op));
+        buf.reserve(at + sizeof(Op) +
+                    playlist.GetCount() * sizeof(wxUint32) +
+                    playlist.m_pool.size());
+        for (size_t i = 0; i < playlist.GetCount(); ++i)
         {
-            wxMessageBox(wxT("Couldn't loop movie!"));
-            m_playlist->SetItem(m_nLastFileId, 0, wxT("E"));
+            const wxUint32 start = playlist.m_offsets[i];
+            AddPath(buf, &playlist.m_pool[0] + start,
+                    playlist.m_offsets[i + 1] - start);
         }
-        else
-            ++m_nLoops;
-    }
-    else
-    {
-        m_playlist->SetItem(m_nLastFileId, 0, wxT("[]"));
+        FinishOp(buf, at, wxPLAYLISTOP_APPEND, playlist.m_nId,
+                 playlist.GetCount());
+
+        bOK = out.Write(&buf[0], buf.size());
+        *size += buf.size();
     }
-}
 
+    return bOK && out.Commit();
+}